@@ -1,24 +1,32 @@
 /*
  * adfread.c
  * 
- * Read Amiga Disk File (ADF) images and write contents to a local directory
- * in the host environment.
+ * Read AmigaDOS disk images (ADF, or any other image libdisk can open) and
+ * write contents to a local directory in the host environment.
+ * 
+ * The disk is read into memory once and its filesystem walked there. Files
+ * are then written out by a pool of worker processes.
  * 
  * Written in 2011 by Keir Fraser
  */
 
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <unistd.h>
 #include <time.h>
 #include <utime.h>
 #include <ctype.h>
 #include <libdisk/util.h>
+#include <libdisk/disk.h>
 
 /* Physical characteristics of an AmigaDOS DS/DD floppy disk. */
 #define BYTES_PER_BLOCK   512
@@ -108,48 +116,104 @@ struct ffs_fileheader {
 #define ST_USERDIR   2
 #define ST_FILE     -3
 
-static int is_ffs, is_readonly;
+static int is_ffs, is_readonly, verify_only;
+static unsigned int nr_bad_blocks;
+
+/* The whole disk, read up front: the filesystem is walked in memory. */
+static uint8_t *disk_image;
+static uint8_t block_ok[BLOCKS_PER_DISK];
 
-/* read_exact, write_exact */
-#include "../libdisk/util.c"
+/* Files are extracted after the directory walk, on a pool of workers.
+ * Directory times are set last, as creating entries would update them. */
+struct extract_job {
+    char *path;
+    uint32_t idx;
+};
+static struct extract_job *files, *dirs;
+static unsigned int nr_files, nr_dirs;
 
-static void *get_block(int fd, unsigned int block)
+static void add_job(
+    struct extract_job **jobs, unsigned int *nr, char *path, uint32_t idx)
 {
-    off_t off;
-    void *dat;
+    struct extract_job *p;
 
-    if (block >= BLOCKS_PER_DISK)
-        errx(1, "Block index %u out of range", block);
+    if ((*nr & (*nr - 1)) == 0) {
+        if ((p = realloc(*jobs, (*nr ? *nr * 2 : 1) * sizeof(*p))) == NULL)
+            err(1, NULL);
+        *jobs = p;
+    }
+    (*jobs)[*nr].path = path;
+    (*jobs)[*nr].idx = idx;
+    (*nr)++;
+}
 
-    dat = malloc(BYTES_PER_BLOCK);
-    if (dat == NULL)
-        err(1, NULL);
+static void load_disk(const char *name)
+{
+    struct disk *d;
+    unsigned int i, nr_blocks, bytes_per_block;
+
+    if ((d = disk_open(name, 1)) == NULL)
+        errx(1, "%s: Unable to open disk", name);
 
-    off = lseek(fd, block * BYTES_PER_BLOCK, SEEK_SET);
-    if (off < 0)
+    nr_blocks = disk_block_count(d, &bytes_per_block);
+    if ((nr_blocks < BLOCKS_PER_DISK) || (bytes_per_block != BYTES_PER_BLOCK))
+        errx(1, "Bad disk geometry %u blocks of %u bytes (expected %u "
+             "blocks of %u bytes)", nr_blocks, bytes_per_block,
+             BLOCKS_PER_DISK, BYTES_PER_BLOCK);
+
+    if ((disk_image = malloc(BYTES_PER_DISK)) == NULL)
         err(1, NULL);
+    for (i = 0; i < BLOCKS_PER_DISK; i++)
+        block_ok[i] = (disk_block_read(
+                           d, i, &disk_image[i * BYTES_PER_BLOCK]) == 0);
 
-    read_exact(fd, dat, BYTES_PER_BLOCK);
+    disk_close(d);
+}
 
-    return dat;
+/* Report a bad block: fatal unless only verifying, when it is counted. */
+static void bad_block(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    if (!verify_only)
+        verrx(1, fmt, ap);
+    vwarnx(fmt, ap);
+    va_end(ap);
+    nr_bad_blocks++;
 }
 
-static void put_block(void *dat)
+/* Returns NULL for a missing block, which is fatal unless only verifying. */
+static void *get_block(unsigned int block)
 {
-    memset(dat, 0xAA, BYTES_PER_BLOCK);
-    free(dat);
+    if (block >= BLOCKS_PER_DISK) {
+        bad_block("Block index %u out of range", block);
+        return NULL;
+    }
+    if (!block_ok[block]) {
+        bad_block("Block %u is unreadable", block);
+        return NULL;
+    }
+    return &disk_image[block * BYTES_PER_BLOCK];
 }
 
-static void checksum_block(void *dat)
+/* Returns -1 on a missing block or a bad checksum, which is fatal unless 
+ * only verifying. */
+static int checksum_block(unsigned int block)
 {
-    uint32_t sum = 0, *blk = dat;
+    uint32_t sum = 0, *blk = get_block(block);
     unsigned int i;
 
+    if (blk == NULL)
+        return -1;
+
     for (i = 0; i < BYTES_PER_BLOCK/4; i++)
         sum += be32toh(blk[i]);
 
-    if (sum != 0)
-        errx(1, "Bad block checksum %08x", sum);
+    if (sum == 0)
+        return 0;
+    bad_block("Bad block checksum %08x (block %u)", sum, block);
+    return -1;
 }
 
 static const char *format_bcpl_string(uint8_t *bcpl_str)
@@ -184,23 +248,22 @@ static void set_times(const char *path, time_t time)
     (void)utime(path, &utimbuf);
 }
 
-static void handle_file(int fd, char *path, struct ffs_fileheader *file)
+/* Follow a file's data-block chain, writing the payload to @path (or only
+ * checking it, when verifying). */
+static void extract_file(char *path, uint32_t hdr_idx)
 {
-    int file_fd;
+    struct ffs_fileheader *file = get_block(hdr_idx);
+    int file_fd = -1;
     unsigned int todo, nxtblk, data_per_block;
-    time_t time = time_from_datestamp(&file->datestamp);
-
-    printf(" %-54s %6u %s\n",
-           path,
-           be32toh(file->file_size),
-           format_datestamp(&file->datestamp));
 
-    if (is_readonly)
+    if (file == NULL)
         return;
 
-    file_fd = file_open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
-    if (file_fd == -1)
-        err(1, "%s", path);
+    if (!verify_only) {
+        file_fd = file_open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+        if (file_fd == -1)
+            err(1, "%s", path);
+    }
 
     data_per_block = is_ffs ? BYTES_PER_BLOCK : BYTES_PER_BLOCK-24;
 
@@ -210,37 +273,108 @@ static void handle_file(int fd, char *path, struct ffs_fileheader *file)
         char *dat;
         if (nxtblk == HASH_SIZE) {
             idx = be32toh(file->extension);
-            put_block(file);
-            file = get_block(fd, idx);
-            checksum_block(file);
+            if (checksum_block(idx) != 0)
+                return;
+            file = get_block(idx);
             if ((be32toh(file->type) != T_LIST) ||
-                (be32toh(file->subtype) != ST_FILE))
-                errx(1, "Bad file-ext block");
+                (be32toh(file->subtype) != ST_FILE)) {
+                bad_block("Bad file-ext block (block %u)", idx);
+                return;
+            }
             nxtblk = 0;
         }
         idx = be32toh(file->data[HASH_SIZE-nxtblk-1]);
-        dat = get_block(fd, idx);
-        if (!is_ffs)
-            checksum_block(dat);
         this_todo = (todo > data_per_block) ? data_per_block : todo;
-        write_exact(file_fd, &dat[is_ffs?0:24], this_todo);
-        put_block(dat);
         todo -= this_todo;
+        if (!is_ffs && (checksum_block(idx) != 0))
+            continue;
+        if ((dat = get_block(idx)) == NULL)
+            continue;
+        if (file_fd != -1)
+            write_exact(file_fd, &dat[is_ffs?0:24], this_todo);
+    }
+
+    if (file_fd != -1) {
+        close(file_fd);
+        file = get_block(hdr_idx);
+        set_times(path, time_from_datestamp(&file->datestamp));
     }
+}
 
-    close(file_fd);
-    set_times(path, time);
+static void run_worker(unsigned int w, unsigned int nr_workers)
+{
+    unsigned int i;
 
-    put_block(file);
-    free(path);
+    for (i = w; i < nr_files; i += nr_workers)
+        extract_file(files[i].path, files[i].idx);
 }
 
-static void handle_dir(int fd, char *prefix, struct ffs_dir *dir)
+static void extract_files(unsigned int nr_workers)
+{
+    unsigned int w;
+    pid_t *pids;
+    int wstatus, failed = 0;
+
+    if (nr_workers > nr_files)
+        nr_workers = nr_files;
+    if (nr_workers <= 1) {
+        run_worker(0, 1);
+        return;
+    }
+
+    /* Workers share the disk image (copy-on-write) and take every Nth
+     * file. Unflushed output would otherwise be duplicated in each. */
+    fflush(stdout);
+    if ((pids = malloc(nr_workers * sizeof(*pids))) == NULL)
+        err(1, NULL);
+    for (w = 0; w < nr_workers; w++) {
+        if ((pids[w] = fork()) == -1)
+            err(1, "fork");
+        if (pids[w] == 0) {
+            run_worker(w, nr_workers);
+            exit(0);
+        }
+    }
+
+    for (w = 0; w < nr_workers; w++) {
+        while (waitpid(pids[w], &wstatus, 0) == -1)
+            if (errno != EINTR)
+                err(1, "waitpid");
+        if (!WIFEXITED(wstatus) || (WEXITSTATUS(wstatus) != 0))
+            failed = 1;
+    }
+
+    free(pids);
+    if (failed)
+        errx(1, "File extraction failed");
+}
+
+static void handle_file(char *path, uint32_t idx)
+{
+    struct ffs_fileheader *file = get_block(idx);
+
+    printf(" %-54s %6u %s\n",
+           path,
+           be32toh(file->file_size),
+           format_datestamp(&file->datestamp));
+
+    if (verify_only)
+        extract_file(path, idx);
+    if (is_readonly) {
+        free(path);
+        return;
+    }
+
+    add_job(&files, &nr_files, path, idx);
+}
+
+static void handle_dir(char *prefix, uint32_t dir_idx)
 {
     uint32_t idx;
     unsigned int i;
     char *path;
     const char *name;
+    struct ffs_dir *dir = get_block(dir_idx);
     struct ffs_fileheader *file;
 
     if (!is_readonly)
@@ -252,10 +386,12 @@ static void handle_dir(int fd, char *prefix, struct ffs_dir *dir)
     for (i = 0; i < HASH_SIZE; i++) {
         idx = be32toh(dir->hash[i]);
         while (idx != 0) {
-            file = get_block(fd, idx);
+            if ((file = get_block(idx)) == NULL)
+                break;
             if (be32toh(file->type) != T_HEADER)
                 errx(1, "Not a header block (type %08x)", be32toh(file->type));
-            checksum_block(file);
+            if (checksum_block(idx) != 0)
+                break;
 
             name = format_bcpl_string(file->file_name);
             if ((path = malloc(strlen(prefix) + strlen(name) + 2)) == NULL)
@@ -263,63 +399,101 @@ static void handle_dir(int fd, char *prefix, struct ffs_dir *dir)
             strcpy(path, prefix);
             strcat(path, name);
 
-            idx = be32toh(file->hash_chain);
-
             switch ((int)be32toh(file->subtype)) {
             case ST_USERDIR:
-                handle_dir(fd, path, (struct ffs_dir *)file);
+                handle_dir(path, idx);
                 break;
             case ST_FILE:
-                handle_file(fd, path, file);
+                handle_file(path, idx);
                 break;
             default:
                 errx(1, "Unrecognised subtype %08x", be32toh(dir->subtype));
             }
+
+            idx = be32toh(file->hash_chain);
         }
     }
 
-    if (!is_readonly)
-        set_times(prefix, time_from_datestamp(&dir->datestamp));
+    if (is_readonly)
+        free(prefix);
+    else
+        add_job(&dirs, &nr_dirs, prefix, dir_idx);
+}
+
+static void check_bitmap(struct ffs_root_block *root_block)
+{
+    unsigned int i, idx;
 
-    put_block(dir);
-    free(prefix);
+    for (i = 0; i < ARRAY_SIZE(root_block->bitmap_keys); i++)
+        if ((idx = be32toh(root_block->bitmap_keys[i])) != 0)
+            (void)checksum_block(idx);
+}
+
+static void usage(int rc)
+{
+    printf("Usage: adfread [options] <filename> [<dest_dir>]\n");
+    printf("Options:\n");
+    printf("  -h, --help          Display this information\n");
+    printf("  -j, --jobs=N        Files to extract in parallel (nr CPUs)\n");
+    printf("  -v, --verify-only   Check all block checksums; write nothing\n");
+    printf("Without <dest_dir>, the volume's contents are only listed.\n");
+    exit(rc);
 }
 
 int main(int argc, char **argv)
 {
-    int fd;
-    off_t sz;
     struct ffs_root_block *root_block;
     char *boot_block, *dest_dir = ".", *tmp;
     const char *vol;
+    unsigned int i;
+    int ch, nr_jobs = 0;
+
+    const static char sopts[] = "hj:v";
+    const static struct option lopts[] = {
+        { "help", 0, NULL, 'h' },
+        { "jobs", 1, NULL, 'j' },
+        { "verify-only", 0, NULL, 'v' },
+        { 0, 0, 0, 0 }
+    };
+
+    while ((ch = getopt_long(argc, argv, sopts, lopts, NULL)) != -1) {
+        switch (ch) {
+        case 'h':
+            usage(0);
+            break;
+        case 'j':
+            nr_jobs = atoi(optarg);
+            break;
+        case 'v':
+            verify_only = 1;
+            break;
+        default:
+            usage(1);
+            break;
+        }
+    }
 
-    if (argc == 3)
-        dest_dir = argv[2];
-    else if (argc == 2)
+    if (argc == (optind + 2))
+        dest_dir = argv[optind+1];
+    else if (argc == (optind + 1))
         is_readonly = 1;
     else
-        errx(1, "Usage: adfread <filename> [<dest_dir>]");
+        usage(1);
+    if (verify_only)
+        is_readonly = 1;
+    if (nr_jobs <= 0)
+        nr_jobs = sysconf(_SC_NPROCESSORS_ONLN);
 
-    fd = file_open(argv[1], O_RDONLY);
-    if (fd == -1)
-        err(1, "%s", argv[1]);
+    load_disk(argv[optind]);
 
-    sz = lseek(fd, 0, SEEK_END);
-    if (sz < 0)
-        err(1, NULL);
-    if (sz != BYTES_PER_DISK)
-        errx(1, "Bad file size %ld bytes (expected %ld bytes)",
-             (long)sz, (long)BYTES_PER_DISK);
-
-    boot_block = get_block(fd, 0);
-    if (strncmp(boot_block, "DOS", 3))
+    boot_block = get_block(0);
+    if ((boot_block == NULL) || strncmp(boot_block, "DOS", 3))
         errx(1, "Bad Amiga bootblock");
     is_ffs = boot_block[3] & 1;
-    put_block(boot_block);
 
-    root_block = get_block(fd, BLOCKS_PER_DISK/2);
-    checksum_block(root_block);
-    if ((be32toh(root_block->type) != T_HEADER) ||
+    root_block = get_block(BLOCKS_PER_DISK/2);
+    if ((checksum_block(BLOCKS_PER_DISK/2) != 0) ||
+        (be32toh(root_block->type) != T_HEADER) ||
         (be32toh(root_block->subtype) != ST_ROOT) ||
         (be32toh(root_block->hash_size) != HASH_SIZE))
         errx(1, "Bad root block");
@@ -339,7 +513,24 @@ int main(int argc, char **argv)
     printf("Last altered:\t%s\n",
            format_datestamp(&root_block->disk_altered_datestamp));
 
-    handle_dir(fd, dest_dir, (struct ffs_dir *)root_block);
+    handle_dir(dest_dir, BLOCKS_PER_DISK/2);
+
+    if (verify_only) {
+        check_bitmap(root_block);
+        printf("%u bad block%s\n",
+               nr_bad_blocks, (nr_bad_blocks == 1) ? "" : "s");
+        return nr_bad_blocks ? 1 : 0;
+    }
+
+    extract_files(nr_jobs);
+
+    for (i = 0; i < nr_dirs; i++) {
+        set_times(dirs[i].path, time_from_datestamp(
+                      &((struct ffs_dir *)get_block(dirs[i].idx))->datestamp));
+        free(dirs[i].path);
+    }
+    for (i = 0; i < nr_files; i++)
+        free(files[i].path);
 
     return 0;
 }
@@ -0,0 +1,1050 @@
+/*
+ * common/config.c
+ * 
+ * Parse config file which defines allowed formats for particular disks.
+ * 
+ * Parsed configs are compiled into a binary index, stored in the user's 
+ * cache directory, which maps every format specifier directly to its 
+ * per-track format lists. The index is rebuilt whenever any of its 
+ * source files change, or when libdisk's set of formats changes. Lookups 
+ * which the index cannot satisfy fall back to parsing the config as text, 
+ * so errors are always reported against the config source.
+ * 
+ * Written in 2011 by Keir Fraser
+ */
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if !defined(__MINGW32__)
+#include <sys/mman.h>
+#endif
+#include <libdisk/disk.h>
+#include <libdisk/util.h>
+
+#include "config.h"
+
+#define DEF_DIR PREFIX "/share/disk-analyse"
+#define DEF_FIL "formats"
+
+struct token {
+    enum { STR, NUM, CHR, EOL } type;
+    union {
+        char str[128];
+        struct {
+            unsigned int start, end, step;
+        } num;
+        int ch;
+    } u;
+};
+
+static struct file_info {
+    FILE *f;
+    char *name;
+    unsigned int line;
+    struct file_info *next;
+} *fi;
+
+/* Set while compiling the index: parse errors set parse_failed, and 
+ * abandon the current specifier, rather than exiting. */
+static bool_t compiling, parse_failed;
+
+/* Set while compiling the index: every file opened is recorded here. */
+static struct source {
+    char *name, *path;
+    struct source *next;
+} *sources;
+
+static void parse_err(const char *f, ...)
+{
+    char errs[128];
+    va_list args;
+
+    if (compiling) {
+        parse_failed = 1;
+        return;
+    }
+
+    va_start(args, f);
+    vsnprintf(errs, sizeof(errs), f, args);
+    va_end(args);
+
+    errx(1, "error at %s:%u: %s", fi->name, fi->line, errs);
+}
+
+static int mygetc(void)
+{
+    int c = fgetc(fi->f);
+    if (c == '\n')
+        fi->line++;
+    return c;
+}
+
+static void myungetc(int c)
+{
+    if (c == '\n')
+        fi->line--;
+    ungetc(c, fi->f);
+}
+
+static void parse_token(struct token *t)
+{
+    int c;
+
+    if (parse_failed)
+        goto fail;
+
+    while (isspace(c = mygetc()) && (c != '\n'))
+        continue;
+
+retry:
+    if (isdigit(c)) {
+        t->type = NUM;
+        t->u.num.start = c - '0';
+        while (isdigit(c = mygetc()))
+            t->u.num.start = t->u.num.start * 10 + c - '0';
+        t->u.num.end = t->u.num.start;
+        t->u.num.step = 1;
+        if (c == '-') {
+            t->u.num.end = 0;
+            while (isdigit(c = mygetc()))
+                t->u.num.end = t->u.num.end * 10 + c - '0';
+            if (t->u.num.end < t->u.num.start) {
+                parse_err("bad range %u-%u", t->u.num.start, t->u.num.end);
+                goto fail;
+            }
+        }
+        if (c == '/') {
+            t->u.num.step = 0;
+            while (isdigit(c = mygetc()))
+                t->u.num.step = t->u.num.step * 10 + c - '0';
+        }
+        myungetc(c);
+    } else if (c == '"') {
+        char *p = t->u.str;
+        t->type = STR;
+        while ((c = mygetc()) != '"') {
+            if ((c == '\n') || (c == '\r') || (c == EOF)) {
+                parse_err("unexpected newline or end-of-file in string");
+                goto fail;
+            }
+            *p++ = c;
+            if ((p - t->u.str) >= (sizeof(t->u.str)-1)) {
+                parse_err("string too long");
+                goto fail;
+            }
+        }
+        *p = '\0';
+    } else if (isalpha(c)) {
+        char *p = t->u.str;
+        t->type = STR;
+        *p++ = c;
+        while (isalnum(c = mygetc()) || (c == '_')) {
+            *p++ = c;
+            if ((p - t->u.str) >= (sizeof(t->u.str)-1)) {
+                parse_err("string too long");
+                goto fail;
+            }
+        }
+        *p = '\0';
+        myungetc(c);
+    } else if (c == '\\') { /* ignore EOL at line break */
+        while (isspace(c = mygetc()) && (c != '\n'))
+            continue;
+        if (c != '\n') {
+            parse_err("expected newline after backslash");
+            goto fail;
+        }
+        while (isspace(c = mygetc()) && (c != '\n'))
+            continue;
+        goto retry;
+    } else if (c == '#') { /* ignore until EOL */
+        while (((c = mygetc()) != EOF) && (c != '\n'))
+            continue;
+        goto retry;
+    } else if ((c == EOF) || (c == '\n')) {
+        t->type = EOL;
+        t->u.ch = c;
+    } else {
+        t->type = CHR;
+        t->u.ch = c;
+    }
+    return;
+
+fail:
+    /* Only reached while compiling: end the parse. */
+    t->type = EOL;
+    t->u.ch = EOF;
+}
+
+/* Find the file that @name refers to: relative names are tried first in 
+ * the current directory and then in the default config directory. */
+static char *resolve_file(const char *name)
+{
+    char *path;
+
+    if (name[0] != '/') {
+        char *cwd;
+        if ((cwd = getcwd(NULL, 0)) == NULL)
+            err(1, NULL);
+        path = memalloc(strlen(cwd) + strlen(name) + 2);
+        sprintf(path, "%s/%s", cwd, name);
+        free(cwd);
+        if (access(path, R_OK) != 0) {
+            memfree(path);
+            path = memalloc(strlen(DEF_DIR) + strlen(name) + 2);
+            sprintf(path, "%s/%s", DEF_DIR, name);
+        }
+    } else {
+        path = memalloc(strlen(name) + 1);
+        strcpy(path, name);
+    }
+
+    return path;
+}
+
+static void record_source(const char *name, const char *path)
+{
+    struct source *src;
+
+    for (src = sources; src != NULL; src = src->next)
+        if (!strcmp(src->name, name) && !strcmp(src->path, path))
+            return;
+
+    src = memalloc(sizeof(*src));
+    src->name = memalloc(strlen(name) + 1);
+    strcpy(src->name, name);
+    src->path = memalloc(strlen(path) + 1);
+    strcpy(src->path, path);
+    src->next = sources;
+    sources = src;
+}
+
+static struct file_info *open_file(char *name)
+{
+    struct file_info *fi = memalloc(sizeof(*fi));
+
+    fi->line = 1;
+    fi->name = resolve_file(name);
+    fi->f = fopen(fi->name, "r");
+
+    if (fi->f == NULL) {
+        memfree(fi->name);
+        memfree(fi);
+        fi = NULL;
+    } else if (compiling) {
+        record_source(name, fi->name);
+    }
+
+    return fi;
+}
+
+void close_file(struct file_info *fi)
+{
+    if (fi->f != NULL)
+        fclose(fi->f);
+    memfree(fi->name);
+    memfree(fi);
+}
+
+struct format_list *realloc_format_list(struct format_list *old)
+{
+    struct format_list *list;
+    unsigned int max = old ? old->max*2 : 4;
+    list = memalloc(sizeof(*list) + (max-1)*2);
+    if (old) {
+        memcpy(list, old, sizeof(*list) + (old->max-1)*2);
+        memfree(old);
+    }
+    list->max = max;
+    return list;
+}
+
+static void close_all_files(void)
+{
+    while (fi != NULL) {
+        struct file_info *fi2 = fi->next;
+        close_file(fi);
+        fi = fi2;
+    }
+}
+
+static void free_format_lists(struct format_list **formats);
+
+/* Parse the config as text, looking for @specifier. If @p_target is 
+ * non-NULL it receives the specifier's name after following aliases. 
+ * Returns NULL if parsing fails while compiling the index. */
+static struct format_list **parse_spec(
+    char *config, char *specifier, char **p_target)
+{
+    unsigned int i;
+    struct format_list **formats, ignore_list, *list = NULL;
+    struct token t;
+    char *spec;
+
+    formats = memalloc(NR_TRACKS * sizeof(*formats));
+
+    spec = memalloc(strlen(specifier)+1);
+    strcpy(spec, specifier);
+
+    if ((fi = open_file(config ? : DEF_FIL)) == NULL)
+        errx(1, "could not open config file \"%s\"", config ? : DEF_FIL);
+
+    for (;;) {
+        parse_token(&t);
+        if (parse_failed)
+            goto fail;
+        if ((t.type == EOL) && (t.u.ch == EOF)) {
+            struct file_info *fi2 = fi->next;
+            if (fi2 == NULL) {
+                parse_err("no match for \"%s\"", spec);
+                goto fail;
+            }
+            close_file(fi);
+            fi = fi2;
+        } else if (t.type != STR) {
+            /* nothing */
+        } else if (!strcmp("INCLUDE", t.u.str)) {
+            struct file_info *fi2;
+            parse_token(&t);
+            if (t.type != STR) {
+                parse_err("expected string after INCLUDE");
+                goto fail;
+            }
+            if ((fi2 = open_file(t.u.str)) == NULL) {
+                parse_err("could not open config file \"%s\"", t.u.str);
+                goto fail;
+            }
+            fi2->next = fi;
+            fi = fi2;
+            t.type = EOL;
+        } else if (!strcmp(spec, t.u.str)) {
+            parse_token(&t);
+            if ((t.type == CHR) && (t.u.ch == '=')) {
+                parse_token(&t);
+                if (t.type != STR) {
+                    parse_err("expected string after =");
+                    goto fail;
+                }
+                if (verbose)
+                    printf("Format \"%s\" -> \"%s\"\n", spec, t.u.str);
+                memfree(spec);
+                spec = memalloc(strlen(t.u.str)+1);
+                strcpy(spec, t.u.str);
+            } else {
+                goto found;
+            }
+        }
+        while (t.type != EOL)
+            parse_token(&t);
+    }
+
+found:
+    if (verbose)
+        printf("Found format \"%s\"\n", spec);
+    for (;;) {
+        const char *fmtname;
+        unsigned int start, end, step;
+
+        list = realloc_format_list(NULL);
+        while (t.type != EOL)
+            parse_token(&t);
+        parse_token(&t);
+        if ((t.type == CHR) && (t.u.ch == '*')) {
+            t.type = NUM;
+            t.u.num.start = 0;
+            t.u.num.end = NR_TRACKS-1;
+            t.u.num.step = 1;
+        }
+        if (t.type != NUM) {
+            memfree(list);
+            list = NULL;
+            break;
+        }
+        start = t.u.num.start;
+        end = t.u.num.end;
+        step = t.u.num.step;
+        if ((start >= NR_TRACKS) || (end >= NR_TRACKS)) {
+            parse_err("bad track range %u-%u", start, end);
+            goto fail;
+        }
+        for (;;) {
+            parse_token(&t);
+            if (t.type == EOL)
+                break;
+            if (list == &ignore_list) {
+                parse_err("'ignore' must be sole format specifier");
+                goto fail;
+            }
+            if (t.type != STR) {
+                parse_err("expected format string");
+                goto fail;
+            }
+            if (!strcmp("budget", t.u.str)) {
+                parse_token(&t);
+                if ((t.type != CHR) || (t.u.ch != '=')) {
+                    parse_err("expected = after budget");
+                    goto fail;
+                }
+                parse_token(&t);
+                if ((t.type != NUM) || (t.u.num.start != t.u.num.end) ||
+                    (t.u.num.start >= BUDGET_NONE)) {
+                    parse_err("expected budget in %% of a revolution");
+                    goto fail;
+                }
+                list->budget = t.u.num.start ? : BUDGET_NONE;
+            } else if (!strcmp("ignore", t.u.str)) {
+                if (list->nr != 0) {
+                    parse_err("'ignore' must be sole format specifier");
+                    goto fail;
+                }
+                memfree(list);
+                list = &ignore_list;
+            } else if (!strcmp("all", t.u.str)) {
+                for (i = 0; disk_get_format_id_name(i) != NULL; i++) {
+                    if (list->nr == list->max)
+                        list = realloc_format_list(list);
+                    list->ent[list->nr++] = i;
+                }
+            } else {
+                for (i = 0;
+                     (fmtname = disk_get_format_id_name(i)) != NULL;
+                     i++)
+                    if (!strcmp(fmtname, t.u.str))
+                        break;
+                if (fmtname == NULL) {
+                    parse_err("bad format name \"%s\"", t.u.str);
+                    goto fail;
+                }
+                if (list->nr == list->max)
+                    list = realloc_format_list(list);
+                list->ent[list->nr++] = i;
+            }
+        }
+        if ((list->nr == 0) && (list != &ignore_list)) {
+            parse_err("empty format list");
+            goto fail;
+        }
+        for (i = start; i <= end; i += step)
+            if (formats[i] == NULL)
+                formats[i] = list;
+    }
+
+    /* A failed token ends the parse early: the result is incomplete. */
+    if (parse_failed)
+        goto fail;
+
+    for (i = 0; i < NR_TRACKS; i++) {
+        if (formats[i] == NULL) {
+            parse_err("no format specified for track %u", i);
+            goto fail;
+        }
+        if (formats[i] == &ignore_list)
+            formats[i] = NULL;
+    }
+
+    if (p_target != NULL)
+        *p_target = spec;
+    else
+        memfree(spec);
+    close_all_files();
+
+    return formats;
+
+fail:
+    /* Only reached while compiling: discard the partial result. */
+    for (i = 0; i < NR_TRACKS; i++) {
+        if (formats[i] == list)
+            list = NULL;
+        if (formats[i] == &ignore_list)
+            formats[i] = NULL;
+    }
+    if (list != &ignore_list)
+        memfree(list);
+    free_format_lists(formats);
+    memfree(spec);
+    close_all_files();
+    return NULL;
+}
+
+/*
+ * Binary index. Offsets are from the start of the file, so that zero can 
+ * mean "none". Integers are in host byte order: the index is a private 
+ * cache, and is simply rebuilt if it does not match what we expect.
+ */
+
+#define INDEX_SIG     "DAINDEX"
+#define INDEX_VERSION 3
+
+struct index_header {
+    char sig[8];
+    uint32_t version, size;
+    uint32_t formats_hash; /* libdisk format names, in id order */
+    uint32_t nr_sources, sources_off;
+    uint32_t nr_buckets, buckets_off;
+};
+
+/* Every file read while compiling, as named in the config, and the path 
+ * that name resolved to. Files are checked by content rather than mtime, 
+ * which may not change across a quick edit. */
+struct index_source {
+    uint32_t name_off, path_off;
+    int64_t size;
+    uint32_t crc, pad;
+};
+
+/* Open-addressed hash table of specifiers. Each maps to NR_TRACKS list 
+ * offsets (zero for ignored tracks). A list is a uint16_t count and scan 
+ * budget, followed by that many format ids; tracks sharing a list in the 
+ * config share one here too, so that disk-analyse's per-list state 
+ * behaves as before. */
+struct index_bucket {
+    uint32_t hash, name_off; /* name_off == 0: empty */
+    uint32_t target_off;     /* name after following '=' aliases */
+    uint32_t tracks_off;
+};
+
+enum { INDEX_FOUND, INDEX_NO_SPEC, INDEX_STALE };
+
+struct index_buf {
+    uint8_t *p;
+    uint32_t len, max;
+};
+
+static uint32_t fnv1a(uint32_t h, const void *p, size_t len)
+{
+    const uint8_t *q = p;
+    while (len--)
+        h = (h ^ *q++) * 16777619u;
+    return h;
+}
+
+/* CRC32 of the contents of @path, or -1 if it cannot be read. */
+static int file_crc(const char *path, uint32_t *p_crc)
+{
+    char buf[4096];
+    uint32_t crc = 0;
+    size_t n;
+    FILE *f;
+
+    if ((f = fopen(path, "r")) == NULL)
+        return -1;
+    while ((n = fread(buf, 1, sizeof(buf), f)) != 0)
+        crc = crc32_add(buf, n, crc);
+    n = ferror(f);
+    fclose(f);
+    if (n)
+        return -1;
+
+    *p_crc = crc;
+    return 0;
+}
+
+static uint32_t hash_str(const char *s)
+{
+    return fnv1a(2166136261u, s, strlen(s));
+}
+
+static uint32_t formats_hash(void)
+{
+    const char *name;
+    uint32_t h = 2166136261u;
+    unsigned int i;
+
+    for (i = 0; (name = disk_get_format_id_name(i)) != NULL; i++)
+        h = fnv1a(h, name, strlen(name) + 1);
+
+    return h;
+}
+
+/* Allocate @len zeroed bytes, 4-byte aligned. Returns the offset: any 
+ * earlier pointers into the buffer are invalidated. */
+static uint32_t ibuf_alloc(struct index_buf *b, uint32_t len)
+{
+    uint32_t off = b->len;
+
+    len = (len + 3) & ~3u;
+    if (off + len > b->max) {
+        uint8_t *p;
+        while (off + len > b->max)
+            b->max = b->max ? b->max * 2 : 65536;
+        p = memalloc(b->max);
+        memcpy(p, b->p, b->len);
+        memfree(b->p);
+        b->p = p;
+    }
+
+    b->len += len;
+    return off;
+}
+
+static uint32_t ibuf_str(struct index_buf *b, const char *s)
+{
+    uint32_t off = ibuf_alloc(b, strlen(s) + 1);
+    strcpy((char *)b->p + off, s);
+    return off;
+}
+
+static void free_format_lists(struct format_list **formats)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < NR_TRACKS; i++) {
+        for (j = 0; j < i; j++)
+            if (formats[j] == formats[i])
+                break;
+        if (j == i)
+            memfree(formats[i]);
+    }
+
+    memfree(formats);
+}
+
+/* Every specifier is defined by a line whose first token is its name. 
+ * Returns the number of specifiers, or -1 if the config does not parse. */
+static int collect_specs(char *config, char ***p_names)
+{
+    char **names = NULL;
+    unsigned int i, nr = 0;
+    struct token t;
+
+    if ((fi = open_file(config)) == NULL)
+        return -1;
+
+    for (;;) {
+        parse_token(&t);
+        if (parse_failed)
+            goto fail;
+        if ((t.type == EOL) && (t.u.ch == EOF)) {
+            struct file_info *fi2 = fi->next;
+            if (fi2 == NULL)
+                break;
+            close_file(fi);
+            fi = fi2;
+        } else if (t.type != STR) {
+            /* nothing */
+        } else if (!strcmp("INCLUDE", t.u.str)) {
+            struct file_info *fi2;
+            parse_token(&t);
+            if ((t.type != STR) || ((fi2 = open_file(t.u.str)) == NULL))
+                goto fail;
+            fi2->next = fi;
+            fi = fi2;
+            t.type = EOL;
+        } else {
+            for (i = 0; i < nr; i++)
+                if (!strcmp(names[i], t.u.str))
+                    break;
+            if (i == nr) {
+                if ((nr & (nr - 1)) == 0) {
+                    char **p = memalloc((nr ? nr * 2 : 1) * sizeof(*p));
+                    memcpy(p, names, nr * sizeof(*p));
+                    memfree(names);
+                    names = p;
+                }
+                names[nr] = memalloc(strlen(t.u.str) + 1);
+                strcpy(names[nr++], t.u.str);
+            }
+        }
+        while (t.type != EOL)
+            parse_token(&t);
+    }
+
+    close_all_files();
+    *p_names = names;
+    return nr;
+
+fail:
+    close_all_files();
+    for (i = 0; i < nr; i++)
+        memfree(names[i]);
+    memfree(names);
+    return -1;
+}
+
+static void index_add_spec(
+    struct index_buf *b, const char *name, const char *target,
+    struct format_list **formats)
+{
+    struct index_header *hdr;
+    struct index_bucket *bkt;
+    uint32_t tracks_off, off, h = hash_str(name);
+    uint16_t *list;
+    unsigned int i, j;
+
+    tracks_off = ibuf_alloc(b, NR_TRACKS * sizeof(uint32_t));
+    for (i = 0; i < NR_TRACKS; i++) {
+        if (formats[i] == NULL)
+            continue;
+        for (j = 0; j < i; j++)
+            if (formats[j] == formats[i])
+                break;
+        if (j < i) {
+            off = ((uint32_t *)(b->p + tracks_off))[j];
+        } else {
+            off = ibuf_alloc(b, (formats[i]->nr + 2) * sizeof(uint16_t));
+            list = (uint16_t *)(b->p + off);
+            list[0] = formats[i]->nr;
+            list[1] = formats[i]->budget;
+            memcpy(&list[2], formats[i]->ent,
+                   formats[i]->nr * sizeof(uint16_t));
+        }
+        ((uint32_t *)(b->p + tracks_off))[i] = off;
+    }
+
+    off = ibuf_str(b, name);
+    hdr = (struct index_header *)b->p;
+    bkt = (struct index_bucket *)(b->p + hdr->buckets_off);
+    for (i = h & (hdr->nr_buckets - 1);
+         bkt[i].name_off != 0;
+         i = (i + 1) & (hdr->nr_buckets - 1))
+        continue;
+    bkt[i].hash = h;
+    bkt[i].name_off = off;
+    bkt[i].tracks_off = tracks_off;
+    bkt[i].target_off = off;
+    if (strcmp(name, target))
+        bkt[i].target_off = ibuf_str(b, target);
+}
+
+/* Parse every specifier in the config and write the results to @idx_name. 
+ * Specifiers which fail to parse are left out of the index. */
+static int index_compile(char *config, const char *idx_name)
+{
+    struct index_buf b = { 0 };
+    struct index_header *hdr;
+    struct index_source *isrc;
+    struct format_list **formats;
+    struct source *src;
+    struct stat st;
+    char *tmp_name, *target, **names = NULL;
+    unsigned int i, nr_buckets, nr_sources;
+    int fd, nr_names = 0, rc = -1, saved_verbose = verbose;
+
+    /* Bail early if we cannot write the index. */
+    tmp_name = memalloc(strlen(idx_name) + 8);
+    sprintf(tmp_name, "%s.XXXXXX", idx_name);
+    if ((fd = mkstemp(tmp_name)) == -1) {
+        memfree(tmp_name);
+        return -1;
+    }
+
+    compiling = 1;
+    verbose = 0;
+
+    if ((nr_names = collect_specs(config, &names)) < 0) {
+        nr_names = 0;
+        goto out;
+    }
+
+    for (nr_buckets = 16; nr_buckets < nr_names * 2; nr_buckets *= 2)
+        continue;
+    ibuf_alloc(&b, sizeof(*hdr));
+    hdr = (struct index_header *)b.p;
+    memcpy(hdr->sig, INDEX_SIG, sizeof(hdr->sig));
+    hdr->version = INDEX_VERSION;
+    hdr->formats_hash = formats_hash();
+    hdr->nr_buckets = nr_buckets;
+    hdr->buckets_off = ibuf_alloc(
+        &b, nr_buckets * sizeof(struct index_bucket));
+
+    for (i = 0; i < nr_names; i++) {
+        parse_failed = 0;
+        if ((formats = parse_spec(config, names[i], &target)) == NULL)
+            continue;
+        index_add_spec(&b, names[i], target, formats);
+        free_format_lists(formats);
+        memfree(target);
+    }
+
+    for (src = sources, nr_sources = 0; src != NULL; src = src->next)
+        nr_sources++;
+    hdr = (struct index_header *)b.p;
+    hdr->nr_sources = nr_sources;
+    hdr->sources_off = ibuf_alloc(&b, nr_sources * sizeof(*isrc));
+    for (src = sources, i = 0; src != NULL; src = src->next, i++) {
+        uint32_t name_off = ibuf_str(&b, src->name);
+        uint32_t path_off = ibuf_str(&b, src->path);
+        uint32_t crc;
+        if ((stat(src->path, &st) != 0) || (file_crc(src->path, &crc) != 0))
+            goto out;
+        hdr = (struct index_header *)b.p;
+        isrc = (struct index_source *)(b.p + hdr->sources_off) + i;
+        isrc->name_off = name_off;
+        isrc->path_off = path_off;
+        isrc->size = st.st_size;
+        isrc->crc = crc;
+    }
+
+    hdr = (struct index_header *)b.p;
+    hdr->size = b.len;
+    write_exact(fd, b.p, b.len);
+    fchmod(fd, 0644);
+    if ((close(fd) == 0) && (rename(tmp_name, idx_name) == 0))
+        rc = 0;
+    fd = -1;
+
+out:
+    compiling = parse_failed = 0;
+    verbose = saved_verbose;
+    if (fd != -1)
+        close(fd);
+    if (rc != 0)
+        unlink(tmp_name);
+    memfree(tmp_name);
+    memfree(b.p);
+    for (i = 0; i < nr_names; i++)
+        memfree(names[i]);
+    memfree(names);
+    while ((src = sources) != NULL) {
+        sources = src->next;
+        memfree(src->name);
+        memfree(src->path);
+        memfree(src);
+    }
+    return rc;
+}
+
+/* Return a pointer to @len bytes at @off, or NULL if out of bounds. */
+static const void *index_ptr(
+    const uint8_t *idx, uint32_t size, uint32_t off, uint32_t len)
+{
+    return ((off != 0) && (off <= size) && (len <= (size - off)))
+        ? idx + off : NULL;
+}
+
+static const char *index_str(const uint8_t *idx, uint32_t size, uint32_t off)
+{
+    const char *s = index_ptr(idx, size, off, 1);
+    return (s && memchr(s, '\0', size - off)) ? s : NULL;
+}
+
+static bool_t index_sources_valid(
+    const uint8_t *idx, uint32_t size, const struct index_header *hdr)
+{
+    const struct index_source *isrc;
+    const char *name, *path;
+    struct stat st;
+    unsigned int i;
+    uint32_t crc;
+    bool_t ok;
+    char *p;
+
+    isrc = index_ptr(idx, size, hdr->sources_off,
+                     hdr->nr_sources * sizeof(*isrc));
+    if ((isrc == NULL) || (hdr->nr_sources == 0))
+        return 0;
+
+    for (i = 0; i < hdr->nr_sources; i++) {
+        name = index_str(idx, size, isrc[i].name_off);
+        path = index_str(idx, size, isrc[i].path_off);
+        if (!name || !path)
+            return 0;
+        /* Relative names may now resolve to a different file. */
+        p = resolve_file(name);
+        ok = !strcmp(p, path);
+        memfree(p);
+        if (!ok || (stat(path, &st) != 0) || (st.st_size != isrc[i].size) ||
+            (file_crc(path, &crc) != 0) || (crc != isrc[i].crc))
+            return 0;
+    }
+
+    return 1;
+}
+
+static int index_get_formats(
+    const uint8_t *idx, uint32_t size, const struct index_bucket *bkt,
+    struct format_list ***p_formats)
+{
+    struct format_list **formats;
+    struct {
+        uint32_t off;
+        struct format_list *list;
+    } seen[NR_TRACKS];
+    const uint32_t *tracks;
+    const uint16_t *ent;
+    unsigned int i, j, nr_seen = 0;
+
+    tracks = index_ptr(idx, size, bkt->tracks_off,
+                       NR_TRACKS * sizeof(uint32_t));
+    if (tracks == NULL)
+        return INDEX_STALE;
+
+    formats = memalloc(NR_TRACKS * sizeof(*formats));
+    for (i = 0; i < NR_TRACKS; i++) {
+        if (tracks[i] == 0)
+            continue;
+        for (j = 0; j < nr_seen; j++)
+            if (seen[j].off == tracks[i])
+                break;
+        if (j == nr_seen) {
+            ent = index_ptr(idx, size, tracks[i], sizeof(uint16_t));
+            if ((ent == NULL) || (ent[0] == 0) ||
+                !index_ptr(idx, size, tracks[i], (ent[0]+2)*sizeof(*ent))) {
+                free_format_lists(formats);
+                return INDEX_STALE;
+            }
+            seen[j].off = tracks[i];
+            seen[j].list = memalloc(sizeof(struct format_list)
+                                    + (ent[0]-1)*2);
+            seen[j].list->nr = seen[j].list->max = ent[0];
+            seen[j].list->budget = ent[1];
+            memcpy(seen[j].list->ent, &ent[2], ent[0] * sizeof(*ent));
+            nr_seen++;
+        }
+        formats[i] = seen[j].list;
+    }
+
+    *p_formats = formats;
+    return INDEX_FOUND;
+}
+
+static int index_lookup(
+    const char *idx_name, const char *spec, struct format_list ***p_formats)
+{
+    const struct index_header *hdr;
+    const struct index_bucket *bkt;
+    const char *name, *target;
+    const uint8_t *idx;
+    struct stat st;
+    uint32_t i, h, size;
+    int fd, rc = INDEX_STALE;
+
+    if ((fd = file_open(idx_name, O_RDONLY)) == -1)
+        return INDEX_STALE;
+    if ((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(*hdr)) ||
+        (st.st_size > UINT32_MAX)) {
+        close(fd);
+        return INDEX_STALE;
+    }
+    size = st.st_size;
+
+#if !defined(__MINGW32__)
+    idx = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (idx == MAP_FAILED)
+        return INDEX_STALE;
+#else
+    idx = memalloc(size);
+    read_exact(fd, (void *)idx, size);
+    close(fd);
+#endif
+
+    hdr = (const struct index_header *)idx;
+    if (memcmp(hdr->sig, INDEX_SIG, sizeof(hdr->sig)) ||
+        (hdr->version != INDEX_VERSION) || (hdr->size != size) ||
+        (hdr->formats_hash != formats_hash()) ||
+        (hdr->nr_buckets & (hdr->nr_buckets - 1)) ||
+        ((bkt = index_ptr(idx, size, hdr->buckets_off,
+                          hdr->nr_buckets * sizeof(*bkt))) == NULL) ||
+        !index_sources_valid(idx, size, hdr))
+        goto out;
+
+    rc = INDEX_NO_SPEC;
+    h = hash_str(spec);
+    for (i = h & (hdr->nr_buckets - 1);
+         bkt[i].name_off != 0;
+         i = (i + 1) & (hdr->nr_buckets - 1)) {
+        if ((bkt[i].hash != h) ||
+            ((name = index_str(idx, size, bkt[i].name_off)) == NULL) ||
+            strcmp(name, spec))
+            continue;
+        if ((target = index_str(idx, size, bkt[i].target_off)) == NULL) {
+            rc = INDEX_STALE;
+            break;
+        }
+        rc = index_get_formats(idx, size, &bkt[i], p_formats);
+        if ((rc == INDEX_FOUND) && verbose) {
+            if (strcmp(spec, target))
+                printf("Format \"%s\" -> \"%s\"\n", spec, target);
+            printf("Found format \"%s\"\n", target);
+        }
+        break;
+    }
+
+out:
+#if !defined(__MINGW32__)
+    munmap((void *)idx, size);
+#else
+    memfree((void *)idx);
+#endif
+    return rc;
+}
+
+/* The index for config file @cfg_path lives in $XDG_CACHE_HOME (default 
+ * ~/.cache), named after the config's full path so that different configs 
+ * do not collide. Returns NULL if there is no cache directory. */
+static char *index_name(const char *cfg_path)
+{
+    const char *base, *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    char *dir, *name, *p;
+
+    if (xdg && *xdg) {
+        dir = memalloc(strlen(xdg) + 16);
+        sprintf(dir, "%s/disk-analyse", xdg);
+    } else if (home && *home) {
+        dir = memalloc(strlen(home) + 24);
+        sprintf(dir, "%s/.cache/disk-analyse", home);
+    } else {
+        return NULL;
+    }
+
+    /* Create the directory and any missing parents. */
+    for (p = strchr(dir + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        (void)posix_mkdir(dir, 0777);
+        *p = '/';
+    }
+    (void)posix_mkdir(dir, 0777);
+
+    base = strrchr(cfg_path, '/');
+    base = base ? base + 1 : cfg_path;
+    name = memalloc(strlen(dir) + strlen(base) + 16);
+    sprintf(name, "%s/%s-%08x.idx", dir, base, hash_str(cfg_path));
+    memfree(dir);
+    return name;
+}
+
+struct format_list **parse_config(char *config, char *specifier)
+{
+    struct format_list **formats;
+    char *cfg_path, *idx_name;
+    int rc = INDEX_STALE;
+
+    if (specifier == NULL)
+        specifier = "default";
+
+    cfg_path = resolve_file(config ? : DEF_FIL);
+    if ((access(cfg_path, R_OK) == 0) &&
+        ((idx_name = index_name(cfg_path)) != NULL)) {
+        rc = index_lookup(idx_name, specifier, &formats);
+        if ((rc == INDEX_STALE) &&
+            (index_compile(config ? : DEF_FIL, idx_name) == 0))
+            rc = index_lookup(idx_name, specifier, &formats);
+        memfree(idx_name);
+    }
+    memfree(cfg_path);
+
+    if (rc == INDEX_FOUND)
+        return formats;
+
+    /* Not indexed: parse as text, which reports any error. */
+    return parse_spec(config, specifier, NULL);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,45 @@
+/*
+ * common/config.h
+ * 
+ * Format lists parsed from the disk-analyse formats config, shared by the 
+ * tools which decode tracks: disk-analyse and scp_dump.
+ * 
+ * Written in 2026 by agent
+ */
+
+#ifndef __COMMON_CONFIG_H__
+#define __COMMON_CONFIG_H__
+
+#define NR_TRACKS 200
+
+struct handler_stats;
+
+/* format_list.budget: scan budget in % of a revolution, or one of these. */
+#define BUDGET_DEFAULT 0
+#define BUDGET_NONE    0xffff
+
+struct format_list {
+    uint16_t nr, max, pos;
+    uint16_t budget;
+    struct handler_stats *stats; /* see disk-analyse/sched.c */
+    uint16_t ent[1];
+};
+
+/* Per-track format lists for @specifier (default "default") in @config 
+ * (default the installed "formats"). Exits on a config error. */
+extern struct format_list **parse_config(char *config, char *specifier);
+
+/* Defined by the program: print what is parsed. */
+extern int verbose;
+
+#endif /* __COMMON_CONFIG_H__ */
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,614 @@
+/*
+ * disk-analyse/batch.c
+ * 
+ * Analyse many images in one run, on a pool of worker processes.
+ * 
+ * Inputs come from a directory (every entry is an image, subdirectories
+ * being Kryoflux STREAM dumps) or from a manifest file. Manifest lines are
+ * tab-separated: input, then optionally a format specifier and an output
+ * name. Blank lines and lines starting with '#' are ignored.
+ * 
+ * The config is parsed once, up front, for every format specifier in the
+ * batch. Each image is then analysed in a forked child: workers start
+ * instantly with the parsed config and libdisk already in place, and an
+ * image which makes libdisk bail out cannot take the rest of the batch with
+ * it. Tracks within an image are analysed in order, as some formats depend
+ * on information gathered from earlier tracks.
+ * 
+ * Outputs are written under a temporary name and renamed into place when
+ * complete, so an interrupted batch may simply be run again: items whose
+ * output is newer than their input are skipped, and keep their rows from
+ * the previous run's summary.
+ * 
+ * Written in 2026 by agent
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libdisk/disk.h>
+#include <libdisk/util.h>
+
+#include "common.h"
+
+struct batch_item {
+    char *in, *out, *tmp;
+    const char *format;
+    struct format_list **format_lists;
+    char *prev_row; /* summary row from an earlier run, if any */
+};
+
+/* Sent from a worker to the parent when its image is done. It is followed
+ * by @nr_stats format statistics deltas, which the parent merges so that
+ * later workers inherit what has been learned. */
+struct batch_result {
+    struct analyse_result res;
+    unsigned int nr_stats;
+};
+
+struct batch_slot {
+    pid_t pid;
+    int log_fd, res_fd;
+    struct batch_item *item;
+    double start;
+    char *log;
+    size_t log_len;
+};
+
+static struct {
+    struct batch_item *items;
+    unsigned int nr_items;
+    unsigned int nr_ok, nr_damaged, nr_failed, nr_skipped;
+    FILE *summary;
+} batch;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *copy_str(const char *s)
+{
+    char *p = memalloc(strlen(s) + 1);
+    strcpy(p, s);
+    return p;
+}
+
+static void add_item(const char *in, const char *format, const char *out)
+{
+    struct batch_item *item;
+
+    if ((batch.nr_items & (batch.nr_items - 1)) == 0) {
+        struct batch_item *p = memalloc(
+            (batch.nr_items ? batch.nr_items * 2 : 1) * sizeof(*p));
+        memcpy(p, batch.items, batch.nr_items * sizeof(*p));
+        memfree(batch.items);
+        batch.items = p;
+    }
+
+    item = &batch.items[batch.nr_items++];
+    item->in = copy_str(in);
+    item->format = format ? copy_str(format) : NULL;
+    item->out = out ? copy_str(out) : NULL;
+}
+
+static int dirent_cmp(const struct dirent **a, const struct dirent **b)
+{
+    return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+static int dirent_filter(const struct dirent *d)
+{
+    return d->d_name[0] != '.';
+}
+
+static void read_dir(const char *dir)
+{
+    struct dirent **ents;
+    char *path;
+    int i, nr;
+
+    if ((nr = scandir(dir, &ents, dirent_filter, dirent_cmp)) < 0)
+        err(1, "%s", dir);
+
+    for (i = 0; i < nr; i++) {
+        path = memalloc(strlen(dir) + strlen(ents[i]->d_name) + 2);
+        sprintf(path, "%s/%s", dir, ents[i]->d_name);
+        add_item(path, NULL, NULL);
+        memfree(path);
+        free(ents[i]);
+    }
+
+    free(ents);
+}
+
+static void read_manifest(const char *name)
+{
+    char line[4096], *field[3], *p;
+    unsigned int i, lineno = 0;
+    FILE *f;
+
+    if ((f = fopen(name, "r")) == NULL)
+        err(1, "%s", name);
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        if ((p = strchr(line, '\n')) == NULL)
+            errx(1, "%s:%u: line too long", name, lineno);
+        *p = '\0';
+        if ((p > line) && (p[-1] == '\r'))
+            p[-1] = '\0';
+        if ((line[0] == '#') || (line[0] == '\0'))
+            continue;
+        memset(field, 0, sizeof(field));
+        for (i = 0, p = line; (i < 3) && (p != NULL); i++) {
+            field[i] = p;
+            if ((p = strchr(p, '\t')) != NULL)
+                *p++ = '\0';
+            if (*field[i] == '\0')
+                field[i] = NULL;
+        }
+        if (field[0] == NULL)
+            errx(1, "%s:%u: no input file", name, lineno);
+        add_item(field[0], field[1], field[2]);
+    }
+
+    fclose(f);
+}
+
+/* Output file name: the input's name with its suffix replaced. */
+static void make_out_names(
+    struct batch_item *item, const char *out_dir, const char *out_type)
+{
+    const char *base, *dot;
+    size_t len;
+
+    if (item->out == NULL) {
+        len = strlen(item->in);
+        while ((len > 1) && (item->in[len-1] == '/'))
+            len--;
+        for (base = item->in + len; base != item->in; base--)
+            if (base[-1] == '/')
+                break;
+        len -= base - item->in;
+        for (dot = base + len - 1; (dot > base) && (*dot != '.'); dot--)
+            continue;
+        if (dot > base)
+            len = dot - base;
+        item->out = memalloc(strlen(out_dir) + len + strlen(out_type) + 3);
+        sprintf(item->out, "%s/%.*s.%s", out_dir, (int)len, base, out_type);
+    }
+
+    /* Temporary name is hidden, and keeps the suffix which selects the 
+     * output container: dir/.name.part.suffix */
+    base = strrchr(item->out, '/');
+    base = base ? base + 1 : item->out;
+    if (((dot = strrchr(base, '.')) == NULL) || (dot == base))
+        dot = base + strlen(base);
+    item->tmp = memalloc(strlen(item->out) + 8);
+    sprintf(item->tmp, "%.*s.%.*s.part%s", (int)(base - item->out), item->out,
+            (int)(dot - base), base, dot);
+}
+
+static bool_t up_to_date(struct batch_item *item)
+{
+    struct stat in_st, out_st;
+
+    return ((stat(item->in, &in_st) == 0) &&
+            (stat(item->out, &out_st) == 0) &&
+            (out_st.st_mtime >= in_st.st_mtime));
+}
+
+/* Parse each distinct format specifier once, before any worker starts. */
+static void parse_formats(char *config, char *format)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < batch.nr_items; i++) {
+        struct batch_item *item = &batch.items[i];
+        if (item->format == NULL)
+            item->format = format ? : "default";
+        for (j = 0; j < i; j++)
+            if (!strcmp(batch.items[j].format, item->format))
+                break;
+        item->format_lists = (j < i)
+            ? batch.items[j].format_lists
+            : parse_config(config, (char *)item->format);
+    }
+}
+
+static void run_worker(struct batch_slot *slot, int log_fd, int res_fd)
+{
+    struct batch_item *item = slot->item;
+    struct batch_result res;
+    struct sched_delta *delta;
+    unsigned int i, nr;
+
+    dup2(log_fd, 1);
+    dup2(log_fd, 2);
+    close(log_fd);
+
+    memset(&res, 0, sizeof(res));
+    sched_snapshot(item->format_lists, &delta, &nr);
+    analyse_image(item->in, item->tmp, item->format_lists, &res.res);
+    if (rename(item->tmp, item->out) != 0)
+        err(1, "%s", item->out);
+    fflush(stdout);
+
+    /* Send only the formats which were tried. */
+    sched_diff(item->format_lists, delta, nr);
+    for (i = 0; i < nr; i++)
+        if (delta[i].attempts)
+            delta[res.nr_stats++] = delta[i];
+
+    /* The parent waits for our log to close before it reads the result. */
+    close(1);
+    close(2);
+    write_exact(res_fd, &res, sizeof(res));
+    write_exact(res_fd, delta, res.nr_stats * sizeof(*delta));
+    _exit(0);
+}
+
+static void start_item(struct batch_slot *slot, struct batch_item *item)
+{
+    int log_pipe[2], res_pipe[2];
+
+    if ((pipe(log_pipe) != 0) || (pipe(res_pipe) != 0))
+        err(1, "pipe");
+
+    fflush(NULL);
+    slot->item = item;
+    slot->start = now();
+    if ((slot->pid = fork()) == -1)
+        err(1, "fork");
+
+    if (slot->pid == 0) {
+        close(log_pipe[0]);
+        close(res_pipe[0]);
+        run_worker(slot, log_pipe[1], res_pipe[1]);
+    }
+
+    close(log_pipe[1]);
+    close(res_pipe[1]);
+    slot->log_fd = log_pipe[0];
+    slot->res_fd = res_pipe[0];
+    slot->log = NULL;
+    slot->log_len = 0;
+}
+
+static void summarise(
+    struct batch_item *item, const char *status, int nr_bad,
+    double secs, const char *msg)
+{
+    if (batch.summary == NULL)
+        return;
+    fprintf(batch.summary, "%s\t%s\t%s\t%s\t", item->in, item->out,
+            item->format, status);
+    if (nr_bad >= 0)
+        fprintf(batch.summary, "%d", nr_bad);
+    fprintf(batch.summary, "\t%.2f\t%s\n", secs, msg ? : "");
+    fflush(batch.summary);
+}
+
+static int cmp_item_in(const void *a, const void *b)
+{
+    return strcmp((*(struct batch_item **)a)->in,
+                  (*(struct batch_item **)b)->in);
+}
+
+/* Remember each item's row from an existing summary file, so that items 
+ * which are up to date can carry their results into the new summary. */
+static void load_summary(const char *name)
+{
+    struct batch_item **sorted, key, *pkey = &key, **pitem;
+    char line[4096], *p;
+    unsigned int i;
+    FILE *f;
+
+    if ((f = fopen(name, "r")) == NULL)
+        return;
+
+    sorted = memalloc(batch.nr_items * sizeof(*sorted));
+    for (i = 0; i < batch.nr_items; i++)
+        sorted[i] = &batch.items[i];
+    qsort(sorted, batch.nr_items, sizeof(*sorted), cmp_item_in);
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (((p = strchr(line, '\t')) == NULL) || !strchr(p, '\n'))
+            continue;
+        *p = '\0';
+        key.in = line;
+        pitem = bsearch(&pkey, sorted, batch.nr_items, sizeof(*sorted),
+                        cmp_item_in);
+        *p = '\t';
+        if ((pitem == NULL) || ((*pitem)->prev_row != NULL))
+            continue;
+        (*pitem)->prev_row = memalloc(strlen(line) + 1);
+        strcpy((*pitem)->prev_row, line);
+    }
+
+    memfree(sorted);
+    fclose(f);
+}
+
+/* Like read_exact(), but a short read is not fatal. */
+static bool_t read_all(int fd, void *buf, size_t count)
+{
+    ssize_t done;
+    char *_buf = buf;
+
+    while (count > 0) {
+        if ((done = read(fd, _buf, count)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        if (done == 0)
+            return 0;
+        count -= done;
+        _buf += done;
+    }
+
+    return 1;
+}
+
+/* Read a worker's result, merging its format statistics. */
+static bool_t read_result(struct batch_slot *slot, struct analyse_result *r)
+{
+    struct batch_result res;
+    struct sched_delta *delta;
+    bool_t ok;
+
+    if (!read_all(slot->res_fd, &res, sizeof(res)))
+        return 0;
+
+    delta = memalloc((res.nr_stats ? : 1) * sizeof(*delta));
+    ok = read_all(slot->res_fd, delta, res.nr_stats * sizeof(*delta));
+    if (ok) {
+        sched_merge(slot->item->format_lists, delta, res.nr_stats);
+        *r = res.res;
+    }
+    memfree(delta);
+
+    return ok;
+}
+
+static void finish_item(struct batch_slot *slot)
+{
+    struct batch_item *item = slot->item;
+    struct analyse_result res;
+    const char *status, *msg = NULL;
+    int wstatus, nr_bad = -1;
+    bool_t have_result;
+    char *p;
+
+    memset(&res, 0, sizeof(res));
+    have_result = read_result(slot, &res);
+
+    while (waitpid(slot->pid, &wstatus, 0) == -1)
+        if (errno != EINTR)
+            err(1, "waitpid");
+
+    if (WIFEXITED(wstatus) && (WEXITSTATUS(wstatus) == 0) && have_result) {
+        nr_bad = res.nr_bad;
+        if (nr_bad == 0) {
+            status = "ok";
+            batch.nr_ok++;
+        } else {
+            status = "damaged";
+            batch.nr_damaged++;
+        }
+    } else {
+        unlink(item->tmp);
+        status = "failed";
+        batch.nr_failed++;
+        /* Report the last thing the worker said. */
+        if (slot->log != NULL) {
+            while (slot->log_len && (slot->log[slot->log_len-1] == '\n'))
+                slot->log[--slot->log_len] = '\0';
+            msg = ((p = strrchr(slot->log, '\n')) != NULL) ? p+1 : slot->log;
+        }
+        if (WIFSIGNALED(wstatus))
+            msg = strsignal(WTERMSIG(wstatus));
+    }
+
+    close(slot->res_fd);
+
+    summarise(item, status, nr_bad, now() - slot->start, msg);
+
+    if (!quiet) {
+        printf("%s: %s", item->in, status);
+        if (nr_bad > 0)
+            printf(" (%d tracks)", nr_bad);
+        printf("\n");
+        if ((verbose || strcmp(status, "ok")) && slot->log_len)
+            printf("%s\n", slot->log);
+    }
+
+    memfree(slot->log);
+    slot->item = NULL;
+}
+
+/* Returns -1 when the worker has closed its output. */
+static int read_log(struct batch_slot *slot)
+{
+    char buf[4096], *p;
+    ssize_t nr;
+
+    if ((nr = read(slot->log_fd, buf, sizeof(buf))) <= 0) {
+        if ((nr < 0) && (errno == EINTR))
+            return 0;
+        close(slot->log_fd);
+        return -1;
+    }
+
+    p = memalloc(slot->log_len + nr + 1);
+    memcpy(p, slot->log, slot->log_len);
+    memcpy(p + slot->log_len, buf, nr);
+    slot->log_len += nr;
+    p[slot->log_len] = '\0';
+    memfree(slot->log);
+    slot->log = p;
+    return 0;
+}
+
+/* Distinct format specifiers in the batch, for loading/saving statistics. */
+static unsigned int batch_specs(
+    const char **specs, struct format_list ***format_lists)
+{
+    unsigned int i, j, nr = 0;
+
+    for (i = 0; i < batch.nr_items; i++) {
+        for (j = 0; j < nr; j++)
+            if (format_lists[j] == batch.items[i].format_lists)
+                break;
+        if (j < nr)
+            continue;
+        specs[nr] = batch.items[i].format;
+        format_lists[nr++] = batch.items[i].format_lists;
+    }
+
+    return nr;
+}
+
+int run_batch(
+    const char *src, const char *out_dir, char *config, char *format,
+    const char *out_type, unsigned int nr_jobs, const char *summary,
+    const char *stats)
+{
+    const char **specs = NULL;
+    struct format_list ***spec_lists = NULL;
+    unsigned int nr_specs = 0;
+    struct batch_slot *slots;
+    struct pollfd *pfd;
+    unsigned int i, nr_active = 0, next = 0;
+    struct stat st;
+    double t = now();
+
+    if (stat(src, &st) != 0)
+        err(1, "%s", src);
+    if (S_ISDIR(st.st_mode))
+        read_dir(src);
+    else
+        read_manifest(src);
+
+    if ((mkdir(out_dir, 0777) != 0) && (errno != EEXIST))
+        err(1, "%s", out_dir);
+
+    for (i = 0; i < batch.nr_items; i++)
+        make_out_names(&batch.items[i], out_dir, out_type);
+    parse_formats(config, format);
+
+    if (stats != NULL) {
+        specs = memalloc((batch.nr_items + 1) * sizeof(*specs));
+        spec_lists = memalloc((batch.nr_items + 1) * sizeof(*spec_lists));
+        nr_specs = batch_specs(specs, spec_lists);
+        sched_load(stats, specs, spec_lists, nr_specs);
+    }
+
+    if (summary == NULL) {
+        char *name = memalloc(strlen(out_dir) + 16);
+        sprintf(name, "%s/summary.tsv", out_dir);
+        load_summary(name);
+        batch.summary = fopen(name, "w");
+        if (batch.summary == NULL)
+            err(1, "%s", name);
+        memfree(name);
+    } else if (!strcmp(summary, "-")) {
+        batch.summary = stdout;
+    } else {
+        load_summary(summary);
+        if ((batch.summary = fopen(summary, "w")) == NULL)
+            err(1, "%s", summary);
+    }
+    fprintf(batch.summary, "input\toutput\tformat\tstatus\t"
+            "bad_tracks\tseconds\tmessage\n");
+
+    slots = memalloc(nr_jobs * sizeof(*slots));
+    pfd = memalloc(nr_jobs * sizeof(*pfd));
+
+    while ((next < batch.nr_items) || nr_active) {
+        /* Fill any idle slots. */
+        for (i = 0; (i < nr_jobs) && (next < batch.nr_items); i++) {
+            struct batch_item *item;
+            if (slots[i].item != NULL)
+                continue;
+            item = &batch.items[next++];
+            if (up_to_date(item)) {
+                if (item->prev_row != NULL) {
+                    fputs(item->prev_row, batch.summary);
+                    fflush(batch.summary);
+                } else {
+                    summarise(item, "skipped", -1, 0, "up to date");
+                }
+                batch.nr_skipped++;
+                i--;
+                continue;
+            }
+            start_item(&slots[i], item);
+            nr_active++;
+        }
+
+        if (nr_active == 0)
+            break;
+
+        for (i = 0; i < nr_jobs; i++) {
+            pfd[i].fd = slots[i].item ? slots[i].log_fd : -1;
+            pfd[i].events = POLLIN;
+            pfd[i].revents = 0;
+        }
+        if (poll(pfd, nr_jobs, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            err(1, "poll");
+        }
+
+        for (i = 0; i < nr_jobs; i++) {
+            if (!pfd[i].revents || (read_log(&slots[i]) == 0))
+                continue;
+            finish_item(&slots[i]);
+            nr_active--;
+        }
+    }
+
+    memfree(pfd);
+    memfree(slots);
+
+    if (stats != NULL) {
+        sched_save(stats, specs, spec_lists, nr_specs);
+        memfree(specs);
+        memfree(spec_lists);
+    }
+    if (batch.summary != stdout)
+        fclose(batch.summary);
+
+    if (!quiet)
+        printf("%u images in %.1f seconds: %u ok, %u damaged, %u failed, "
+               "%u up to date\n", batch.nr_items, now() - t, batch.nr_ok,
+               batch.nr_damaged, batch.nr_failed, batch.nr_skipped);
+
+    return batch.nr_failed ? 1 : 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -1,14 +1,63 @@
 #ifndef __MFMPARSE_COMMON_H__
 #define __MFMPARSE_COMMON_H__
 
-struct format_list {
-    uint16_t nr, max, pos;
-    uint16_t ent[1];
+#include <common/config.h>
+
+struct analyse_result {
+    unsigned int nr_bad;     /* damaged or unidentified tracks */
+    unsigned int nr_probes;  /* formats tried */
+    double expected_probes;  /* formats we expected to try */
+    unsigned int nr_pll_wins[3]; /* -p auto: tracks won by each PLL mode */
+};
+extern void analyse_image(
+    char *in, char *out, struct format_list **format_lists,
+    struct analyse_result *res);
+
+/* Adaptive ordering of each track's candidate formats. */
+struct sched_delta {
+    uint16_t list, ent;
+    uint32_t attempts, successes;
+    uint64_t reject_ns, accept_ns;
 };
+extern uint64_t sched_now_ns(void);
+/* Fills @order with @list's entries in the order to try them. Returns the 
+ * expected number of formats tried before one succeeds. */
+extern double sched_order(struct format_list *list, uint16_t *order);
+extern void sched_update(
+    struct format_list *list, unsigned int ent, bool_t success, uint64_t ns);
+extern unsigned int sched_lists(
+    struct format_list **format_lists, struct format_list **lists);
+/* Statistics gathered in a batch worker are passed back to the parent as the 
+ * difference from a snapshot taken before the image was analysed. */
+extern void sched_snapshot(
+    struct format_list **format_lists, struct sched_delta **p_snap,
+    unsigned int *p_nr);
+extern void sched_diff(
+    struct format_list **format_lists, struct sched_delta *snap,
+    unsigned int nr);
+extern void sched_merge(
+    struct format_list **format_lists, const struct sched_delta *delta,
+    unsigned int nr);
+extern void sched_load(
+    const char *name, const char **specs,
+    struct format_list ***format_lists, unsigned int nr_specs);
+extern void sched_save(
+    const char *name, const char **specs,
+    struct format_list ***format_lists, unsigned int nr_specs);
+
+struct stream_profile;
+extern const char *pll_mode_name(unsigned int mode);
+/* Mark the last accepted attempt on @tracknr as the result kept. */
+extern void profile_select(struct stream_profile *prof, unsigned int tracknr);
+extern void profile_report(
+    const char *name, const char *image, const struct stream_profile *prof);
 
-extern struct format_list **parse_config(char *config, char *specifier);
+extern int run_batch(
+    const char *src, const char *out_dir, char *config, char *format,
+    const char *out_type, unsigned int nr_jobs, const char *summary,
+    const char *stats);
 
-extern int quiet, verbose;
+extern int quiet;
 
 #endif /* __MFMPARSE_COMMON_H__ */
 
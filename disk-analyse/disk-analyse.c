@@ -27,27 +27,56 @@
 int quiet, verbose;
 static int index_align;
 static enum pll_mode pll_mode = PLL_default;
+static bool_t pll_auto, histogram;
+
+/* PLL modes tried by -p auto, in order of preference. */
+static const enum pll_mode auto_modes[] = {
+    PLL_authentic, PLL_variable_clock, PLL_fixed_clock
+};
 static struct format_list **format_lists;
-static char *in, *out;
+static char *in, *out, *profile;
 
 static void usage(int rc)
 {
     printf("Usage: disk-analyse [options] in_file out_file\n");
+    printf("       disk-analyse [options] -B in_dir|manifest out_dir\n");
     printf("Options:\n");
     printf("  -h, --help    Display this information\n");
     printf("  -q, --quiet   Quiesce normal informational output\n");
     printf("  -v, --verbose Print extra diagnostic info\n");
     printf("  -i, --index-align   Align all track starts near index mark\n");
-    printf("  -p, --pll=MODE      MODE={fixed,variable,authentic}\n");
+    printf("  -p, --pll=MODE      MODE={fixed,variable,authentic,auto}\n");
     printf("  -f, --format=FORMAT Name of format descriptor in config file\n");
     printf("  -c, --config=FILE   Config file to parse for format info\n");
+    printf("  -S, --stats=FILE    Load and save format statistics, which "
+           "decide the\n");
+    printf("                      order in which formats are tried\n");
+    printf("  -P, --profile=FILE  Write a profile of format handler "
+           "attempts, as\n");
+    printf("                      CSV or (for *.json) JSON\n");
+    printf("  -H, --histogram     Print each track's flux histogram and "
+           "estimated\n");
+    printf("                      encoding\n");
+    printf("  -C, --cache=DIR     Cache track analyses in DIR, so that "
+           "unchanged\n");
+    printf("                      tracks are not decoded again\n");
+    printf("Batch mode:\n");
+    printf("  -B, --batch         Analyse every image in a directory, or "
+           "listed in\n");
+    printf("                      a manifest (lines: in_file[\\tformat"
+           "[\\tout_file]])\n");
+    printf("  -j, --jobs=N        Images to analyse in parallel (nr CPUs)\n");
+    printf("  -t, --type=SUFFIX   Output file type (dsk)\n");
+    printf("  -s, --summary=FILE  Summary table (out_dir/summary.tsv)\n");
     printf("Supported file formats (suffix => type):\n");
     printf("  .adf  => ADF\n");
     printf("  .eadf => Extended-ADF\n");
     printf("  .img  => IBM-MFM Sector Dump\n");
     printf("  .ipf  => SPS/IPF\n");
     printf("  .dsk  => Libdisk\n");
+    printf("  .dskm => Libdisk manifest (track data in $LIBDISK_STORE)\n");
     printf("  .scp  => Supercard Pro\n");
+    printf("  .ldf  => Libdisk flux archive (from any flux image)\n");
     printf("Read-only support:\n");
     printf("  .dat  => Diskread\n");
     printf("  .dfi  => DiscFerret DFE2\n");
@@ -85,18 +114,189 @@ static void dump_track_list(struct disk_info *di)
     printf("%u: %s\n", i-1, prev_name);
 }
 
-static void handle_stream(void)
+static unsigned int nr_valid_sectors(struct track_info *ti)
+{
+    unsigned int i, nr = 0;
+    for (i = 0; i < ti->nr_sectors; i++)
+        if (is_valid_sector(ti, i))
+            nr++;
+    return nr;
+}
+
+/* Try the formats of @list, in @order, until one decodes the track. Each 
+ * attempt's duration is stored in @ns. Returns the number of formats tried; 
+ * *@p_rc is zero if the last of them succeeded. */
+static unsigned int try_formats(
+    struct disk *d, struct stream *s, unsigned int tracknr,
+    struct format_list *list, const uint16_t *order, uint64_t *ns,
+    int *p_rc)
+{
+    unsigned int j = 0;
+    uint64_t t;
+    int rc = -1;
+
+    while (j < list->nr) {
+        t = sched_now_ns();
+        rc = track_write_raw_from_stream(d, tracknr, list->ent[order[j]], s);
+        ns[j++] = sched_now_ns() - t;
+        if (rc == 0)
+            break;
+    }
+
+    *p_rc = rc;
+    return j;
+}
+
+/* Feed the attempts which produced a track's result to the scheduler. */
+static void record_probes(
+    struct format_list *list, unsigned int tracknr, const uint16_t *order,
+    const uint64_t *ns, unsigned int nr, int rc, double expected,
+    struct analyse_result *res)
+{
+    unsigned int j;
+
+    for (j = 0; j < nr; j++)
+        sched_update(list, order[j], (rc == 0) && (j == nr - 1), ns[j]);
+
+    res->nr_probes += nr;
+    res->expected_probes += expected;
+    if (verbose)
+        printf("T%u: %u formats tried (%.1f expected)\n", tracknr,
+               nr, expected);
+}
+
+/* Try each format in @list until one decodes the track. */
+static int decode_track(
+    struct disk *d, struct stream *s, unsigned int tracknr,
+    struct format_list *list, struct analyse_result *res)
+{
+    uint16_t order[list->nr];
+    uint64_t ns[list->nr];
+    unsigned int nr;
+    double expected;
+    int rc;
+
+    expected = sched_order(list, order);
+    nr = try_formats(d, s, tracknr, list, order, ns, &rc);
+    record_probes(list, tracknr, order, ns, nr, rc, expected, res);
+
+    return rc;
+}
+
+/* Decode the track under each PLL mode, and keep the result with the most
+ * valid sectors. A mode which recovers every sector is not bettered, so
+ * later modes are tried only for marginal tracks. Only the attempts of the 
+ * kept mode (or, if all fail, of the first) count towards the statistics. */
+static int decode_track_auto(
+    struct disk *d, struct stream *s, unsigned int tracknr,
+    struct format_list *list, struct analyse_result *res)
+{
+    struct track_info *ti = &disk_get_info(d)->track[tracknr];
+    enum pll_mode mode = PLL_default, best_mode = PLL_default;
+    uint16_t order[list->nr];
+    uint64_t ns[list->nr], best_ns[list->nr];
+    unsigned int m, nr_tried, best_tried = 0, best_type = 0;
+    double expected;
+    int rc, nr, best = -1;
+
+    expected = sched_order(list, order);
+    for (m = 0; m < ARRAY_SIZE(auto_modes); m++) {
+        stream_pll_mode(s, mode = auto_modes[m]);
+        nr_tried = try_formats(d, s, tracknr, list, order, ns, &rc);
+        if (rc != 0) {
+            if (m == 0) {
+                memcpy(best_ns, ns, nr_tried * sizeof(*ns));
+                best_tried = nr_tried;
+            }
+            continue;
+        }
+        if ((nr = nr_valid_sectors(ti)) > best) {
+            best = nr;
+            best_mode = mode;
+            best_type = ti->type;
+            memcpy(best_ns, ns, nr_tried * sizeof(*ns));
+            best_tried = nr_tried;
+        }
+        if (nr == ti->nr_sectors)
+            break;
+    }
+
+    record_probes(list, tracknr, order, best_ns, best_tried,
+                  (best < 0) ? -1 : 0, expected, res);
+    if (best < 0)
+        return -1;
+
+    /* Decoding is deterministic: redo the best if it has been replaced. */
+    if ((mode != best_mode) || (ti->type != best_type)) {
+        stream_pll_mode(s, best_mode);
+        if (track_write_raw_from_stream(d, tracknr, best_type, s) != 0)
+            return -1;
+    }
+
+    res->nr_pll_wins[best_mode]++;
+    if (verbose && (m != 0))
+        printf("T%u: PLL mode %s (%d/%u sectors)\n", tracknr,
+               pll_mode_name(best_mode), best, ti->nr_sectors);
+
+    return 0;
+}
+
+/* Histogram rows, in units of flux histogram bins, and maximum bar width. */
+#define HIST_ROW_BINS 5
+#define HIST_BAR      50
+
+static void print_histogram(struct stream *s, unsigned int tracknr)
+{
+    const struct stream_flux_info *fi;
+    uint32_t row[FLUX_HIST_BINS / HIST_ROW_BINS], max = 0;
+    unsigned int i, first = ~0u, last = 0;
+
+    if (stream_select_track(s, tracknr) != 0)
+        return;
+    if ((fi = stream_flux_info(s)) == NULL) {
+        printf("T%u: No flux histogram for this stream type\n", tracknr);
+        return;
+    }
+
+    printf("T%u: %s, %u ns/cell, %u%% of %u intervals explained%s\n",
+           tracknr, stream_flux_encoding_name(fi->encoding),
+           fi->ns_per_cell, fi->explained, fi->nr_samples,
+           fi->confident ? "" : " (not confident)");
+
+    memset(row, 0, sizeof(row));
+    for (i = 0; i < FLUX_HIST_BINS; i++)
+        row[i / HIST_ROW_BINS] += fi->hist[i];
+    for (i = 0; i < ARRAY_SIZE(row); i++) {
+        if (row[i] <= fi->nr_samples / 1000)
+            continue;
+        first = min(first, i);
+        last = i;
+        max = max(max, row[i]);
+    }
+
+    for (i = first; i <= last; i++)
+        printf("  %5.2fus %6u%s%.*s\n",
+               (i * HIST_ROW_BINS * FLUX_HIST_NS_PER_BIN) / 1000.0, row[i],
+               row[i] ? " " : "",
+               (int)(((uint64_t)row[i] * HIST_BAR + max - 1) / max),
+               "##################################################");
+}
+
+static void handle_stream(struct analyse_result *res)
 {
     struct stream *s;
     struct disk *d;
     struct disk_info *di;
     struct track_info *ti;
     unsigned int i, unidentified = 0;
+    int rc;
 
     if ((s = stream_open(in)) == NULL)
         errx(1, "Failed to probe input file: %s", in);
 
     stream_pll_mode(s, pll_mode);
+    if (profile)
+        stream_enable_profiling(s);
 
     if ((d = disk_create(out)) == NULL)
         errx(1, "Unable to create new disk file: %s", out);
@@ -105,23 +305,25 @@ static void handle_stream(void)
 
     for (i = 0; i < di->nr_tracks; i++) {
         struct format_list *list = format_lists[i];
-        unsigned int j;
         if (list == NULL)
             continue;
-        for (j = 0; j < list->nr; j++) {
-            if (track_write_raw_from_stream(
-                    d, i, list->ent[list->pos], s) == 0)
-                break;
-            if (++list->pos >= list->nr)
-                list->pos = 0;
-        }
-        if ((j == list->nr) &&
+        stream_scan_budget(s, (list->budget == BUDGET_DEFAULT)
+                           ? STREAM_DEFAULT_BUDGET
+                           : (list->budget == BUDGET_NONE) ? 0
+                           : list->budget);
+        if (histogram)
+            print_histogram(s, i);
+        rc = pll_auto ? decode_track_auto(d, s, i, list, res)
+            : decode_track(d, s, i, list, res);
+        if ((rc != 0) &&
             (track_write_raw_from_stream(d, i, TRKTYP_unformatted, s) != 0)) {
             /* Tracks 160+ are expected to be unused. Don't warn about them. */
             if (i < 160)
                 unidentified++;
             else
                 track_mark_unformatted(d, i);
+        } else if (profile) {
+            profile_select(s->prof, i);
         }
     }
 
@@ -145,11 +347,40 @@ static void handle_stream(void)
 
     dump_track_list(di);
 
+    if (verbose)
+        printf("%u formats tried (%.1f expected)\n",
+               res->nr_probes, res->expected_probes);
+    if (pll_auto && !quiet) {
+        printf("PLL modes chosen:");
+        for (i = 0; i < ARRAY_SIZE(auto_modes); i++)
+            printf(" %s %u%s", pll_mode_name(auto_modes[i]),
+                   res->nr_pll_wins[auto_modes[i]],
+                   (i == ARRAY_SIZE(auto_modes) - 1) ? "\n" : ",");
+    }
+
     if (unidentified)
         fprintf(stderr,"** WARNING: %u tracks are damaged or unidentified!\n",
                 unidentified);
 
     disk_close(d);
+    if (profile)
+        profile_report(profile, in, s->prof);
+    stream_close(s);
+
+    res->nr_bad = unidentified;
+}
+
+/* Archive the input's flux: no decoding is done. */
+static void handle_flux(void)
+{
+    struct stream *s;
+
+    if ((s = stream_open(in)) == NULL)
+        errx(1, "Failed to probe input file: %s", in);
+
+    if (stream_write_ldf(s, out, NR_TRACKS) != 0)
+        errx(1, "%s: Not a flux image", in);
+
     stream_close(s);
 }
 
@@ -204,12 +435,44 @@ static void handle_img(void)
     track_free_sector_buffer(sectors);
 }
 
+static bool_t has_suffix(const char *name, const char *suffix)
+{
+    const char *p = strrchr(name, '.');
+    return (p != NULL) && !strcmp(p+1, suffix);
+}
+
+/* Is @in copied to @out as a flux archive? Then no track is decoded. */
+static bool_t is_flux_copy(const char *in, const char *out)
+{
+    return !has_suffix(in, "img") && has_suffix(out, "ldf");
+}
+
+void analyse_image(
+    char *_in, char *_out, struct format_list **_format_lists,
+    struct analyse_result *res)
+{
+    in = _in;
+    out = _out;
+    format_lists = _format_lists;
+    memset(res, 0, sizeof(*res));
+
+    if (has_suffix(in, "img"))
+        handle_img();
+    else if (is_flux_copy(in, out))
+        handle_flux();
+    else
+        handle_stream(res);
+}
+
 int main(int argc, char **argv)
 {
-    char *p, *config = NULL, *format = NULL;
-    int ch;
+    char *config = NULL, *format = NULL;
+    char *out_type = "dsk", *summary = NULL, *stats = NULL;
+    struct format_list **lists;
+    struct analyse_result res;
+    int ch, batch = 0, nr_jobs = 0;
 
-    const static char sopts[] = "hqvip:f:c:";
+    const static char sopts[] = "hqvip:f:c:S:P:HC:Bj:t:s:";
     const static struct option lopts[] = {
         { "help", 0, NULL, 'h' },
         { "quiet", 0, NULL, 'q' },
@@ -218,6 +481,14 @@ int main(int argc, char **argv)
         { "pll", 1, NULL, 'p' },
         { "format", 1, NULL, 'f' },
         { "config",  1, NULL, 'c' },
+        { "stats", 1, NULL, 'S' },
+        { "profile", 1, NULL, 'P' },
+        { "histogram", 0, NULL, 'H' },
+        { "cache", 1, NULL, 'C' },
+        { "batch", 0, NULL, 'B' },
+        { "jobs", 1, NULL, 'j' },
+        { "type", 1, NULL, 't' },
+        { "summary", 1, NULL, 's' },
         { 0, 0, 0, 0}
     };
 
@@ -242,6 +513,8 @@ int main(int argc, char **argv)
                 pll_mode = PLL_variable_clock;
             else if (!strcmp(optarg, "authentic"))
                 pll_mode = PLL_authentic;
+            else if (!strcmp(optarg, "auto"))
+                pll_auto = 1;
             else {
                 warnx("Unrecognised PLL mode '%s'", optarg);
                 usage(1);
@@ -253,6 +526,30 @@ int main(int argc, char **argv)
         case 'c':
             config = optarg;
             break;
+        case 'S':
+            stats = optarg;
+            break;
+        case 'P':
+            profile = optarg;
+            break;
+        case 'H':
+            histogram = 1;
+            break;
+        case 'C':
+            disk_set_cache_dir(optarg);
+            break;
+        case 'B':
+            batch = 1;
+            break;
+        case 'j':
+            nr_jobs = atoi(optarg);
+            break;
+        case 't':
+            out_type = optarg;
+            break;
+        case 's':
+            summary = optarg;
+            break;
         default:
             usage(1);
             break;
@@ -262,15 +559,31 @@ int main(int argc, char **argv)
     if (argc != (optind + 2))
         usage(1);
 
-    in = argv[optind];
-    out = argv[optind+1];
+    if (batch) {
+        if (profile)
+            errx(1, "--profile is not supported in batch mode");
+        if (nr_jobs <= 0)
+            nr_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+        return run_batch(argv[optind], argv[optind+1], config, format,
+                         out_type, (nr_jobs > 0) ? nr_jobs : 1, summary,
+                         stats);
+    }
 
-    format_lists = parse_config(config, format);
+    if (is_flux_copy(argv[optind], argv[optind+1])) {
+        analyse_image(argv[optind], argv[optind+1], NULL, &res);
+        return 0;
+    }
 
-    if (((p = strrchr(in, '.')) != NULL) && !strcmp(p+1, "img"))
-        handle_img();
-    else
-        handle_stream();
+    if (format == NULL)
+        format = "default";
+    lists = parse_config(config, format);
+    if (stats)
+        sched_load(stats, (const char **)&format, &lists, 1);
+
+    analyse_image(argv[optind], argv[optind+1], lists, &res);
+
+    if (stats)
+        sched_save(stats, (const char **)&format, &lists, 1);
 
     return 0;
 }
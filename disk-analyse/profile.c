@@ -0,0 +1,205 @@
+/*
+ * disk-analyse/profile.c
+ * 
+ * Report where analysis time goes: one record per attempt to decode a track
+ * with a format handler, written as CSV or (for a .json suffix) JSON, and a
+ * summary table of the most expensive handlers.
+ * 
+ * Times are in microseconds. Stream-layer times (bit_us, flux_us) are
+ * estimated by sampling, and are included in the attempt's total time.
+ * 
+ * Written in 2026 by agent
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdisk/stream.h>
+#include <libdisk/disk.h>
+#include <libdisk/util.h>
+
+#include "common.h"
+
+/* Number of handlers listed in the summary table. */
+#define NR_SLOWEST 10
+
+struct handler_cost {
+    uint16_t type;
+    unsigned int attempts, accepted;
+    uint64_t ns, reject_ns, bits;
+};
+
+#define us(ns) ((unsigned long long)(ns) / 1000)
+
+const char *pll_mode_name(unsigned int mode)
+{
+    static const char *const names[] = {
+        [PLL_fixed_clock] = "fixed",
+        [PLL_variable_clock] = "variable",
+        [PLL_authentic] = "authentic"
+    };
+    return (mode < ARRAY_SIZE(names)) ? names[mode] : "unknown";
+}
+
+void profile_select(struct stream_profile *prof, unsigned int tracknr)
+{
+    unsigned int i = prof->nr_rec;
+
+    while (i--) {
+        if ((prof->rec[i].tracknr == tracknr) && prof->rec[i].accepted) {
+            prof->rec[i].selected = 1;
+            break;
+        }
+    }
+}
+
+static void write_csv(FILE *f, const struct stream_profile *prof)
+{
+    const struct stream_profile_record *r;
+    unsigned int i;
+
+    fprintf(f, "track,format,pll,accepted,selected,us,io_us,bit_us,flux_us,"
+            "bits,flux,resets,revs\n");
+    for (i = 0; i < prof->nr_rec; i++) {
+        r = &prof->rec[i];
+        fprintf(f, "%u,%s,%s,%u,%u,%llu,%llu,%llu,%llu,%llu,%llu,%u,%u\n",
+                r->tracknr, disk_get_format_id_name(r->type),
+                pll_mode_name(r->pll_mode), r->accepted, r->selected,
+                us(r->ns), us(r->io_ns), us(r->bit_ns), us(r->flux_ns),
+                (unsigned long long)r->bits, (unsigned long long)r->flux,
+                r->resets, r->revs);
+    }
+}
+
+static void write_json_str(FILE *f, const char *str)
+{
+    const unsigned char *p;
+
+    putc('"', f);
+    for (p = (const unsigned char *)str; *p; p++) {
+        if ((*p == '"') || (*p == '\\'))
+            fprintf(f, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(f, "\\u%04x", *p);
+        else
+            putc(*p, f);
+    }
+    putc('"', f);
+}
+
+static void write_json(
+    FILE *f, const char *image, const struct stream_profile *prof)
+{
+    const struct stream_profile_record *r;
+    unsigned int i;
+
+    fprintf(f, "{\n  \"image\": ");
+    write_json_str(f, image);
+    fprintf(f, ",\n  \"attempts\": [");
+
+    for (i = 0; i < prof->nr_rec; i++) {
+        r = &prof->rec[i];
+        fprintf(f, "%s\n    { \"track\": %u, \"format\": ",
+                i ? "," : "", r->tracknr);
+        write_json_str(f, disk_get_format_id_name(r->type));
+        fprintf(f, ", \"pll\": \"%s\", \"accepted\": %s, \"selected\": %s, "
+                "\"us\": %llu, \"io_us\": %llu, "
+                "\"bit_us\": %llu, \"flux_us\": %llu, \"bits\": %llu, "
+                "\"flux\": %llu, \"resets\": %u, \"revs\": %u }",
+                pll_mode_name(r->pll_mode), r->accepted ? "true" : "false",
+                r->selected ? "true" : "false",
+                us(r->ns), us(r->io_ns), us(r->bit_ns), us(r->flux_ns),
+                (unsigned long long)r->bits, (unsigned long long)r->flux,
+                r->resets, r->revs);
+    }
+
+    fprintf(f, "\n  ]\n}\n");
+}
+
+static int cmp_cost(const void *a, const void *b)
+{
+    const struct handler_cost *x = a, *y = b;
+    return (x->ns < y->ns) ? 1 : (x->ns > y->ns) ? -1 : 0;
+}
+
+static void print_summary(const struct stream_profile *prof)
+{
+    const struct stream_profile_record *r;
+    struct handler_cost *cost, *c;
+    unsigned int i, j, nr = 0;
+    uint64_t total_ns = 0;
+
+    cost = memalloc((prof->nr_rec ? : 1) * sizeof(*cost));
+    for (i = 0; i < prof->nr_rec; i++) {
+        r = &prof->rec[i];
+        for (j = 0; j < nr; j++)
+            if (cost[j].type == r->type)
+                break;
+        c = &cost[j];
+        if (j == nr) {
+            c->type = r->type;
+            nr++;
+        }
+        c->attempts++;
+        c->ns += r->ns;
+        c->bits += r->bits;
+        if (r->accepted)
+            c->accepted++;
+        else
+            c->reject_ns += r->ns;
+        total_ns += r->ns;
+    }
+
+    qsort(cost, nr, sizeof(*cost), cmp_cost);
+
+    printf("Slowest formats (of %u tried, %.1f ms in total):\n",
+           nr, total_ns / 1e6);
+    printf("  %-24s %8s %8s %10s %6s %12s %10s\n", "format", "attempts",
+           "accepted", "total ms", "%", "reject ms", "bits");
+    for (i = 0; i < min_t(unsigned int, nr, NR_SLOWEST); i++) {
+        c = &cost[i];
+        printf("  %-24s %8u %8u %10.1f %6.1f %12.2f %10llu\n",
+               disk_get_format_id_name(c->type), c->attempts, c->accepted,
+               c->ns / 1e6, total_ns ? (c->ns * 100.0) / total_ns : 0.0,
+               (c->attempts > c->accepted)
+               ? c->reject_ns / 1e6 / (c->attempts - c->accepted) : 0.0,
+               (unsigned long long)(c->bits / c->attempts));
+    }
+    printf("  (reject ms: mean per rejection; bits: mean per attempt)\n");
+    printf("Stream layer: %.1f ms track I/O, %.1f ms producing bitcells "
+           "(of which\n  %.1f ms parsing flux)\n", prof->io_ns / 1e6,
+           prof->bit_ns / 1e6, prof->flux_ns / 1e6);
+
+    memfree(cost);
+}
+
+void profile_report(
+    const char *name, const char *image, const struct stream_profile *prof)
+{
+    const char *p = strrchr(name, '.');
+    FILE *f;
+
+    if ((f = fopen(name, "w")) == NULL)
+        err(1, "%s", name);
+    if ((p != NULL) && !strcmp(p, ".json"))
+        write_json(f, image, prof);
+    else
+        write_csv(f, prof);
+    if (fclose(f) != 0)
+        err(1, "%s", name);
+
+    if (!quiet)
+        print_summary(prof);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,337 @@
+/*
+ * disk-analyse/sched.c
+ * 
+ * Choose the order in which a track's candidate formats are tried.
+ * 
+ * Each format list (that is, each track range of a format specifier) keeps
+ * per-format statistics: how often the format has been tried, how often it
+ * succeeded, and how long it took to accept or reject a track. The format
+ * which last succeeded on the list is tried first, as neighbouring tracks
+ * are very likely to share a format. The rest are tried in decreasing order
+ * of p/c, where p is the estimated probability of success and c the mean
+ * cost of a rejection: for independent candidates this ordering minimises
+ * the expected time to find the right format.
+ * 
+ * Statistics may be saved to, and primed from, a file so that they persist
+ * across runs and batches.
+ * 
+ * Written in 2026 by agent
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libdisk/disk.h>
+#include <libdisk/util.h>
+
+#include "common.h"
+
+struct handler_stats {
+    uint32_t attempts, successes;
+    uint64_t reject_ns, accept_ns;
+};
+
+static struct handler_stats *get_stats(struct format_list *list)
+{
+    if (list->stats == NULL)
+        list->stats = memalloc(list->nr * sizeof(*list->stats));
+    return list->stats;
+}
+
+/* Success probability, with a uniform prior (Laplace's rule). */
+static double p_success(const struct handler_stats *st)
+{
+    return (st->successes + 1.0) / (st->attempts + 2.0);
+}
+
+uint64_t sched_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+double sched_order(struct format_list *list, uint16_t *order)
+{
+    struct handler_stats *st = get_stats(list);
+    unsigned int i, j, nr_rejects = 0, nr = 0;
+    double score[list->nr], cost, mean_cost, expected, p_reach;
+    uint64_t total_ns = 0;
+
+    /* Rejection cost of untried formats is taken as the list average. */
+    for (i = 0; i < list->nr; i++) {
+        nr_rejects += st[i].attempts - st[i].successes;
+        total_ns += st[i].reject_ns;
+    }
+    mean_cost = nr_rejects ? (double)total_ns / nr_rejects : 1.0;
+
+    order[nr++] = list->pos;
+    for (i = 0; i < list->nr; i++) {
+        if (i == list->pos)
+            continue;
+        cost = (st[i].attempts > st[i].successes)
+            ? (double)st[i].reject_ns / (st[i].attempts - st[i].successes)
+            : mean_cost;
+        score[i] = p_success(&st[i]) / (cost ? : 1.0);
+        /* Insertion sort: lists are short. Ties keep config order. */
+        for (j = nr; (j > 1) && (score[order[j-1]] < score[i]); j--)
+            order[j] = order[j-1];
+        order[j] = i;
+        nr++;
+    }
+
+    /* Expected number of formats tried before one succeeds. */
+    for (i = 0, expected = 0, p_reach = 1; i < list->nr; i++) {
+        expected += p_reach;
+        p_reach *= 1 - p_success(&st[order[i]]);
+    }
+
+    return expected;
+}
+
+void sched_update(
+    struct format_list *list, unsigned int ent, bool_t success, uint64_t ns)
+{
+    struct handler_stats *st = &get_stats(list)[ent];
+
+    st->attempts++;
+    if (success) {
+        st->successes++;
+        st->accept_ns += ns;
+        list->pos = ent;
+    } else {
+        st->reject_ns += ns;
+    }
+}
+
+/* Distinct format lists of a specifier, in track order. */
+unsigned int sched_lists(
+    struct format_list **format_lists, struct format_list **lists)
+{
+    unsigned int i, j, nr = 0;
+
+    for (i = 0; i < NR_TRACKS; i++) {
+        if (format_lists[i] == NULL)
+            continue;
+        for (j = 0; j < nr; j++)
+            if (lists[j] == format_lists[i])
+                break;
+        if (j == nr)
+            lists[nr++] = format_lists[i];
+    }
+
+    return nr;
+}
+
+void sched_snapshot(
+    struct format_list **format_lists, struct sched_delta **p_snap,
+    unsigned int *p_nr)
+{
+    struct format_list *lists[NR_TRACKS];
+    struct sched_delta *snap;
+    struct handler_stats *st;
+    unsigned int i, j, nr, nr_lists;
+
+    nr_lists = sched_lists(format_lists, lists);
+    for (i = nr = 0; i < nr_lists; i++)
+        nr += lists[i]->nr;
+
+    snap = memalloc(nr * sizeof(*snap));
+    for (i = nr = 0; i < nr_lists; i++) {
+        st = get_stats(lists[i]);
+        for (j = 0; j < lists[i]->nr; j++, nr++) {
+            snap[nr].list = i;
+            snap[nr].ent = j;
+            snap[nr].attempts = st[j].attempts;
+            snap[nr].successes = st[j].successes;
+            snap[nr].reject_ns = st[j].reject_ns;
+            snap[nr].accept_ns = st[j].accept_ns;
+        }
+    }
+
+    *p_snap = snap;
+    *p_nr = nr;
+}
+
+void sched_diff(
+    struct format_list **format_lists, struct sched_delta *snap,
+    unsigned int nr)
+{
+    struct format_list *lists[NR_TRACKS];
+    struct handler_stats *st;
+    unsigned int i;
+
+    sched_lists(format_lists, lists);
+    for (i = 0; i < nr; i++) {
+        st = &get_stats(lists[snap[i].list])[snap[i].ent];
+        snap[i].attempts = st->attempts - snap[i].attempts;
+        snap[i].successes = st->successes - snap[i].successes;
+        snap[i].reject_ns = st->reject_ns - snap[i].reject_ns;
+        snap[i].accept_ns = st->accept_ns - snap[i].accept_ns;
+    }
+}
+
+void sched_merge(
+    struct format_list **format_lists, const struct sched_delta *delta,
+    unsigned int nr)
+{
+    struct format_list *lists[NR_TRACKS];
+    struct handler_stats *st;
+    unsigned int i, nr_lists;
+
+    nr_lists = sched_lists(format_lists, lists);
+    for (i = 0; i < nr; i++) {
+        if ((delta[i].list >= nr_lists) ||
+            (delta[i].ent >= lists[delta[i].list]->nr))
+            continue;
+        st = &get_stats(lists[delta[i].list])[delta[i].ent];
+        st->attempts += delta[i].attempts;
+        st->successes += delta[i].successes;
+        st->reject_ns += delta[i].reject_ns;
+        st->accept_ns += delta[i].accept_ns;
+    }
+}
+
+/*
+ * Statistics file: one line per format of each list, tab-separated:
+ *  specifier, list number, format name, attempts, successes,
+ *  total reject time (us), total accept time (us)
+ * Lines for specifiers not used in this run are preserved on save.
+ */
+
+static struct sched_file {
+    char **other; /* lines for other specifiers */
+    unsigned int nr_other;
+} sched_file;
+
+static void keep_line(const char *line)
+{
+    size_t len = strcspn(line, "\r\n");
+    char **p;
+
+    if ((sched_file.nr_other & (sched_file.nr_other - 1)) == 0) {
+        p = memalloc((sched_file.nr_other ? sched_file.nr_other * 2 : 1)
+                     * sizeof(*p));
+        memcpy(p, sched_file.other, sched_file.nr_other * sizeof(*p));
+        memfree(sched_file.other);
+        sched_file.other = p;
+    }
+
+    p = &sched_file.other[sched_file.nr_other++];
+    *p = memalloc(len + 1);
+    memcpy(*p, line, len);
+}
+
+static void load_stats(
+    struct format_list **format_lists, unsigned int list_no, const char *fmt,
+    unsigned int attempts, unsigned int successes,
+    unsigned long long reject_us, unsigned long long accept_us)
+{
+    struct format_list *lists[NR_TRACKS];
+    struct handler_stats *st;
+    unsigned int i;
+
+    if (list_no >= sched_lists(format_lists, lists))
+        return;
+
+    for (i = 0; i < lists[list_no]->nr; i++)
+        if (!strcmp(disk_get_format_id_name(lists[list_no]->ent[i]), fmt))
+            break;
+    if (i == lists[list_no]->nr)
+        return;
+
+    st = &get_stats(lists[list_no])[i];
+    st->attempts = attempts;
+    st->successes = successes;
+    st->reject_ns = reject_us * 1000;
+    st->accept_ns = accept_us * 1000;
+}
+
+void sched_load(
+    const char *name, const char **specs,
+    struct format_list ***format_lists, unsigned int nr_specs)
+{
+    char line[512], spec[256], fmt[128];
+    unsigned int i, list_no, attempts, successes;
+    unsigned long long reject_us, accept_us;
+    FILE *f;
+
+    if ((f = fopen(name, "r")) == NULL)
+        return;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if ((sscanf(line, "%255[^\t]\t%u\t%127[^\t]\t%u\t%u\t%llu\t%llu",
+                    spec, &list_no, fmt, &attempts, &successes,
+                    &reject_us, &accept_us) != 7) ||
+            (successes > attempts))
+            continue;
+        for (i = 0; i < nr_specs; i++)
+            if (!strcmp(specs[i], spec))
+                break;
+        if (i == nr_specs)
+            keep_line(line);
+        else
+            load_stats(format_lists[i], list_no, fmt, attempts, successes,
+                       reject_us, accept_us);
+    }
+
+    fclose(f);
+}
+
+static void save_spec(
+    FILE *f, const char *spec, struct format_list **format_lists)
+{
+    struct format_list *lists[NR_TRACKS];
+    struct handler_stats *st;
+    unsigned int i, j, nr_lists;
+
+    nr_lists = sched_lists(format_lists, lists);
+    for (i = 0; i < nr_lists; i++) {
+        st = get_stats(lists[i]);
+        for (j = 0; j < lists[i]->nr; j++) {
+            if (st[j].attempts == 0)
+                continue;
+            fprintf(f, "%s\t%u\t%s\t%u\t%u\t%llu\t%llu\n", spec, i,
+                    disk_get_format_id_name(lists[i]->ent[j]),
+                    st[j].attempts, st[j].successes,
+                    (unsigned long long)st[j].reject_ns / 1000,
+                    (unsigned long long)st[j].accept_ns / 1000);
+        }
+    }
+}
+
+void sched_save(
+    const char *name, const char **specs,
+    struct format_list ***format_lists, unsigned int nr_specs)
+{
+    unsigned int i;
+    char *tmp;
+    FILE *f;
+
+    tmp = memalloc(strlen(name) + 8);
+    sprintf(tmp, "%s.new", name);
+    if ((f = fopen(tmp, "w")) == NULL)
+        err(1, "%s", tmp);
+
+    for (i = 0; i < sched_file.nr_other; i++)
+        fprintf(f, "%s\n", sched_file.other[i]);
+    for (i = 0; i < nr_specs; i++)
+        save_spec(f, specs[i], format_lists[i]);
+
+    if ((fclose(f) != 0) || (rename(tmp, name) != 0))
+        err(1, "%s", name);
+    memfree(tmp);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
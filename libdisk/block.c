@@ -0,0 +1,241 @@
+/*
+ * libdisk/block.c
+ * 
+ * Random access to a disk's sectors as a linear array of logical blocks.
+ * Block @lba lives in sector (lba % spt) of track (lba / spt), where spt is
+ * the most common number of sectors per track on the disk.
+ * 
+ * Tracks are decoded whole, so a small LRU cache of decoded tracks is kept:
+ * filesystem walkers tend to visit a few neighbouring blocks at a time.
+ * Writes are buffered in the cache and re-encoded a track at a time when a
+ * dirty track is evicted, on disk_block_flush(), or on disk_close().
+ * 
+ * Written in 2026 by agent
+ */
+
+#include <libdisk/util.h>
+#include "private.h"
+
+#define NR_CACHED_TRACKS 8
+
+struct cached_track {
+    int tracknr;            /* -1: slot is empty */
+    uint16_t type;          /* track type to re-encode a dirty track as */
+    bool_t dirty;
+    uint32_t stamp;         /* last use, for LRU replacement */
+    uint8_t valid[8];       /* readable blocks: cf. track_info.valid_sectors */
+    uint8_t *dat;
+};
+
+struct block_cache {
+    unsigned int blocks_per_track, bytes_per_block, nr_blocks;
+    uint32_t stamp;
+    struct track_sectors *sectors;
+    struct cached_track track[NR_CACHED_TRACKS];
+};
+
+static struct block_cache *block_cache(struct disk *d)
+{
+    struct disk_info *di = d->di;
+    struct block_cache *bc;
+    unsigned int i, j, best = 0, count[256] = { 0 };
+
+    if (d->bcache != NULL)
+        return d->bcache;
+
+    /* Blocks per track: the most common layout of a sector-readable track. */
+    for (i = 0; i < di->nr_tracks; i++) {
+        if (handlers[di->track[i].type]->read_sectors == NULL)
+            continue;
+        j = min_t(unsigned int, di->track[i].nr_sectors, 255);
+        if (++count[j] > count[best])
+            best = j;
+    }
+
+    bc = memalloc(sizeof(*bc));
+    bc->sectors = track_alloc_sector_buffer(d);
+    for (i = 0; i < NR_CACHED_TRACKS; i++)
+        bc->track[i].tracknr = -1;
+
+    /* Block size: from the first track of that layout which decodes. */
+    for (i = 0; (best != 0) && (i < di->nr_tracks); i++) {
+        if ((di->track[i].nr_sectors != best) ||
+            (track_read_sectors(bc->sectors, i) != 0))
+            continue;
+        bc->blocks_per_track = best;
+        bc->bytes_per_block = bc->sectors->nr_bytes / best;
+        bc->nr_blocks = di->nr_tracks * best;
+        break;
+    }
+
+    track_purge_sector_buffer(bc->sectors);
+    return d->bcache = bc;
+}
+
+static int write_back(struct disk *d, struct cached_track *ct)
+{
+    struct block_cache *bc = d->bcache;
+    struct track_info *ti = &d->di->track[ct->tracknr];
+    unsigned int i;
+    int rc;
+
+    if (!ct->dirty)
+        return 0;
+
+    bc->sectors->data = ct->dat;
+    bc->sectors->nr_bytes = bc->blocks_per_track * bc->bytes_per_block;
+    rc = track_write_sectors(bc->sectors, ct->tracknr, ct->type);
+    bc->sectors->data = NULL;
+    bc->sectors->nr_bytes = 0;
+    if (rc != 0) {
+        warnx("T%u: Failed to write back %s track", ct->tracknr,
+              disk_get_format_id_name(ct->type));
+        return -1;
+    }
+
+    /* Blocks which were never readable, nor written, stay unreadable. */
+    for (i = 0; i < bc->blocks_per_track; i++)
+        if (!(ct->valid[i>>3] & (0x80u >> (i & 7))))
+            set_sector_invalid(ti, i);
+
+    ct->dirty = 0;
+    return 0;
+}
+
+static struct cached_track *get_track(struct disk *d, unsigned int tracknr)
+{
+    struct block_cache *bc = d->bcache;
+    struct track_info *ti = &d->di->track[tracknr];
+    struct cached_track *ct, *lru = &bc->track[0];
+    unsigned int i;
+
+    for (i = 0; i < NR_CACHED_TRACKS; i++) {
+        ct = &bc->track[i];
+        if (ct->tracknr == tracknr)
+            goto out;
+        if ((ct->tracknr == -1) ? (lru->tracknr != -1)
+            : ((lru->tracknr != -1) && (ct->stamp < lru->stamp)))
+            lru = ct;
+    }
+
+    ct = lru;
+    if (ct->tracknr != -1) {
+        if (write_back(d, ct) != 0)
+            return NULL;
+        memfree(ct->dat);
+        ct->dat = NULL;
+        ct->tracknr = -1;
+    }
+
+    if ((ti->nr_sectors != bc->blocks_per_track) ||
+        (track_read_sectors(bc->sectors, tracknr) != 0))
+        return NULL;
+    if (bc->sectors->nr_bytes !=
+        bc->blocks_per_track * bc->bytes_per_block) {
+        track_purge_sector_buffer(bc->sectors);
+        return NULL;
+    }
+
+    ct->tracknr = tracknr;
+    ct->type = ti->type;
+    ct->dat = bc->sectors->data;
+    bc->sectors->data = NULL;
+    bc->sectors->nr_bytes = 0;
+    memset(ct->valid, 0, sizeof(ct->valid));
+    for (i = 0; i < bc->blocks_per_track; i++)
+        if (is_valid_sector(ti, i))
+            ct->valid[i>>3] |= 0x80u >> (i & 7);
+
+out:
+    ct->stamp = ++bc->stamp;
+    return ct;
+}
+
+unsigned int disk_block_count(struct disk *d, unsigned int *bytes_per_block)
+{
+    struct block_cache *bc = block_cache(d);
+
+    if (bytes_per_block != NULL)
+        *bytes_per_block = bc->bytes_per_block;
+    return bc->nr_blocks;
+}
+
+int disk_block_read(struct disk *d, unsigned int lba, void *buf)
+{
+    struct block_cache *bc = block_cache(d);
+    struct cached_track *ct;
+    unsigned int sec;
+
+    if ((lba >= bc->nr_blocks) ||
+        ((ct = get_track(d, lba / bc->blocks_per_track)) == NULL))
+        return -1;
+
+    sec = lba % bc->blocks_per_track;
+    if (!(ct->valid[sec>>3] & (0x80u >> (sec & 7))))
+        return -1;
+
+    memcpy(buf, ct->dat + sec * bc->bytes_per_block, bc->bytes_per_block);
+    return 0;
+}
+
+int disk_block_write(struct disk *d, unsigned int lba, const void *buf)
+{
+    struct block_cache *bc = block_cache(d);
+    struct cached_track *ct;
+    unsigned int sec;
+
+    if (d->read_only || (lba >= bc->nr_blocks) ||
+        ((ct = get_track(d, lba / bc->blocks_per_track)) == NULL) ||
+        (handlers[ct->type]->write_sectors == NULL))
+        return -1;
+
+    sec = lba % bc->blocks_per_track;
+    memcpy(ct->dat + sec * bc->bytes_per_block, buf, bc->bytes_per_block);
+    ct->valid[sec>>3] |= 0x80u >> (sec & 7);
+    ct->dirty = 1;
+    return 0;
+}
+
+int disk_block_flush(struct disk *d)
+{
+    struct block_cache *bc = d->bcache;
+    unsigned int i;
+    int rc = 0;
+
+    if (bc == NULL)
+        return 0;
+
+    for (i = 0; i < NR_CACHED_TRACKS; i++)
+        if ((bc->track[i].tracknr != -1) &&
+            (write_back(d, &bc->track[i]) != 0))
+            rc = -1;
+
+    return rc;
+}
+
+void block_cache_close(struct disk *d)
+{
+    struct block_cache *bc = d->bcache;
+    unsigned int i;
+
+    if (bc == NULL)
+        return;
+
+    (void)disk_block_flush(d);
+
+    for (i = 0; i < NR_CACHED_TRACKS; i++)
+        memfree(bc->track[i].dat);
+    track_free_sector_buffer(bc->sectors);
+    memfree(bc);
+    d->bcache = NULL;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,239 @@
+/*
+ * libdisk/cache.c
+ * 
+ * Persistent cache of track analyses. The outcome of decoding a track with
+ * a format handler is a function of the track's flux, the handler and its
+ * version, the stream's PLL mode and scan budget, and any disk tags set by
+ * earlier tracks. A hash of these keys an entry holding the outcome: either
+ * a rejection, or the accepted track data and the disk tags as they stood
+ * after decoding. Re-analysing an unchanged image is then almost free.
+ * 
+ * Entries are written in host byte order: the key includes a byte-order
+ * marker, so that a cache shared with a host of other endianness misses.
+ * 
+ * Written in 2026 by agent
+ */
+
+#include <libdisk/util.h>
+#include "private.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Bump to invalidate all entries, e.g. on a change to the stream layer. */
+#define CACHE_VERSION 1
+
+struct cache_key {
+    uint32_t magic;         /* byte-order marker */
+    uint16_t cache_version;
+    uint16_t handler_version;
+    uint16_t tracknr, type;
+    uint8_t pll_mode, density;
+    uint16_t scan_budget;
+    uint8_t flux[16];       /* stream_flux_hash() */
+    uint8_t tags[16];       /* disk tags before decoding */
+};
+
+struct cache_entry {
+    char signature[4];      /* "LDC\0" */
+    uint8_t accepted;
+    uint8_t nr_sectors;
+    uint16_t type, flags, bytes_per_sector, nr_tags;
+    uint8_t valid_sectors[8];
+    uint32_t data_bitoff, total_bits, len;
+    /* Followed by: len bytes of track data; nr_tags tags (struct disktag
+     * and data), the disk's complete tag list after decoding. */
+};
+
+static char *cache_dir;
+
+void disk_set_cache_dir(const char *dir)
+{
+    memfree(cache_dir);
+    cache_dir = NULL;
+    if (dir == NULL)
+        return;
+    cache_dir = memalloc(strlen(dir) + 1);
+    strcpy(cache_dir, dir);
+}
+
+static void hash_tags(struct disk *d, uint8_t *hash)
+{
+    struct disk_list_tag *dltag;
+    unsigned int len = 0;
+    uint8_t *p, *q;
+
+    for (dltag = d->tags; dltag != NULL; dltag = dltag->next)
+        len += sizeof(dltag->tag) + dltag->tag.len;
+    p = q = memalloc(len + 1);
+    for (dltag = d->tags; dltag != NULL; dltag = dltag->next) {
+        memcpy(q, &dltag->tag, sizeof(dltag->tag) + dltag->tag.len);
+        q += sizeof(dltag->tag) + dltag->tag.len;
+    }
+    hash128(p, len, hash);
+    memfree(p);
+}
+
+/* Entries are stored as dir/xx/yyyy..., like the manifest track store. */
+static char *cache_path(const uint8_t *hash)
+{
+    char *path = memalloc(strlen(cache_dir) + 36);
+    unsigned int i, n;
+
+    n = sprintf(path, "%s/%02x/", cache_dir, hash[0]);
+    for (i = 1; i < 16; i++)
+        n += sprintf(path + n, "%02x", hash[i]);
+    return path;
+}
+
+int cache_key(
+    struct disk *d, unsigned int tracknr, enum track_type type,
+    struct stream *s, uint8_t *hash)
+{
+    struct cache_key key;
+    const uint8_t *flux;
+
+    if ((cache_dir == NULL) || handlers[type]->no_cache ||
+        (stream_select_track(s, tracknr) != 0) ||
+        ((flux = stream_flux_hash(s)) == NULL))
+        return -1;
+
+    memset(&key, 0, sizeof(key));
+    key.magic = 0x4c444331;
+    key.cache_version = CACHE_VERSION;
+    key.handler_version = handlers[type]->version;
+    key.tracknr = tracknr;
+    key.type = type;
+    key.pll_mode = s->pll_mode;
+    key.density = handlers[type]->density;
+    key.scan_budget = s->scan_budget;
+    memcpy(key.flux, flux, sizeof(key.flux));
+    hash_tags(d, key.tags);
+
+    hash128(&key, sizeof(key), hash);
+    return 0;
+}
+
+int cache_lookup(
+    struct disk *d, unsigned int tracknr, const uint8_t *hash)
+{
+    struct track_info *ti = &d->di->track[tracknr];
+    struct cache_entry e;
+    struct disktag tag;
+    struct stat sbuf;
+    uint8_t *dat = NULL, *tdat = NULL;
+    unsigned int i;
+    char *path = cache_path(hash);
+    int fd, rc = CACHE_MISS;
+
+    if ((fd = file_open(path, O_RDONLY)) == -1)
+        goto out;
+
+    /* Entries are validated in full before the track is touched. */
+    if ((fstat(fd, &sbuf) != 0) || (sbuf.st_size < sizeof(e)))
+        goto out;
+    read_exact(fd, &e, sizeof(e));
+    if (strncmp(e.signature, "LDC\0", 4) ||
+        (e.len > (sbuf.st_size - sizeof(e))))
+        goto out;
+    if (e.len != 0) {
+        dat = memalloc(e.len);
+        read_exact(fd, dat, e.len);
+    }
+
+    memfree(ti->dat);
+    memset(ti, 0, sizeof(*ti));
+    init_track_info(ti, e.type);
+    ti->flags = e.flags;
+    ti->bytes_per_sector = e.bytes_per_sector;
+    ti->nr_sectors = e.nr_sectors;
+    memcpy(ti->valid_sectors, e.valid_sectors, sizeof(ti->valid_sectors));
+    ti->data_bitoff = e.data_bitoff;
+    ti->total_bits = e.total_bits;
+    ti->len = e.len;
+    ti->dat = dat;
+    if (!e.accepted)
+        ti->typename = "Unformatted*";
+
+    for (i = 0; i < e.nr_tags; i++) {
+        read_exact(fd, &tag, sizeof(tag));
+        tdat = memalloc(tag.len + 1);
+        read_exact(fd, tdat, tag.len);
+        disk_set_tag(d, tag.id, tag.len, tdat);
+        memfree(tdat);
+    }
+
+    rc = e.accepted ? 0 : -1;
+
+out:
+    if (fd != -1)
+        close(fd);
+    if (rc == CACHE_MISS)
+        memfree(dat);
+    memfree(path);
+    return rc;
+}
+
+void cache_store(
+    struct disk *d, unsigned int tracknr, const uint8_t *hash, int rc)
+{
+    struct track_info *ti = &d->di->track[tracknr];
+    struct disk_list_tag *dltag;
+    struct cache_entry e;
+    char *path = cache_path(hash), *tmp;
+    int fd;
+
+    memset(&e, 0, sizeof(e));
+    strncpy(e.signature, "LDC\0", 4);
+    e.accepted = (rc == 0);
+    e.nr_sectors = ti->nr_sectors;
+    e.type = ti->type;
+    e.flags = ti->flags;
+    e.bytes_per_sector = ti->bytes_per_sector;
+    memcpy(e.valid_sectors, ti->valid_sectors, sizeof(e.valid_sectors));
+    e.data_bitoff = ti->data_bitoff;
+    e.total_bits = ti->total_bits;
+    e.len = ti->dat ? ti->len : 0;
+    for (dltag = d->tags; dltag != NULL; dltag = dltag->next)
+        if (dltag->tag.id != DSKTAG_end)
+            e.nr_tags++;
+
+    (void)posix_mkdir(cache_dir, 0777);
+    *strrchr(path, '/') = '\0';
+    (void)posix_mkdir(path, 0777);
+    path[strlen(path)] = '/';
+
+    /* Write then rename: concurrent analyses may share the cache. */
+    tmp = memalloc(strlen(path) + 16);
+    sprintf(tmp, "%s.%u", path, (unsigned int)getpid());
+    if ((fd = file_open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1) {
+        warn("%s", tmp);
+        goto out;
+    }
+    write_exact(fd, &e, sizeof(e));
+    write_exact(fd, ti->dat, e.len);
+    for (dltag = d->tags; dltag != NULL; dltag = dltag->next)
+        if (dltag->tag.id != DSKTAG_end)
+            write_exact(fd, &dltag->tag,
+                        sizeof(dltag->tag) + dltag->tag.len);
+    if ((close(fd) != 0) || (rename(tmp, path) != 0)) {
+        warn("%s", path);
+        unlink(tmp);
+    }
+
+out:
+    memfree(tmp);
+    memfree(path);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -11,6 +11,15 @@
  *  [<struct tag_header> tag data...]+
  *  <track data...>
  * All fields are big endian (network ordering).
+ * 
+ * Manifest (.dskm) Format:
+ *  <struct disk_header> (signature "DSKM")
+ *  <struct manifest_track_header> * #tracks
+ *  [<struct tag_header> tag data...]+
+ * Track data lives in a content-addressed store which is shared by all 
+ * manifests: one file per distinct track payload, named by a 128-bit hash 
+ * of its contents. The store is $LIBDISK_STORE, else dskstore/ beside the 
+ * manifest.
  */
 
 #include <libdisk/util.h>
@@ -57,11 +66,25 @@ struct track_header {
     uint32_t total_bits;
 };
 
+struct manifest_track_header {
+    uint16_t type;
+    uint16_t flags;
+    uint8_t valid_sectors[8];
+    uint32_t len;
+    uint32_t data_bitoff;
+    uint32_t total_bits;
+    /* Hash of track data in the store (all zeroes if len is 0). */
+    uint8_t hash[16];
+};
+
 struct tag_header {
     uint16_t id;
     uint16_t len;
 };
 
+#define STORE_ENV     "LIBDISK_STORE"
+#define STORE_DEFAULT "dskstore"
+
 static void tag_swizzle(struct disktag *dtag)
 {
     switch (dtag->id) {
@@ -96,13 +119,48 @@ void dsk_init(struct disk *d)
     d->tags->tag.id = DSKTAG_end;
 }
 
-static struct container *dsk_open(struct disk *d)
+static void read_tags(struct disk *d)
 {
-    struct disk_header dh;
-    struct track_header th;
     struct tag_header tagh;
     struct disk_list_tag *dltag, **pprevtag;
     struct disktag *dtag;
+
+    pprevtag = &d->tags;
+    do {
+        read_exact(d->fd, &tagh, sizeof(tagh));
+        dltag = memalloc(sizeof(*dltag) + be16toh(tagh.len));
+        dtag = &dltag->tag;
+        dtag->id = be16toh(tagh.id);
+        dtag->len = be16toh(tagh.len);
+        read_exact(d->fd, dtag+1, dtag->len);
+        tag_swizzle(dtag);
+        *pprevtag = dltag;
+        pprevtag = &dltag->next;
+    } while (dtag->id != DSKTAG_end);
+    *pprevtag = NULL;
+}
+
+static void write_tags(struct disk *d)
+{
+    struct tag_header tagh;
+    struct disk_list_tag *dltag;
+    struct disktag *dtag;
+
+    for (dltag = d->tags; dltag != NULL; dltag = dltag->next) {
+        dtag = &dltag->tag;
+        tagh.id = htobe16(dtag->id);
+        tagh.len = htobe16(dtag->len);
+        tag_swizzle(dtag);
+        write_exact(d->fd, &tagh, sizeof(tagh));
+        write_exact(d->fd, dtag+1, dtag->len);
+        tag_swizzle(dtag);
+    }
+}
+
+static struct container *dsk_open(struct disk *d)
+{
+    struct disk_header dh;
+    struct track_header th;
     struct disk_info *di;
     struct track_info *ti;
     unsigned int i, bytes_per_th, read_bytes_per_th;
@@ -138,19 +196,7 @@ static struct container *dsk_open(struct disk *d)
         lseek(d->fd, off, SEEK_SET);
     }
 
-    pprevtag = &d->tags;
-    do {
-        read_exact(d->fd, &tagh, sizeof(tagh));
-        dltag = memalloc(sizeof(*dltag) + be16toh(tagh.len));
-        dtag = &dltag->tag;
-        dtag->id = be16toh(tagh.id);
-        dtag->len = be16toh(tagh.len);
-        read_exact(d->fd, dtag+1, dtag->len);
-        tag_swizzle(dtag);
-        *pprevtag = dltag;
-        pprevtag = &dltag->next;
-    } while (dtag->id != DSKTAG_end);
-    *pprevtag = NULL;
+    read_tags(d);
 
     d->di = di;
     return &container_dsk;
@@ -163,7 +209,6 @@ static void dsk_close(struct disk *d)
     struct disk_info *di = d->di;
     struct track_info *ti;
     struct disk_list_tag *dltag;
-    struct disktag *dtag;
     unsigned int i, datoff;
 
     lseek(d->fd, 0, SEEK_SET);
@@ -194,16 +239,7 @@ static void dsk_close(struct disk *d)
         datoff += ti->len;
     }
 
-    for (dltag = d->tags; dltag != NULL; dltag = dltag->next) {
-        struct tag_header tagh;
-        dtag = &dltag->tag;
-        tagh.id = htobe16(dtag->id);
-        tagh.len = htobe16(dtag->len);
-        tag_swizzle(dtag);
-        write_exact(d->fd, &tagh, sizeof(tagh));
-        write_exact(d->fd, dtag+1, dtag->len);
-        tag_swizzle(dtag);
-    }
+    write_tags(d);
 
     for (i = 0; i < di->nr_tracks; i++) {
         ti = &di->track[i];
@@ -212,6 +248,197 @@ static void dsk_close(struct disk *d)
     }
 }
 
+static char *store_dir(struct disk *d)
+{
+    const char *env = getenv(STORE_ENV), *p;
+    size_t n;
+    char *dir;
+
+    if ((env != NULL) && *env) {
+        dir = memalloc(strlen(env) + 1);
+        strcpy(dir, env);
+        return dir;
+    }
+
+    p = strrchr(d->name, '/');
+    n = p ? (p - d->name + 1) : 0;
+    dir = memalloc(n + sizeof(STORE_DEFAULT));
+    memcpy(dir, d->name, n);
+    strcpy(dir + n, STORE_DEFAULT);
+    return dir;
+}
+
+/* Payloads are stored as dir/xx/yyyy...: the first byte of the hash in hex 
+ * names a subdirectory, and the remaining 15 name the file. */
+static char *store_path(const char *dir, const uint8_t *hash)
+{
+    char *path = memalloc(strlen(dir) + 36);
+    unsigned int i, n;
+
+    n = sprintf(path, "%s/%02x/", dir, hash[0]);
+    for (i = 1; i < 16; i++)
+        n += sprintf(path + n, "%02x", hash[i]);
+    return path;
+}
+
+static void store_put(
+    const char *dir, const uint8_t *hash, const void *dat, uint32_t len)
+{
+    char *path = store_path(dir, hash), *tmp;
+    struct stat sbuf;
+    int fd;
+
+    /* Already stored: nothing to do. */
+    if ((stat(path, &sbuf) == 0) && (sbuf.st_size == len))
+        goto out;
+
+    (void)mkdir(dir, 0777);
+    *strrchr(path, '/') = '\0';
+    (void)mkdir(path, 0777);
+    path[strlen(path)] = '/';
+
+    /* Write then rename, so that concurrent writers of the same payload 
+     * never see a partial file. */
+    tmp = memalloc(strlen(path) + 16);
+    sprintf(tmp, "%s.%u", path, (unsigned int)getpid());
+    if ((fd = file_open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1)
+        err(1, "%s", tmp);
+    write_exact(fd, dat, len);
+    if ((close(fd) != 0) || (rename(tmp, path) != 0))
+        err(1, "%s", path);
+    memfree(tmp);
+
+out:
+    memfree(path);
+}
+
+static void *store_get(const char *dir, const uint8_t *hash, uint32_t len)
+{
+    char *path = store_path(dir, hash);
+    struct stat sbuf;
+    void *dat = NULL;
+    int fd;
+
+    if ((fd = file_open(path, O_RDONLY)) == -1) {
+        warn("%s", path);
+    } else if ((fstat(fd, &sbuf) != 0) || (sbuf.st_size != len)) {
+        warnx("%s: Bad length", path);
+    } else {
+        dat = memalloc(len);
+        read_exact(fd, dat, len);
+    }
+
+    if (fd != -1)
+        close(fd);
+    memfree(path);
+    return dat;
+}
+
+static struct container *dskm_open(struct disk *d)
+{
+    struct disk_header dh;
+    struct manifest_track_header th;
+    struct disk_info *di;
+    struct track_info *ti;
+    unsigned int i, bytes_per_th, read_bytes_per_th;
+    char *dir;
+
+    read_exact(d->fd, &dh, sizeof(dh));
+    if (strncmp(dh.signature, "DSKM", 4) ||
+        (be16toh(dh.version) != 0))
+        return NULL;
+
+    dir = store_dir(d);
+    di = memalloc(sizeof(*di));
+    di->nr_tracks = be16toh(dh.nr_tracks);
+    di->flags = be16toh(dh.flags);
+    di->track = memalloc(di->nr_tracks * sizeof(*ti));
+    read_bytes_per_th = bytes_per_th = be16toh(dh.bytes_per_thdr);
+    if (read_bytes_per_th > sizeof(th))
+        read_bytes_per_th = sizeof(th);
+
+    for (i = 0; i < di->nr_tracks; i++) {
+        memset(&th, 0, sizeof(th));
+        read_exact(d->fd, &th, read_bytes_per_th);
+        lseek(d->fd, bytes_per_th-read_bytes_per_th, SEEK_CUR);
+        ti = &di->track[i];
+        init_track_info(ti, be16toh(th.type));
+        ti->flags = be16toh(th.flags);
+        memcpy(ti->valid_sectors, th.valid_sectors, sizeof(th.valid_sectors));
+        ti->len = be32toh(th.len);
+        ti->data_bitoff = be32toh(th.data_bitoff);
+        ti->total_bits = be32toh(th.total_bits);
+        if ((ti->len != 0) &&
+            ((ti->dat = store_get(dir, th.hash, ti->len)) == NULL))
+            goto fail;
+    }
+
+    read_tags(d);
+
+    memfree(dir);
+    d->di = di;
+    return &container_dskm;
+
+fail:
+    while (i--)
+        memfree(di->track[i].dat);
+    memfree(di->track);
+    memfree(di);
+    memfree(dir);
+    return NULL;
+}
+
+static void dskm_close(struct disk *d)
+{
+    struct disk_header dh;
+    struct manifest_track_header th;
+    struct disk_info *di = d->di;
+    struct track_info *ti;
+    unsigned int i;
+    char *dir = store_dir(d);
+
+    lseek(d->fd, 0, SEEK_SET);
+    if (ftruncate(d->fd, 0) < 0)
+        err(1, NULL);
+
+    memcpy(dh.signature, "DSKM", 4);
+    dh.version = 0;
+    dh.nr_tracks = htobe16(di->nr_tracks);
+    dh.bytes_per_thdr = htobe16(sizeof(th));
+    dh.flags = htobe16(di->flags);
+    write_exact(d->fd, &dh, sizeof(dh));
+
+    for (i = 0; i < di->nr_tracks; i++) {
+        ti = &di->track[i];
+        memset(&th, 0, sizeof(th));
+        th.type = htobe16(ti->type);
+        th.flags = htobe16(ti->flags);
+        memcpy(th.valid_sectors, ti->valid_sectors, sizeof(th.valid_sectors));
+        th.len = htobe32(ti->len);
+        th.data_bitoff = htobe32(ti->data_bitoff);
+        th.total_bits = htobe32(ti->total_bits);
+        if (ti->len != 0) {
+            hash128(ti->dat, ti->len, th.hash);
+            store_put(dir, th.hash, ti->dat, ti->len);
+        }
+        write_exact(d->fd, &th, sizeof(th));
+    }
+
+    write_tags(d);
+    memfree(dir);
+}
+
+/* Is the track confidently of a density other than @ns_per_cell? Then the 
+ * handler cannot succeed, and need not run its PLL over the track. */
+static bool_t density_mismatch(struct stream *s, unsigned int ns_per_cell)
+{
+    const struct stream_flux_info *fi = stream_flux_info(s);
+
+    return ((fi != NULL) && fi->confident &&
+            (((fi->ns_per_cell * 4) < (ns_per_cell * 3)) ||
+             ((fi->ns_per_cell * 3) > (ns_per_cell * 4))));
+}
+
 int dsk_write_raw(
     struct disk *d, unsigned int tracknr, enum track_type type,
     struct stream *s)
@@ -219,6 +446,7 @@ int dsk_write_raw(
     struct disk_info *di = d->di;
     struct track_info *ti = &di->track[tracknr];
     unsigned int ns_per_cell = 0, default_len;
+    uint32_t bitlen;
 
     memset(ti, 0, sizeof(*ti));
     init_track_info(ti, type);
@@ -234,8 +462,12 @@ int dsk_write_raw(
     default_len = (DEFAULT_BITS_PER_TRACK * 2000u) / ns_per_cell;
     ti->total_bits = default_len;
 
-    if (stream_select_track(s, tracknr) == 0)
+    if ((stream_select_track(s, tracknr) == 0) &&
+        !density_mismatch(s, ns_per_cell)) {
+        stream_arm_budget(s, handlers[type]->sync, default_len);
         ti->dat = handlers[type]->write_raw(d, tracknr, s);
+        stream_disarm_budget(s);
+    }
 
     if (ti->dat == NULL) {
         track_mark_unformatted(d, tracknr);
@@ -243,17 +475,16 @@ int dsk_write_raw(
         return -1;
     }
 
-    stream_reset(s);
-    stream_next_index(s);
+    bitlen = stream_revolution_bitlen(s, 0);
 
     if (ti->total_bits == 0) {
-        ti->total_bits = s->track_bitlen ? : default_len;
-    } else if (ti->total_bits == TRK_WEAK) {
+        ti->total_bits = bitlen ? : default_len;
+    } else if ((ti->total_bits == TRK_WEAK) || (bitlen == 0)) {
         /* nothing */
-    } else if (((s->track_bitlen - (s->track_bitlen/50)) > ti->total_bits) ||
-               ((s->track_bitlen + (s->track_bitlen/50)) < ti->total_bits)) {
+    } else if (((bitlen - (bitlen/50)) > ti->total_bits) ||
+               ((bitlen + (bitlen/50)) < ti->total_bits)) {
         printf("*** T%u: Unexpected track length (seen %u, "
-               "expected %u)\n", tracknr, s->track_bitlen, ti->total_bits);
+               "expected %u)\n", tracknr, bitlen, ti->total_bits);
     }
 
     ti->data_bitoff = (int32_t)ti->data_bitoff % (int32_t)ti->total_bits;
@@ -270,6 +501,13 @@ struct container container_dsk = {
     .write_raw = dsk_write_raw
 };
 
+struct container container_dskm = {
+    .init = dsk_init,
+    .open = dskm_open,
+    .close = dskm_close,
+    .write_raw = dsk_write_raw
+};
+
 /*
  * Local variables:
  * mode: C
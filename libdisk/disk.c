@@ -49,6 +49,8 @@ static struct container *container_from_filename(
         return &container_eadf;
     if (!strcmp(p, "dsk"))
         return &container_dsk;
+    if (!strcmp(p, "dskm"))
+        return &container_dskm;
     if (!strcmp(p, "img"))
         return &container_img;
     if (!strcmp(p, "ipf"))
@@ -56,7 +58,8 @@ static struct container *container_from_filename(
     if (!strcmp(p, "scp"))
         return &container_scp;
 fail:
-    warnx("Unknown file suffix: %s (valid suffixes: .adf,.dsk,.ipf)", name);
+    warnx("Unknown file suffix: %s (valid suffixes: .adf,.dsk,.dskm,.ipf)",
+          name);
     return NULL;
 }
 
@@ -75,6 +78,8 @@ struct disk *disk_create(const char *name)
     }
 
     d = memalloc(sizeof(*d));
+    d->name = memalloc(strlen(name) + 1);
+    strcpy(d->name, name);
     d->fd = fd;
     d->read_only = 0;
     d->container = c;
@@ -99,12 +104,15 @@ struct disk *disk_open(const char *name, int read_only)
     }
 
     d = memalloc(sizeof(*d));
+    d->name = memalloc(strlen(name) + 1);
+    strcpy(d->name, name);
     d->fd = fd;
     d->read_only = read_only;
     d->container = c->open(d);
 
     if (!d->container) {
         warnx("%s: Bad disk image", name);
+        memfree(d->name);
         memfree(d);
         return NULL;
     }
@@ -118,6 +126,8 @@ void disk_close(struct disk *d)
     struct disk_info *di = d->di;
     unsigned int i;
 
+    block_cache_close(d);
+
     if (!d->read_only)
         d->container->close(d);
 
@@ -133,6 +143,7 @@ void disk_close(struct disk *d)
     memfree(di->track);
     memfree(di);
     close(d->fd);
+    memfree(d->name);
     memfree(d);
 }
 
@@ -203,11 +214,23 @@ int track_write_raw_from_stream(
 {
     struct disk_info *di = d->di;
     struct track_info *ti = &di->track[tracknr];
+    uint8_t key[16];
+    bool_t cache;
+    int rc;
 
     memfree(ti->dat);
     ti->dat = NULL;
 
-    return d->container->write_raw(d, tracknr, type, s);
+    stream_profile_start(s);
+    cache = (cache_key(d, tracknr, type, s, key) == 0);
+    if (!cache || ((rc = cache_lookup(d, tracknr, key)) == CACHE_MISS)) {
+        rc = d->container->write_raw(d, tracknr, type, s);
+        if (cache)
+            cache_store(d, tracknr, key, rc);
+    }
+    stream_profile_end(s, tracknr, type, rc == 0);
+
+    return rc;
 }
 
 struct sbuf {
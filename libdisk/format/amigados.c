@@ -201,18 +201,59 @@ static void ados_read_raw(
     }
 }
 
+static void *ados_write_sectors(
+    struct disk *d, unsigned int tracknr, struct track_sectors *sectors)
+{
+    struct track_info *ti = &d->di->track[tracknr];
+    char *block;
+
+    if (sectors->nr_bytes < ti->len)
+        return NULL;
+
+    block = memalloc(ti->len);
+    memcpy(block, sectors->data, ti->len);
+
+    sectors->data += ti->len;
+    sectors->nr_bytes -= ti->len;
+
+    set_all_sectors_valid(ti);
+    ti->data_bitoff = 1024;
+
+    return block;
+}
+
+static void ados_read_sectors(
+    struct disk *d, unsigned int tracknr, struct track_sectors *sectors)
+{
+    struct track_info *ti = &d->di->track[tracknr];
+    unsigned int i, off = (ti->type == TRKTYP_amigados_extended)
+        ? EXT_SEC - STD_SEC : 0;
+
+    sectors->nr_bytes = ti->nr_sectors * STD_SEC;
+    sectors->data = memalloc(sectors->nr_bytes);
+    for (i = 0; i < ti->nr_sectors; i++)
+        memcpy(sectors->data + i * STD_SEC,
+               ti->dat + i * ti->bytes_per_sector + off, STD_SEC);
+}
+
 struct track_handler amigados_handler = {
     .bytes_per_sector = STD_SEC,
     .nr_sectors = 11,
+    .sync = { 0x44894489, 0x45214521 },
     .write_raw = ados_write_raw,
-    .read_raw = ados_read_raw
+    .read_raw = ados_read_raw,
+    .write_sectors = ados_write_sectors,
+    .read_sectors = ados_read_sectors
 };
 
+/* Sector data can be read, but writing it would lose the custom headers. */
 struct track_handler amigados_extended_handler = {
     .bytes_per_sector = EXT_SEC,
     .nr_sectors = 11,
+    .sync = { 0x44894489, 0x45214521 },
     .write_raw = ados_write_raw,
-    .read_raw = ados_read_raw
+    .read_raw = ados_read_raw,
+    .read_sectors = ados_read_sectors
 };
 
 /* AmigaDOS Long Tracks:
@@ -126,6 +126,7 @@ static void archipelagos_read_raw(
 struct track_handler archipelagos_handler = {
     .bytes_per_sector = 1024,
     .nr_sectors = 5,
+    .sync = { 0x44894489 },
     .write_raw = archipelagos_write_raw,
     .read_raw = archipelagos_read_raw
 };
@@ -78,6 +78,7 @@ static void bat_read_raw(
 struct track_handler bat_handler = {
     .bytes_per_sector = 6304,
     .nr_sectors = 1,
+    .sync = { 0x8945 },
     .write_raw = bat_write_raw,
     .read_raw = bat_read_raw
 };
@@ -149,6 +149,7 @@ static void batman_read_raw(
 struct track_handler batman_handler = {
     .bytes_per_sector = 512,
     .nr_sectors = 12,
+    .sync = { 0x8944aaaa },
     .write_raw = batman_write_raw,
     .read_raw = batman_read_raw
 };
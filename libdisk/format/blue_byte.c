@@ -94,6 +94,7 @@ static void blue_byte_read_raw(
 struct track_handler blue_byte_handler = {
     .bytes_per_sector = 6032,
     .nr_sectors = 1,
+    .sync = { 0x5542aaaa },
     .write_raw = blue_byte_write_raw,
     .read_raw = blue_byte_read_raw
 };
@@ -83,6 +83,7 @@ static void core_read_raw(
 struct track_handler core_design_handler = {
     .bytes_per_sector = 11*512,
     .nr_sectors = 1,
+    .sync = { 0x8915 },
     .write_raw = core_write_raw,
     .read_raw = core_read_raw
 };
@@ -22,12 +22,37 @@
 
 #define weak_sec(_type) (((_type) == TRKTYP_chaos_strikes_back_weak) ? 1 : 0)
 
+/* Weak bytes of the protection sector, and revolutions compared to find 
+ * them. */
+#define WEAK_START 20
+#define WEAK_END   509
+#define WEAK_REVS  4
+
+/* The weak area of a genuine disk reads differently on each revolution. A 
+ * stable weak area suggests a copy, which we can still remaster. */
+static void check_weak_area(
+    struct stream *s, unsigned int tracknr, uint32_t dam_off)
+{
+    enum pll_mode old_mode = stream_pll_mode(s, PLL_authentic);
+    struct stream_weak_map *m = stream_weak_map(s, 0x44894489, WEAK_REVS);
+
+    stream_pll_mode(s, old_mode);
+    if (m == NULL)
+        return;
+    if (stream_weak_count(m, dam_off + 1 + WEAK_START*16,
+                          (WEAK_END - WEAK_START)*16) == 0)
+        printf("*** T%u: Weak sector is stable over %u revolutions\n",
+               tracknr, m->nr_revs);
+    stream_weak_map_free(m);
+}
+
 static void *dungeon_master_weak_write_raw(
     struct disk *d, unsigned int tracknr, struct stream *s)
 {
     struct track_info *ti = &d->di->track[tracknr];
     char *block = memalloc(ti->bytes_per_sector * ti->nr_sectors);
     unsigned int weak_sec = weak_sec(ti->type), nr_valid_blocks = 0;
+    uint32_t weak_off = 0;
 
     /* Fill value for all sectors seems to be 0xe5. */
     memset(block, 0xe5, ti->bytes_per_sector * ti->nr_sectors);
@@ -61,6 +86,7 @@ static void *dungeon_master_weak_write_raw(
             /* Weak-bit protection relies on authentic behaviour of FDC PLL to 
              * respond slowly to marginal bits at edge of inspection window. */
             enum pll_mode old_mode = stream_pll_mode(s, PLL_authentic);
+            weak_off = s->index_offset;
             if (stream_next_bytes(s, dat, sizeof(dat)) == -1)
                 break;
             stream_pll_mode(s, old_mode);
@@ -68,12 +94,12 @@ static void *dungeon_master_weak_write_raw(
 
             /* Check each flakey byte is read as 0x68 or 0xE8. Rewrite as
              * originally mastered (always 0x68, with timing variation). */
-            for (i = 20; i < 509; i++) {
+            for (i = WEAK_START; i < WEAK_END; i++) {
                 dat[i] &= 0x7f;
                 if (dat[i] != 0x68)
                     break;
             }
-            if (i != 509)
+            if (i != WEAK_END)
                 continue;
             /* Re-compute the CRC on fixed-up data. */
             s->crc16_ccitt = crc16_ccitt(dat, 514, crc);
@@ -99,6 +125,8 @@ static void *dungeon_master_weak_write_raw(
         return NULL;
     }
 
+    check_weak_area(s, tracknr, weak_off);
+
     return block;
 }
 
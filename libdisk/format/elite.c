@@ -110,6 +110,7 @@ static void elite_read_raw(
 struct track_handler elite_a_handler = {
     .bytes_per_sector = 6144,
     .nr_sectors = 1,
+    .sync = { 0xa2454489 },
     .write_raw = elite_write_raw,
     .read_raw = elite_read_raw
 };
@@ -117,6 +118,7 @@ struct track_handler elite_a_handler = {
 struct track_handler elite_b_handler = {
     .bytes_per_sector = 5888,
     .nr_sectors = 1,
+    .sync = { 0xa2454489 },
     .write_raw = elite_write_raw,
     .read_raw = elite_read_raw
 };
@@ -124,6 +126,7 @@ struct track_handler elite_b_handler = {
 struct track_handler elite_c_handler = {
     .bytes_per_sector = 6312,
     .nr_sectors = 1,
+    .sync = { 0xa2454489 },
     .write_raw = elite_write_raw,
     .read_raw = elite_read_raw
 };
@@ -131,6 +134,7 @@ struct track_handler elite_c_handler = {
 struct track_handler elite_d_handler = {
     .bytes_per_sector = 5120,
     .nr_sectors = 1,
+    .sync = { 0xa2454489 },
     .write_raw = elite_write_raw,
     .read_raw = elite_read_raw
 };
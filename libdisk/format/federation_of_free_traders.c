@@ -124,6 +124,7 @@ static void federation_of_free_traders_read_raw(
 struct track_handler federation_of_free_traders_handler = {
     .bytes_per_sector = 2000,
     .nr_sectors = 3,
+    .sync = { 0x44894489 },
     .write_raw = federation_of_free_traders_write_raw,
     .read_raw = federation_of_free_traders_read_raw
 };
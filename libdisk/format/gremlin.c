@@ -101,6 +101,7 @@ static void gremlin_read_raw(
 struct track_handler gremlin_handler = {
     .bytes_per_sector = 12*512,
     .nr_sectors = 1,
+    .sync = { 0x44894489 },
     .write_raw = gremlin_write_raw,
     .read_raw = gremlin_read_raw
 };
@@ -266,6 +266,7 @@ struct track_handler ibm_pc_dd_handler = {
     .density = trkden_double,
     .bytes_per_sector = 512,
     .nr_sectors = 9,
+    .sync = { 0x44894489, 0x52245224 },
     .write_raw = ibm_pc_write_raw,
     .read_raw = ibm_pc_read_raw,
     .write_sectors = ibm_pc_write_sectors,
@@ -280,6 +281,7 @@ struct track_handler ibm_pc_dd_10sec_handler = {
     .density = trkden_double,
     .bytes_per_sector = 512,
     .nr_sectors = 10,
+    .sync = { 0x44894489, 0x52245224 },
     .write_raw = ibm_pc_write_raw,
     .read_raw = ibm_pc_read_raw,
     .write_sectors = ibm_pc_write_sectors,
@@ -294,6 +296,7 @@ struct track_handler ibm_pc_hd_5_25_handler = {
     .density = trkden_high,
     .bytes_per_sector = 512,
     .nr_sectors = 15,
+    .sync = { 0x44894489, 0x52245224 },
     .write_raw = ibm_pc_write_raw,
     .read_raw = ibm_pc_read_raw,
     .write_sectors = ibm_pc_write_sectors,
@@ -307,6 +310,7 @@ struct track_handler ibm_pc_hd_handler = {
     .density = trkden_high,
     .bytes_per_sector = 512,
     .nr_sectors = 18,
+    .sync = { 0x44894489, 0x52245224 },
     .write_raw = ibm_pc_write_raw,
     .read_raw = ibm_pc_read_raw,
     .write_sectors = ibm_pc_write_sectors,
@@ -320,6 +324,7 @@ struct track_handler ibm_pc_ed_handler = {
     .density = trkden_extra,
     .bytes_per_sector = 512,
     .nr_sectors = 36,
+    .sync = { 0x44894489, 0x52245224 },
     .write_raw = ibm_pc_write_raw,
     .read_raw = ibm_pc_read_raw,
     .write_sectors = ibm_pc_write_sectors,
@@ -334,6 +339,7 @@ struct track_handler siemens_isdx_hd_handler = {
     .density = trkden_high,
     .bytes_per_sector = 256,
     .nr_sectors = 32,
+    .sync = { 0x44894489, 0x52245224 },
     .write_raw = ibm_pc_write_raw,
     .read_raw = ibm_pc_read_raw,
     .write_sectors = ibm_pc_write_sectors,
@@ -349,6 +355,7 @@ struct track_handler microsoft_dmf_hd_handler = {
     .density = trkden_high,
     .bytes_per_sector = 512,
     .nr_sectors = 21,
+    .sync = { 0x44894489, 0x52245224 },
     .write_raw = ibm_pc_write_raw,
     .read_raw = ibm_pc_read_raw,
     .write_sectors = ibm_pc_write_sectors,
@@ -365,6 +372,7 @@ struct track_handler trace_traceback_hd_handler = {
     .density = trkden_high,
     .bytes_per_sector = 2048,
     .nr_sectors = 1,
+    .sync = { 0x44894489, 0x52245224 },
     .write_raw = ibm_pc_write_raw,
     .read_raw = ibm_pc_read_raw,
     .write_sectors = ibm_pc_write_sectors,
@@ -382,6 +390,7 @@ struct track_handler acorn_adfs_s_m_l_handler = {
     .density = trkden_double,
     .bytes_per_sector = 256,
     .nr_sectors = 16,
+    .sync = { 0x44894489, 0x52245224 },
     .write_raw = ibm_pc_write_raw,
     .read_raw = ibm_pc_read_raw,
     .write_sectors = ibm_pc_write_sectors,
@@ -396,6 +405,7 @@ struct track_handler acorn_adfs_d_e_handler = {
     .density = trkden_double,
     .bytes_per_sector = 1024,
     .nr_sectors = 5,
+    .sync = { 0x44894489, 0x52245224 },
     .write_raw = ibm_pc_write_raw,
     .read_raw = ibm_pc_read_raw,
     .write_sectors = ibm_pc_write_sectors,
@@ -410,6 +420,7 @@ struct track_handler acorn_adfs_f_handler = {
     .density = trkden_high,
     .bytes_per_sector = 1024,
     .nr_sectors = 10,
+    .sync = { 0x44894489, 0x52245224 },
     .write_raw = ibm_pc_write_raw,
     .read_raw = ibm_pc_read_raw,
     .write_sectors = ibm_pc_write_sectors,
@@ -22,10 +22,11 @@ static int check_sequence(struct stream *s, unsigned int nr, uint8_t byte)
     return !nr;
 }
 
+/* Is the current revolution at least @min_bits long? */
 static int check_length(struct stream *s, unsigned int min_bits)
 {
-    stream_next_index(s);
-    return (s->track_bitlen >= min_bits);
+    unsigned int rev = s->nr_index ? s->nr_index - 1 : 0;
+    return (stream_revolution_bitlen(s, rev) >= min_bits);
 }
 
 /* TRKTYP_protec_longtrack: PROTEC protection track, used on many releases
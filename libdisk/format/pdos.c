@@ -164,6 +164,7 @@ static void pdos_read_raw(
 struct track_handler rnc_pdos_handler = {
     .bytes_per_sector = 512,
     .nr_sectors = 12,
+    .sync = { 0x1448 },
     .write_raw = pdos_write_raw,
     .read_raw = pdos_read_raw
 };
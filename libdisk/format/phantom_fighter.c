@@ -94,6 +94,7 @@ static void phantom_fighter_read_raw(
 struct track_handler phantom_fighter_handler = {
     .bytes_per_sector = 5982,
     .nr_sectors = 1,
+    .sync = { 0x44894489 },
     .write_raw = phantom_fighter_write_raw,
     .read_raw = phantom_fighter_read_raw
 };
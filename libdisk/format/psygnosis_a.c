@@ -113,6 +113,7 @@ static void psygnosis_a_read_raw(
 struct track_handler psygnosis_a_handler = {
     .bytes_per_sector = 12*512,
     .nr_sectors = 1,
+    .sync = { 0x4489, 0x4429 },
     .write_raw = psygnosis_a_write_raw,
     .read_raw = psygnosis_a_read_raw
 };
@@ -301,6 +301,7 @@ static void psygnosis_c_custom_rll_read_raw(
 }
 
 struct track_handler psygnosis_c_custom_rll_handler = {
+    .no_cache = 1, /* uses track 0 metadata */
     .write_raw = psygnosis_c_custom_rll_write_raw,
     .read_raw = psygnosis_c_custom_rll_read_raw
 };
@@ -386,6 +387,7 @@ static void psygnosis_c_read_raw(
 }
 
 struct track_handler psygnosis_c_handler = {
+    .no_cache = 1, /* uses track 0 metadata */
     .write_raw = psygnosis_c_write_raw,
     .read_raw = psygnosis_c_read_raw
 };
@@ -83,6 +83,7 @@ static void rainbird_read_raw(
 struct track_handler rainbird_handler = {
     .bytes_per_sector = 5120,
     .nr_sectors = 1,
+    .sync = { 0x44894489 },
     .write_raw = rainbird_write_raw,
     .read_raw = rainbird_read_raw
 };
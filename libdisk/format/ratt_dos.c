@@ -130,6 +130,7 @@ static void ratt_dos_read_raw(
 }
 
 struct track_handler ratt_dos_1800_handler = {
+    .no_cache = 1, /* uses the track 2 directory */
     .bytes_per_sector = 0x1800,
     .nr_sectors = 1,
     .write_raw = ratt_dos_write_raw,
@@ -137,6 +138,7 @@ struct track_handler ratt_dos_1800_handler = {
 };
 
 struct track_handler ratt_dos_1810_handler = {
+    .no_cache = 1, /* uses the track 2 directory */
     .bytes_per_sector = 0x1810,
     .nr_sectors = 1,
     .write_raw = ratt_dos_write_raw,
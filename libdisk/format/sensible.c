@@ -91,6 +91,7 @@ static void sensible_read_raw(
 struct track_handler sensible_handler = {
     .bytes_per_sector = 12*512,
     .nr_sectors = 1,
+    .sync = { 0x44894489 },
     .write_raw = sensible_write_raw,
     .read_raw = sensible_read_raw
 };
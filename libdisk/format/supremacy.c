@@ -83,6 +83,7 @@ static void supremacy_a_read_raw(
 struct track_handler supremacy_a_handler = {
     .bytes_per_sector = 4*1024,
     .nr_sectors = 1,
+    .sync = { 0x44894489 },
     .write_raw = supremacy_a_write_raw,
     .read_raw = supremacy_a_read_raw
 };
@@ -193,6 +194,7 @@ static void supremacy_b_read_raw(
 struct track_handler supremacy_b_handler = {
     .bytes_per_sector = 512,
     .nr_sectors = 11,
+    .sync = { 0x44894489 },
     .write_raw = supremacy_b_write_raw,
     .read_raw = supremacy_b_read_raw
 };
@@ -83,6 +83,11 @@ struct disk *disk_create(const char *name);
 struct disk *disk_open(const char *name, int read_only);
 void disk_close(struct disk *);
 
+/* Cache track analyses in directory @dir (NULL to disable). Decoding a 
+ * track which has been decoded before with the same format, flux and 
+ * settings returns the earlier result without decoding it again. */
+void disk_set_cache_dir(const char *dir);
+
 const char *disk_get_format_id_name(enum track_type type);
 const char *disk_get_format_desc_name(enum track_type type);
 
@@ -120,6 +125,15 @@ int track_read_sectors(struct track_sectors *, unsigned int tracknr);
 int track_write_sectors(
     struct track_sectors *, unsigned int tracknr, enum track_type);
 
+/* Sectors as an array of logical blocks, numbered in track order. Writes
+ * are cached, and reach the disk on disk_block_flush() or disk_close().
+ * Read/write/flush return -1 on failure (e.g. block out of range or
+ * unreadable, or its track cannot be re-encoded from sector data). */
+unsigned int disk_block_count(struct disk *, unsigned int *bytes_per_block);
+int disk_block_read(struct disk *, unsigned int lba, void *buf);
+int disk_block_write(struct disk *, unsigned int lba, const void *buf);
+int disk_block_flush(struct disk *);
+
 void track_mark_unformatted(
     struct disk *, unsigned int tracknr);
 
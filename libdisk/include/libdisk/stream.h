@@ -21,9 +21,92 @@ enum pll_mode {
 /* Default mode: seems to work well for most things. */
 #define PLL_default PLL_authentic
 
+/* Default scan budget, in % of a revolution. */
+#define STREAM_DEFAULT_BUDGET 120
+
+/* Flux histogram: bin width and number of bins (the last bin also counts 
+ * all longer intervals). */
+#define FLUX_HIST_NS_PER_BIN 50
+#define FLUX_HIST_BINS       400
+
+enum flux_encoding {
+    FLUXENC_unknown,
+    FLUXENC_mfm,  /* peaks at 2, 3 and 4 bitcells */
+    FLUXENC_fm,   /* peaks at 1 and 2 bitcells */
+    FLUXENC_gcr   /* peaks at 1, 2 and 3 bitcells */
+};
+
+/* Flux intervals of one revolution of the current track, and the bitcell 
+ * period and encoding they suggest. */
+struct stream_flux_info {
+    unsigned int tracknr;
+    bool_t valid;
+    /* The estimate explains at least 90% of intervals as a known encoding, 
+     * and may be used to rule out decoders of a different density. */
+    bool_t confident;
+    enum flux_encoding encoding;
+    unsigned int ns_per_cell;   /* 0 if unknown */
+    unsigned int explained;     /* % of intervals near a multiple of a cell */
+    uint32_t nr_samples;
+    uint32_t hist[FLUX_HIST_BINS];
+};
+
+/* Bitcells of a track which read differently on different revolutions. 
+ * Offsets are those of s->index_offset in the reference revolution. */
+struct stream_weak_map {
+    unsigned int nr_revs;  /* revolutions compared */
+    uint32_t bitlen;       /* length of the reference revolution */
+    uint32_t nr_weak;      /* number of weak bitcells */
+    uint64_t *map;         /* bitcell N is bit 63-(N%64) of map[N/64] */
+};
+
+/* One attempt to decode a track with a given format handler. */
+struct stream_profile_record {
+    uint16_t tracknr, type;  /* track number, enum track_type */
+    uint8_t pll_mode;        /* enum pll_mode */
+    bool_t accepted;
+    bool_t selected;         /* set by the caller if this result was kept */
+    uint64_t ns;             /* wall time of the attempt */
+    uint64_t io_ns;          /* ...of which selecting/loading the track */
+    uint64_t bit_ns;         /* ...of which producing bitcells (sampled) */
+    uint64_t flux_ns;        /* ...of which parsing flux (sampled) */
+    uint64_t bits;           /* bitcells consumed */
+    uint64_t flux;           /* flux samples parsed */
+    uint32_t resets;         /* stream resets */
+    uint32_t revs;           /* index pulses passed */
+};
+
+/* Profiling state, allocated by stream_enable_profiling(). The counters run
+ * for the life of the stream; each track decode attempt appends a record of
+ * their deltas. */
+struct stream_profile {
+    uint64_t io_ns, bit_ns, flux_ns, bits, flux;
+    uint32_t resets, revs;
+    uint64_t clock_ns;                  /* cost of reading the clock */
+    struct stream_profile_record start; /* counters when attempt began */
+    struct stream_profile_record *rec;
+    unsigned int nr_rec;
+};
+
 struct stream {
     const struct stream_type *type;
 
+    /* Profiling counters, or NULL if profiling is not enabled. */
+    struct stream_profile *prof;
+
+    /* Stream state at each index pulse of the current track, recorded as 
+     * the track is first decoded; NULL if the stream type cannot seek. */
+    struct stream_checkpoints *ckpt;
+
+    /* Flux histogram of the current track, computed on demand by 
+     * stream_flux_info(); NULL if the stream type has no flux. */
+    struct stream_flux_info *flux_info;
+
+    /* Hash of the current track's flux, computed on demand by 
+     * stream_flux_hash(); NULL if the stream type has neither flux nor a 
+     * track hash. */
+    struct stream_flux_hash *flux_hash;
+
     /* Accumulated read latency in nanosecs. Can be reset by the caller. */
     uint64_t latency;
 
@@ -36,6 +119,15 @@ struct stream {
     /* Number of index pulses seen so far. */
     uint32_t nr_index;
 
+    /* Stream ends when this many index pulses have been seen. */
+    uint32_t max_index;
+
+    /* Scan budget: a track decode attempt fails if none of its format's
+     * sync words is seen within this % of a revolution (0 = no limit). */
+    unsigned int scan_budget;
+    uint32_t budget_bits, budget_max_index;
+    const uint32_t *budget_sync;
+
     /* Most recent 32 bits read from the stream. */
     uint32_t word;
 
@@ -56,16 +148,56 @@ struct stream {
 struct stream *stream_open(const char *name);
 struct stream *stream_soft_open(
     uint8_t *data, uint16_t *speed, uint32_t bitlen);
+/* In-memory SCP flux for a single track: @nr_revs consecutive revolutions of 
+ * big-endian 25ns samples, with @nr_samples[i] samples in revolution i. The 
+ * data is not copied and must remain valid until the stream is closed. */
+struct stream *stream_scp_open_memory(
+    uint16_t *dat, const uint32_t *nr_samples, unsigned int nr_revs);
 void stream_close(struct stream *s);
+/* Archive the flux of tracks 0 to @nr_tracks-1 of @s as a libdisk flux 
+ * (.ldf) file. Returns -1 if @s is not a flux-based stream. */
+int stream_write_ldf(
+    struct stream *s, const char *name, unsigned int nr_tracks);
 int stream_select_track(struct stream *s, unsigned int tracknr);
 void stream_reset(struct stream *s);
 void stream_next_index(struct stream *s);
+/* Position the stream at the index pulse which starts revolution @rev 
+ * (revolution 0 starts where stream_reset() leaves the stream). Returns -1 
+ * if the stream ends first. O(1) if the pulse has been seen before. */
+int stream_seek_revolution(struct stream *s, unsigned int rev);
+/* Length of revolution @rev in bitcells, or 0 if the stream ends before it 
+ * completes. Leaves the stream at the start of revolution @rev+1. */
+uint32_t stream_revolution_bitlen(struct stream *s, unsigned int rev);
 int stream_next_bit(struct stream *s);
 int stream_next_bits(struct stream *s, unsigned int bits);
 int stream_next_bytes(struct stream *s, void *p, unsigned int bytes);
 void stream_start_crc(struct stream *s);
 enum pll_mode stream_pll_mode(struct stream *s, enum pll_mode pll_mode);
 void stream_set_density(struct stream *s, unsigned int ns_per_cell);
+void stream_enable_profiling(struct stream *s);
+unsigned int stream_scan_budget(struct stream *s, unsigned int percent);
+/* Histogram the current track's flux and estimate its encoding. Resets the 
+ * stream. Returns NULL for streams which are not flux-based. */
+const struct stream_flux_info *stream_flux_info(struct stream *s);
+const char *stream_flux_encoding_name(enum flux_encoding encoding);
+/* 128-bit hash of the current track's flux, including index pulse 
+ * positions. Resets the stream. Streams without flux may instead hash the 
+ * track data they decode; otherwise NULL is returned. */
+const uint8_t *stream_flux_hash(struct stream *s);
+/* Compare up to @nr_revs revolutions of the current track, from the second 
+ * onwards (the PLL may still be locking during the first). Revolutions are 
+ * aligned on each occurrence of @sync (16 bits if <= 0xffff, else 32). 
+ * Resets the stream. Returns NULL if fewer than two revolutions are 
+ * available. */
+struct stream_weak_map *stream_weak_map(
+    struct stream *s, uint32_t sync, unsigned int nr_revs);
+void stream_weak_map_free(struct stream_weak_map *m);
+/* Number of weak bitcells in [@off,@off+@len). */
+uint32_t stream_weak_count(
+    const struct stream_weak_map *m, uint32_t off, uint32_t len);
+/* Find the first run of weak bitcells at or after *@off: updates *@off to 
+ * its start and returns its length, or returns 0 if there is none. */
+uint32_t stream_weak_region(const struct stream_weak_map *m, uint32_t *off);
 #pragma GCC visibility pop
 
 #endif /* __LIBDISK_STREAM_H__ */
@@ -85,6 +85,9 @@ uint32_t crc32(const void *buf, size_t len);
 uint16_t crc16_ccitt(const void *buf, size_t len, uint16_t crc);
 uint16_t crc16_ccitt_bit(uint8_t b, uint16_t crc);
 
+/* 128-bit non-cryptographic hash of @len bytes at @dat. */
+void hash128(const void *dat, size_t len, uint8_t *hash);
+
 uint16_t rnd16(uint32_t *p_seed);
 
 #if !defined(__PLATFORM_HAS_ENDIAN_H__)
@@ -23,11 +23,13 @@ struct container;
 
 /* Private data relating to an open disk. */
 struct disk {
+    char *name;
     int fd;
     bool_t read_only;
     struct container *container;
     struct disk_info *di;
     struct disk_list_tag *tags;
+    struct block_cache *bcache;
 };
 
 /* How to interpret data being appended to a track buffer. */
@@ -78,10 +80,21 @@ enum track_density {
 };
 
 /* Track handler -- interface for various raw-bitcell analysers/encoders. */
+#define MAX_SYNCS 3
+
 struct track_handler {
+    /* Bump when a change alters the handler's decode results: this 
+     * invalidates cached analyses of the format (see cache.c). */
+    unsigned int version;
+    /* Decoding depends on other tracks' data: results are not cached. */
+    bool_t no_cache;
     enum track_density density;
     unsigned int bytes_per_sector;
     unsigned int nr_sectors;
+    /* Sync words, one of which must be found early in the track (see
+     * stream_scan_budget()). Values below 0x10000 match the last 16 bits
+     * read, others the last 32. Zero-terminated; none disables the budget. */
+    uint32_t sync[MAX_SYNCS+1];
     void *(*write_raw)(
         struct disk *, unsigned int tracknr, struct stream *);
     void (*read_raw)(
@@ -99,6 +112,23 @@ extern const struct track_handler *handlers[];
 /* Set up a track with defaults for a given track format. */
 void init_track_info(struct track_info *ti, enum track_type type);
 
+/* Analysis cache (see disk_set_cache_dir()). cache_key() fills @hash with 
+ * the key of decoding @tracknr of @s as @type, or returns -1 if the 
+ * analysis cannot be cached. cache_lookup() returns the cached result of 
+ * write_raw (0 or -1), having updated the track and disk tags to match, or 
+ * CACHE_MISS. */
+#define CACHE_MISS 1
+int cache_key(
+    struct disk *d, unsigned int tracknr, enum track_type type,
+    struct stream *s, uint8_t *hash);
+int cache_lookup(
+    struct disk *d, unsigned int tracknr, const uint8_t *hash);
+void cache_store(
+    struct disk *d, unsigned int tracknr, const uint8_t *hash, int rc);
+
+/* Write back and free the disk's block cache (see disk_block_read()). */
+void block_cache_close(struct disk *d);
+
 /* Container -- interface for a disk-image container format. */
 struct container {
     /* Create a brand new empty container. */
@@ -116,6 +146,7 @@ struct container {
 extern struct container container_adf;
 extern struct container container_eadf;
 extern struct container container_dsk;
+extern struct container container_dskm;
 extern struct container container_img;
 extern struct container container_ipf;
 extern struct container container_scp;
@@ -141,6 +172,18 @@ int ibm_scan_dam(struct stream *s);
 
 bool_t track_is_copylock(struct track_info *ti);
 
+/* Apply the stream's scan budget to a decode attempt, given a format's sync
+ * words and its expected revolution length. */
+void stream_arm_budget(
+    struct stream *s, const uint32_t *sync, uint32_t track_bits);
+void stream_disarm_budget(struct stream *s);
+
+/* Bracket a track decode attempt on a profiled stream (no-op otherwise). */
+void stream_profile_start(struct stream *s);
+void stream_profile_end(
+    struct stream *s, unsigned int tracknr, enum track_type type,
+    bool_t accepted);
+
 #define trk_warn(ti,trk,msg,a...) \
     printf("*** T%u: %s: " msg "\n", trk, (ti)->typename, ## a)
 
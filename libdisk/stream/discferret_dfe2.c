@@ -186,6 +186,24 @@ static void dfe2_reset(struct stream *s)
     lseek(dfss->fd, 0, SEEK_SET);
 }
 
+static void dfe2_save_pos(struct stream *s, struct stream_pos *pos)
+{
+    struct dfe2_stream *dfss = container_of(s, struct dfe2_stream, s);
+
+    pos->w[0] = dfss->dat_idx;
+    pos->w[1] = dfss->stream_idx;
+    pos->w[2] = dfss->index_pos;
+}
+
+static void dfe2_restore_pos(struct stream *s, const struct stream_pos *pos)
+{
+    struct dfe2_stream *dfss = container_of(s, struct dfe2_stream, s);
+
+    dfss->dat_idx = pos->w[0];
+    dfss->stream_idx = pos->w[1];
+    dfss->index_pos = pos->w[2];
+}
+
 static int dfe2_next_flux(struct stream *s)
 {
     struct dfe2_stream *dfss = container_of(s, struct dfe2_stream, s);
@@ -244,6 +262,8 @@ struct stream_type discferret_dfe2 = {
     .reset = dfe2_reset,
     .next_bit = flux_next_bit,
     .next_flux = dfe2_next_flux,
+    .save_pos = dfe2_save_pos,
+    .restore_pos = dfe2_restore_pos,
     .suffix = { "dfi", NULL }
 
 };
@@ -94,6 +94,25 @@ static void dr_reset(struct stream *s)
     drs->bpos = 0;
 }
 
+static void dr_save_pos(struct stream *s, struct stream_pos *pos)
+{
+    struct dr_stream *drs = container_of(s, struct dr_stream, s);
+
+    pos->w[0] = drs->dat_idx;
+    pos->w[1] = drs->b | (drs->bpos << 8);
+    pos->w[2] = drs->byte_latency;
+}
+
+static void dr_restore_pos(struct stream *s, const struct stream_pos *pos)
+{
+    struct dr_stream *drs = container_of(s, struct dr_stream, s);
+
+    drs->dat_idx = pos->w[0];
+    drs->b = (uint8_t)pos->w[1];
+    drs->bpos = (uint8_t)(pos->w[1] >> 8);
+    drs->byte_latency = pos->w[2];
+}
+
 static int dr_next_bit(struct stream *s)
 {
     struct dr_stream *drs = container_of(s, struct dr_stream, s);
@@ -126,6 +145,8 @@ struct stream_type diskread = {
     .select_track = dr_select_track,
     .reset = dr_reset,
     .next_bit = dr_next_bit,
+    .save_pos = dr_save_pos,
+    .restore_pos = dr_restore_pos,
     .suffix = { "dat", NULL }
 };
 
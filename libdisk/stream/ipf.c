@@ -0,0 +1,742 @@
+/*
+ * stream/ipf.c
+ * 
+ * Native decoder for SPS IPF images (see ipfinfo/ipf.txt), for images
+ * written by either the CAPS or the SPS encoder. Each track is decoded from
+ * its block descriptors into packed bitcells and a per-bitcell speed map.
+ * All state belongs to the stream, so any number of images may be decoded
+ * at once, in any number of threads or processes.
+ * 
+ * Images this decoder does not understand are left to libcapsimage (see
+ * stream/caps.c), which is tried next.
+ * 
+ * Written in 2026 by agent
+ */
+
+#include <libdisk/util.h>
+#include "private.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct ipf_header {
+    uint8_t id[4];
+    uint32_t len;
+    uint32_t crc;
+};
+
+struct ipf_img {
+    uint32_t cyl, head;
+    uint32_t dentype;  /* enum dentype */
+    uint32_t sigtype;  /* 1 */
+    uint32_t trksize;  /* ceil(trkbits/8) */
+    uint32_t startpos; /* floor(startbit/8) */
+    uint32_t startbit; /* bit offset from index of data start */
+    uint32_t databits; /* # raw MFM cells */
+    uint32_t gapbits;  /* # raw MFM cells */
+    uint32_t trkbits;  /* databits + gapbits */
+    uint32_t blkcnt;   /* e.g., 11 for DOS */
+    uint32_t process;  /* 0 */
+    uint32_t flags;    /* 0 (unless weak bits) */
+    uint32_t dat_chunk; /* id */
+    uint32_t reserved[3];
+};
+
+struct ipf_data {
+    uint32_t size;  /* ceil(bsize/8) */
+    uint32_t bsize; /* # bits of encoded stream data */
+    uint32_t dcrc;  /* data area crc */
+    uint32_t dat_chunk; /* id */
+};
+
+struct ipf_block {
+    uint32_t blockbits;  /* # raw MFM cells */
+    uint32_t gapbits;    /* # raw MFM cells */
+    uint32_t u[2];       /* CAPS: block/gap bytes; SPS: gapoffset/celltype */
+    uint32_t enctype;    /* 1 */
+    uint32_t flag;       /* enum blkflag */
+    uint32_t gapvalue;
+    uint32_t dataoffset; /* offset of data stream in data area */
+};
+
+/* Encoder types. */
+#define ENC_CAPS 1
+#define ENC_SPS  2
+
+/* Density type codes */
+enum dentype { denNoise=1, denUniform=2, denCopylock=3, denSpeedlock=6 };
+
+/* ipf_block.flag (SPS encoder only) */
+#define BLKF_FW_GAP  (1u<<0) /* forward gap stream */
+#define BLKF_BW_GAP  (1u<<1) /* backward gap stream */
+#define BLKF_DATABIT (1u<<2) /* data stream counts are in bits */
+
+/* Data stream chunk codes. */
+enum chkcode { chkEnd=0, chkSync, chkData, chkGap, chkRaw, chkFlaky };
+
+/* Gap stream chunk codes. */
+enum gapcode { gapEnd=0, gapLength, gapSample };
+
+/* A track's IMGE and DATA records, as found in the image file. */
+struct ipf_track {
+    struct ipf_img img;
+    const uint8_t *dat;
+    uint32_t dat_len;
+};
+
+struct ipf_stream {
+    struct stream s;
+    uint8_t *file;
+    uint32_t encoder;
+    unsigned int nr_tracks;
+    struct ipf_track *trk;
+
+    /* Current track info */
+    unsigned int track;
+    uint8_t *bits;
+    uint16_t *speed;      /* NULL if every bitcell is nominal */
+    uint32_t pos, bitlen, ns_per_cell;
+    bool_t has_weak_bits;
+    uint32_t prng_seed;
+    unsigned int rev;     /* revolutions since reset, for weak-bit seeding */
+};
+
+/* A track being decoded: bitcells in order from the start of block 0. */
+struct ipf_decode {
+    struct ipf_stream *ipfs;
+    uint8_t *bits;
+    uint32_t pos, lim, len;
+    int prev;             /* last data bit, for MFM clocking */
+};
+
+/* Parsed gap stream. Samples without a length are explicit loop samples. */
+struct gap_sample {
+    const uint8_t *dat;
+    uint32_t bits, len;
+    bool_t has_len;
+};
+
+struct gap_stream {
+    struct gap_sample *ent;
+    unsigned int nr;
+    int loop;             /* index of the sample to loop, or -1 */
+    bool_t explicit_loop;
+    uint32_t fixed;       /* data bits before any looping */
+};
+
+static uint32_t get_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void get_be32s(void *dst, const uint8_t *p, unsigned int nr)
+{
+    uint32_t *d = dst;
+    while (nr--) {
+        *d++ = get_be32(p);
+        p += 4;
+    }
+}
+
+/* Chunk header: code[4:0], count_len[7:5], then a big-endian count. */
+static int get_chunk(
+    const uint8_t **pp, const uint8_t *end, unsigned int *code,
+    uint32_t *count)
+{
+    const uint8_t *p = *pp;
+    unsigned int n;
+
+    if (p >= end)
+        return -1;
+    *code = *p & 0x1f;
+    n = *p++ >> 5;
+    if ((n > 4) || ((end - p) < n))
+        return -1;
+    for (*count = 0; n--; )
+        *count = (*count << 8) | *p++;
+    *pp = p;
+    return 0;
+}
+
+static void emit_cell(struct ipf_decode *dec, int bit)
+{
+    if (dec->pos < dec->lim) {
+        if (bit)
+            dec->bits[dec->pos >> 3] |= 0x80u >> (dec->pos & 7);
+        else
+            dec->bits[dec->pos >> 3] &= ~(0x80u >> (dec->pos & 7));
+    }
+    dec->pos++;
+    dec->prev = bit;
+}
+
+static void emit_mfm(struct ipf_decode *dec, int bit)
+{
+    emit_cell(dec, !(dec->prev | bit));
+    emit_cell(dec, bit);
+}
+
+static int sample_bit(const uint8_t *p, uint32_t i)
+{
+    return !!(p[i >> 3] & (0x80u >> (i & 7)));
+}
+
+static int decode_data_stream(
+    struct ipf_decode *dec, const struct ipf_block *blk,
+    const uint8_t *p, const uint8_t *end)
+{
+    struct ipf_stream *ipfs = dec->ipfs;
+    bool_t in_bits = (ipfs->encoder == ENC_SPS) &&
+        (blk->flag & BLKF_DATABIT);
+    unsigned int code;
+    uint32_t i, count;
+
+    for (;;) {
+        if (get_chunk(&p, end, &code, &count))
+            return -1;
+        if (code == chkEnd)
+            return 0;
+        if (!in_bits)
+            count *= 8;
+        switch (code) {
+        case chkSync: case chkRaw:
+            if ((end - p) < (count + 7) / 8)
+                return -1;
+            for (i = 0; i < count; i++)
+                emit_cell(dec, sample_bit(p, i));
+            p += (count + 7) / 8;
+            break;
+        case chkData: case chkGap:
+            if ((end - p) < (count + 7) / 8)
+                return -1;
+            for (i = 0; i < count; i++)
+                emit_mfm(dec, sample_bit(p, i));
+            p += (count + 7) / 8;
+            break;
+        case chkFlaky:
+            /* No stream data: a fresh random pattern on every revolution. */
+            for (i = 0; i < count; i++)
+                emit_mfm(dec, rnd16(&ipfs->prng_seed) & 1);
+            ipfs->has_weak_bits = 1;
+            break;
+        default:
+            return -1;
+        }
+    }
+}
+
+static int parse_gap_stream(
+    struct gap_stream *gs, bool_t backward,
+    const uint8_t **pp, const uint8_t *end)
+{
+    const uint8_t *p = *pp;
+    struct gap_sample *ent;
+    unsigned int code, i;
+    uint32_t count, len = 0;
+    bool_t has_len = 0;
+
+    gs->ent = memalloc(((end - p) / 2 + 1) * sizeof(*gs->ent));
+    gs->loop = -1;
+
+    for (;;) {
+        if (get_chunk(&p, end, &code, &count))
+            return -1;
+        if (code == gapEnd)
+            break;
+        if (code == gapLength) {
+            len = count;
+            has_len = 1;
+            continue;
+        }
+        if ((code != gapSample) || ((end - p) < (count + 7) / 8))
+            return -1;
+        ent = &gs->ent[gs->nr++];
+        ent->dat = p;
+        ent->bits = count;
+        ent->len = has_len ? len : count;
+        ent->has_len = has_len;
+        if (!has_len) {
+            gs->loop = gs->nr - 1;
+            gs->explicit_loop = 1;
+        }
+        p += (count + 7) / 8;
+        has_len = 0;
+    }
+
+    /* No explicit loop sample: loop the sample at the far end of the gap
+     * (the first sample of a backward stream, else the last). */
+    if ((gs->loop < 0) && gs->nr)
+        gs->loop = backward ? 0 : gs->nr - 1;
+    if ((gs->loop >= 0) && (gs->ent[gs->loop].bits == 0))
+        gs->loop = -1;
+
+    for (i = 0; i < gs->nr; i++)
+        gs->fixed += gs->ent[i].len;
+
+    *pp = p;
+    return 0;
+}
+
+/* Data bit @i of a gap stream's fixed portion. Backward streams are laid
+ * out so that each sample's repetitions end flush with its region. */
+static int gap_fixed_bit(const struct gap_stream *gs, bool_t backward,
+                         uint32_t i)
+{
+    const struct gap_sample *ent;
+    unsigned int j;
+
+    for (j = 0; j < gs->nr; j++) {
+        ent = &gs->ent[j];
+        if (i < ent->len)
+            break;
+        i -= ent->len;
+    }
+    if ((j == gs->nr) || (ent->bits == 0))
+        return 0;
+    if (backward)
+        i = (ent->bits - (ent->len - i) % ent->bits) % ent->bits;
+    else
+        i %= ent->bits;
+    return sample_bit(ent->dat, i);
+}
+
+/* Fill @n data bits of gap from a forward and a backward gap stream. The
+ * streams are truncated evenly if too long, and otherwise their loop
+ * samples fill the remainder, meeting in the middle (see ipf.txt). */
+static void fill_gap(
+    struct ipf_decode *dec, struct gap_stream *fw, struct gap_stream *bw,
+    uint32_t n)
+{
+    uint32_t f = fw->fixed, b = bw->fixed, rf = 0, rb = 0, cut, i;
+    uint32_t f_off = 0;  /* fixed backward bits truncated from the front */
+    const struct gap_sample *ls;
+
+    if ((f + b) >= n) {
+        cut = (f + b) - n;
+        if (cut / 2 > f) {
+            b -= cut - f;
+            f = 0;
+        } else if ((cut - cut / 2) > b) {
+            f -= cut - b;
+            b = 0;
+        } else {
+            f -= cut / 2;
+            b -= cut - cut / 2;
+        }
+        f_off = bw->fixed - b;
+    } else if ((fw->loop >= 0) && (bw->loop >= 0)) {
+        if (fw->explicit_loop && !bw->explicit_loop)
+            rf = n - f - b;
+        else if (bw->explicit_loop && !fw->explicit_loop)
+            rb = n - f - b;
+        else
+            rb = (n - f - b) - (rf = (n - f - b) / 2);
+    } else if (fw->loop >= 0) {
+        rf = n - f - b;
+    } else if (bw->loop >= 0) {
+        rb = n - f - b;
+    }
+
+    for (i = 0; i < f; i++)
+        emit_mfm(dec, gap_fixed_bit(fw, 0, i));
+    if (rf) {
+        ls = &fw->ent[fw->loop];
+        for (i = 0; i < rf; i++)
+            emit_mfm(dec, sample_bit(ls->dat, i % ls->bits));
+    }
+    for (i = f + rf + rb + b; i < n; i++)
+        emit_mfm(dec, 0);
+    if (rb) {
+        ls = &bw->ent[bw->loop];
+        for (i = 0; i < rb; i++)
+            emit_mfm(dec, sample_bit(
+                         ls->dat, (ls->bits - (rb - i) % ls->bits)
+                         % ls->bits));
+    }
+    for (i = 0; i < b; i++)
+        emit_mfm(dec, gap_fixed_bit(bw, 1, f_off + i));
+}
+
+static int decode_gap(
+    struct ipf_decode *dec, const struct ipf_block *blk,
+    const uint8_t *dat, uint32_t dat_len)
+{
+    struct ipf_stream *ipfs = dec->ipfs;
+    struct gap_stream fw = { 0 }, bw = { 0 };
+    struct gap_sample value;
+    const uint8_t *p, *end = dat + dat_len;
+    uint8_t gapvalue = blk->gapvalue;
+    int rc = -1;
+
+    fw.loop = bw.loop = -1;
+
+    if ((ipfs->encoder == ENC_SPS) &&
+        (blk->flag & (BLKF_FW_GAP|BLKF_BW_GAP))) {
+        if (blk->u[0] >= dat_len)
+            goto out;
+        p = dat + blk->u[0];
+        if ((blk->flag & BLKF_FW_GAP) && parse_gap_stream(&fw, 0, &p, end))
+            goto out;
+        if ((blk->flag & BLKF_BW_GAP) && parse_gap_stream(&bw, 1, &p, end))
+            goto out;
+    } else {
+        /* No gap streams: repeat the gap value forwards and backwards. */
+        value.dat = &gapvalue;
+        value.bits = value.len = 8;
+        value.has_len = 0;
+        fw.ent = &value;
+        fw.nr = fw.explicit_loop = 1;
+        fw.loop = 0;
+        fw.fixed = 8;
+        bw = fw;
+    }
+
+    fill_gap(dec, &fw, &bw, (blk->gapbits + 1) / 2);
+    rc = 0;
+
+out:
+    if (fw.ent != &value)
+        memfree(fw.ent);
+    if (bw.ent != &value)
+        memfree(bw.ent);
+    return rc;
+}
+
+/* Variable-density protections are not described by the image: apply the
+ * bitcell timings that libdisk's own handlers expect. */
+static void apply_density(
+    struct ipf_stream *ipfs, const struct ipf_img *img,
+    const uint32_t *blk_start, const struct ipf_block *blk, uint16_t *speed)
+{
+    unsigned int i, j, nr = img->blkcnt;
+    uint32_t start, end, word;
+    uint16_t sp;
+
+    for (i = 0; i < ipfs->bitlen; i++)
+        speed[i] = 1000u;
+
+    switch (img->dentype) {
+    case denCopylock:
+        /* Sync 0x8912 sector 5% faster; sync 0x8914 sector 5% slower. The
+         * change starts at the preceding sector's gap. */
+        for (i = 0; i < nr; i++) {
+            for (j = 0, word = 0, sp = 0; j < blk[i].blockbits; j++) {
+                word = (word << 1) | sample_bit(
+                    ipfs->bits, (blk_start[i] + j) % ipfs->bitlen);
+                if ((uint16_t)word == 0x8912)
+                    sp = 950u;
+                if ((uint16_t)word == 0x8914)
+                    sp = 1050u;
+                if (sp)
+                    break;
+            }
+            if (!sp)
+                continue;
+            j = (i + nr - 1) % nr;
+            start = blk_start[j] + blk[j].blockbits;
+            end = blk_start[i] + blk[i].blockbits;
+            for (; start != end; start = (start + 1) % ipfs->bitlen)
+                speed[start] = sp;
+        }
+        break;
+    case denSpeedlock:
+        /* Long then short bitcells, at a fixed distance from the index. */
+        for (i = 0; i < 640; i++) {
+            speed[(77824 + i) % ipfs->bitlen] = 1100u;
+            speed[(78464 + i) % ipfs->bitlen] = 900u;
+        }
+        break;
+    }
+}
+
+static int ipf_decode_track(struct ipf_stream *ipfs, unsigned int tracknr)
+{
+    const struct ipf_track *trk = &ipfs->trk[tracknr];
+    const struct ipf_img *img = &trk->img;
+    struct ipf_decode dec = { 0 };
+    struct ipf_block *blk;
+    uint32_t *blk_start, i, off;
+    uint16_t *speed = NULL;
+    int rc = -1;
+
+    if ((trk->dat == NULL) || (img->blkcnt == 0) ||
+        (trk->dat_len < img->blkcnt * sizeof(*blk)))
+        return -1;
+
+    blk = memalloc(img->blkcnt * sizeof(*blk));
+    blk_start = memalloc(img->blkcnt * sizeof(*blk_start));
+    get_be32s(blk, trk->dat, img->blkcnt * sizeof(*blk) / 4);
+    for (i = 0; i < img->blkcnt; i++)
+        dec.len += blk[i].blockbits + blk[i].gapbits;
+    if ((dec.len == 0) || (dec.len > (8u << 20)))
+        goto out;
+
+    dec.ipfs = ipfs;
+    dec.bits = memalloc((dec.len + 7) / 8);
+    ipfs->has_weak_bits = 0;
+
+    for (i = 0; i < img->blkcnt; i++) {
+        blk_start[i] = dec.pos;
+        dec.lim = dec.pos + blk[i].blockbits;
+        if (blk[i].blockbits != 0) {
+            if ((blk[i].dataoffset >= trk->dat_len) ||
+                decode_data_stream(&dec, &blk[i],
+                                   trk->dat + blk[i].dataoffset,
+                                   trk->dat + trk->dat_len))
+                goto out;
+        }
+        dec.pos = dec.lim;
+        dec.lim += blk[i].gapbits;
+        if ((blk[i].gapbits != 0) &&
+            decode_gap(&dec, &blk[i], trk->dat, trk->dat_len))
+            goto out;
+        dec.pos = dec.lim;
+    }
+
+    /* Rotate so that block 0 starts @startbit cells after the index. */
+    memfree(ipfs->bits);
+    memfree(ipfs->speed);
+    ipfs->bitlen = dec.len;
+    ipfs->bits = memalloc((dec.len + 7) / 8);
+    ipfs->speed = NULL;
+    off = img->startbit % dec.len;
+    for (i = 0; i < dec.len; i++)
+        if (sample_bit(dec.bits, i))
+            ipfs->bits[(off + i) % dec.len >> 3] |=
+                0x80u >> ((off + i) % dec.len & 7);
+    for (i = 0; i < img->blkcnt; i++)
+        blk_start[i] = (blk_start[i] + off) % dec.len;
+
+    if ((img->dentype == denCopylock) || (img->dentype == denSpeedlock)) {
+        speed = memalloc(dec.len * sizeof(*speed));
+        apply_density(ipfs, img, blk_start, blk, speed);
+        ipfs->speed = speed;
+    }
+
+    ipfs->ns_per_cell = 200000000u / ipfs->bitlen;
+    rc = 0;
+
+out:
+    if (rc)
+        warnx("ipf: T%u: Bad track data", tracknr);
+    memfree(dec.bits);
+    memfree(blk_start);
+    memfree(blk);
+    return rc;
+}
+
+static struct stream *ipf_open(const char *name)
+{
+    struct ipf_stream *ipfs;
+    struct ipf_header hdr;
+    struct ipf_data data;
+    struct ipf_img img;
+    struct stat sbuf;
+    uint8_t *p, *end, *file;
+    uint32_t crc, len, encoder = 0;
+    unsigned int i, tracknr;
+    int fd;
+
+    if ((fd = file_open(name, O_RDONLY)) == -1)
+        return NULL;
+    if ((fstat(fd, &sbuf) < 0) || (sbuf.st_size < sizeof(hdr))) {
+        close(fd);
+        return NULL;
+    }
+    file = memalloc(sbuf.st_size);
+    read_exact(fd, file, sbuf.st_size);
+    close(fd);
+    if (strncmp((char *)file, "CAPS", 4)) {
+        memfree(file);
+        return NULL;
+    }
+
+    ipfs = memalloc(sizeof(*ipfs));
+    ipfs->file = file;
+    ipfs->track = ~0u;
+
+    for (p = file, end = file + sbuf.st_size; (end - p) >= sizeof(hdr); ) {
+        memcpy(&hdr, p, sizeof(hdr));
+        if (hdr.id[0] == '\0')
+            break;
+        len = be32toh(hdr.len);
+        if ((len < sizeof(hdr)) || (len > (end - p)))
+            goto bad;
+        crc = be32toh(hdr.crc);
+        hdr.crc = 0;
+        if (crc32_add(p + sizeof(hdr), len - sizeof(hdr),
+                      crc32(&hdr, sizeof(hdr))) != crc)
+            goto bad;
+
+        if (!strncmp((char *)hdr.id, "INFO", 4)) {
+            if (len < sizeof(hdr) + 8)
+                goto bad;
+            encoder = get_be32(p + sizeof(hdr) + 4);
+        } else if (!strncmp((char *)hdr.id, "IMGE", 4)) {
+            if (len != sizeof(hdr) + sizeof(img))
+                goto bad;
+            get_be32s(&img, p + sizeof(hdr), sizeof(img) / 4);
+            tracknr = img.cyl * 2 + img.head;
+            if ((img.head > 1) || (tracknr > 255))
+                goto bad;
+            if (tracknr >= ipfs->nr_tracks) {
+                struct ipf_track *trk = memalloc((tracknr + 1)
+                                                 * sizeof(*trk));
+                memcpy(trk, ipfs->trk, ipfs->nr_tracks * sizeof(*trk));
+                memfree(ipfs->trk);
+                ipfs->trk = trk;
+                ipfs->nr_tracks = tracknr + 1;
+            }
+            ipfs->trk[tracknr].img = img;
+        } else if (!strncmp((char *)hdr.id, "DATA", 4)) {
+            /* The data area follows the record, outside its length. */
+            if (len != sizeof(hdr) + sizeof(data))
+                goto bad;
+            get_be32s(&data, p + sizeof(hdr), sizeof(data) / 4);
+            if ((data.size > (end - p - len)) ||
+                (data.size && (crc32(p + len, data.size) != data.dcrc)))
+                goto bad;
+            for (i = 0; i < ipfs->nr_tracks; i++) {
+                if (ipfs->trk[i].img.dat_chunk != data.dat_chunk)
+                    continue;
+                ipfs->trk[i].dat = p + len;
+                ipfs->trk[i].dat_len = data.size;
+            }
+            len += data.size;
+        }
+
+        p += len;
+    }
+
+    if ((encoder != ENC_CAPS) && (encoder != ENC_SPS)) {
+        warnx("ipf: Unknown encoder type %u", encoder);
+        goto fail;
+    }
+    ipfs->encoder = encoder;
+
+    return &ipfs->s;
+
+bad:
+    warnx("ipf: Bad %.4s record at offset %lu", (char *)hdr.id,
+          (unsigned long)(p - file));
+fail:
+    memfree(ipfs->trk);
+    memfree(ipfs);
+    memfree(file);
+    return NULL;
+}
+
+static void ipf_close(struct stream *s)
+{
+    struct ipf_stream *ipfs = container_of(s, struct ipf_stream, s);
+    memfree(ipfs->bits);
+    memfree(ipfs->speed);
+    memfree(ipfs->trk);
+    memfree(ipfs->file);
+    memfree(ipfs);
+}
+
+static uint32_t ipf_seed(unsigned int tracknr, unsigned int rev)
+{
+    return (0x12345678u ^ tracknr) + rev * 0x9e3779b9u;
+}
+
+static int ipf_select_track(struct stream *s, unsigned int tracknr)
+{
+    struct ipf_stream *ipfs = container_of(s, struct ipf_stream, s);
+
+    if (ipfs->track == tracknr)
+        return 0;
+
+    ipfs->track = ~0u;
+    if ((tracknr >= ipfs->nr_tracks) ||
+        (ipfs->trk[tracknr].img.dentype == denNoise))
+        return -1;
+
+    ipfs->rev = 0;
+    ipfs->prng_seed = ipf_seed(tracknr, 0);
+    if (ipf_decode_track(ipfs, tracknr))
+        return -1;
+
+    ipfs->track = tracknr;
+    return 0;
+}
+
+/* Start revolution @rev since reset. Weak bits are a function of the track 
+ * and revolution alone, so that every analysis of a track sees the same 
+ * data however many have gone before it. */
+static void ipf_start_rev(struct stream *s, unsigned int rev)
+{
+    struct ipf_stream *ipfs = container_of(s, struct ipf_stream, s);
+
+    ipfs->rev = rev;
+    if (ipfs->has_weak_bits) {
+        ipfs->prng_seed = ipf_seed(ipfs->track, rev);
+        if (ipf_decode_track(ipfs, ipfs->track))
+            BUG();
+    }
+
+    index_reset(s);
+    ipfs->pos = 0;
+}
+
+static void ipf_reset(struct stream *s)
+{
+    ipf_start_rev(s, 0);
+}
+
+static int ipf_next_bit(struct stream *s)
+{
+    struct ipf_stream *ipfs = container_of(s, struct ipf_stream, s);
+    uint16_t speed;
+
+    if (++ipfs->pos >= ipfs->bitlen)
+        ipf_start_rev(s, ipfs->rev + 1);
+
+    speed = ipfs->speed ? ipfs->speed[ipfs->pos] : 1000u;
+    s->latency += (ipfs->ns_per_cell * speed) / 1000u;
+
+    return sample_bit(ipfs->bits, ipfs->pos);
+}
+
+static int ipf_track_hash(struct stream *s, uint8_t *hash)
+{
+    struct ipf_stream *ipfs = container_of(s, struct ipf_stream, s);
+    const struct ipf_track *trk = &ipfs->trk[ipfs->track];
+    struct {
+        struct ipf_img img;
+        uint32_t encoder, max_index;
+        uint8_t dat[16];
+    } key;
+
+    memset(&key, 0, sizeof(key));
+    key.img = trk->img;
+    key.img.dat_chunk = 0;
+    key.encoder = ipfs->encoder;
+    key.max_index = s->max_index;
+    hash128(trk->dat, trk->dat_len, key.dat);
+    hash128(&key, sizeof(key), hash);
+    return 0;
+}
+
+struct stream_type ipf = {
+    .open = ipf_open,
+    .close = ipf_close,
+    .select_track = ipf_select_track,
+    .reset = ipf_reset,
+    .next_bit = ipf_next_bit,
+    .track_hash = ipf_track_hash,
+    .suffix = { "ipf", NULL }
+};
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -104,6 +104,24 @@ static void kfs_reset(struct stream *s)
     kfss->index_pos = ~0u;
 }
 
+static void kfs_save_pos(struct stream *s, struct stream_pos *pos)
+{
+    struct kfs_stream *kfss = container_of(s, struct kfs_stream, s);
+
+    pos->w[0] = kfss->dat_idx;
+    pos->w[1] = kfss->stream_idx;
+    pos->w[2] = kfss->index_pos;
+}
+
+static void kfs_restore_pos(struct stream *s, const struct stream_pos *pos)
+{
+    struct kfs_stream *kfss = container_of(s, struct kfs_stream, s);
+
+    kfss->dat_idx = pos->w[0];
+    kfss->stream_idx = pos->w[1];
+    kfss->index_pos = pos->w[2];
+}
+
 static int kfs_next_flux(struct stream *s)
 {
     struct kfs_stream *kfss = container_of(s, struct kfs_stream, s);
@@ -182,7 +200,9 @@ struct stream_type kryoflux_stream = {
     .select_track = kfs_select_track,
     .reset = kfs_reset,
     .next_bit = flux_next_bit,
-    .next_flux = kfs_next_flux
+    .next_flux = kfs_next_flux,
+    .save_pos = kfs_save_pos,
+    .restore_pos = kfs_restore_pos
 };
 
 /*
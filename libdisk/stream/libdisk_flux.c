@@ -0,0 +1,425 @@
+/*
+ * stream/libdisk_flux.c
+ * 
+ * Libdisk flux archive (LDF): a compact, seekable container for the flux
+ * of any flux-based stream.
+ * 
+ * File Format:
+ *  <struct ldf_header>
+ *  <uint32_t track_offset> * #tracks (0 = track not present)
+ *  Per track:
+ *   <struct ldf_track>
+ *   <struct ldf_seg> * #segments
+ *   <encoded flux samples>
+ * All fields are big endian (network ordering).
+ * 
+ * Segment 0 holds flux before the first index pulse (often empty), and
+ * segment N the flux following index pulse N. Each segment is coded
+ * independently, so any revolution can be decoded without its predecessors.
+ * 
+ * A sample is a flux interval of V ticks. It is coded relative to the
+ * nearest of three nominal intervals, K*cell for K in [k0,k0+2], as a class
+ * (1-3) and a zigzag-coded residual R; or, if no nominal interval is near,
+ * as class 0 with R = V. The first byte is <class:2><more:1><R[4:0]:5>,
+ * followed, if more is set, by R>>5 as an LEB128 varint. Typical jitter
+ * fits in the first byte, so a sample usually takes one byte.
+ * 
+ * Written in 2026 by agent
+ */
+
+#include <libdisk/util.h>
+#include "private.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct ldf_header {
+    char signature[4]; /* "LDF\0" */
+    uint16_t version;
+    uint16_t nr_tracks;
+};
+
+struct ldf_track {
+    uint32_t tick_ns;    /* sample unit */
+    uint32_t cell;       /* nominal bitcell, in ticks (0 = none) */
+    uint16_t max_index;  /* index pulses at which the source stream ends */
+    uint8_t k0;          /* bitcells in the shortest nominal interval */
+    uint8_t nr_segs;
+    uint32_t len;        /* bytes of encoded samples */
+};
+
+struct ldf_seg {
+    uint32_t nr_samples;
+    uint32_t nr_bytes;
+};
+
+struct ldf_stream {
+    struct stream s;
+    int fd;
+
+    unsigned int nr_tracks;
+    uint32_t *track_off;
+
+    /* Current track: encoded samples, and those decoded so far. */
+    unsigned int track;
+    uint8_t *dat;
+    uint32_t *flux;
+    uint32_t tick, cell;
+    unsigned int k0, nr_segs, nr_decoded;
+    struct {
+        uint32_t dat_off, flux_off;
+    } *seg;  /* seg[nr_segs] marks the end of the data */
+
+    /* Current position. */
+    unsigned int seg_idx;
+    uint32_t flux_idx;
+};
+
+static uint32_t zigzag(int32_t x)
+{
+    return ((uint32_t)x << 1) ^ (uint32_t)(x >> 31);
+}
+
+static int32_t unzigzag(uint32_t x)
+{
+    return (int32_t)(x >> 1) ^ -(int32_t)(x & 1);
+}
+
+static uint8_t *encode_sample(
+    uint8_t *p, uint32_t v, uint32_t cell, unsigned int k0)
+{
+    unsigned int cls = 0;
+    uint32_t k, z = v;
+
+    if (cell != 0) {
+        k = (v + cell/2) / cell;
+        if ((k >= k0) && (k <= k0 + 2)) {
+            cls = k - k0 + 1;
+            z = zigzag((int32_t)(v - k * cell));
+        }
+    }
+
+    *p = (cls << 6) | (z & 0x1f);
+    z >>= 5;
+    if (z == 0)
+        return p + 1;
+    *p++ |= 0x20;
+    while (z >= 0x80) {
+        *p++ = z | 0x80;
+        z >>= 7;
+    }
+    *p++ = z;
+    return p;
+}
+
+static void ldf_decode_seg(struct ldf_stream *ldfs, unsigned int seg)
+{
+    const uint8_t *p = &ldfs->dat[ldfs->seg[seg].dat_off];
+    uint32_t *f = &ldfs->flux[ldfs->seg[seg].flux_off];
+    const uint8_t *pend = &ldfs->dat[ldfs->seg[seg+1].dat_off];
+    uint32_t *end = &ldfs->flux[ldfs->seg[seg+1].flux_off];
+    uint32_t z, cell = ldfs->cell, tick = ldfs->tick;
+    unsigned int b, sh, k0 = ldfs->k0 - 1;
+
+    /* A corrupt segment decodes short, as zero-length intervals. */
+    while ((f != end) && (p < pend)) {
+        b = *p++;
+        z = b & 0x1f;
+        if (b & 0x20) {
+            sh = 5;
+            do {
+                z |= (uint32_t)(*p & 0x7f) << sh;
+                sh += 7;
+            } while (*p++ & 0x80);
+        }
+        if (b >>= 6)
+            z = (k0 + b) * cell + unzigzag(z);
+        *f++ = z * tick;
+    }
+}
+
+/* Decode segments in order, up to and including @seg. */
+static void ldf_decode_to(struct ldf_stream *ldfs, unsigned int seg)
+{
+    while (ldfs->nr_decoded <= seg)
+        ldf_decode_seg(ldfs, ldfs->nr_decoded++);
+}
+
+static struct stream *ldf_open(const char *name)
+{
+    struct stat sbuf;
+    struct ldf_stream *ldfs;
+    struct ldf_header hdr;
+    unsigned int i;
+    int fd;
+
+    if (stat(name, &sbuf) < 0)
+        return NULL;
+
+    if ((fd = file_open(name, O_RDONLY)) == -1)
+        err(1, "%s", name);
+
+    read_exact(fd, &hdr, sizeof(hdr));
+    if (strncmp(hdr.signature, "LDF\0", 4) || (be16toh(hdr.version) != 0))
+        errx(1, "%s is not a libdisk flux archive!", name);
+
+    ldfs = memalloc(sizeof(*ldfs));
+    ldfs->fd = fd;
+    ldfs->nr_tracks = be16toh(hdr.nr_tracks);
+    ldfs->track_off = memalloc(ldfs->nr_tracks * sizeof(uint32_t));
+    read_exact(fd, ldfs->track_off, ldfs->nr_tracks * sizeof(uint32_t));
+    for (i = 0; i < ldfs->nr_tracks; i++)
+        ldfs->track_off[i] = be32toh(ldfs->track_off[i]);
+    ldfs->track = ~0u;
+
+    return &ldfs->s;
+}
+
+static void ldf_free_track(struct ldf_stream *ldfs)
+{
+    memfree(ldfs->dat);
+    memfree(ldfs->flux);
+    memfree(ldfs->seg);
+    ldfs->dat = NULL;
+    ldfs->flux = NULL;
+    ldfs->seg = NULL;
+    ldfs->nr_segs = 0;
+    ldfs->track = ~0u;
+}
+
+static void ldf_close(struct stream *s)
+{
+    struct ldf_stream *ldfs = container_of(s, struct ldf_stream, s);
+
+    ldf_free_track(ldfs);
+    close(ldfs->fd);
+    memfree(ldfs->track_off);
+    memfree(ldfs);
+}
+
+static int ldf_select_track(struct stream *s, unsigned int tracknr)
+{
+    struct ldf_stream *ldfs = container_of(s, struct ldf_stream, s);
+    struct ldf_track thdr;
+    struct ldf_seg seg;
+    uint32_t dat_off = 0, flux_off = 0;
+    unsigned int i;
+    off_t off;
+
+    if (ldfs->track == tracknr)
+        return 0;
+
+    ldf_free_track(ldfs);
+
+    if ((tracknr >= ldfs->nr_tracks) || !ldfs->track_off[tracknr])
+        return -1;
+
+    off = ldfs->track_off[tracknr];
+    if (lseek(ldfs->fd, off, SEEK_SET) != off)
+        return -1;
+
+    read_exact(ldfs->fd, &thdr, sizeof(thdr));
+    ldfs->tick = be32toh(thdr.tick_ns);
+    ldfs->cell = be32toh(thdr.cell);
+    ldfs->k0 = thdr.k0;
+    ldfs->nr_segs = thdr.nr_segs;
+    if (ldfs->nr_segs == 0)
+        return -1;
+
+    ldfs->seg = memalloc((ldfs->nr_segs + 1) * sizeof(*ldfs->seg));
+    for (i = 0; i < ldfs->nr_segs; i++) {
+        read_exact(ldfs->fd, &seg, sizeof(seg));
+        ldfs->seg[i].dat_off = dat_off;
+        ldfs->seg[i].flux_off = flux_off;
+        dat_off += be32toh(seg.nr_bytes);
+        flux_off += be32toh(seg.nr_samples);
+    }
+    ldfs->seg[i].dat_off = dat_off;
+    ldfs->seg[i].flux_off = flux_off;
+
+    if (dat_off != be32toh(thdr.len)) {
+        ldf_free_track(ldfs);
+        return -1;
+    }
+
+    /* Padding allows a truncated final sample to be decoded. */
+    ldfs->dat = memalloc(dat_off + 8);
+    read_exact(ldfs->fd, ldfs->dat, dat_off);
+    ldfs->flux = memalloc((flux_off ? : 1) * sizeof(uint32_t));
+    ldfs->nr_decoded = 0;
+
+    ldfs->track = tracknr;
+    s->max_index = be16toh(thdr.max_index);
+
+    return 0;
+}
+
+static void ldf_reset(struct stream *s)
+{
+    struct ldf_stream *ldfs = container_of(s, struct ldf_stream, s);
+
+    ldfs->seg_idx = 0;
+    ldfs->flux_idx = 0;
+    if (ldfs->nr_segs != 0)
+        ldf_decode_to(ldfs, 0);
+}
+
+static void ldf_save_pos(struct stream *s, struct stream_pos *pos)
+{
+    struct ldf_stream *ldfs = container_of(s, struct ldf_stream, s);
+
+    pos->w[0] = ldfs->flux_idx;
+    pos->w[1] = ldfs->seg_idx;
+}
+
+/* Segments before a checkpoint have been decoded already. */
+static void ldf_restore_pos(struct stream *s, const struct stream_pos *pos)
+{
+    struct ldf_stream *ldfs = container_of(s, struct ldf_stream, s);
+
+    ldfs->flux_idx = pos->w[0];
+    ldfs->seg_idx = pos->w[1];
+}
+
+static int ldf_next_flux(struct stream *s)
+{
+    struct ldf_stream *ldfs = container_of(s, struct ldf_stream, s);
+
+    if (ldfs->nr_segs == 0)
+        return -1;
+
+    while (ldfs->flux_idx >= ldfs->seg[ldfs->seg_idx+1].flux_off) {
+        if ((ldfs->seg_idx + 1) >= ldfs->nr_segs)
+            return -1;
+        ldf_decode_to(ldfs, ++ldfs->seg_idx);
+        index_reset(s);
+    }
+
+    return (int)ldfs->flux[ldfs->flux_idx++];
+}
+
+struct stream_type libdisk_flux = {
+    .open = ldf_open,
+    .close = ldf_close,
+    .select_track = ldf_select_track,
+    .reset = ldf_reset,
+    .next_bit = flux_next_bit,
+    .next_flux = ldf_next_flux,
+    .save_pos = ldf_save_pos,
+    .restore_pos = ldf_restore_pos,
+    .suffix = { "ldf", NULL }
+};
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    uint32_t t;
+    while (b != 0) {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static void write_track(int fd, struct stream *s, struct flux_buf *fb)
+{
+    const struct stream_flux_info *fi = stream_flux_info(s);
+    uint32_t *flux;
+    uint32_t nr_samples[MAX_FLUX_SEGS], tick = 0, cell = 0, i, j, n;
+    struct ldf_track thdr;
+    struct ldf_seg seg[MAX_FLUX_SEGS];
+    unsigned int k0, nr_segs;
+    uint8_t *dat, *p, *q;
+
+    nr_segs = stream_capture_flux(s, fb, nr_samples);
+    flux = fb->p;
+    for (i = n = 0; i < nr_segs; i++)
+        n += nr_samples[i];
+
+    /* Samples are stored in the largest unit which loses nothing. */
+    for (i = 0; i < n; i++)
+        tick = gcd(flux[i], tick);
+    tick = tick ? : 1;
+
+    k0 = ((fi != NULL) && (fi->encoding == FLUXENC_mfm)) ? 2 : 1;
+    if ((fi != NULL) && fi->ns_per_cell)
+        cell = (fi->ns_per_cell + tick/2) / tick;
+
+    /* An LEB128 varint of 32 bits, plus the first byte, never exceeds 6. */
+    p = dat = memalloc(n * 6 + 1);
+    for (i = j = 0; i < nr_segs; i++) {
+        q = p;
+        for (n = nr_samples[i]; n != 0; n--)
+            p = encode_sample(p, flux[j++] / tick, cell, k0);
+        seg[i].nr_samples = htobe32(nr_samples[i]);
+        seg[i].nr_bytes = htobe32(p - q);
+    }
+
+    memset(&thdr, 0, sizeof(thdr));
+    thdr.tick_ns = htobe32(tick);
+    thdr.cell = htobe32(cell);
+    thdr.max_index = htobe16(min_t(uint32_t, s->max_index, 0xffffu));
+    thdr.k0 = k0;
+    thdr.nr_segs = nr_segs;
+    thdr.len = htobe32(p - dat);
+    write_exact(fd, &thdr, sizeof(thdr));
+    write_exact(fd, seg, nr_segs * sizeof(seg[0]));
+    write_exact(fd, dat, p - dat);
+
+    memfree(dat);
+    stream_reset(s);
+}
+
+int stream_write_ldf(
+    struct stream *s, const char *name, unsigned int nr_tracks)
+{
+    struct flux_buf fb = { 0 };
+    struct ldf_header hdr;
+    uint32_t *track_off;
+    unsigned int i;
+    off_t off;
+    int fd;
+
+    if (s->type->next_flux == NULL)
+        return -1;
+
+    if ((fd = file_open(name, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1)
+        err(1, "%s", name);
+
+    strncpy(hdr.signature, "LDF\0", 4);
+    hdr.version = 0;
+    hdr.nr_tracks = htobe16(nr_tracks);
+    write_exact(fd, &hdr, sizeof(hdr));
+
+    track_off = memalloc(nr_tracks * sizeof(uint32_t));
+    write_exact(fd, track_off, nr_tracks * sizeof(uint32_t));
+
+    for (i = 0; i < nr_tracks; i++) {
+        if (stream_select_track(s, i) != 0)
+            continue;
+        off = lseek(fd, 0, SEEK_CUR);
+        track_off[i] = htobe32(off);
+        write_track(fd, s, &fb);
+    }
+
+    lseek(fd, sizeof(hdr), SEEK_SET);
+    write_exact(fd, track_off, nr_tracks * sizeof(uint32_t));
+    if (close(fd) != 0)
+        err(1, "%s", name);
+
+    memfree(fb.p);
+    memfree(track_off);
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
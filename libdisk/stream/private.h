@@ -3,6 +3,11 @@
 
 #include <libdisk/stream.h>
 
+/* A stream type's position within the current track's data. */
+struct stream_pos {
+    uint32_t w[4];
+};
+
 struct stream_type {
     struct stream *(*open)(const char *name);
     void (*close)(struct stream *);
@@ -10,9 +15,37 @@ struct stream_type {
     void (*reset)(struct stream *);
     int (*next_bit)(struct stream *);
     int (*next_flux)(struct stream *);
+    /* Optional: save/restore the position between two calls to next_flux 
+     * (or next_bit). Needed for revolution checkpoints. */
+    void (*save_pos)(struct stream *, struct stream_pos *);
+    void (*restore_pos)(struct stream *, const struct stream_pos *);
+    /* Optional, for streams without flux: hash the current track's data, 
+     * standing in for the flux hash (see stream_flux_hash()). */
+    int (*track_hash)(struct stream *, uint8_t *hash);
     const char *suffix[];
 };
 
+/* Default limit on index pulses per track (see struct stream). */
+#define STREAM_DEFAULT_INDEX 5
+
+/* Flux of the current track, captured by stream_capture_flux(). */
+struct flux_buf {
+    uint32_t *p;
+    uint32_t nr, max;
+};
+
+/* Limits on a track's captured flux. */
+#define MAX_FLUX_SEGS    255
+#define MAX_FLUX_SAMPLES (8u << 20)
+
+void stream_setup(struct stream *s, const struct stream_type *st);
+/* Capture the current track's flux intervals, as the stream would present 
+ * them, into @fb. Segment 0 is the flux before the first index pulse, and 
+ * segment N that following pulse N, up to pulse max_index. Returns the 
+ * number of segments, and the samples in each in @nr_samples. The stream 
+ * must be reset before it is used again. */
+unsigned int stream_capture_flux(
+    struct stream *s, struct flux_buf *fb, uint32_t *nr_samples);
 void index_reset(struct stream *s);
 int flux_next_bit(struct stream *s);
 
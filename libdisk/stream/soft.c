@@ -68,7 +68,7 @@ struct stream *stream_soft_open(
     ss->bitlen = bitlen;
     ss->ns_per_cell = 200000000u / ss->bitlen;
 
-    ss->s.type = &stream_soft;
+    stream_setup(&ss->s, &stream_soft);
 
     return &ss->s;
 }
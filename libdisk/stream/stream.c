@@ -11,6 +11,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <libdisk/util.h>
 #include "private.h"
@@ -22,20 +23,60 @@
 #define CLOCK_MIN(_c) (((_c) * (100 - CLOCK_MAX_ADJ)) / 100)
 #define CLOCK_MAX(_c) (((_c) * (100 + CLOCK_MAX_ADJ)) / 100)
 
+/* Profiling: time one in every N bitcells and flux samples (power of 2). */
+#define PROFILE_BIT_SAMPLE  256
+#define PROFILE_FLUX_SAMPLE 64
+
+/* Stream state just after an index pulse. */
+struct stream_checkpoint {
+    struct stream_pos pos;
+    int flux, clock;
+    unsigned int clocked_zeros;
+    uint32_t word, track_bitlen;
+    uint16_t crc16_ccitt;
+    uint8_t crc_bitoff;
+};
+
+/* Decoding a track from its start is deterministic for a given PLL mode and 
+ * clock, so the state at each index pulse can be recorded on the first pass 
+ * and restored thereafter, in place of walking the track bit by bit. */
+struct stream_checkpoints {
+    /* Checkpoints are valid for this track, PLL mode and clock. */
+    unsigned int tracknr;
+    enum pll_mode pll_mode;
+    int clock_centre;
+    /* Has the stream run from a reset with the above parameters? */
+    bool_t clean;
+    /* ent[i] is the stream state at index pulse i+1. */
+    unsigned int nr, max;
+    struct stream_checkpoint *ent;
+};
+
+/* Hash of a track's flux. */
+struct stream_flux_hash {
+    unsigned int tracknr;
+    bool_t valid;
+    uint8_t hash[16];
+};
+
 extern struct stream_type kryoflux_stream;
 extern struct stream_type diskread;
 extern struct stream_type disk_image;
+extern struct stream_type ipf;
 extern struct stream_type caps;
 extern struct stream_type discferret_dfe2;
 extern struct stream_type supercard_scp;
+extern struct stream_type libdisk_flux;
 
 const static struct stream_type *stream_type[] = {
     &kryoflux_stream,
     &diskread,
     &disk_image,
+    &ipf,
     &caps,
     &discferret_dfe2,
     &supercard_scp,
+    &libdisk_flux,
     NULL
 };
 
@@ -57,10 +98,14 @@ struct stream *stream_open(const char *name)
         return NULL;
     suffix++;
 
+    /* Several types may claim a suffix: each is tried in turn. */
     for (i = 0; (st = stream_type[i]) != NULL; i++) {
         for (suffix_list = st->suffix; *suffix_list != NULL; suffix_list++) {
-            if (!strcmp(suffix, *suffix_list))
-                goto found;
+            if (strcmp(suffix, *suffix_list))
+                continue;
+            if ((s = st->open(name)) != NULL)
+                goto setup;
+            break;
         }
     }
 
@@ -70,29 +115,159 @@ found:
     if ((s = st->open(name)) == NULL)
         return NULL;
 
+setup:
+    stream_setup(s, st);
+
+    return s;
+}
+
+void stream_setup(struct stream *s, const struct stream_type *st)
+{
     s->type = st;
+    s->max_index = STREAM_DEFAULT_INDEX;
+    s->scan_budget = STREAM_DEFAULT_BUDGET;
 
     /* Flux-based streams */
     s->pll_mode = PLL_default;
     s->clock = s->clock_centre = CLOCK_CENTRE;
 
-    return s;
+    if (st->save_pos != NULL) {
+        s->ckpt = memalloc(sizeof(*s->ckpt));
+        s->ckpt->tracknr = ~0u;
+    }
+
+    if (st->next_flux != NULL) {
+        s->flux_info = memalloc(sizeof(*s->flux_info));
+        s->flux_info->tracknr = ~0u;
+    }
+
+    if ((st->next_flux != NULL) || (st->track_hash != NULL)) {
+        s->flux_hash = memalloc(sizeof(*s->flux_hash));
+        s->flux_hash->tracknr = ~0u;
+    }
 }
 
 void stream_close(struct stream *s)
 {
+    if (s->prof != NULL) {
+        memfree(s->prof->rec);
+        memfree(s->prof);
+    }
+    if (s->ckpt != NULL) {
+        memfree(s->ckpt->ent);
+        memfree(s->ckpt);
+    }
+    memfree(s->flux_info);
+    memfree(s->flux_hash);
     s->type->close(s);
 }
 
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
 int stream_select_track(struct stream *s, unsigned int tracknr)
 {
+    uint64_t t = s->prof ? now_ns() : 0;
     int rc = s->type->select_track(s, tracknr);
-    if (rc)
+    if (s->prof)
+        s->prof->io_ns += now_ns() - t;
+    if (rc) {
+        /* The stream may have dropped what it had loaded of the previous 
+         * track, so its checkpoints can no longer be trusted. */
+        if (s->ckpt != NULL) {
+            s->ckpt->tracknr = ~0u;
+            s->ckpt->nr = 0;
+        }
         return rc;
+    }
+    if ((s->ckpt != NULL) && (s->ckpt->tracknr != tracknr)) {
+        s->ckpt->tracknr = tracknr;
+        s->ckpt->nr = 0;
+    }
+    if ((s->flux_info != NULL) && (s->flux_info->tracknr != tracknr)) {
+        s->flux_info->tracknr = tracknr;
+        s->flux_info->valid = 0;
+    }
+    if ((s->flux_hash != NULL) && (s->flux_hash->tracknr != tracknr)) {
+        s->flux_hash->tracknr = tracknr;
+        s->flux_hash->valid = 0;
+    }
     stream_reset(s);
     return 0;
 }
 
+static void checkpoint_record(struct stream *s)
+{
+    struct stream_checkpoints *c = s->ckpt;
+    struct stream_checkpoint *cp;
+
+    if (!c->clean || (s->nr_index != (c->nr + 1)))
+        return;
+
+    if (c->nr == c->max) {
+        c->max = c->max ? c->max * 2 : 8;
+        cp = memalloc(c->max * sizeof(*cp));
+        memcpy(cp, c->ent, c->nr * sizeof(*cp));
+        memfree(c->ent);
+        c->ent = cp;
+    }
+
+    cp = &c->ent[c->nr++];
+    s->type->save_pos(s, &cp->pos);
+    cp->flux = s->flux;
+    cp->clock = s->clock;
+    cp->clocked_zeros = s->clocked_zeros;
+    cp->word = s->word;
+    cp->track_bitlen = s->track_bitlen;
+    cp->crc16_ccitt = s->crc16_ccitt;
+    cp->crc_bitoff = s->crc_bitoff;
+}
+
+/* Restore the state at index pulse @index, if it has been recorded. 
+ * Accumulated latency is not restored: it is only ever measured over a 
+ * span of the stream which is read in full. */
+static int checkpoint_restore(struct stream *s, unsigned int index)
+{
+    struct stream_checkpoints *c = s->ckpt;
+    struct stream_checkpoint *cp;
+
+    if ((c == NULL) || !c->clean || (index == 0) || (index > c->nr) ||
+        (index > s->max_index))
+        return -1;
+
+    cp = &c->ent[index-1];
+    s->type->restore_pos(s, &cp->pos);
+    s->flux = cp->flux;
+    s->clock = cp->clock;
+    s->clocked_zeros = cp->clocked_zeros;
+    s->word = cp->word;
+    s->track_bitlen = cp->track_bitlen;
+    s->crc16_ccitt = cp->crc16_ccitt;
+    s->crc_bitoff = cp->crc_bitoff;
+    s->nr_index = index;
+    s->index_offset = 0;
+    return 0;
+}
+
+/* Checkpoints recorded under a different PLL configuration are stale. */
+static void checkpoint_reset(struct stream *s)
+{
+    struct stream_checkpoints *c = s->ckpt;
+
+    if (c == NULL)
+        return;
+
+    if ((c->pll_mode != s->pll_mode) || (c->clock_centre != s->clock_centre))
+        c->nr = 0;
+    c->pll_mode = s->pll_mode;
+    c->clock_centre = s->clock_centre;
+    c->clean = 1;
+}
+
 void stream_reset(struct stream *s)
 {
     /* Flux-based streams */
@@ -104,20 +279,50 @@ void stream_reset(struct stream *s)
     s->latency = 0;
     s->index_offset = ~0u>>1; /* bad */
 
+    if (s->prof)
+        s->prof->resets++;
+
     s->type->reset(s);
+    checkpoint_reset(s);
 
-    if (s->nr_index == 0)
+    if ((s->nr_index == 0) && (checkpoint_restore(s, 1) != 0))
         stream_next_index(s);
 }
 
 void stream_next_index(struct stream *s)
 {
+    if (checkpoint_restore(s, s->nr_index + 1) == 0)
+        return;
     do {
         if (stream_next_bit(s) == -1)
             break;
     } while (s->index_offset != 0);
 }
 
+int stream_seek_revolution(struct stream *s, unsigned int rev)
+{
+    unsigned int index = rev + 1;
+
+    if (index > s->max_index)
+        return -1;
+    if (checkpoint_restore(s, index) == 0)
+        return 0;
+
+    if ((s->nr_index > index) ||
+        ((s->nr_index == index) && (s->index_offset != 0)))
+        stream_reset(s);
+    while (s->nr_index < index)
+        if (stream_next_bit(s) == -1)
+            return -1;
+
+    return 0;
+}
+
+uint32_t stream_revolution_bitlen(struct stream *s, unsigned int rev)
+{
+    return (stream_seek_revolution(s, rev + 1) == 0) ? s->track_bitlen : 0;
+}
+
 void stream_start_crc(struct stream *s)
 {
     uint16_t x = htobe16(mfm_decode_bits(bc_mfm, s->word));
@@ -125,20 +330,95 @@ void stream_start_crc(struct stream *s)
     s->crc_bitoff = 0;
 }
 
+/* Time since @t, less the overhead of reading the clock. */
+static uint64_t profile_elapsed(struct stream_profile *prof, uint64_t t)
+{
+    uint64_t ns = now_ns() - t;
+    return (ns > prof->clock_ns) ? ns - prof->clock_ns : 0;
+}
+
+unsigned int stream_scan_budget(struct stream *s, unsigned int percent)
+{
+    unsigned int old = s->scan_budget;
+    s->scan_budget = percent;
+    return old;
+}
+
+void stream_arm_budget(
+    struct stream *s, const uint32_t *sync, uint32_t track_bits)
+{
+    if ((s->scan_budget == 0) || (sync[0] == 0))
+        return;
+    s->budget_sync = sync;
+    s->budget_bits = ((uint64_t)track_bits * s->scan_budget) / 100;
+    s->budget_max_index = s->max_index;
+}
+
+void stream_disarm_budget(struct stream *s)
+{
+    if (s->budget_sync == NULL)
+        return;
+    s->budget_bits = 0;
+    s->budget_sync = NULL;
+    s->max_index = s->budget_max_index;
+}
+
+/* Called for each bit until a sync is found. On exhausting the budget, the
+ * stream is ended (until disarmed) by zeroing its index-pulse limit, which
+ * also survives the handler resetting the stream. */
+static int budget_next_bit(struct stream *s)
+{
+    const uint32_t *p;
+
+    for (p = s->budget_sync; *p != 0; p++) {
+        if ((*p > 0xffffu) ? (s->word == *p) : ((uint16_t)s->word == *p)) {
+            s->budget_bits = 0;
+            return 0;
+        }
+    }
+
+    if (--s->budget_bits == 0) {
+        s->max_index = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int profile_next_bit(struct stream *s)
+{
+    struct stream_profile *prof = s->prof;
+    uint64_t t;
+    int b;
+
+    if (prof->bits++ & (PROFILE_BIT_SAMPLE-1))
+        return s->type->next_bit(s);
+
+    t = now_ns();
+    b = s->type->next_bit(s);
+    prof->bit_ns += profile_elapsed(prof, t) * PROFILE_BIT_SAMPLE;
+    return b;
+}
+
 int stream_next_bit(struct stream *s)
 {
     int b;
-    if (s->nr_index >= 5)
+    if (s->nr_index >= s->max_index)
         return -1;
     s->index_offset++;
-    if ((b = s->type->next_bit(s)) == -1)
+    b = s->prof ? profile_next_bit(s) : s->type->next_bit(s);
+    if (b == -1)
         return -1;
     s->word = (s->word << 1) | b;
+    if (s->budget_bits && (budget_next_bit(s) == -1))
+        return -1;
     if (++s->crc_bitoff == 16) {
         uint8_t b = mfm_decode_bits(bc_mfm, s->word);
         s->crc16_ccitt = crc16_ccitt(&b, 1, s->crc16_ccitt);
         s->crc_bitoff = 0;
     }
+    if ((s->index_offset == 0) && (s->ckpt != NULL))
+        checkpoint_record(s);
     return b;
 }
 
@@ -169,20 +449,317 @@ enum pll_mode stream_pll_mode(struct stream *s, enum pll_mode pll_mode)
 {
     enum pll_mode old_mode = s->pll_mode;
     s->pll_mode = pll_mode;
+    if ((pll_mode != old_mode) && (s->ckpt != NULL))
+        s->ckpt->clean = 0;
     return old_mode;
 }
 
 void stream_set_density(struct stream *s, unsigned int ns_per_cell)
 {
     /* Flux-based streams */
+    if ((ns_per_cell != s->clock_centre) && (s->ckpt != NULL))
+        s->ckpt->clean = 0;
     s->clock = s->clock_centre = ns_per_cell;
 }
 
+/* Number of intervals within @tol ns of @ns, and optionally their sum. */
+static uint32_t flux_window(
+    const struct stream_flux_info *fi, unsigned int ns, unsigned int tol,
+    uint64_t *sum)
+{
+    unsigned int i, lo, hi;
+    uint32_t nr = 0;
+
+    lo = (ns > tol) ? (ns - tol) / FLUX_HIST_NS_PER_BIN : 0;
+    hi = min_t(unsigned int, (ns + tol) / FLUX_HIST_NS_PER_BIN,
+               FLUX_HIST_BINS - 2);
+    for (i = lo; i <= hi; i++) {
+        nr += fi->hist[i];
+        if (sum)
+            *sum += (uint64_t)fi->hist[i] *
+                (i * FLUX_HIST_NS_PER_BIN + FLUX_HIST_NS_PER_BIN/2);
+    }
+
+    return nr;
+}
+
+/* Fit a bitcell period to intervals near the given multiples of @cell, and 
+ * return the % of all intervals which the fit explains. */
+static unsigned int flux_fit(
+    struct stream_flux_info *fi, unsigned int cell,
+    const unsigned int *mult, unsigned int nr_mult)
+{
+    uint64_t sum = 0, cells = 0;
+    uint32_t nr, explained = 0;
+    unsigned int i;
+
+    for (i = 0; i < nr_mult; i++) {
+        nr = flux_window(fi, mult[i] * cell, cell / 3, &sum);
+        cells += (uint64_t)nr * mult[i];
+    }
+    if (cells == 0)
+        return 0;
+    fi->ns_per_cell = cell = sum / cells;
+
+    for (i = 0; i < nr_mult; i++)
+        explained += flux_window(fi, mult[i] * cell, cell / 3, NULL);
+    return ((uint64_t)explained * 100) / fi->nr_samples;
+}
+
+/* The shortest common interval is the fundamental: 2 cells for MFM, and 1 
+ * cell for FM and GCR. The encoding is told apart by which multiples of 
+ * the fundamental are also common. */
+static void flux_estimate(struct stream_flux_info *fi)
+{
+    static const unsigned int mfm[] = { 2, 3, 4 }, fm[] = { 1, 2 };
+    static const unsigned int gcr[] = { 1, 2, 3 };
+    uint32_t min_peak = fi->nr_samples / 50, min_seen = fi->nr_samples / 100;
+    uint32_t sm, prev = 0, next, nr;
+    unsigned int i, fund = 0;
+    uint64_t sum = 0;
+
+    fi->encoding = FLUXENC_unknown;
+    fi->ns_per_cell = fi->explained = 0;
+    fi->confident = 0;
+    if (fi->nr_samples < 1000)
+        return;
+
+    /* First local maximum of the smoothed histogram with 2% of intervals. */
+    for (i = 1; i < FLUX_HIST_BINS - 2; i++) {
+        sm = fi->hist[i-1] + fi->hist[i] + fi->hist[i+1];
+        next = fi->hist[i] + fi->hist[i+1] + fi->hist[i+2];
+        if ((sm >= min_peak) && (sm >= prev) && (sm > next))
+            break;
+        prev = sm;
+    }
+    if (i == FLUX_HIST_BINS - 2)
+        return;
+    i = i * FLUX_HIST_NS_PER_BIN + FLUX_HIST_NS_PER_BIN/2;
+    if ((nr = flux_window(fi, i, i / 8, &sum)) != 0)
+        fund = sum / nr;
+    if (fund < FLUX_HIST_NS_PER_BIN)
+        return;
+
+    if (flux_window(fi, fund * 3 / 2, fund / 8, NULL) >= min_seen) {
+        fi->encoding = FLUXENC_mfm;
+        fi->explained = flux_fit(fi, fund / 2, mfm, ARRAY_SIZE(mfm));
+        fi->confident = (fi->explained >= 90);
+    } else if (flux_window(fi, fund * 3, fund / 4, NULL) >= min_seen) {
+        fi->encoding = FLUXENC_gcr;
+        fi->explained = flux_fit(fi, fund, gcr, ARRAY_SIZE(gcr));
+    } else if (flux_window(fi, fund * 2, fund / 4, NULL) >= min_seen) {
+        fi->encoding = FLUXENC_fm;
+        fi->explained = flux_fit(fi, fund, fm, ARRAY_SIZE(fm));
+    } else {
+        /* A single peak: most likely MFM filler, but we cannot be sure. */
+        fi->explained = flux_fit(fi, fund / 2, mfm, 1);
+    }
+}
+
+const struct stream_flux_info *stream_flux_info(struct stream *s)
+{
+    struct stream_flux_info *fi = s->flux_info;
+    int flux;
+
+    if ((fi == NULL) || fi->valid)
+        return fi;
+
+    /* Histogram raw intervals, up to the second index pulse. This bypasses 
+     * the PLL, so it is cheap compared with decoding the track. */
+    memset(fi->hist, 0, sizeof(fi->hist));
+    fi->nr_samples = 0;
+    s->nr_index = 0;
+    s->type->reset(s);
+    while ((flux = s->type->next_flux(s)) != -1) {
+        if (s->nr_index >= 2)
+            break;
+        fi->hist[min_t(unsigned int, flux / FLUX_HIST_NS_PER_BIN,
+                       FLUX_HIST_BINS - 1)]++;
+        fi->nr_samples++;
+    }
+
+    flux_estimate(fi);
+    fi->valid = 1;
+    stream_reset(s);
+    return fi;
+}
+
+unsigned int stream_capture_flux(
+    struct stream *s, struct flux_buf *fb, uint32_t *nr_samples)
+{
+    unsigned int nr_segs = 1, max_segs;
+    uint32_t *p;
+    int flux;
+
+    /* Rewind the stream type directly: stream_reset() would run on to the 
+     * first index pulse. */
+    s->nr_index = 0;
+    s->type->reset(s);
+
+    max_segs = min_t(unsigned int, s->max_index + 1, MAX_FLUX_SEGS);
+    nr_samples[0] = 0;
+    fb->nr = 0;
+
+    while ((fb->nr < MAX_FLUX_SAMPLES) &&
+           ((flux = s->type->next_flux(s)) != -1)) {
+        if ((s->nr_index + 1) > max_segs)
+            break;
+        while (nr_segs < (s->nr_index + 1))
+            nr_samples[nr_segs++] = 0;
+        if (fb->nr == fb->max) {
+            fb->max = fb->max ? fb->max * 2 : 65536;
+            p = memalloc(fb->max * sizeof(*p));
+            memcpy(p, fb->p, fb->nr * sizeof(*p));
+            memfree(fb->p);
+            fb->p = p;
+        }
+        fb->p[fb->nr++] = flux;
+        nr_samples[nr_segs-1]++;
+    }
+
+    return nr_segs;
+}
+
+const uint8_t *stream_flux_hash(struct stream *s)
+{
+    struct stream_flux_hash *fh = s->flux_hash;
+    /* Hash of the samples; segment lengths; index limit. */
+    uint32_t tail[4 + MAX_FLUX_SEGS + 1], *nr_samples = &tail[4];
+    struct flux_buf fb = { 0 };
+    unsigned int nr_segs;
+
+    if ((fh == NULL) || fh->valid)
+        return fh ? fh->hash : NULL;
+
+    if (s->type->track_hash != NULL) {
+        if (s->type->track_hash(s, fh->hash) != 0)
+            return NULL;
+        fh->valid = 1;
+        return fh->hash;
+    }
+
+    /* Index pulse positions matter as much as the intervals: the segment 
+     * lengths and index limit are hashed too. */
+    nr_segs = stream_capture_flux(s, &fb, nr_samples);
+    nr_samples[nr_segs] = s->max_index;
+    hash128(fb.p, fb.nr * sizeof(*fb.p), (uint8_t *)tail);
+    hash128(tail, (4 + nr_segs + 1) * sizeof(*tail), fh->hash);
+    memfree(fb.p);
+
+    fh->valid = 1;
+    stream_reset(s);
+    return fh->hash;
+}
+
+const char *stream_flux_encoding_name(enum flux_encoding encoding)
+{
+    static const char *const names[] = {
+        [FLUXENC_unknown] = "unknown",
+        [FLUXENC_mfm] = "MFM",
+        [FLUXENC_fm] = "FM",
+        [FLUXENC_gcr] = "GCR"
+    };
+    return (encoding < ARRAY_SIZE(names)) ? names[encoding] : "unknown";
+}
+
+void stream_enable_profiling(struct stream *s)
+{
+    uint64_t t;
+    unsigned int i;
+
+    if (s->prof != NULL)
+        return;
+
+    s->prof = memalloc(sizeof(*s->prof));
+
+    /* Sampled timings are short: calibrate out the cost of the clock. */
+    t = now_ns();
+    for (i = 0; i < 1000; i++)
+        now_ns();
+    s->prof->clock_ns = (now_ns() - t) / 1000;
+}
+
+static void profile_snapshot(
+    struct stream_profile *prof, struct stream_profile_record *r)
+{
+    r->io_ns = prof->io_ns;
+    r->bit_ns = prof->bit_ns;
+    r->flux_ns = prof->flux_ns;
+    r->bits = prof->bits;
+    r->flux = prof->flux;
+    r->resets = prof->resets;
+    r->revs = prof->revs;
+}
+
+void stream_profile_start(struct stream *s)
+{
+    struct stream_profile *prof = s->prof;
+
+    if (prof == NULL)
+        return;
+
+    profile_snapshot(prof, &prof->start);
+    prof->start.ns = now_ns();
+}
+
+void stream_profile_end(
+    struct stream *s, unsigned int tracknr, enum track_type type,
+    bool_t accepted)
+{
+    struct stream_profile *prof = s->prof;
+    struct stream_profile_record *r, *start;
+
+    if (prof == NULL)
+        return;
+
+    /* Grow the record array in powers of two. */
+    if ((prof->nr_rec & (prof->nr_rec - 1)) == 0) {
+        r = memalloc((prof->nr_rec ? prof->nr_rec * 2 : 1) * sizeof(*r));
+        memcpy(r, prof->rec, prof->nr_rec * sizeof(*r));
+        memfree(prof->rec);
+        prof->rec = r;
+    }
+
+    start = &prof->start;
+    r = &prof->rec[prof->nr_rec++];
+    profile_snapshot(prof, r);
+    r->tracknr = tracknr;
+    r->type = type;
+    r->pll_mode = s->pll_mode;
+    r->accepted = accepted;
+    r->selected = 0;
+    r->ns = now_ns() - start->ns;
+    r->io_ns -= start->io_ns;
+    r->bit_ns -= start->bit_ns;
+    r->flux_ns -= start->flux_ns;
+    r->bits -= start->bits;
+    r->flux -= start->flux;
+    r->resets -= start->resets;
+    r->revs -= start->revs;
+}
+
 void index_reset(struct stream *s)
 {
     s->track_bitlen = s->index_offset;
     s->index_offset = 0;
     s->nr_index++;
+    if (s->prof)
+        s->prof->revs++;
+}
+
+static int profile_next_flux(struct stream *s)
+{
+    struct stream_profile *prof = s->prof;
+    uint64_t t;
+    int flux;
+
+    if (prof->flux++ & (PROFILE_FLUX_SAMPLE-1))
+        return s->type->next_flux(s);
+
+    t = now_ns();
+    flux = s->type->next_flux(s);
+    prof->flux_ns += profile_elapsed(prof, t) * PROFILE_FLUX_SAMPLE;
+    return flux;
 }
 
 int flux_next_bit(struct stream *s)
@@ -190,7 +767,8 @@ int flux_next_bit(struct stream *s)
     int new_flux;
 
     while (s->flux < (s->clock/2)) {
-        if ((new_flux = s->type->next_flux(s)) == -1)
+        new_flux = s->prof ? profile_next_flux(s) : s->type->next_flux(s);
+        if (new_flux == -1)
             return -1;
         s->flux += new_flux;
         s->clocked_zeros = 0;
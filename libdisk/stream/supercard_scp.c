@@ -16,7 +16,7 @@
 
 struct scp_stream {
     struct stream s;
-    int fd;
+    int fd; /* -1 if in-memory */
 
     /* Current track number. */
     unsigned int track;
@@ -25,11 +25,18 @@ struct scp_stream {
     uint16_t *dat;
     unsigned int datsz;
 
-    unsigned int revs;       /* stored disk revolutions */
+    unsigned int max_revs;   /* revolutions per track, from file header */
+    unsigned int revs;       /* stored revolutions on current track */
+    unsigned int nr_loaded;  /* revolutions read into dat[] so far */
     unsigned int dat_idx;    /* current index into dat[] */
     unsigned int index_pos;  /* next index offset */
 
-    unsigned int index_off[]; /* data offsets of each index */
+    /* Revolutions are indexed when a track is selected, and their flux 
+     * is read from file only when the stream first reaches them. */
+    struct {
+        uint32_t file_off;   /* file offset of flux samples */
+        uint32_t index_off;  /* data offset of following index */
+    } rev[];
 };
 
 #define SCK_NS_PER_TICK (25u)
@@ -58,9 +65,9 @@ static struct stream *scp_open(const char *name)
     if (header[9] != 0 && header[9] != 16)
         errx(1, "%s has unsupported bit cell time width (%u)", name, header[9]);
 
-    scss = memalloc(sizeof(*scss) + revs*sizeof(unsigned int));
+    scss = memalloc(sizeof(*scss) + revs*sizeof(scss->rev[0]));
     scss->fd = fd;
-    scss->revs = revs;
+    scss->max_revs = revs;
 
     return &scss->s;
 }
@@ -68,25 +75,41 @@ static struct stream *scp_open(const char *name)
 static void scp_close(struct stream *s)
 {
     struct scp_stream *scss = container_of(s, struct scp_stream, s);
-    close(scss->fd);
-    memfree(scss->dat);
+    if (scss->fd != -1) {
+        close(scss->fd);
+        memfree(scss->dat);
+    }
     memfree(scss);
 }
 
+/* Allow the stream to run through every stored revolution, but never fewer 
+ * than the default number of index pulses, so that images with the usual 
+ * five revolutions decode exactly as before. */
+static void scp_set_max_index(struct scp_stream *scss)
+{
+    scss->s.max_index = (scss->revs > STREAM_DEFAULT_INDEX)
+        ? scss->revs + 1 : STREAM_DEFAULT_INDEX;
+}
+
 static int scp_select_track(struct stream *s, unsigned int tracknr)
 {
     struct scp_stream *scss = container_of(s, struct scp_stream, s);
     uint8_t trk_header[4];
     uint32_t longwords[3];
-    unsigned int rev, trkoffset[scss->revs];
+    unsigned int rev;
     uint32_t hdr_offset, tdh_offset;
 
+    /* In-memory flux is the same whichever track is selected. */
+    if (scss->fd == -1)
+        return 0;
+
     if (scss->dat && (scss->track == tracknr))
         return 0;
 
     memfree(scss->dat);
     scss->dat = NULL;
     scss->datsz = 0;
+    scss->nr_loaded = 0;
     
     hdr_offset = 0x10 + tracknr*sizeof(uint32_t);
 
@@ -106,27 +129,40 @@ static int scp_select_track(struct stream *s, unsigned int tracknr)
     if (trk_header[3] != tracknr)
         return -1;
 
+    /* The header's revolution count is a maximum: a track may store fewer, 
+     * in which case its flux data immediately follows a shorter table. */
+    scss->revs = scss->max_revs;
     for (rev = 0 ; rev < scss->revs ; rev++) {
         read_exact(scss->fd, longwords, sizeof(longwords));
-        trkoffset[rev] = tdh_offset + le32toh(longwords[2]);
-        scss->index_off[rev] = le32toh(longwords[1]);
-        scss->datsz += scss->index_off[rev];
+        if ((rev == 0) && (le32toh(longwords[2]) >= 16))
+            scss->revs = min_t(unsigned int, scss->revs,
+                               (le32toh(longwords[2]) - 4) / 12);
+        scss->rev[rev].file_off = tdh_offset + le32toh(longwords[2]);
+        scss->datsz += le32toh(longwords[1]);
+        scss->rev[rev].index_off = scss->datsz;
     }
 
     scss->dat = memalloc(scss->datsz * sizeof(scss->dat[0]));
-    scss->datsz = 0;
+    scss->track = tracknr;
+    scp_set_max_index(scss);
 
-    for (rev = 0 ; rev < scss->revs ; rev++) {
-        if (lseek(scss->fd, trkoffset[rev], SEEK_SET) != trkoffset[rev])
+    return 0;
+}
+
+static int scp_load_rev(struct scp_stream *scss, unsigned int rev)
+{
+    unsigned int r, off;
+
+    for (r = scss->nr_loaded; r <= rev; r++) {
+        off = r ? scss->rev[r-1].index_off : 0;
+        if (lseek(scss->fd, scss->rev[r].file_off, SEEK_SET)
+            != scss->rev[r].file_off)
             return -1;
-        read_exact(scss->fd, &scss->dat[scss->datsz],
-                   scss->index_off[rev] * sizeof(scss->dat[0]));
-        scss->datsz += scss->index_off[rev];
-        scss->index_off[rev] = scss->datsz;
+        read_exact(scss->fd, &scss->dat[off],
+                   (scss->rev[r].index_off - off) * sizeof(scss->dat[0]));
     }
 
-    scss->track = tracknr;
-
+    scss->nr_loaded = max_t(unsigned int, scss->nr_loaded, rev + 1);
     return 0;
 }
 
@@ -138,6 +174,23 @@ static void scp_reset(struct stream *s)
     scss->index_pos = 0;
 }
 
+static void scp_save_pos(struct stream *s, struct stream_pos *pos)
+{
+    struct scp_stream *scss = container_of(s, struct scp_stream, s);
+
+    pos->w[0] = scss->dat_idx;
+    pos->w[1] = scss->index_pos;
+}
+
+/* Revolutions before a checkpoint have been loaded already. */
+static void scp_restore_pos(struct stream *s, const struct stream_pos *pos)
+{
+    struct scp_stream *scss = container_of(s, struct scp_stream, s);
+
+    scss->dat_idx = pos->w[0];
+    scss->index_pos = pos->w[1];
+}
+
 static int scp_next_flux(struct stream *s)
 {
     struct scp_stream *scss = container_of(s, struct scp_stream, s);
@@ -146,8 +199,10 @@ static int scp_next_flux(struct stream *s)
     for (;;) {
         if (scss->dat_idx >= scss->index_pos) {
             uint32_t rev = s->nr_index % scss->revs;
-            scss->index_pos = scss->index_off[rev];
-            scss->dat_idx = rev ? scss->index_off[rev-1] : 0;
+            if ((rev >= scss->nr_loaded) && scp_load_rev(scss, rev))
+                return -1;
+            scss->index_pos = scss->rev[rev].index_off;
+            scss->dat_idx = rev ? scss->rev[rev-1].index_off : 0;
             index_reset(s);
             val = 0;
         }
@@ -174,5 +229,35 @@ struct stream_type supercard_scp = {
     .reset = scp_reset,
     .next_bit = flux_next_bit,
     .next_flux = scp_next_flux,
+    .save_pos = scp_save_pos,
+    .restore_pos = scp_restore_pos,
     .suffix = { "scp", NULL }
 };
+
+struct stream *stream_scp_open_memory(
+    uint16_t *dat, const uint32_t *nr_samples, unsigned int nr_revs)
+{
+    struct scp_stream *scss;
+    unsigned int rev;
+
+    if (nr_revs == 0)
+        return NULL;
+
+    scss = memalloc(sizeof(*scss) + nr_revs*sizeof(scss->rev[0]));
+    scss->fd = -1;
+    scss->max_revs = scss->revs = scss->nr_loaded = nr_revs;
+    scss->dat = dat;
+    for (rev = 0; rev < nr_revs; rev++) {
+        if (nr_samples[rev] == 0) {
+            memfree(scss);
+            return NULL;
+        }
+        scss->datsz += nr_samples[rev];
+        scss->rev[rev].index_off = scss->datsz;
+    }
+
+    stream_setup(&scss->s, &supercard_scp);
+    scp_set_max_index(scss);
+
+    return &scss->s;
+}
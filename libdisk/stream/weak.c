@@ -0,0 +1,255 @@
+/*
+ * stream/weak.c
+ * 
+ * Find weak bitcells: those which read differently on different revolutions
+ * of a track. Revolutions are decoded once into memory, aligned on each
+ * occurrence of a sync word (so that PLL slips are not mistaken for weak
+ * bits), and compared 64 bitcells at a time.
+ * 
+ * Written in 2026 by agent
+ */
+
+#include <libdisk/util.h>
+#include "private.h"
+
+/* Largest misalignment of a sync mark between revolutions, as a fraction of
+ * a revolution (1/N). */
+#define MAX_SYNC_SKEW 50
+
+struct bitbuf {
+    uint8_t *p;
+    uint32_t nr, max;      /* bitcells stored, bytes allocated */
+};
+
+static void bitbuf_push(struct bitbuf *bb, int bit)
+{
+    uint8_t *p;
+
+    /* Keep 16 bytes of zero padding for get64() beyond the last bitcell. */
+    if ((bb->nr / 8 + 16) >= bb->max) {
+        p = memalloc(bb->max ? bb->max * 2 : 16384);
+        memcpy(p, bb->p, bb->max);
+        memfree(bb->p);
+        bb->p = p;
+        bb->max = bb->max ? bb->max * 2 : 16384;
+    }
+
+    if (bit)
+        bb->p[bb->nr >> 3] |= 0x80u >> (bb->nr & 7);
+    bb->nr++;
+}
+
+static int bitbuf_get(const struct bitbuf *bb, uint32_t off)
+{
+    return !!(bb->p[off >> 3] & (0x80u >> (off & 7)));
+}
+
+/* 64 bitcells starting at bit @off, MSB first. */
+static uint64_t get64(const uint8_t *p, uint32_t off)
+{
+    uint32_t w[2];
+    uint64_t x;
+    unsigned int sh = off & 7;
+
+    memcpy(w, &p[off >> 3], sizeof(w));
+    x = ((uint64_t)be32toh(w[0]) << 32) | be32toh(w[1]);
+    if (sh)
+        x = (x << sh) | (p[(off >> 3) + 8] >> (8 - sh));
+    return x;
+}
+
+static void or64(uint64_t *map, uint32_t off, uint64_t x)
+{
+    unsigned int sh = off & 63;
+
+    map[off >> 6] |= x >> sh;
+    if (sh)
+        map[(off >> 6) + 1] |= x << (64 - sh);
+}
+
+/* Offsets of each sync word in bitcells [@start,@end) of @bb, relative to
+ * @start. Returns the number found. */
+static unsigned int find_syncs(
+    const struct bitbuf *bb, uint32_t start, uint32_t end, uint32_t sync,
+    uint32_t **p_syncs)
+{
+    unsigned int nr = 0, max = 0, sync_bits = (sync > 0xffffu) ? 32 : 16;
+    uint32_t off, word = 0, *syncs = NULL, *p;
+
+    for (off = start; off < end; off++) {
+        word = (word << 1) | bitbuf_get(bb, off);
+        if (((sync_bits == 32) ? word : (uint16_t)word) != sync)
+            continue;
+        if ((off + 1 - start) < sync_bits)
+            continue;
+        if (nr == max) {
+            max = max ? max * 2 : 32;
+            p = memalloc(max * sizeof(*p));
+            memcpy(p, syncs, nr * sizeof(*p));
+            memfree(syncs);
+            syncs = p;
+        }
+        syncs[nr++] = off + 1 - sync_bits - start;
+    }
+
+    *p_syncs = syncs;
+    return nr;
+}
+
+/* Mark bitcells which differ between [@a,@a+@len) of the reference
+ * revolution and [@b,@b+@len) of another. */
+static void compare(
+    struct stream_weak_map *m, const struct bitbuf *bb,
+    uint32_t a, uint32_t b, uint32_t len)
+{
+    uint32_t i;
+    uint64_t x;
+
+    for (i = 0; i < len; i += 64) {
+        x = get64(bb->p, a + i) ^ get64(bb->p, b + i);
+        if ((len - i) < 64)
+            x &= ~0ull << (64 - (len - i));
+        or64(m->map, a + i, x);
+    }
+}
+
+/* Compare revolution @rev, starting at bitcell @start of @bb, against the
+ * reference. Each stretch of the reference from one sync mark to the next
+ * is aligned on the nearest sync mark of the other revolution. */
+static void compare_rev(
+    struct stream_weak_map *m, const struct bitbuf *bb, uint32_t start,
+    uint32_t end, const uint32_t *ref, unsigned int nr_ref, uint32_t sync)
+{
+    uint32_t *syncs, a, b, len, skew;
+    unsigned int i, j = 0, nr;
+
+    nr = find_syncs(bb, start, end, sync, &syncs);
+    skew = m->bitlen / MAX_SYNC_SKEW;
+
+    /* Before the first sync mark: align on the index pulse. */
+    len = nr_ref ? ref[0] : m->bitlen;
+    compare(m, bb, 0, start, min(len, end - start));
+
+    for (i = 0; i < nr_ref; i++) {
+        a = ref[i];
+        len = ((i + 1) < nr_ref ? ref[i+1] : m->bitlen) - a;
+        /* Nearest sync mark in this revolution. */
+        while (((j + 1) < nr) && (abs((int)syncs[j+1] - (int)a)
+                                  <= abs((int)syncs[j] - (int)a)))
+            j++;
+        if ((nr == 0) || (abs((int)syncs[j] - (int)a) > skew))
+            continue;
+        b = syncs[j];
+        len = min(len, ((j + 1) < nr ? syncs[j+1] : end - start) - b);
+        compare(m, bb, a, start + b, len);
+    }
+
+    memfree(syncs);
+}
+
+struct stream_weak_map *stream_weak_map(
+    struct stream *s, uint32_t sync, unsigned int nr_revs)
+{
+    struct stream_weak_map *m;
+    struct bitbuf bb = { 0 };
+    uint32_t *start, *ref;
+    unsigned int r, nr_ref, i;
+    int b;
+
+    /* Revolution 0 is skipped: the PLL may not lock until part way in. */
+    nr_revs = min_t(unsigned int, nr_revs, s->max_index - 2);
+    if ((s->max_index < 2) || (nr_revs < 2) ||
+        (stream_seek_revolution(s, 1) != 0))
+        return NULL;
+
+    /* Decode the revolutions. Each starts with the bitcell which crossed
+     * its index pulse, so that map offsets match s->index_offset. */
+    start = memalloc((nr_revs + 1) * sizeof(*start));
+    bitbuf_push(&bb, s->word & 1);
+    for (r = 0; r < nr_revs; ) {
+        if ((b = stream_next_bit(s)) == -1)
+            break;
+        if (s->index_offset == 0)
+            start[++r] = bb.nr;
+        bitbuf_push(&bb, b);
+    }
+    nr_revs = r;
+
+    m = NULL;
+    if (nr_revs >= 2) {
+        m = memalloc(sizeof(*m));
+        m->nr_revs = nr_revs;
+        m->bitlen = start[1];
+        m->map = memalloc((m->bitlen / 64 + 2) * sizeof(*m->map));
+        nr_ref = find_syncs(&bb, 0, start[1], sync, &ref);
+        for (r = 1; r < nr_revs; r++)
+            compare_rev(m, &bb, start[r], start[r+1], ref, nr_ref, sync);
+        for (i = 0; i <= m->bitlen / 64; i++)
+            m->nr_weak += __builtin_popcountll(m->map[i]);
+        memfree(ref);
+    }
+
+    memfree(start);
+    memfree(bb.p);
+    stream_reset(s);
+    return m;
+}
+
+void stream_weak_map_free(struct stream_weak_map *m)
+{
+    if (m == NULL)
+        return;
+    memfree(m->map);
+    memfree(m);
+}
+
+static int weak_bit(const struct stream_weak_map *m, uint32_t off)
+{
+    return !!(m->map[off >> 6] & (1ull << (63 - (off & 63))));
+}
+
+uint32_t stream_weak_count(
+    const struct stream_weak_map *m, uint32_t off, uint32_t len)
+{
+    uint32_t nr = 0, end = min(off + len, m->bitlen);
+
+    /* Whole words at a time where possible. */
+    for (; (off < end) && (off & 63); off++)
+        nr += weak_bit(m, off);
+    for (; (off + 64) <= end; off += 64)
+        nr += __builtin_popcountll(m->map[off >> 6]);
+    for (; off < end; off++)
+        nr += weak_bit(m, off);
+
+    return nr;
+}
+
+uint32_t stream_weak_region(const struct stream_weak_map *m, uint32_t *off)
+{
+    uint32_t start = *off, end;
+
+    while ((start < m->bitlen) && !weak_bit(m, start)) {
+        if (((start & 63) == 0) && (m->map[start >> 6] == 0))
+            start += 64;
+        else
+            start++;
+    }
+    if (start >= m->bitlen)
+        return 0;
+
+    for (end = start; (end < m->bitlen) && weak_bit(m, end); end++)
+        continue;
+
+    *off = start;
+    return end - start;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -157,6 +157,67 @@ uint16_t crc16_ccitt_bit(uint8_t b, uint16_t crc)
     return crc;
 }
 
+static uint64_t rotl64(uint64_t x, unsigned int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+/* Little-endian load of @n (up to 8) bytes. */
+static uint64_t get_le(const uint8_t *p, unsigned int n)
+{
+    uint64_t x = 0;
+    while (n--)
+        x = (x << 8) | p[n];
+    return x;
+}
+
+/* MurmurHash3 (x64, 128-bit), with zero seed. */
+void hash128(const void *dat, size_t len, uint8_t *hash)
+{
+    const uint64_t c1 = 0x87c37b91114253d5ull, c2 = 0x4cf5ad432745937full;
+    const uint8_t *p = dat;
+    uint64_t h1 = 0, h2 = 0, k1, k2;
+    size_t i, tail = len & 15;
+
+    for (i = 0; i < len - tail; i += 16) {
+        k1 = get_le(&p[i], 8);
+        k2 = get_le(&p[i+8], 8);
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+    }
+
+    if (tail > 8) {
+        k2 = get_le(&p[i+8], tail - 8);
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    if (tail != 0) {
+        k1 = get_le(&p[i], min_t(size_t, tail, 8));
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= len; h2 ^= len;
+    h1 += h2; h2 += h1;
+    h1 = fmix64(h1); h2 = fmix64(h2);
+    h1 += h2; h2 += h1;
+
+    for (i = 0; i < 8; i++) {
+        hash[i] = h1 >> (56 - i*8);
+        hash[i+8] = h2 >> (56 - i*8);
+    }
+}
+
 uint16_t rnd16(uint32_t *p_seed)
 {
     *p_seed = *p_seed * 1103515245 + 12345;
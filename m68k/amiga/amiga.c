@@ -26,6 +26,22 @@ void __assert_failed(
     errx(1, "Assertion failed at %s:%u", file, line);
 }
 
+void amiga_sync(struct amiga_state *s)
+{
+    s->event_base.current_time +=
+        (time_ns_t)s->pending_cycles * M68K_CYCLE_NS;
+    s->budget_cycles -= min_t(uint64_t, s->budget_cycles, s->pending_cycles);
+    s->pending_cycles = 0;
+}
+
+/* An I/O register access: the device needs the current time, and may 
+ * schedule new events. */
+static void io_sync(struct amiga_state *s)
+{
+    amiga_sync(s);
+    s->resched = 1;
+}
+
 static int amiga_read(uint32_t addr, uint32_t *val, unsigned int bytes,
                       struct m68k_emulate_ctxt *ctxt)
 {
@@ -36,16 +52,19 @@ static int amiga_read(uint32_t addr, uint32_t *val, unsigned int bytes,
     addr &= 0xffffff;
 
     if ((addr & 0xfff0ff) == CIAB_BASE) {
+        io_sync(s);
         *val = cia_read_reg(s, &s->ciab, (addr >> 8) & 15);
         return M68KEMUL_OKAY;
     }
 
     if ((addr & 0xfff0ff) == CIAA_BASE) {
+        io_sync(s);
         *val = cia_read_reg(s, &s->ciaa, (addr >> 8) & 15);
         return M68KEMUL_OKAY;
     }
 
     if ((addr & 0xfff000) == CUSTOM_BASE) {
+        io_sync(s);
         addr -= CUSTOM_BASE;
         if (bytes == 4) {
             *val = (custom_read_reg(s, addr) << 16)
@@ -74,16 +93,19 @@ static int amiga_write(uint32_t addr, uint32_t val, unsigned int bytes,
     addr &= 0xffffff;
 
     if ((addr & 0xfff0ff) == CIAB_BASE) {
+        io_sync(s);
         cia_write_reg(s, &s->ciab, (addr >> 8) & 15, val);
         return M68KEMUL_OKAY;
     }
 
     if ((addr & 0xfff0ff) == CIAA_BASE) {
+        io_sync(s);
         cia_write_reg(s, &s->ciaa, (addr >> 8) & 15, val);
         return M68KEMUL_OKAY;
     }
 
     if ((addr & 0xfff000) == CUSTOM_BASE) {
+        io_sync(s);
         addr -= CUSTOM_BASE;
         if (bytes == 4) {
             custom_write_reg(s, addr, val >> 16);
@@ -161,16 +183,70 @@ static struct m68k_emulate_ops amiga_m68k_ops = {
     .deliver_exception = amiga_deliver_exception
 };
 
-int amiga_emulate(struct amiga_state *s)
+/* Cycles from the current time until the next event, or @until. */
+static void reschedule(struct amiga_state *s, time_ns_t until)
 {
-    int rc = m68k_emulate(&s->ctxt);
-    if ((rc != M68KEMUL_OKAY) || !s->ctxt.emulate)
+    time_ns_t now = s->event_base.current_time;
+    time_ns_t deadline = min(event_next_deadline(&s->event_base), until);
+
+    s->resched = 0;
+    s->budget_cycles = (deadline <= now) ? 0
+        : (deadline == TIME_NEVER) ? ~0ull
+        : (deadline - now + M68K_CYCLE_NS - 1) / M68K_CYCLE_NS;
+}
+
+int amiga_run(
+    struct amiga_state *s, time_ns_t until, unsigned long max_insns,
+    int (*hook)(struct amiga_state *, uint32_t pc, void *), void *hook_data)
+{
+    struct m68k_emulate_ctxt *ctxt = &s->ctxt;
+    unsigned long nr;
+    uint32_t pc;
+    int rc = M68KEMUL_OKAY;
+
+    amiga_sync(s);
+    s->resched = 1;
+    if (s->event_base.current_time >= until)
         return rc;
-    s->event_base.current_time += s->ctxt.cycles * M68K_CYCLE_NS;
-    fire_events(&s->event_base);
+
+    for (nr = 0; nr < max_insns; nr++) {
+        if (s->resched)
+            reschedule(s, until);
+
+        pc = ctxt->regs->pc;
+        rc = m68k_emulate(ctxt);
+        if ((rc != M68KEMUL_OKAY) || !ctxt->emulate)
+            break;
+
+        /* A register write may have scheduled an event which falls due 
+         * within this very instruction. */
+        if (s->resched)
+            reschedule(s, until);
+
+        /* Exact equivalent of firing events after every instruction. */
+        s->pending_cycles += ctxt->cycles;
+        if (s->pending_cycles >= s->budget_cycles) {
+            amiga_sync(s);
+            fire_events(&s->event_base);
+            s->resched = 1;
+            if (s->event_base.current_time >= until)
+                break;
+        }
+
+        if (hook && (*hook)(s, pc, hook_data))
+            break;
+    }
+
+    amiga_sync(s);
+    m68k_sync_ccr(ctxt);
     return rc;
 }
 
+int amiga_emulate(struct amiga_state *s)
+{
+    return amiga_run(s, TIME_NEVER, 1, NULL, NULL);
+}
+
 void amiga_init(struct amiga_state *s, unsigned int mem_size)
 {
     memset(s, 0, sizeof(*s));
@@ -188,6 +264,13 @@ void amiga_init(struct amiga_state *s, unsigned int mem_size)
     s->ctxt.regs->xsp = 0x1000;  /* SSP */
 }
 
+void amiga_destroy(struct amiga_state *s)
+{
+    disk_destroy(s);
+    mem_destroy(s);
+    memfree(s->ctxt.regs);
+}
+
 /*
  * Local variables:
  * mode: C
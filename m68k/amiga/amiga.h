@@ -48,6 +48,12 @@ struct amiga_state {
     /* Passage of time. */
     struct event_base event_base;
 
+    /* amiga_run(): CPU cycles executed but not yet added to current_time, 
+     * and cycles remaining until the next event is due. */
+    uint32_t pending_cycles;
+    uint64_t budget_cycles;
+    bool_t resched;
+
     /* Logging. */
     enum loglevel max_loglevel;
     FILE *logfile;
@@ -62,10 +68,34 @@ void __assert_failed(
         if (!(p)) __assert_failed(s, __FILE__, __LINE__);       \
 } while (0)
 
+/* Each amiga_state is a self-contained emulated machine: any number of them 
+ * may be run concurrently, one per thread. */
 void amiga_init(struct amiga_state *, unsigned int mem_size);
+void amiga_destroy(struct amiga_state *);
+
+/* Execute instructions until @max_insns have run, emulated time reaches 
+ * @until, or @hook (if any) returns non-zero. @hook is called after each 
+ * instruction with the address it was fetched from. Events are fired only 
+ * when due, so between events the CPU runs in a tight loop. Returns an 
+ * M68KEMUL_* code. */
+int amiga_run(
+    struct amiga_state *, time_ns_t until, unsigned long max_insns,
+    int (*hook)(struct amiga_state *, uint32_t pc, void *), void *hook_data);
+
+/* Execute a single instruction. */
 int amiga_emulate(struct amiga_state *);
 
-void amiga_insert_df0(const char *filename);
+/* Bring event_base.current_time up to date with the CPU. Anything which 
+ * reads the current time from within amiga_run() must call this first. */
+void amiga_sync(struct amiga_state *);
+
+/* Returns -1, with DF0: left empty, if the image cannot be opened. */
+int amiga_insert_df0(struct amiga_state *, const char *filename);
+
+/* Save/restore complete emulator state. A snapshot can only be restored into 
+ * an amiga_state with the same memory layout. DF0: contents are not saved. */
+void amiga_save_snapshot(struct amiga_state *, const char *filename);
+void amiga_load_snapshot(struct amiga_state *, const char *filename);
 
 void exec_init(struct amiga_state *);
 
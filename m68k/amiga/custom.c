@@ -11,12 +11,31 @@
 
 #define SUBSYSTEM subsystem_main
 
+/* Registers which affect the disk controller's view of the bitstream. */
+static bool_t is_disk_reg(uint16_t addr)
+{
+    switch (addr) {
+    case CUST_dskpth:
+    case CUST_dskptl:
+    case CUST_dsklen:
+    case CUST_dsksync:
+    case CUST_dmacon:
+    case CUST_adkcon:
+        return 1;
+    }
+    return 0;
+}
+
 void custom_write_reg(struct amiga_state *s, uint16_t addr, uint16_t val)
 {
     addr >>= 1;
     if (addr >= ARRAY_SIZE(custom_reg_name))
         return;
 
+    /* Disk state is advanced lazily: catch up before changing it. */
+    if (is_disk_reg(addr))
+        disk_sync(s);
+
     switch (addr) {
     case CUST_dsklen:
         s->custom[addr] = val;
@@ -36,6 +55,9 @@ void custom_write_reg(struct amiga_state *s, uint16_t addr, uint16_t val)
         break;
     }
 
+    if (is_disk_reg(addr))
+        disk_sync(s);
+
     log_info("Write %04x to custom register %s (%x) becomes %04x",
              val, custom_reg_name[addr], (addr<<1)+0xdff000,
              s->custom[addr]);
@@ -63,6 +85,7 @@ uint16_t custom_read_reg(struct amiga_state *s, uint16_t addr)
         val = s->custom[CUST_intreq];
         break;
     case CUST_dskbytr:
+        disk_sync(s);
         val = s->custom[CUST_dskbytr];
         s->custom[CUST_dskbytr] &= 0x7fff;
         break;
@@ -20,21 +20,150 @@
 
 #define SUBSYSTEM subsystem_disk
 
-static const char *df0_filename =
-    "/home/keir/Amiga/raw_dumps/newzealandstory/nzs.dat";
-
 #define STEP_DELAY     MILLISECS(1)
 #define MOTORON_DELAY  MILLISECS(100)
 #define MOTOROFF_DELAY MILLISECS(1)
 
 static void track_load_byte(struct amiga_state *s)
 {
-    s->disk.ns_per_cell =
-        (s->disk.av_ns_per_cell *
-         s->disk.track_raw->speed[s->disk.input_pos]) / 1000u;
+    s->disk.ns_per_cell = s->disk.cell_ns[s->disk.input_pos/8];
     s->disk.input_byte = s->disk.track_raw->bits[s->disk.input_pos/8];
 }
 
+/* Time, in ns, from the index pulse to the start of bitcell @pos. */
+static uint32_t cell_time(struct amiga_state *s, uint32_t pos)
+{
+    return s->disk.byte_time[pos/8] + (pos&7) * s->disk.cell_ns[pos/8];
+}
+
+/* Time taken to stream the next @nr bitcells from the current position. */
+static time_ns_t bits_to_ns(struct amiga_state *s, uint64_t nr)
+{
+    uint32_t bitlen = s->disk.track_raw->bitlen;
+    uint32_t pos = s->disk.input_pos, end;
+    time_ns_t t = (nr / bitlen) * s->disk.rev_ns;
+
+    end = pos + nr % bitlen;
+    if (end <= bitlen)
+        return t + cell_time(s, end) - cell_time(s, pos);
+    return t + s->disk.rev_ns - cell_time(s, pos) + cell_time(s, end-bitlen);
+}
+
+/* Largest bitcell position whose start time is no later than @t. */
+static uint32_t cell_at_time(struct amiga_state *s, uint32_t t)
+{
+    uint32_t bitlen = s->disk.track_raw->bitlen;
+    unsigned int lo = 0, hi = (bitlen + 7) / 8, b, nr;
+
+    while ((hi - lo) > 1) {
+        b = (lo + hi) / 2;
+        if (s->disk.byte_time[b] <= t)
+            lo = b;
+        else
+            hi = b;
+    }
+
+    nr = (t - s->disk.byte_time[lo]) / s->disk.cell_ns[lo];
+    return min_t(uint32_t, lo*8 + nr, bitlen);
+}
+
+/* Number of bitcells which can be streamed within @delta ns from now. */
+static uint64_t ns_to_bits(struct amiga_state *s, time_ns_t delta)
+{
+    uint32_t bitlen = s->disk.track_raw->bitlen;
+    uint32_t pos = s->disk.input_pos, t;
+    uint64_t nr = (delta / s->disk.rev_ns) * bitlen;
+
+    t = cell_time(s, pos) + delta % s->disk.rev_ns;
+    if (t >= s->disk.rev_ns) {
+        nr += bitlen - pos;
+        t -= s->disk.rev_ns;
+        pos = 0;
+    }
+
+    return nr + cell_at_time(s, t) - pos;
+}
+
+static unsigned int raw_bit(struct amiga_state *s, uint32_t pos)
+{
+    return (s->disk.track_raw->bits[pos/8] >> (7 - (pos&7))) & 1;
+}
+
+/* The @nr (<= 16) bitcells ending at (and including) position @pos. */
+static uint16_t raw_bits(struct amiga_state *s, uint32_t pos, unsigned int nr)
+{
+    uint32_t bitlen = s->disk.track_raw->bitlen;
+    uint16_t w = 0;
+
+    pos = (pos + bitlen - nr + 1) % bitlen;
+    while (nr--) {
+        w = (w << 1) | raw_bit(s, pos);
+        if (++pos == bitlen)
+            pos = 0;
+    }
+
+    return w;
+}
+
+/* Find every position at which the rendered track matches DSKSYNC. */
+static void find_sync_positions(struct amiga_state *s)
+{
+    uint32_t i, bitlen = s->disk.track_raw->bitlen;
+    uint16_t sync = s->custom[CUST_dsksync];
+    uint16_t w;
+    unsigned int pass, nr = 0;
+
+    memfree(s->disk.sync_pos);
+    s->disk.sync_pos = NULL;
+
+    /* First pass counts the matches, second pass records them. */
+    for (pass = 0; pass < 2; pass++) {
+        if (pass)
+            s->disk.sync_pos = memalloc(nr * sizeof(uint32_t));
+        w = raw_bits(s, bitlen-1, 15);
+        for (i = nr = 0; i < bitlen; i++) {
+            w = (w << 1) | raw_bit(s, i);
+            if (w != sync)
+                continue;
+            if (pass)
+                s->disk.sync_pos[nr] = i;
+            nr++;
+        }
+    }
+
+    s->disk.nr_sync = nr;
+    s->disk.sync_word = sync;
+    s->disk.sync_valid = 1;
+}
+
+/* Bitcells to stream until the next sync match (~0 if there is none). */
+static uint64_t bits_to_sync(struct amiga_state *s)
+{
+    uint32_t bitlen = s->disk.track_raw->bitlen;
+    uint32_t pos = s->disk.input_pos;
+    unsigned int lo = 0, hi, i;
+
+    if (!(s->custom[CUST_adkcon] & (1u<<10))) /* WORDSYNC? */
+        return ~0ull;
+
+    if (!s->disk.sync_valid || (s->disk.sync_word != s->custom[CUST_dsksync]))
+        find_sync_positions(s);
+    if (s->disk.nr_sync == 0)
+        return ~0ull;
+
+    hi = s->disk.nr_sync;
+    while (lo < hi) {
+        i = (lo + hi) / 2;
+        if (s->disk.sync_pos[i] < pos)
+            lo = i + 1;
+        else
+            hi = i;
+    }
+    if (lo == s->disk.nr_sync)
+        return s->disk.sync_pos[0] + bitlen - pos + 1;
+    return s->disk.sync_pos[lo] - pos + 1;
+}
+
 static void disk_dma_word(struct amiga_state *s, uint16_t w)
 {
     if (s->disk.dsklen & 0x3fff) {
@@ -54,72 +183,233 @@ static void disk_dma_word(struct amiga_state *s, uint16_t w)
     }
 }
 
-static void data_cb(void *_s)
+/* Exact model: stream a single bitcell through the disk controller. */
+static void step_bit(struct amiga_state *s)
 {
-    struct amiga_state *s = _s;
-    time_ns_t t = s->disk.last_bitcell_time;
-    time_ns_t now = s->event_base.current_time;
     uint16_t w = s->disk.data_word;
 
-    for (t += s->disk.ns_per_cell; t <= now; t += s->disk.ns_per_cell) {
-        w <<= 1;
-        if (s->disk.input_byte & 0x80)
-            w |= 1;
-        s->disk.input_byte <<= 1;
-        if (++s->disk.input_pos == s->disk.track_raw->bitlen) {
-            cia_set_icr_flag(s, &s->ciab, CIAICRB_FLG);
-            s->disk.input_pos = 0;
+    s->disk.last_bitcell_time += s->disk.ns_per_cell;
+
+    w <<= 1;
+    if (s->disk.input_byte & 0x80)
+        w |= 1;
+    s->disk.input_byte <<= 1;
+    if (++s->disk.input_pos == s->disk.track_raw->bitlen) {
+        cia_set_icr_flag(s, &s->ciab, CIAICRB_FLG);
+        s->disk.input_pos = 0;
+    }
+    if (!(s->disk.input_pos & 7))
+        track_load_byte(s);
+    if (s->disk.bits_since_load < 16)
+        s->disk.bits_since_load++;
+    s->disk.data_word_bitpos++;
+    s->custom[CUST_dskbytr] &= ~(1u<<12);
+    if (!(s->disk.data_word_bitpos & 7)) {
+        s->custom[CUST_dskbytr] &= 0x7f00;
+        s->custom[CUST_dskbytr] |= 0x8000 | (uint8_t)w;
+        if ((s->disk.dma == 2) && !(s->disk.data_word_bitpos & 15))
+            disk_dma_word(s, w);
+    }
+    if ((s->custom[CUST_adkcon] & (1u<<10)) /* WORDSYNC? */
+        && (w == s->custom[CUST_dsksync])) {
+        log_info("Disk sync found");
+        intreq_set_bit(s, 12); /* disk sync found */
+        s->custom[CUST_dskbytr] |= 1u<<12; /* WORDEQUAL */
+        s->disk.data_word_bitpos = 0;
+        if ((s->custom[CUST_dmacon] & (1u<<4)) && (s->disk.dma == 1)) {
+            /* How much checking should I do for DMA read start? RNC 
+             * Copylock only sets dmacon[4], doesn't touch the master 
+             * enable (dmacon[9]). UAE doesn't check DMACON at all for 
+             * disk read DMAs. I check dmacon[4] only for now. */
+            log_info("Disk DMA started");
+            /* Note that DMA fetch begins with the *next* full word of MFM 
+             * streamed from disk (i.e., toss the first sync word). */
+            s->disk.dma = 2;
         }
-        if (!(s->disk.input_pos & 7))
-            track_load_byte(s);
-        s->disk.data_word_bitpos++;
-        s->custom[CUST_dskbytr] &= ~(1u<<12);
-        if (!(s->disk.data_word_bitpos & 7)) {
-            s->custom[CUST_dskbytr] &= 0x7f00;
-            s->custom[CUST_dskbytr] |= 0x8000 | (uint8_t)w;
-            if ((s->disk.dma == 2) && !(s->disk.data_word_bitpos & 15))
-                disk_dma_word(s, w);
+    }
+
+    s->disk.data_word = w;
+}
+
+/* Fast-forward @nr bitcells, none of which completes a sync match. The 
+ * externally-visible state ends up exactly as if @nr calls were made to 
+ * step_bit(). */
+static void skip_bits(struct amiga_state *s, uint64_t nr)
+{
+    uint32_t bitlen = s->disk.track_raw->bitlen;
+    uint32_t start = s->disk.input_pos;
+    unsigned int bitpos = s->disk.data_word_bitpos;
+    uint64_t i, last;
+
+    s->disk.last_bitcell_time += bits_to_ns(s, nr);
+
+    if ((start + nr) >= bitlen)
+        cia_set_icr_flag(s, &s->ciab, CIAICRB_FLG);
+
+    /* DMA words are fetched every 16 bitcells, in order, until done. */
+    for (i = 16 - (bitpos & 15); (s->disk.dma == 2) && (i <= nr); i += 16)
+        disk_dma_word(s, raw_bits(s, (start + i - 1) % bitlen, 16));
+
+    /* Only the most recent DSKBYTR update is visible. */
+    s->custom[CUST_dskbytr] &= ~(1u<<12);
+    if (nr >= (8 - (bitpos & 7))) {
+        last = nr - ((bitpos + nr) & 7);
+        s->custom[CUST_dskbytr] &= 0x7f00;
+        s->custom[CUST_dskbytr] |= 0x8000 |
+            (uint8_t)raw_bits(s, (start + last - 1) % bitlen, 8);
+    }
+
+    s->disk.input_pos = (start + nr) % bitlen;
+    s->disk.data_word = raw_bits(s, (start + nr - 1) % bitlen, 16);
+    s->disk.data_word_bitpos = bitpos + nr;
+    track_load_byte(s);
+    s->disk.input_byte <<= s->disk.input_pos & 7;
+}
+
+/* Bring the disk controller up to date with the current time. Bitcells are 
+ * streamed in bulk up to the next sync match, which is itself handled by 
+ * the exact per-bitcell model. */
+static void disk_catch_up(struct amiga_state *s)
+{
+    time_ns_t now = s->event_base.current_time;
+    uint64_t nr, sync;
+
+    if (s->disk.cell_ns == NULL)
+        return;
+
+    while ((s->disk.last_bitcell_time + s->disk.ns_per_cell) <= now) {
+        if (s->disk.bits_since_load < 16) {
+            /* Data word is not yet fully populated from the track. */
+            step_bit(s);
+            continue;
         }
-        if ((s->custom[CUST_adkcon] & (1u<<10)) /* WORDSYNC? */
-            && (w == s->custom[CUST_dsksync])) {
-            log_info("Disk sync found");
-            intreq_set_bit(s, 12); /* disk sync found */
-            s->custom[CUST_dskbytr] |= 1u<<12; /* WORDEQUAL */
-            s->disk.data_word_bitpos = 0;
-            if ((s->custom[CUST_dmacon] & (1u<<4)) && (s->disk.dma == 1)) {
-                /* How much checking should I do for DMA read start? RNC 
-                 * Copylock only sets dmacon[4], doesn't touch the master 
-                 * enable (dmacon[9]). UAE doesn't check DMACON at all for 
-                 * disk read DMAs. I check dmacon[4] only for now. */
-                log_info("Disk DMA started");
-                /* Note that DMA fetch begins with the *next* full word of MFM 
-                 * streamed from disk (i.e., toss the first sync word). */
-                s->disk.dma = 2;
-            }
+        nr = ns_to_bits(s, now - s->disk.last_bitcell_time);
+        sync = bits_to_sync(s);
+        if (sync > nr) {
+            skip_bits(s, nr);
+            break;
         }
+        if (sync > 1)
+            skip_bits(s, sync - 1);
+        step_bit(s);
     }
+}
 
-    s->disk.last_bitcell_time = t - s->disk.ns_per_cell;
-    s->disk.data_word = w;
+/* Schedule the next time the disk controller does something that software 
+ * can observe asynchronously: an index pulse, a sync match, or a DMA word. 
+ * DSKBYTR polls are handled synchronously via disk_sync(). */
+static void disk_schedule(struct amiga_state *s)
+{
+    uint64_t nr;
+
+    if (s->disk.cell_ns == NULL)
+        return;
+
+    nr = s->disk.track_raw->bitlen - s->disk.input_pos;
+    nr = min_t(uint64_t, nr, bits_to_sync(s));
+    if (s->disk.dma == 2)
+        nr = min_t(uint64_t, nr, 16 - (s->disk.data_word_bitpos & 15));
+    if (s->disk.bits_since_load < 16)
+        nr = 1;
+
+    event_set(s->disk.data_delay,
+              s->disk.last_bitcell_time + bits_to_ns(s, nr));
+}
+
+void disk_sync(struct amiga_state *s)
+{
+    disk_catch_up(s);
+    disk_schedule(s);
+}
+
+static void data_cb(void *_s)
+{
+    disk_sync(_s);
+}
+
+static void track_unload(struct amiga_state *s)
+{
+    if (s->disk.track_raw != NULL)
+        track_purge_raw_buffer(s->disk.track_raw);
+    event_unset(s->disk.data_delay);
+    memfree(s->disk.cell_ns);
+    memfree(s->disk.byte_time);
+    s->disk.cell_ns = s->disk.byte_time = NULL;
+    s->disk.sync_valid = 0;
+}
+
+/* Render the current track and precompute its bitcell timings. */
+static bool_t track_render(struct amiga_state *s)
+{
+    struct track_raw *raw = s->disk.track_raw;
+    unsigned int i, nr_bytes;
+
+    if (raw == NULL) {
+        log_warn("No disk in DF0:");
+        return 0;
+    }
 
-    event_set(s->disk.data_delay, t);
+    track_read_raw(raw, s->disk.tracknr);
+    if (raw->bitlen < 16) {
+        log_warn("Track %u is empty", s->disk.tracknr);
+        return 0;
+    }
+
+    s->disk.av_ns_per_cell = 200000000ul / raw->bitlen;
+
+    nr_bytes = (raw->bitlen + 7) / 8;
+    s->disk.cell_ns = memalloc((nr_bytes + 1) * sizeof(uint32_t));
+    s->disk.byte_time = memalloc((nr_bytes + 1) * sizeof(uint32_t));
+    for (i = 0; i < nr_bytes; i++) {
+        s->disk.cell_ns[i] = max_t(uint32_t, 1, (s->disk.av_ns_per_cell *
+                                                 raw->speed[i*8]) / 1000u);
+        s->disk.byte_time[i+1] = s->disk.byte_time[i] +
+            s->disk.cell_ns[i] * min_t(uint32_t, 8, raw->bitlen - i*8);
+    }
+    s->disk.rev_ns = s->disk.byte_time[nr_bytes];
+
+    return 1;
 }
 
 static void track_load(struct amiga_state *s)
 {
+    disk_catch_up(s);
+    track_unload(s);
+
     log_info("Loading track %u", s->disk.tracknr);
-    track_read_raw(s->disk.track_raw, s->disk.tracknr);
+    if (!track_render(s))
+        return;
+
     s->disk.input_pos = s->disk.data_word_bitpos = s->disk.data_word = 0;
+    s->disk.bits_since_load = 0;
     s->disk.last_bitcell_time = s->event_base.current_time;
-    s->disk.av_ns_per_cell = 200000000ul / s->disk.track_raw->bitlen;
+
     track_load_byte(s);
-    data_cb(s);
+    disk_sync(s);
 }
 
-static void track_unload(struct amiga_state *s)
+bool_t disk_track_loaded(struct amiga_state *s)
 {
-    track_purge_raw_buffer(s->disk.track_raw);
-    event_unset(s->disk.data_delay);
+    return s->disk.cell_ns != NULL;
+}
+
+void disk_reload_track(struct amiga_state *s, bool_t loaded)
+{
+    track_unload(s);
+    if (loaded)
+        (void)track_render(s);
+}
+
+void disk_restore_pos(struct amiga_state *s, unsigned int pos)
+{
+    s->disk.input_pos = pos;
+    if (!disk_track_loaded(s) || (pos < s->disk.track_raw->bitlen))
+        return;
+
+    log_warn("Track %u is shorter than when snapshotted", s->disk.tracknr);
+    s->disk.input_pos = pos % s->disk.track_raw->bitlen;
+    track_load_byte(s);
+    s->disk.input_byte <<= s->disk.input_pos & 7;
 }
 
 static void disk_recalc_cia_inputs(struct amiga_state *s)
@@ -244,11 +534,6 @@ void disk_dsklen_changed(struct amiga_state *s)
 
 void disk_init(struct amiga_state *s)
 {
-    s->disk.df0_disk = disk_open(df0_filename, 1);
-    if (s->disk.df0_disk == NULL)
-        errx(1, "%s", df0_filename);
-    s->disk.track_raw = track_alloc_raw_buffer(s->disk.df0_disk);
-
     /* Set up CIA peripheral data registers. */
     s->ciaa.pra_i = 0xff; /* disk inputs, all off (active low) */
     s->ciaa.ddra = 0x03;
@@ -264,9 +549,41 @@ void disk_init(struct amiga_state *s)
     s->disk.data_delay = event_alloc(&s->event_base, data_cb, s);
 }
 
-void amiga_insert_df0(const char *filename)
+static void eject_df0(struct amiga_state *s)
 {
-    df0_filename = filename;
+    track_unload(s);
+    if (s->disk.df0_disk == NULL)
+        return;
+    track_free_raw_buffer(s->disk.track_raw);
+    disk_close(s->disk.df0_disk);
+    s->disk.track_raw = NULL;
+    s->disk.df0_disk = NULL;
+}
+
+void disk_destroy(struct amiga_state *s)
+{
+    eject_df0(s);
+    memfree(s->disk.sync_pos);
+    event_destroy(s->disk.motor_delay);
+    event_destroy(s->disk.step_delay);
+    event_destroy(s->disk.data_delay);
+}
+
+int amiga_insert_df0(struct amiga_state *s, const char *filename)
+{
+    bool_t loaded = disk_track_loaded(s);
+
+    eject_df0(s);
+
+    s->disk.df0_disk = disk_open(filename, 1);
+    if (s->disk.df0_disk == NULL)
+        return -1;
+    s->disk.track_raw = track_alloc_raw_buffer(s->disk.df0_disk);
+
+    if (loaded)
+        track_load(s);
+
+    return 0;
 }
 
 /*
@@ -39,15 +39,34 @@ struct amiga_disk {
     time_ns_t last_bitcell_time;
     unsigned int data_word_bitpos, ns_per_cell;
     unsigned int input_pos, input_byte;
+    unsigned int bits_since_load;
     uint16_t data_word;
 
+    /* Bitcell timings of track_raw: per byte, and cumulative from index. */
+    uint32_t *cell_ns, *byte_time, rev_ns;
+
+    /* Bit positions in track_raw at which a DSKSYNC match completes. */
+    uint32_t *sync_pos;
+    unsigned int nr_sync;
+    uint16_t sync_word;
+    bool_t sync_valid;
+
     uint8_t dma;
     uint16_t dsklen;
 };
 
 void disk_init(struct amiga_state *);
+void disk_destroy(struct amiga_state *);
 void disk_cia_changed(struct amiga_state *);
 void disk_dsklen_changed(struct amiga_state *);
+void disk_sync(struct amiga_state *);
+
+/* Snapshot support: is a track currently rendered? Re-render the current 
+ * track (or not) without disturbing the drive's position state. Then resume 
+ * at bitcell @pos, wrapped to the length of the track now in DF0:. */
+bool_t disk_track_loaded(struct amiga_state *);
+void disk_reload_track(struct amiga_state *, bool_t loaded);
+void disk_restore_pos(struct amiga_state *, unsigned int pos);
 
 #endif /* __DISK_H__ */
 
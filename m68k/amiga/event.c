@@ -76,6 +76,16 @@ void event_unset(struct event *event)
     event->time = 0;
 }
 
+time_ns_t event_time(struct event *event)
+{
+    return event->time;
+}
+
+time_ns_t event_next_deadline(struct event_base *base)
+{
+    return base->active_events ? base->active_events->time : TIME_NEVER;
+}
+
 void fire_events(struct event_base *base)
 {
     struct event *event;
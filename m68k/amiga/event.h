@@ -14,6 +14,8 @@
 /* An absolute or delta time, in nanoseconds. */
 typedef uint64_t time_ns_t;
 
+#define TIME_NEVER (~(time_ns_t)0)
+
 #define MICROSECS(x) ((x) * 1000ull)
 #define MILLISECS(x) ((x) * 1000000ull)
 
@@ -34,6 +36,12 @@ void event_set(struct event *event, time_ns_t time);
 void event_set_delta(struct event *event, time_ns_t delta);
 void event_unset(struct event *event);
 
+/* Absolute time at which @event will fire, or 0 if it is not set. */
+time_ns_t event_time(struct event *event);
+
+/* Absolute time of the earliest registered event, or TIME_NEVER. */
+time_ns_t event_next_deadline(struct event_base *base);
+
 void fire_events(struct event_base *base);
 
 #endif /* __EVENT_H__ */
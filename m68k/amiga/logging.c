@@ -24,6 +24,7 @@ static void write_log(
 {
     if (loglevel < s->max_loglevel)
         return;
+    amiga_sync(s);
     fprintf(s->logfile, "[%s,PC=%08x,%u.%03uus] ",
             subsys_name[subsystem], s->ctxt.regs->pc,
             (unsigned int)(s->event_base.current_time/1000),
@@ -8,6 +8,9 @@
 
 #include <stdlib.h>
 #include <string.h>
+#if !defined(__MINGW32__)
+#include <sys/mman.h>
+#endif
 
 #include <amiga/amiga.h>
 
@@ -81,14 +84,17 @@ int mem_write(uint32_t addr, uint32_t val, unsigned int bytes,
     return M68KEMUL_OKAY;
 }
 
-static void regions_dump(struct region *r)
+static void regions_dump(struct amiga_state *s, struct region *r)
 {
-    printf("Region list: ");
-    while (r) {
-        printf("%x-%x, ", r->start, r->end);
+    char buf[256];
+    int n = 0;
+
+    buf[0] = '\0';
+    while (r && (n < (sizeof(buf) - 20))) {
+        n += sprintf(&buf[n], "%x-%x, ", r->start, r->end);
         r = r->next;
     }
-    printf("\n");
+    log_info("Region list: %s%s", buf, r ? "..." : "");
 }
 
 void mem_reserve(struct amiga_state *s, uint32_t start, uint32_t bytes)
@@ -99,7 +105,7 @@ void mem_reserve(struct amiga_state *s, uint32_t start, uint32_t bytes)
 
     ASSERT(m != NULL);
 
-    regions_dump(m->free);
+    regions_dump(s, m->free);
 
     pprev = &m->free;
     while (((r = *pprev) != NULL) && (r->end < start))
@@ -125,7 +131,7 @@ void mem_reserve(struct amiga_state *s, uint32_t start, uint32_t bytes)
         memfree(r);
     }
 
-    regions_dump(m->free);
+    regions_dump(s, m->free);
 }
 
 uint32_t mem_alloc(struct amiga_state *s, struct memory *m, uint32_t bytes)
@@ -133,7 +139,7 @@ uint32_t mem_alloc(struct amiga_state *s, struct memory *m, uint32_t bytes)
     uint32_t addr;
     struct region *r, **pprev;
 
-    regions_dump(m->free);
+    regions_dump(s, m->free);
 
     pprev = &m->free;
     while (((r = *pprev) != NULL) && ((r->end - r->start + 1) < bytes))
@@ -150,7 +156,7 @@ uint32_t mem_alloc(struct amiga_state *s, struct memory *m, uint32_t bytes)
         memfree(r);
     }
 
-    regions_dump(m->free);
+    regions_dump(s, m->free);
 
     return addr;
 }
@@ -162,7 +168,7 @@ void mem_free(struct amiga_state *s, uint32_t addr, uint32_t bytes)
 
     ASSERT(m != NULL);
 
-    regions_dump(m->free);
+    regions_dump(s, m->free);
 
     pprev = &m->free;
     while (((r = *pprev) != NULL) && (r->end < addr))
@@ -188,7 +194,7 @@ void mem_free(struct amiga_state *s, uint32_t addr, uint32_t bytes)
 
     memset(&m->dat[addr - m->start], 0xaa, bytes);
 
-    regions_dump(m->free);
+    regions_dump(s, m->free);
 }
 
 struct memory *mem_init(struct amiga_state *s, uint32_t start, uint32_t bytes)
@@ -215,6 +221,25 @@ struct memory *mem_init(struct amiga_state *s, uint32_t start, uint32_t bytes)
     return m;
 }
 
+void mem_destroy(struct amiga_state *s)
+{
+    struct memory *m;
+    struct region *r;
+
+    while ((m = s->memory) != NULL) {
+        s->memory = m->next;
+        while ((r = m->free) != NULL) {
+            m->free = r->next;
+            memfree(r);
+        }
+#if !defined(__MINGW32__)
+        if (m->mapping != NULL)
+            munmap(m->mapping, m->end - m->start + 1);
+#endif
+        memfree(m);
+    }
+}
+
 /*
  * Local variables:
  * mode: C
@@ -23,6 +23,7 @@ struct memory {
     struct memory *next;
     uint32_t start, end;
     uint8_t *dat;
+    void *mapping; /* copy-on-write snapshot image, if any */
     struct region *free;
     struct watch *watch;
 };
@@ -36,6 +37,7 @@ int mem_read(uint32_t addr, uint32_t *val, unsigned int bytes,
 int mem_write(uint32_t addr, uint32_t val, unsigned int bytes,
               struct amiga_state *);
 struct memory *mem_init(struct amiga_state *, uint32_t start, uint32_t bytes);
+void mem_destroy(struct amiga_state *);
 
 #endif /* __AMIGA_MEM_H__ */
 
@@ -0,0 +1,298 @@
+/*
+ * snapshot.c
+ * 
+ * Save and restore complete emulator state.
+ * 
+ * Snapshots contain the CPU, chipset, pending events, disk drive and RAM.
+ * RAM images are page aligned within the snapshot file so that they can be
+ * mapped copy-on-write on restore: resuming from a snapshot costs nothing
+ * more than the pages the emulated program subsequently touches.
+ * 
+ * Snapshots are a dump of in-memory state and are only portable between
+ * builds of the same emulator on the same host architecture. The disk in
+ * DF0: is not part of the snapshot, so a snapshot may be resumed against a
+ * different disk image.
+ * 
+ * Written in 2026 by agent
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#if !defined(__MINGW32__)
+#include <sys/mman.h>
+#endif
+
+#include <amiga/amiga.h>
+
+#define SUBSYSTEM subsystem_main
+
+#define SNAPSHOT_SIG     "AMISNAP"
+#define SNAPSHOT_VERSION 1
+
+/* Alignment of RAM images in the snapshot file. Large enough for any
+ * host page size we are likely to encounter. */
+#define SNAPSHOT_ALIGN   65536u
+
+struct snap_disk {
+    uint32_t motor, step;
+    uint8_t old_ciabb, dma, loaded;
+    uint16_t tracknr, dsklen, data_word;
+    uint64_t last_bitcell_time;
+    uint32_t data_word_bitpos, ns_per_cell;
+    uint32_t input_pos, input_byte, bits_since_load;
+};
+
+struct snap_header {
+    char sig[8];
+    uint32_t version, nr_memory;
+    uint64_t current_time;
+
+    /* CPU */
+    struct m68k_regs regs;
+    uint32_t prefetch_addr, prefetch_valid;
+    uint16_t prefetch_dat[2];
+
+    /* Chipset */
+    uint16_t custom[256];
+    struct cia ciaa, ciab;
+
+    /* Pending events (0 = not set) */
+    uint64_t motor_time, step_time, data_time;
+
+    /* Disk drive and controller */
+    struct snap_disk disk;
+};
+
+struct snap_memory {
+    uint32_t start, end;
+    uint32_t nr_free, pad;
+    uint64_t dat_off;
+};
+
+struct snap_region {
+    uint32_t start, end;
+};
+
+static unsigned int nr_regions(struct region *r)
+{
+    unsigned int nr;
+    for (nr = 0; r != NULL; r = r->next)
+        nr++;
+    return nr;
+}
+
+void amiga_save_snapshot(struct amiga_state *s, const char *filename)
+{
+    struct snap_header hdr;
+    struct snap_memory sm;
+    struct snap_region sr;
+    struct memory *m;
+    struct region *r;
+    uint64_t off;
+    int fd;
+
+    memset(&hdr, 0, sizeof(hdr));
+    strcpy(hdr.sig, SNAPSHOT_SIG);
+    hdr.version = SNAPSHOT_VERSION;
+    for (m = s->memory; m != NULL; m = m->next)
+        hdr.nr_memory++;
+    amiga_sync(s);
+    hdr.current_time = s->event_base.current_time;
+
+    m68k_sync_ccr(&s->ctxt);
+    hdr.regs = *s->ctxt.regs;
+    hdr.prefetch_addr = s->ctxt.prefetch_addr;
+    hdr.prefetch_valid = s->ctxt.prefetch_valid;
+    memcpy(hdr.prefetch_dat, s->ctxt.prefetch_dat, sizeof(hdr.prefetch_dat));
+
+    memcpy(hdr.custom, s->custom, sizeof(hdr.custom));
+    hdr.ciaa = s->ciaa;
+    hdr.ciab = s->ciab;
+
+    hdr.motor_time = event_time(s->disk.motor_delay);
+    hdr.step_time = event_time(s->disk.step_delay);
+    hdr.data_time = event_time(s->disk.data_delay);
+
+    hdr.disk.motor = s->disk.motor;
+    hdr.disk.step = s->disk.step;
+    hdr.disk.old_ciabb = s->disk.old_ciabb;
+    hdr.disk.dma = s->disk.dma;
+    hdr.disk.loaded = disk_track_loaded(s);
+    hdr.disk.tracknr = s->disk.tracknr;
+    hdr.disk.dsklen = s->disk.dsklen;
+    hdr.disk.data_word = s->disk.data_word;
+    hdr.disk.last_bitcell_time = s->disk.last_bitcell_time;
+    hdr.disk.data_word_bitpos = s->disk.data_word_bitpos;
+    hdr.disk.ns_per_cell = s->disk.ns_per_cell;
+    hdr.disk.input_pos = s->disk.input_pos;
+    hdr.disk.input_byte = s->disk.input_byte;
+    hdr.disk.bits_since_load = s->disk.bits_since_load;
+
+    if ((fd = file_open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1)
+        err(1, "%s", filename);
+
+    write_exact(fd, &hdr, sizeof(hdr));
+
+    /* RAM images follow the region descriptors, each suitably aligned. */
+    off = sizeof(hdr);
+    for (m = s->memory; m != NULL; m = m->next)
+        off += sizeof(sm) + nr_regions(m->free) * sizeof(sr);
+
+    for (m = s->memory; m != NULL; m = m->next) {
+        off = (off + SNAPSHOT_ALIGN - 1) & ~(uint64_t)(SNAPSHOT_ALIGN - 1);
+        memset(&sm, 0, sizeof(sm));
+        sm.start = m->start;
+        sm.end = m->end;
+        sm.nr_free = nr_regions(m->free);
+        sm.dat_off = off;
+        write_exact(fd, &sm, sizeof(sm));
+        for (r = m->free; r != NULL; r = r->next) {
+            sr.start = r->start;
+            sr.end = r->end;
+            write_exact(fd, &sr, sizeof(sr));
+        }
+        off += m->end - m->start + 1;
+    }
+
+    for (m = s->memory; m != NULL; m = m->next) {
+        off = (lseek(fd, 0, SEEK_CUR) + SNAPSHOT_ALIGN - 1)
+            & ~(uint64_t)(SNAPSHOT_ALIGN - 1);
+        if (lseek(fd, off, SEEK_SET) != off)
+            err(1, "%s", filename);
+        write_exact(fd, m->dat, m->end - m->start + 1);
+    }
+
+    if (close(fd) == -1)
+        err(1, "%s", filename);
+
+    log_info("Saved snapshot to %s", filename);
+}
+
+static void load_memory_image(
+    struct memory *m, int fd, uint64_t off, const char *filename)
+{
+    uint32_t bytes = m->end - m->start + 1;
+
+#if !defined(__MINGW32__)
+    void *p = mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, off);
+    if (p == MAP_FAILED)
+        err(1, "%s", filename);
+    if (m->mapping != NULL)
+        munmap(m->mapping, bytes);
+    m->mapping = m->dat = p;
+#else
+    if (lseek(fd, off, SEEK_SET) != off)
+        err(1, "%s", filename);
+    read_exact(fd, m->dat, bytes);
+#endif
+}
+
+static void restore_event(struct event *event, time_ns_t time)
+{
+    if (time)
+        event_set(event, time);
+    else
+        event_unset(event);
+}
+
+void amiga_load_snapshot(struct amiga_state *s, const char *filename)
+{
+    struct snap_header hdr;
+    struct snap_memory sm;
+    struct snap_region sr;
+    struct memory *m;
+    struct region *r, **pprev;
+    unsigned int i, nr_memory = 0;
+    uint64_t *dat_off;
+    int fd;
+
+    if ((fd = file_open(filename, O_RDONLY)) == -1)
+        err(1, "%s", filename);
+
+    read_exact(fd, &hdr, sizeof(hdr));
+    if (strncmp(hdr.sig, SNAPSHOT_SIG, sizeof(hdr.sig)) ||
+        (hdr.version != SNAPSHOT_VERSION))
+        errx(1, "%s: Not a snapshot, or incompatible version", filename);
+
+    for (m = s->memory; m != NULL; m = m->next)
+        nr_memory++;
+    if (hdr.nr_memory != nr_memory)
+        errx(1, "%s: Snapshot memory layout does not match", filename);
+    dat_off = memalloc(nr_memory * sizeof(*dat_off));
+
+    /* RAM: region descriptors, free lists, and copy-on-write images. */
+    for (m = s->memory, nr_memory = 0; m != NULL; m = m->next) {
+        read_exact(fd, &sm, sizeof(sm));
+        if ((sm.start != m->start) || (sm.end != m->end))
+            errx(1, "%s: Snapshot memory layout does not match", filename);
+        while ((r = m->free) != NULL) {
+            m->free = r->next;
+            memfree(r);
+        }
+        pprev = &m->free;
+        for (i = 0; i < sm.nr_free; i++) {
+            read_exact(fd, &sr, sizeof(sr));
+            r = memalloc(sizeof(*r));
+            r->start = sr.start;
+            r->end = sr.end;
+            *pprev = r;
+            pprev = &r->next;
+        }
+        *pprev = NULL;
+        dat_off[nr_memory++] = sm.dat_off;
+    }
+
+    for (m = s->memory, nr_memory = 0; m != NULL; m = m->next)
+        load_memory_image(m, fd, dat_off[nr_memory++], filename);
+
+    close(fd);
+    memfree(dat_off);
+
+    s->event_base.current_time = hdr.current_time;
+    s->pending_cycles = 0;
+    s->resched = 1;
+
+    m68k_sync_ccr(&s->ctxt);
+    *s->ctxt.regs = hdr.regs;
+    s->ctxt.prefetch_addr = hdr.prefetch_addr;
+    s->ctxt.prefetch_valid = hdr.prefetch_valid;
+    memcpy(s->ctxt.prefetch_dat, hdr.prefetch_dat, sizeof(hdr.prefetch_dat));
+
+    memcpy(s->custom, hdr.custom, sizeof(s->custom));
+    s->ciaa = hdr.ciaa;
+    s->ciab = hdr.ciab;
+
+    s->disk.motor = hdr.disk.motor;
+    s->disk.step = hdr.disk.step;
+    s->disk.old_ciabb = hdr.disk.old_ciabb;
+    s->disk.dma = hdr.disk.dma;
+    s->disk.tracknr = hdr.disk.tracknr;
+    s->disk.dsklen = hdr.disk.dsklen;
+    disk_reload_track(s, hdr.disk.loaded);
+    s->disk.data_word = hdr.disk.data_word;
+    s->disk.last_bitcell_time = hdr.disk.last_bitcell_time;
+    s->disk.data_word_bitpos = hdr.disk.data_word_bitpos;
+    s->disk.ns_per_cell = hdr.disk.ns_per_cell;
+    s->disk.input_byte = hdr.disk.input_byte;
+    s->disk.bits_since_load = hdr.disk.bits_since_load;
+    disk_restore_pos(s, hdr.disk.input_pos);
+
+    restore_event(s->disk.motor_delay, hdr.motor_time);
+    restore_event(s->disk.step_delay, hdr.step_time);
+    restore_event(s->disk.data_delay, hdr.data_time);
+
+    log_info("Restored snapshot from %s", filename);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -8,6 +8,7 @@
 
 #include <stdarg.h>
 #include <stdint.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,15 +16,43 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <unistd.h>
 #include <time.h>
 #include <utime.h>
 
+#include <dirent.h>
+#include <pthread.h>
+
 #include <amiga/amiga.h>
 #include <libdisk/util.h>
 
 #define MEM_SIZE (512*1024) /* our system has 512kB RAM */
 
+/* Ring of most-recently executed instruction addresses. */
+#define TRACE_LEN 16
+
+#define DEFAULT_JOBS 4
+
+/* One extraction run, against one disk image. */
+struct job {
+    /* Loader image, and where to load it. */
+    const char *infile;
+    uint32_t off, len, base;
+    bool_t loadseg;
+    /* Disk image to insert in DF0:. */
+    const char *df0_file;
+    /* Snapshot to resume from, or to save on reaching snap_pc. */
+    const char *resume_file, *snap_file;
+    uint32_t snap_pc;
+    /* Destinations for the listing and for emulator logging. */
+    FILE *out, *log;
+    /* Results. If the job could not be run, errmsg says why. */
+    int rc;
+    struct m68k_regs regs;
+    char errmsg[128];
+};
+
 static void set_bit(unsigned int bit, char *map)
 {
     map[bit/8] |= 1u << (bit&7);
@@ -34,15 +63,24 @@ static int test_bit(unsigned int bit, char *map)
     return !!(map[bit/8] & (1u << (bit&7)));
 }
 
+/* Destination for m68k_dump_*() output, per thread. */
+static __thread FILE *dump_file;
 static void dump(const char *fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-    vprintf(fmt, args);
+    vfprintf(dump_file, fmt, args);
     va_end(args);
 }
 
-static int ctrl_c;
+static void print_insn(FILE *out, struct amiga_state *s, uint32_t pc)
+{
+    m68k_disassemble(&s->ctxt, pc);
+    fprintf(out, "%08x %04x %04x %04x %s\n", pc,
+           s->ctxt.op[0], s->ctxt.op[1], s->ctxt.op[2], s->ctxt.dis);
+}
+
+static volatile sig_atomic_t ctrl_c;
 static void sigint_handler(int signum)
 {
     ctrl_c = 1;
@@ -63,73 +101,142 @@ static void init_sigint_handler(void)
 #endif
 }
 
-int main(int argc, char **argv)
+/* Record why @job could not be run. */
+static void job_error(struct job *job, const char *fmt, ...)
 {
-    struct amiga_state s;
-    struct m68k_regs *regs;
-    char *p, *shadow, *bmap;
-    int rc, i, fd, zeroes_run = 0;
-    uint32_t off, len, base;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(job->errmsg, sizeof(job->errmsg), fmt, args);
+    va_end(args);
+}
+
+/* Execution state of a job, as seen by its per-instruction hook. */
+struct run_state {
+    struct job *job;
+    const char *snap_file;
+    char *shadow, *bmap;
+    uint32_t trace[TRACE_LEN];
+    unsigned int trace_idx;
+};
 
-    if (argc != 6)
-        errx(1, "Usage: %s <infile> <off> <len> <base> <df0_file>",
-             argv[0]);
+static void check_snapshot(struct amiga_state *s, struct run_state *rs)
+{
+    uint32_t pc = s->ctxt.regs->pc;
+
+    if (!rs->snap_file || (pc != rs->job->snap_pc))
+        return;
+    fprintf(rs->job->out, "Saving snapshot at %08x to %s\n",
+            pc, rs->snap_file);
+    amiga_save_snapshot(s, rs->snap_file);
+    rs->snap_file = NULL;
+}
 
-    fd = file_open(argv[1], O_RDONLY);
-    if (fd == -1)
-        err(1, "%s", argv[1]);
+/* Called after each instruction: record it, and decide whether to stop. */
+static int run_hook(struct amiga_state *s, uint32_t pc, void *data)
+{
+    struct run_state *rs = data;
+    unsigned int i;
 
-    off = strtol(argv[2], NULL, 16);
-    len = strtol(argv[3], NULL, 16);
-    base = strtol(argv[4], NULL, 16);
+    rs->trace[rs->trace_idx++ % TRACE_LEN] = pc;
 
-    if (len == 0) {
-        off_t sz = lseek(fd, 0, SEEK_END);
-        len = sz - off;
+    for (i = 0; i < s->ctxt.op_words; i++) {
+        if ((pc + 2*i+1) >= MEM_SIZE)
+            break;
+        *(uint16_t *)&rs->shadow[pc + 2*i] = htobe16(s->ctxt.op[i]);
+        set_bit(pc + 2*i, rs->bmap);
+        set_bit(pc + 2*i+1, rs->bmap);
     }
 
-    if ((base+len) > MEM_SIZE)
-        errx(1, "Image cannot be loaded into %ukB RAM\n", MEM_SIZE>>10);
+    if (ctrl_c || (s->ctxt.regs->pc == 0xdeadbeee))
+        return 1;
+    check_snapshot(s, rs);
+    return 0;
+}
 
-    shadow = memalloc(MEM_SIZE);
-    bmap = memalloc(MEM_SIZE/8);
+/* Returns -1, with the reason in job->errmsg, if the job cannot be run. */
+static int run_job(struct job *job)
+{
+    struct amiga_state s;
+    struct m68k_regs *regs;
+    struct run_state rs;
+    char *p, *shadow, *bmap;
+    int rc = M68KEMUL_OKAY, i, fd = -1, zeroes_run = 0;
+    uint32_t off = job->off, len = job->len, base = job->base, pc;
+    off_t sz;
+    FILE *out = job->out;
 
-    for (i = 0; i < argc; i++)
-        printf("%s ", argv[i]);
-    printf("\n");
+    dump_file = out;
 
-    init_sigint_handler();
+    shadow = memalloc(MEM_SIZE);
+    bmap = memalloc(MEM_SIZE/8);
 
-    amiga_insert_df0(argv[5]);
     amiga_init(&s, MEM_SIZE);
+    s.logfile = job->log;
     regs = s.ctxt.regs;
+    if (amiga_insert_df0(&s, job->df0_file) != 0) {
+        job_error(job, "%s: Unable to open disk", job->df0_file);
+        goto fail;
+    }
 
-    if (lseek(fd, off, SEEK_SET) != off)
-        err(1, NULL);
+    if (job->resume_file) {
+        amiga_load_snapshot(&s, job->resume_file);
+        s.ctxt.disassemble = 0;
+        s.ctxt.emulate = 1;
+        goto execute;
+    }
+
+    fd = file_open(job->infile, O_RDONLY);
+    if (fd == -1) {
+        job_error(job, "%s: %s", job->infile, strerror(errno));
+        goto fail;
+    }
+
+    sz = lseek(fd, 0, SEEK_END);
+    if (len == 0)
+        len = sz - off;
+    if ((off + len) > sz) {
+        job_error(job, "%s: File is too short", job->infile);
+        goto fail;
+    }
+
+    if ((base+len) > MEM_SIZE) {
+        job_error(job, "Image cannot be loaded into %ukB RAM", MEM_SIZE>>10);
+        goto fail;
+    }
+
+    if (lseek(fd, off, SEEK_SET) != off) {
+        job_error(job, "%s: %s", job->infile, strerror(errno));
+        goto fail;
+    }
     read_exact(fd, shadow, len);
     close(fd);
+    fd = -1;
 
     /* Poison low-memory vectors. */
     for (i = 0; i < 0x100; i += 4)
         mem_write(i, 0xdeadbe00u | i, 4, &s);
 
-    if (*argv[2] == '-') {
+    if (job->loadseg) {
         /* Treat file as a loadable executable. Perform LoadSeg on it. */
         uint32_t *p = (uint32_t *)shadow;
         unsigned int i, j, k, nr_chunks, nr_longs, type, mem_off = base-4;
         unsigned int bptr = 0;
-        if (be32toh(p[0]) != 0x3f3)
-            errx(1, "Unexpected image signature %08x", be32toh(p[0]));
-        printf("Loadable image: ");
+        if (be32toh(p[0]) != 0x3f3) {
+            job_error(job, "Unexpected image signature %08x",
+                      be32toh(p[0]));
+            goto fail;
+        }
+        fprintf(out, "Loadable image: ");
         for (i = 1; p[i] != 0; i++)
             continue;
         nr_chunks = be32toh(p[i+1]);        
-        printf("%u chunks\n", nr_chunks);
+        fprintf(out, "%u chunks\n", nr_chunks);
         i += 1 + 1 + 2 + nr_chunks;
         for (j = 0; j < nr_chunks; j++) {
             type = be32toh(p[i]);
             nr_longs = be32toh(p[i+1]) & 0x3fffffffu;
-            printf("Chunk %u: %08x, %u longwords\n", j, type, nr_longs);
+            fprintf(out, "Chunk %u: %08x, %u longwords\n",
+                    j, type, nr_longs);
             i += 2;
             bptr = mem_off;
             mem_off += 4;
@@ -147,10 +254,13 @@ int main(int argc, char **argv)
                     mem_off += 4;
                 }
             } else {
-                errx(1, "Unexpected chunk type %08x", type);
+                job_error(job, "Unexpected chunk type %08x", type);
+                goto fail;
+            }
+            if (be32toh(p[i]) != 0x3f2) {
+                job_error(job, "Unexpected chunk end %08x", be32toh(p[i]));
+                goto fail;
             }
-            if (be32toh(p[i]) != 0x3f2)
-                errx(1, "Unexpected chunk end %08x", be32toh(p[i]));
             i++;
             mem_write(bptr, mem_off/4, 4, &s);
         }
@@ -164,29 +274,39 @@ int main(int argc, char **argv)
     memset(shadow, 0, MEM_SIZE);
 
     regs->pc = base;
-    s.ctxt.disassemble = 1;
+    s.ctxt.disassemble = 0;
     s.ctxt.emulate = 1;
 
     mem_write(regs->a[7], 0xdeadbeee, 4, &s);
 
-    while (!ctrl_c && (regs->pc != 0xdeadbeee)) {
-        uint32_t pc = regs->pc;
-
-        rc = amiga_emulate(&s);
+execute:
+    /* Execution records only addresses and opcode words. Instructions are 
+     * disassembled on demand, after execution has finished. */
+    memset(&rs, 0, sizeof(rs));
+    rs.job = job;
+    rs.snap_file = job->snap_file;
+    rs.shadow = shadow;
+    rs.bmap = bmap;
+    if (!ctrl_c && (regs->pc != 0xdeadbeee)) {
+        check_snapshot(&s, &rs);
+        rc = amiga_run(&s, TIME_NEVER, ~0ul, run_hook, &rs);
+        /* Include the instruction which failed in the trace. */
         if (rc != M68KEMUL_OKAY)
-            break;
+            rs.trace[rs.trace_idx++ % TRACE_LEN] = regs->pc;
+    }
 
-        for (i = 0; i < s.ctxt.op_words; i++) {
-            if ((pc + 2*i+1) >= MEM_SIZE)
-                break;
-            *(uint16_t *)&shadow[pc + 2*i] = htobe16(s.ctxt.op[i]);
-            set_bit(pc + 2*i, bmap);
-            set_bit(pc + 2*i+1, bmap);
-        }
+    if (rc != M68KEMUL_OKAY) {
+        fprintf(out, "Last %u instructions:\n",
+                min_t(unsigned int, rs.trace_idx, TRACE_LEN));
+        for (i = min_t(unsigned int, rs.trace_idx, TRACE_LEN); i > 0; i--)
+            print_insn(out, &s, rs.trace[(rs.trace_idx - i) % TRACE_LEN]);
     }
 
-    printf("%08x %04x %04x %04x %s\n", regs->pc,
-           s.ctxt.op[0], s.ctxt.op[1],s.ctxt.op[2],s.ctxt.dis);
+    if (rs.trace_idx != 0) {
+        m68k_disassemble(&s.ctxt, rs.trace[(rs.trace_idx - 1) % TRACE_LEN]);
+        fprintf(out, "%08x %04x %04x %04x %s\n", regs->pc,
+                s.ctxt.op[0], s.ctxt.op[1],s.ctxt.op[2],s.ctxt.dis);
+    }
     m68k_dump_regs(regs, dump);
     m68k_dump_stack(&s.ctxt, stack_current, dump);
 
@@ -195,22 +315,21 @@ int main(int argc, char **argv)
             mem_write(i, shadow[i], 1, &s);
     free(shadow);
 
-    regs->pc = 0;
-    s.ctxt.disassemble = 1;
-    s.ctxt.emulate = 0;
+    job->rc = rc;
+    job->regs = *regs;
 
-#define finish_zeroes_run() do {                        \
-    if (zeroes_run >= 2) {                              \
-        printf("      [%u more]\n", zeroes_run-1);      \
-        printf("-------------------------------\n");    \
-    }                                                   \
-    zeroes_run = 0;                                     \
-} while (0)
+    pc = 0;
 
-    while (regs->pc < (MEM_SIZE-2)) {
-        uint32_t pc = regs->pc;
+#define finish_zeroes_run() do {                                \
+    if (zeroes_run >= 2) {                                      \
+        fprintf(out, "      [%u more]\n", zeroes_run-1);        \
+        fprintf(out, "-------------------------------\n");      \
+    }                                                           \
+    zeroes_run = 0;                                             \
+} while (0)
 
-        rc = amiga_emulate(&s);
+    while (pc < (MEM_SIZE-2)) {
+        m68k_disassemble(&s.ctxt, pc);
 
         if (!test_bit(pc, bmap)) {
             /* If we are dumping non-executed bytes, check if we are decoding
@@ -223,9 +342,8 @@ int main(int argc, char **argv)
             /* Skip unexecuted stuff. */
             while (!test_bit(pc, bmap) && (pc < MEM_SIZE-2))
                 pc += 2;
-            regs->pc = pc;
             zeroes_run = 0;
-            printf("-------------------------------\n");
+            fprintf(out, "-------------------------------\n");
             continue;
 #endif
         }
@@ -240,42 +358,300 @@ int main(int argc, char **argv)
         }
 
         /* Print an '*' for lines that were not actually executed. */
-        printf("%08x %c", pc, test_bit(pc, bmap) ? ' ' : '*');
+        fprintf(out, "%08x %c", pc, test_bit(pc, bmap) ? ' ' : '*');
 
         if (zeroes_run == 2) {
-            printf(".... .... ");
+            fprintf(out, ".... .... ");
             goto skip;
         }
 
         for (i = 0; i < 3; i++) {
             if (i < s.ctxt.op_words)
-                printf("%04x ", s.ctxt.op[i]);
+                fprintf(out, "%04x ", s.ctxt.op[i]);
             else
-                printf("     ");
+                fprintf(out, "     ");
         }
         if ((p = strchr(s.ctxt.dis, '\t')) != NULL)
             *p = '\0';
-        printf(" %s", s.ctxt.dis);
+        fprintf(out, " %s", s.ctxt.dis);
         if (p) {
             int spaces = 8-(p-s.ctxt.dis);
             if (spaces < 1)
                 spaces = 1;
-            printf("%*s%s", spaces, "", p+1);
+            fprintf(out, "%*s%s", spaces, "", p+1);
         }
-        printf("\n");
+        fprintf(out, "\n");
         if (i < s.ctxt.op_words) {
-            printf("%08x  ", pc + 2*i);
+            fprintf(out, "%08x  ", pc + 2*i);
             while (i < s.ctxt.op_words)
-                printf("%04x ", s.ctxt.op[i++]);
-            printf("\n");
+                fprintf(out, "%04x ", s.ctxt.op[i++]);
+            fprintf(out, "\n");
         }
 
     skip:
-        regs->pc = pc + s.ctxt.op_words*2;
+        pc += s.ctxt.op_words*2;
     }
 
     finish_zeroes_run();
 
+    free(bmap);
+    amiga_destroy(&s);
+    return 0;
+
+fail:
+    if (fd != -1)
+        close(fd);
+    free(shadow);
+    free(bmap);
+    amiga_destroy(&s);
+    return -1;
+}
+
+static void usage(int rc)
+{
+    printf("Usage: copylock [options] <infile> <off> <len> <base> "
+           "<df0_file>\n");
+    printf("       copylock [options] -r <snapshot> <df0_file>\n");
+    printf("       copylock [options] -b <infile> <off> <len> <base> "
+           "<df0_dir>\n");
+    printf("Options:\n");
+    printf("  -h, --help           Display this information\n");
+    printf("  -p, --snapshot-pc=PC Save a snapshot when execution first "
+           "reaches PC (hex)\n");
+    printf("  -s, --snapshot=FILE  Name of snapshot file to save\n");
+    printf("  -r, --resume=FILE    Resume execution from a saved snapshot\n");
+    printf("  -b, --batch          Run against every disk image in "
+           "<df0_dir>\n");
+    printf("  -j, --jobs=N         Nr images to process concurrently in "
+           "batch mode (%u)\n", DEFAULT_JOBS);
+    printf("  -o, --outdir=DIR     Batch mode: directory for per-image "
+           "listings (.)\n");
+    printf("Code executed before a snapshot was taken is not included in "
+           "the\nlisting of a resumed run.\n");
+
+    exit(rc);
+}
+
+static const char *job_status(struct job *job)
+{
+    if (job->errmsg[0] != '\0')
+        return "ERROR";
+    if (job->rc != M68KEMUL_OKAY)
+        return "FAILED";
+    if (job->regs.pc != 0xdeadbeee)
+        return "INTERRUPTED";
+    return "OK";
+}
+
+static struct job *jobs;
+static unsigned int nr_jobs, next_job;
+static const char *batch_outdir;
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Listings are opened only as each job starts: a collection may be larger
+ * than the file-descriptor limit. */
+static void batch_run_job(struct job *job)
+{
+    const char *base = strrchr(job->df0_file, '/') + 1;
+    char *path;
+
+    path = memalloc(strlen(batch_outdir) + strlen(base) + 16);
+    sprintf(path, "%s/%s.copylock.txt", batch_outdir, base);
+    if ((job->out = fopen(path, "w")) == NULL) {
+        job_error(job, "%s: %s", path, strerror(errno));
+        memfree(path);
+        return;
+    }
+    memfree(path);
+
+    job->log = job->out;
+    if (run_job(job) != 0)
+        fprintf(job->out, "%s\n", job->errmsg);
+    fclose(job->out);
+    job->out = job->log = NULL;
+}
+
+static void *batch_worker(void *unused)
+{
+    struct job *job;
+    unsigned int i;
+
+    for (;;) {
+        pthread_mutex_lock(&jobs_lock);
+        i = next_job++;
+        pthread_mutex_unlock(&jobs_lock);
+        if ((i >= nr_jobs) || ctrl_c)
+            break;
+
+        job = &jobs[i];
+        batch_run_job(job);
+
+        pthread_mutex_lock(&jobs_lock);
+        if (job->errmsg[0] != '\0')
+            printf("%s: %s %s\n", job->df0_file, job_status(job),
+                   job->errmsg);
+        else
+            printf("%s: %s D0=%08x D1=%08x PC=%08x\n", job->df0_file,
+                   job_status(job), job->regs.d[0], job->regs.d[1],
+                   job->regs.pc);
+        fflush(stdout);
+        pthread_mutex_unlock(&jobs_lock);
+    }
+
+    return NULL;
+}
+
+static int namecmp(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void run_batch(
+    struct job *template, const char *df0_dir, const char *outdir,
+    unsigned int nr_threads)
+{
+    pthread_t *threads;
+    char **names = NULL, *path;
+    unsigned int i, nr_names = 0, nr_ok = 0;
+    struct dirent *de;
+    struct stat st;
+    DIR *dir;
+
+    if ((dir = opendir(df0_dir)) == NULL)
+        err(1, "%s", df0_dir);
+    while ((de = readdir(dir)) != NULL) {
+        path = memalloc(strlen(df0_dir) + strlen(de->d_name) + 2);
+        sprintf(path, "%s/%s", df0_dir, de->d_name);
+        if ((stat(path, &st) != 0) || !S_ISREG(st.st_mode)) {
+            memfree(path);
+            continue;
+        }
+        names = realloc(names, (nr_names + 1) * sizeof(*names));
+        if (names == NULL)
+            err(1, NULL);
+        names[nr_names++] = path;
+    }
+    closedir(dir);
+    qsort(names, nr_names, sizeof(*names), namecmp);
+
+    jobs = memalloc(nr_names * sizeof(*jobs));
+    for (i = 0; i < nr_names; i++) {
+        jobs[i] = *template;
+        jobs[i].df0_file = names[i];
+    }
+    nr_jobs = nr_names;
+    batch_outdir = outdir;
+
+    nr_threads = max_t(unsigned int, 1, min(nr_threads, nr_jobs));
+    threads = memalloc(nr_threads * sizeof(*threads));
+    for (i = 0; i < nr_threads; i++)
+        if (pthread_create(&threads[i], NULL, batch_worker, NULL) != 0)
+            errx(1, "Failed to create worker thread");
+    for (i = 0; i < nr_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    for (i = 0; i < nr_jobs; i++)
+        if (!strcmp(job_status(&jobs[i]), "OK"))
+            nr_ok++;
+    printf("%u/%u images completed successfully\n", nr_ok, nr_jobs);
+
+    for (i = 0; i < nr_names; i++)
+        memfree(names[i]);
+    memfree(names);
+    memfree(jobs);
+    memfree(threads);
+}
+
+int main(int argc, char **argv)
+{
+    struct job job;
+    char *outdir = ".";
+    int i, ch, have_snap_pc = 0, batch = 0;
+    unsigned int nr_threads = DEFAULT_JOBS;
+
+    const static char sopts[] = "hp:s:r:bj:o:";
+    const static struct option lopts[] = {
+        { "help", 0, NULL, 'h' },
+        { "snapshot-pc", 1, NULL, 'p' },
+        { "snapshot", 1, NULL, 's' },
+        { "resume", 1, NULL, 'r' },
+        { "batch", 0, NULL, 'b' },
+        { "jobs", 1, NULL, 'j' },
+        { "outdir", 1, NULL, 'o' },
+        { 0, 0, 0, 0 }
+    };
+
+    memset(&job, 0, sizeof(job));
+    job.out = stdout;
+    job.log = stderr;
+
+    while ((ch = getopt_long(argc, argv, sopts, lopts, NULL)) != -1) {
+        switch (ch) {
+        case 'h':
+            usage(0);
+            break;
+        case 'p':
+            job.snap_pc = strtol(optarg, NULL, 16);
+            have_snap_pc = 1;
+            break;
+        case 's':
+            job.snap_file = optarg;
+            break;
+        case 'r':
+            job.resume_file = optarg;
+            break;
+        case 'b':
+            batch = 1;
+            break;
+        case 'j':
+            nr_threads = atoi(optarg);
+            break;
+        case 'o':
+            outdir = optarg;
+            break;
+        default:
+            usage(1);
+            break;
+        }
+    }
+
+    if (argc != (optind + (job.resume_file ? 1 : 5)))
+        usage(1);
+    if (!!job.snap_file != have_snap_pc) {
+        warnx("--snapshot and --snapshot-pc must be specified together");
+        usage(1);
+    }
+    if (batch && (job.resume_file || job.snap_file)) {
+        warnx("Snapshots cannot be used in batch mode");
+        usage(1);
+    }
+
+    init_sigint_handler();
+
+    if (job.resume_file) {
+        job.df0_file = argv[optind];
+    } else {
+        char **arg = &argv[optind];
+        job.infile = arg[0];
+        job.loadseg = (*arg[1] == '-');
+        job.off = strtol(arg[1], NULL, 16);
+        job.len = strtol(arg[2], NULL, 16);
+        job.base = strtol(arg[3], NULL, 16);
+        job.df0_file = arg[4];
+    }
+
+    if (batch) {
+        run_batch(&job, job.df0_file, outdir, nr_threads);
+        return 0;
+    }
+
+    for (i = 0; i < argc; i++)
+        printf("%s ", argv[i]);
+    printf("\n");
+
+    if (run_job(&job) != 0)
+        errx(1, "%s", job.errmsg);
+
     return 0;
 }
 
@@ -9,6 +9,7 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "m68k_emulate.h"
 
 /* Type, address-of, and value of an instruction's operand. */
@@ -29,6 +30,7 @@ struct m68k_emulate_priv_ctxt {
     struct m68k_regs sh_regs; /* shadow copy of regs before writeback */
     struct operand operand;
     struct m68k_exception exception;
+    struct m68k_lazy_cc cc; /* deferred flags, committed with sh_regs */
 };
 
 /* SR flags */
@@ -111,6 +113,21 @@ static int fetch(
 
     bail_if(rc = check_addr_align(c, sh_reg(c, pc), bytes, access_fetch));
 
+    /* Common case: one word from a full prefetch queue. Same result as the 
+     * general code below. */
+    if ((bytes == 2) && (c->prefetch_valid == 2)
+        && (sh_reg(c, pc) == c->prefetch_addr)) {
+        *val = c->prefetch_dat[0];
+        c->prefetch_dat[0] = c->prefetch_dat[1];
+        c->prefetch_addr += 2;
+        c->prefetch_valid = 1;
+        acct_cycles_for_mem_access(c, bytes);
+        sh_reg(c, pc) += bytes;
+        if (!c->ops->read(c->prefetch_addr + 2, &v, 2, c))
+            c->prefetch_dat[c->prefetch_valid++] = (uint16_t)v;
+        goto bail;
+    }
+
     /* Invalidate prefetch queue if it is fetched from wrong address. */
     if (sh_reg(c, pc) != c->prefetch_addr)
         c->prefetch_valid = 0;
@@ -221,18 +238,22 @@ static int fetch_insn_##s##bytes(struct m68k_emulate_ctxt *c,   \
 _fetch_insn_bytes(s,)
 _fetch_insn_bytes(u,u)
 
-static void dump(struct m68k_emulate_ctxt *c, const char *fmt, ...)
+static void _dump(struct m68k_emulate_ctxt *c, const char *fmt, ...)
 {
     va_list args;
 
-    if (!c->disassemble)
-        return;
-
     va_start(args, fmt);
     c->p->dis_p += vsprintf(c->p->dis_p, fmt, args);
     va_end(args);
 }
 
+/* Check before the call: arguments are not even evaluated unless we are 
+ * disassembling, and most emulated instructions make several dump() calls. */
+#define dump(c, fmt, ...) do {                  \
+    if ((c)->disassemble)                       \
+        _dump(c, fmt, ## __VA_ARGS__);          \
+} while (0)
+
 static int deliver_exception(struct m68k_emulate_ctxt *c)
 {
     if (c->ops->deliver_exception)
@@ -264,9 +285,8 @@ static void cc_mov(struct m68k_emulate_ctxt *c, uint32_t result)
     sh_reg(c, sr) = sr;
 }
 
-static int cc_eval_condition(struct m68k_emulate_ctxt *c, uint8_t cond)
+static int cc_test(uint8_t cc, uint8_t cond)
 {
-    uint8_t cc = c->regs->sr;
     int r = 0;
 
     switch ((cond >> 1) & 7) {
@@ -288,6 +308,11 @@ static int cc_eval_condition(struct m68k_emulate_ctxt *c, uint8_t cond)
     return (cond & 1) ? !r : r;
 }
 
+static int cc_eval_condition(struct m68k_emulate_ctxt *c, uint8_t cond)
+{
+    return cc_test(c->regs->sr, cond);
+}
+
 static int decode_ea(struct m68k_emulate_ctxt *c)
 {
     struct operand *op = &c->p->operand;
@@ -568,40 +593,196 @@ static int op_add(struct m68k_emulate_ctxt *c, uint32_t s)
     return write_ea(c);
 }
 
-static int misc_insn(struct m68k_emulate_ctxt *c)
+/* Shift or rotate the operand @cnt times. Operation is selected by @typ 
+ * and op[8]. */
+static int shift_ea(
+    struct m68k_emulate_ctxt *c, uint16_t op, uint8_t typ, uint8_t cnt)
 {
-    uint16_t op = c->op[0];
-    int rc = 0;
+    uint32_t m, v;
+    uint8_t x;
+    int rc;
+
+    bail_if(rc = read_ea(c));
+    v = c->p->operand.val;
+    m = 1u << (c->op_sz == OPSZ_L ? 31 : c->op_sz == OPSZ_W ? 15 : 7);
+    sh_reg(c, sr) &= ~(CC_N|CC_Z|CC_V|CC_C);
+    while (cnt--) {
+        switch ((typ << 1) | ((op >> 8) & 1)) {
+        case 0: /* asr */
+            sh_reg(c, sr) &= ~(CC_X|CC_C);
+            if (v & 1)
+                sh_reg(c, sr) |= CC_X|CC_C;
+            v = (v >> 1) | (v & m);
+            break;
+        case 1: /* asl */
+            sh_reg(c, sr) &= ~(CC_X|CC_C);
+            if (v & m)
+                sh_reg(c, sr) |= CC_X|CC_C;
+            if ((v ^ (v << 1)) & m)
+                sh_reg(c, sr) |= CC_V;
+            v = (v << 1);
+            break;
+        case 2: /* lsr */
+            sh_reg(c, sr) &= ~(CC_X|CC_C);
+            if (v & 1)
+                sh_reg(c, sr) |= CC_X|CC_C;
+            v = (v >> 1);
+            break;
+        case 3: /* lsl */
+            sh_reg(c, sr) &= ~(CC_X|CC_C);
+            if (v & m)
+                sh_reg(c, sr) |= CC_X|CC_C;
+            v = (v << 1);
+            break;
+        case 4: /* roxr */
+            x = !!(v & 1);
+            v = (v >> 1) | (sh_reg(c, sr) & CC_X ? m : 0);
+            sh_reg(c, sr) &= ~CC_X;
+            sh_reg(c, sr) |= x ? CC_X : 0;
+            break;
+        case 5: /* roxl */
+            x = !!(v & m);
+            v = (v << 1) | (sh_reg(c, sr) & CC_X ? 1 : 0);
+            sh_reg(c, sr) &= ~CC_X;
+            sh_reg(c, sr) |= x ? CC_X : 0;
+            break;
+        case 6: /* ror */
+            sh_reg(c, sr) &= ~CC_C;
+            if (v & 1)
+                sh_reg(c, sr) |= CC_C;
+            v = (v >> 1) | (sh_reg(c, sr) & CC_C ? m : 0);
+            break;
+        case 7: /* rol */
+            sh_reg(c, sr) &= ~CC_C;
+            if (v & m)
+                sh_reg(c, sr) |= CC_C;
+            v = (v << 1) | (sh_reg(c, sr) & CC_C ? 1 : 0);
+            break;
+        }
+    }
+    if (typ == 2) /* roxl/roxr */
+        sh_reg(c, sr) |= sh_reg(c, sr) & CC_X ? CC_C : 0;
+    v &= (m << 1) - 1;
+    sh_reg(c, sr) |= (v == 0 ? CC_Z : 0) | (v & m ? CC_N : 0);
+    c->p->operand.val = v;
+    rc = write_ea(c);
 
+bail:
+    return rc;
+}
+
+/* Decoded instruction classes for the misc category (op[15:12]=4). */
+enum {
+    MISC_unknown = 0,
+    MISC_bgnd, MISC_illegal, MISC_reset, MISC_nop, MISC_stop, MISC_rte,
+    MISC_rtd, MISC_rts, MISC_trapv, MISC_rtr, MISC_swap, MISC_bkpt,
+    MISC_extb, MISC_link, MISC_unlk, MISC_chk, MISC_clr, MISC_divl,
+    MISC_ext, MISC_jmp_jsr, MISC_lea, MISC_move_from_sr, MISC_move_to_sr,
+    MISC_move_usp, MISC_movec, MISC_movem, MISC_mull, MISC_nbcd, MISC_neg,
+    MISC_negx, MISC_not, MISC_pea, MISC_tas, MISC_trap, MISC_tst
+};
+
+/* Indexed by op[11:0]. Filled in once at startup by misc_insn_init(). */
+static uint8_t misc_insn_class[0x1000];
+
+static uint8_t classify_misc_insn(uint16_t op)
+{
     /* Misc instruction category (op[15:12]=4) is a hotch potch. Prevent 
      * mis-decoding by checking most precise matches first. */
+#define sz_ok(op) ((((op)>>6)&3) != OPSZ_X)
 
     /* 1. Simple full opcode matches. */
-    if (op == 0x4afau) {
-        /* bgnd */
+    switch (op) {
+    case 0x4afau: return MISC_bgnd;
+    case 0x4afcu: return MISC_illegal;
+    case 0x4e70u: return MISC_reset;
+    case 0x4e71u: return MISC_nop;
+    case 0x4e72u: return MISC_stop;
+    case 0x4e73u: return MISC_rte;
+    case 0x4e74u: return MISC_rtd;
+    case 0x4e75u: return MISC_rts;
+    case 0x4e76u: return MISC_trapv;
+    case 0x4e77u: return MISC_rtr;
+    }
+
+    /* 2. Exact matches with no invalid cases. */
+    if ((op & 0xfff8u) == 0x4840u) return MISC_swap;
+    if ((op & 0xfff8u) == 0x4848u) return MISC_bkpt;
+    if ((op & 0xfff8u) == 0x49c0u) return MISC_extb;
+    if (((op & 0xfff8u) == 0x4e50u) || ((op & 0xfff8u) == 0x4808u))
+        return MISC_link;
+    if ((op & 0xfff8u) == 0x4e58u) return MISC_unlk;
+
+    /* 3. All the rest. The matches may be approximate, and include invalid 
+     * cases for the matched instruction. Where that matters, we should have 
+     * already decoded the correct instruction with a more precise match. */
+    if ((op & 0xf140u) == 0x4100u) return MISC_chk;
+    if (((op & 0xff00u) == 0x4200u) && sz_ok(op)) return MISC_clr;
+    if ((op & 0xffc0u) == 0x4c40u) return MISC_divl;
+    if ((op & 0xffb8u) == 0x4880u) return MISC_ext;
+    if ((op & 0xff80u) == 0x4e80u) return MISC_jmp_jsr;
+    if ((op & 0xf1c0u) == 0x41c0u) return MISC_lea;
+    if ((op & 0xfdc0u) == 0x40c0u) return MISC_move_from_sr;
+    if ((op & 0xfdc0u) == 0x44c0u) return MISC_move_to_sr;
+    if ((op & 0xfff0u) == 0x4e60u) return MISC_move_usp;
+    if ((op & 0xfffeu) == 0x4e7au) return MISC_movec;
+    if ((op & 0xfb80u) == 0x4880u) return MISC_movem;
+    if ((op & 0xffc0u) == 0x4c00u) return MISC_mull;
+    if ((op & 0xffc0u) == 0x4800u) return MISC_nbcd;
+    if (((op & 0xff00u) == 0x4400u) && sz_ok(op)) return MISC_neg;
+    if (((op & 0xff00u) == 0x4000u) && sz_ok(op)) return MISC_negx;
+    if (((op & 0xff00u) == 0x4600u) && sz_ok(op)) return MISC_not;
+    if ((op & 0xffc0u) == 0x4840u) return MISC_pea;
+    if ((op & 0xffc0u) == 0x4ac0u) return MISC_tas;
+    if ((op & 0xfff0u) == 0x4e40u) return MISC_trap;
+    if (((op & 0xff00u) == 0x4a00u) && sz_ok(op)) return MISC_tst;
+
+#undef sz_ok
+    return MISC_unknown;
+}
+
+static void misc_insn_init(void)
+{
+    unsigned int i;
+    for (i = 0; i < sizeof(misc_insn_class); i++)
+        misc_insn_class[i] = classify_misc_insn(0x4000u | i);
+}
+
+static int misc_insn(struct m68k_emulate_ctxt *c)
+{
+    uint16_t op = c->op[0];
+    int rc = 0;
+
+    switch (misc_insn_class[op & 0xfffu]) {
+    case MISC_bgnd: {
         dump(c, "bgnd");
         rc = M68KEMUL_UNHANDLEABLE;
-    } else if (op == 0x4afcu) {
-        /* illegal */
+        break;
+    }
+    case MISC_illegal: {
         dump(c, "illegal");
         raise_exception(M68KVEC_illegal_insn);
-    } else if (op == 0x4e70u) {
-        /* reset */
+        break;
+    }
+    case MISC_reset: {
         dump(c, "reset");
         rc = M68KEMUL_UNHANDLEABLE;
-    } else if (op == 0x4e71u) {
-        /* nop */
+        break;
+    }
+    case MISC_nop: {
         dump(c, "nop");
-    } else if (op == 0x4e72u) {
-        /* stop */
+        break;
+    }
+    case MISC_stop: {
         uint16_t data;
         bail_if(rc = fetch_insn_word(c, &data));
         dump(c, "stop\t#%x", data);
         raise_exception_if(!(sh_reg(c, sr) & SR_S), M68KVEC_priv_violation);
         update_sr(c, data);
         /* should wait for an interrupt/exception... */
-    } else if (op == 0x4e73u) {
-        /* rte */
+        break;
+    }
+    case MISC_rte: {
         uint32_t new_pc, new_sr;
         dump(c, "rte");
         raise_exception_if(!(sh_reg(c, sr) & SR_S), M68KVEC_priv_violation);
@@ -610,8 +791,9 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
         sh_reg(c, a[7]) += 6;
         update_sr(c, new_sr);
         sh_reg(c, pc) = new_pc;
-    } else if (op == 0x4e74u) {
-        /* rtd */
+        break;
+    }
+    case MISC_rtd: {
         int32_t disp;
         bail_if(rc = fetch_insn_sbytes(c, &disp, OPSZ_W));
         dump(c, "rtd\t#");
@@ -621,17 +803,20 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
             dump(c, "%x", disp);
         bail_if(rc = read(sh_reg(c,a[7]), &sh_reg(c, pc), 4, c));
         sh_reg(c, a[7]) += 4 + disp;
-    } else if (op == 0x4e75u) {
-        /* rts */
+        break;
+    }
+    case MISC_rts: {
         dump(c, "rts");
         bail_if(rc = read(sh_reg(c,a[7]), &sh_reg(c, pc), 4, c));
         sh_reg(c, a[7]) += 4;
-    } else if (op == 0x4e76u) {
-        /* trapv */
+        break;
+    }
+    case MISC_trapv: {
         dump(c, "trapv");
         raise_exception_if(sh_reg(c, sr) & CC_V, M68KVEC_trapcc_trapv);
-    } else if (op == 0x4e77u) {
-        /* rtr */
+        break;
+    }
+    case MISC_rtr: {
         uint32_t new_pc, new_sr;
         dump(c, "rtr");
         bail_if(rc = read(sh_reg(c, a[7]) + 2, &new_pc, 4, c));
@@ -640,29 +825,30 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
         sh_reg(c, sr) &= ~0xffu;
         sh_reg(c, sr) |= (uint8_t)new_sr;
         sh_reg(c, pc) = new_pc;
+        break;
     }
-
-    /* 2. Exact matches with no invalid cases. */
-    else if ((op & 0xfff8u) == 0x4840u) {
-        /* swap */
+    case MISC_swap: {
         uint32_t *reg = &sh_reg(c, d[op&7]);
         c->op_sz = OPSZ_L;
         dump(c, "swap\t%s", dreg[op&7]);
         *reg = (*reg << 16) | (uint16_t)(*reg >> 16);
         cc_mov(c, *reg);
-    } else if ((op & 0xfff8u) == 0x4848u) {
-        /* bkpt */
+        break;
+    }
+    case MISC_bkpt: {
         dump(c, "bkpt\t#%x", op&7);
         rc = M68KEMUL_UNHANDLEABLE;
-    } else if ((op & 0xfff8u) == 0x49c0u) {
-        /* extb */
+        break;
+    }
+    case MISC_extb: {
         uint32_t *reg = &sh_reg(c, d[op&7]);
         c->op_sz = OPSZ_L;
         dump(c, "extb.%c\t%s", op_sz_ch[c->op_sz], dreg[op&7]);
         *reg = (int8_t)*reg;
         cc_mov(c, *reg);
-    } else if (((op & 0xfff8u) == 0x4e50u) || ((op & 0xfff8u) == 0x4808u)) {
-        /* link */
+        break;
+    }
+    case MISC_link: {
         int32_t disp;
         uint32_t *reg = &sh_reg(c, a[op&7]);
         c->op_sz = op & (1u<<3) ? OPSZ_L : OPSZ_W;
@@ -676,36 +862,35 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
         bail_if(rc = write(sh_reg(c, a[7]), *reg, 4, c));
         *reg = sh_reg(c, a[7]);
         sh_reg(c, a[7]) += disp;
-    } else if ((op & 0xfff8u) == 0x4e58u) {
-        /* unlk */
+        break;
+    }
+    case MISC_unlk: {
         uint32_t *reg = &sh_reg(c, a[op&7]);
         dump(c, "unlk\t%s", areg[op&7]);
         sh_reg(c, a[7]) = *reg;
         bail_if(rc = read(sh_reg(c, a[7]), reg, 4, c));
         sh_reg(c, a[7]) += 4;
+        break;
     }
-
-    /* 3. All the rest. The matches may be approximate, and include invalid 
-     * cases for the matched instruction. Where that matters, we should have 
-     * already decoded the correct instruction with a more precise match. */
-    else if ((op & 0xf140u) == 0x4100u) {
-        /* chk */
+    case MISC_chk: {
         c->op_sz = (op & (1u<<7)) ? OPSZ_W : OPSZ_L;
         dump(c, "chk.%c\t", op_sz_ch[c->op_sz]);
         bail_if(rc = decode_ea(c));
         dump(c, ",%s", dreg[(op >> 9) & 7]);
         rc = M68KEMUL_UNHANDLEABLE;
-    } else if (((op & 0xff00u) == 0x4200u) &&
-               ((c->op_sz = (op>>6)&3) != OPSZ_X)) {
-        /* clr */
+        break;
+    }
+    case MISC_clr: {
+        c->op_sz = (op>>6)&3;
         dump(c, "clr.%c\t", op_sz_ch[c->op_sz]);
         bail_if(rc = decode_ea(c));
         c->p->operand.val = 0;
         bail_if(rc = write_ea(c));
         sh_reg(c, sr) &= ~(CC_N|CC_Z|CC_V|CC_C);
         sh_reg(c, sr) |= CC_Z;
-    } else if ((op & 0xffc0u) == 0x4c40u) {
-        /* divs/divu.l */
+        break;
+    }
+    case MISC_divl: {
         uint16_t ext, dr, dq, sz;
         bail_if(rc = fetch_insn_word(c, &ext));
         dr = ext&7; dq = (ext>>12)&7; sz = (ext>>10)&1;
@@ -720,8 +905,9 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
             dump(c, "%s:", dreg[dr]);
         dump(c, "%s", dreg[dq]);
         rc = M68KEMUL_UNHANDLEABLE;
-    } else if ((op & 0xffb8u) == 0x4880u) {
-        /* ext */
+        break;
+    }
+    case MISC_ext: {
         uint32_t *reg = &sh_reg(c, d[op&7]);
         c->op_sz = (op & (1u<<6)) ? OPSZ_L : OPSZ_W;
         dump(c, "ext.%c\t%s", op_sz_ch[c->op_sz], dreg[op&7]);
@@ -729,8 +915,9 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
                 ? (*reg & ~0xffffu) | (uint16_t)(int8_t)*reg
                 : (int16_t)*reg);
         cc_mov(c, *reg);
-    } else if ((op & 0xff80u) == 0x4e80u) {
-        /* jmp/jsr */
+        break;
+    }
+    case MISC_jmp_jsr: {
         dump(c, "j%s\t", (op & (1u<<6)) ? "mp" : "sr");
         bail_if(rc = decode_mem_ea(c));
         if (!(op & (1u<<6))) {
@@ -740,15 +927,17 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
         }
         /* update pc to jump target */
         sh_reg(c, pc) = c->p->operand.mem;
-    } else if ((op & 0xf1c0u) == 0x41c0u) {
-        /* lea */
+        break;
+    }
+    case MISC_lea: {
         c->op_sz = OPSZ_L;
         dump(c, "lea.l\t");
         bail_if(rc = decode_mem_ea(c));
         dump(c, ",%s", areg[(op>>9)&7]);
         sh_reg(c, a[(op>>9)&7]) = c->p->operand.mem;
-    } else if ((op & 0xfdc0u) == 0x40c0u) {
-        /* move from ccr/sr */
+        break;
+    }
+    case MISC_move_from_sr: {
         c->op_sz = OPSZ_W;
         dump(c, "move.w\t%s,", op & (1u<<9) ? "ccr" : "sr");
         bail_if(rc = decode_ea(c));
@@ -756,8 +945,9 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
         if (op & (1u<<9))
             c->p->operand.val = (uint8_t)c->p->operand.val;
         bail_if(rc = write_ea(c));
-    } else if ((op & 0xfdc0u) == 0x44c0u) {
-        /* move to ccr/sr */
+        break;
+    }
+    case MISC_move_to_sr: {
         c->op_sz = OPSZ_W;
         dump(c, "move.w\t");
         bail_if(rc = decode_ea(c));
@@ -771,8 +961,9 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
             sh_reg(c, sr) &= ~0xffu;
             sh_reg(c, sr) |= (uint8_t)c->p->operand.val;
         }
-    } else if ((op & 0xfff0u) == 0x4e60u) {
-        /* move to/from usp */
+        break;
+    }
+    case MISC_move_usp: {
         c->op_sz = OPSZ_L;
         dump(c, "move.l\t");
         dump(c, op&(1u<<3) ? "usp,%s" : "%s,usp", areg[op&7]);
@@ -781,8 +972,9 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
             sh_reg(c, a[op&7]) = sh_reg(c, xsp);
         else
             sh_reg(c, xsp) = sh_reg(c, a[op&7]);
-    } else if ((op & 0xfffeu) == 0x4e7au) {
-        /* movec */
+        break;
+    }
+    case MISC_movec: {
         const static char *creg[] = {
             "sfc", "dfc", "cacr", "tc", "itt0", "itt1", "dtt0", "dtt1",
             "usp", "vbr", "caar", "msp", "isp", "mmusr", "urp", "srp" };
@@ -801,8 +993,9 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
         else
             dump(c, "%s,%s", creg[idx], greg);
         raise_exception(M68KVEC_illegal_insn);
-    } else if ((op & 0xfb80u) == 0x4880u) {
-        /* movem */
+        break;
+    }
+    case MISC_movem: {
         uint32_t mask, *r;
         int reg, predec = ((op & 0x38u) == 0x20u);
         c->op_sz = op & (1u<<6) ? OPSZ_L : OPSZ_W;
@@ -860,8 +1053,9 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
             c->p->operand.mem += c->op_sz == OPSZ_W ? 2 : 4;
         if (predec || ((op & 0x38u) == 0x18u)) /* predec / postinc */
             *c->p->operand.reg = c->p->operand.mem;
-    } else if ((op & 0xffc0u) == 0x4c00u) {
-        /* muls/mulu.l */
+        break;
+    }
+    case MISC_mull: {
         uint16_t ext, dh, dl, sz;
         bail_if(rc = fetch_insn_word(c, &ext));
         dh = ext&7; dl = (ext>>12)&7; sz = (ext>>10)&1;
@@ -873,15 +1067,17 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
             dump(c, "%s:", dreg[dh]);
         dump(c, "%s", dreg[dl]);
         rc = M68KEMUL_UNHANDLEABLE;
-    } else if ((op & 0xffc0u) == 0x4800u) {
-        /* nbcd */
+        break;
+    }
+    case MISC_nbcd: {
         c->op_sz = OPSZ_B;
         dump(c, "nbcd.%c\t", op_sz_ch[c->op_sz]);
         bail_if(rc = decode_ea(c));
         rc = M68KEMUL_UNHANDLEABLE;
-    } else if (((op & 0xff00u) == 0x4400u) &&
-               ((c->op_sz = (op>>6)&3) != OPSZ_X)) {
-        /* neg */
+        break;
+    }
+    case MISC_neg: {
+        c->op_sz = (op>>6)&3;
         uint32_t s;
         dump(c, "neg.%c\t", op_sz_ch[c->op_sz]);
         bail_if(rc = decode_ea(c));
@@ -889,9 +1085,10 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
         s = c->p->operand.val;
         c->p->operand.val = 0;
         rc = op_sub(c, s);
-    } else if (((op & 0xff00u) == 0x4000u) &&
-               ((c->op_sz = (op>>6)&3) != OPSZ_X)) {
-        /* negx */
+        break;
+    }
+    case MISC_negx: {
+        c->op_sz = (op>>6)&3;
         uint32_t s;
         uint16_t sr;
         dump(c, "negx.%c\t", op_sz_ch[c->op_sz]);
@@ -910,24 +1107,27 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
         /* CC.Z is never set by this instruction, only cleared */
         if ((sh_reg(c, sr) & CC_Z) && !(sr & CC_Z))
             sh_reg(c, sr) &= ~CC_Z;
-    } else if (((op & 0xff00u) == 0x4600u) &&
-               ((c->op_sz = (op>>6)&3) != OPSZ_X)) {
-        /* not */
+        break;
+    }
+    case MISC_not: {
+        c->op_sz = (op>>6)&3;
         dump(c, "not.%c\t", op_sz_ch[c->op_sz]);
         bail_if(rc = decode_ea(c));
         bail_if(rc = read_ea(c));
         c->p->operand.val = ~c->p->operand.val;
         cc_mov(c, c->p->operand.val);
         rc = write_ea(c);
-    } else if ((op & 0xffc0u) == 0x4840u) {
-        /* pea */
+        break;
+    }
+    case MISC_pea: {
         c->op_sz = OPSZ_L;
         dump(c, "pea.l\t");
         bail_if(rc = decode_mem_ea(c));
         sh_reg(c, a[7]) -= 4;
         bail_if(rc = write(sh_reg(c, a[7]), c->p->operand.mem, 4, c));
-    } else if ((op & 0xffc0u) == 0x4ac0u) {
-        /* tas */
+        break;
+    }
+    case MISC_tas: {
         c->op_sz = OPSZ_B;
         dump(c, "tas.b\t");
         bail_if(rc = decode_ea(c));
@@ -939,44 +1139,36 @@ static int misc_insn(struct m68k_emulate_ctxt *c)
             sh_reg(c, sr) |= CC_Z;
         c->p->operand.val |= 0x80;
         bail_if(rc = write_ea(c));
-    } else if ((op & 0xfff0u) == 0x4e40u) {
-        /* trap */
+        break;
+    }
+    case MISC_trap: {
         uint8_t trap = op & 15;
         dump(c, "trap\t#%x", trap);
         raise_exception(M68KVEC_trap_0 + trap);
-    } else if (((op & 0xff00u) == 0x4a00u) &&
-               ((c->op_sz = (op>>6)&3) != OPSZ_X)) {
-        /* tst */
+        break;
+    }
+    case MISC_tst: {
+        c->op_sz = (op>>6)&3;
         dump(c, "tst.%c\t", op_sz_ch[c->op_sz]);
         bail_if(rc = decode_ea(c));
         bail_if(rc = read_ea(c));
         cc_mov(c, c->p->operand.val);
-    } else {
-    unknown:
+        break;
+    }
+    default: unknown:
         dump(c, "???");
         raise_exception(M68KVEC_illegal_insn);
+        break;
     }
 
 bail:
     return rc;
 }
 
-int m68k_emulate(struct m68k_emulate_ctxt *c)
+/* Decode, disassemble and emulate any instruction. */
+static int decode_insn(struct m68k_emulate_ctxt *c, uint16_t op)
 {
-    struct m68k_emulate_priv_ctxt priv = {
-        .sh_regs = *c->regs,
-        .dis_p = c->dis
-    };
-    uint16_t op;
-    int rc, trace = !!(c->regs->sr & SR_T);
-
-    /* Initialise emulator state. */
-    c->p = &priv;
-    c->dis[0] = '\0';
-    c->op_sz = OPSZ_X;
-    c->op_words = 0;
-    c->cycles = 0;
-    bail_if(rc = fetch_insn_word(c, &op));
+    int rc = 0;
 
     switch ((op >> 12) & 0xf) {
     case 0x0: { /* COMPLETE (but callm/cas/cas2/chk2/cmp2/moves/rtm) */
@@ -1485,8 +1677,7 @@ int m68k_emulate(struct m68k_emulate_ctxt *c)
     case 0xe: { /* COMPLETE */
         static const char *sr[] = {
             "as", "ls", "rox", "ro" };
-        uint32_t m, v;
-        uint8_t x, typ, cnt;
+        uint8_t typ, cnt;
         if ((op & 0xf8c0u) == 0xe8c0u) {
             /* bitfield access */
             goto unknown;
@@ -1515,70 +1706,7 @@ int m68k_emulate(struct m68k_emulate_ctxt *c)
             c->p->operand.type = OP_REG;
             c->p->operand.reg = &sh_reg(c, d[op&7]);
         }
-        bail_if(rc = read_ea(c));
-        v = c->p->operand.val;
-        m = 1u << (c->op_sz == OPSZ_L ? 31 : c->op_sz == OPSZ_W ? 15 : 7);
-        sh_reg(c, sr) &= ~(CC_N|CC_Z|CC_V|CC_C);
-        while (cnt--) {
-            switch ((typ << 1) | ((op >> 8) & 1)) {
-            case 0: /* asr */
-                sh_reg(c, sr) &= ~(CC_X|CC_C);
-                if (v & 1)
-                    sh_reg(c, sr) |= CC_X|CC_C;
-                v = (v >> 1) | (v & m);
-                break;
-            case 1: /* asl */
-                sh_reg(c, sr) &= ~(CC_X|CC_C);
-                if (v & m)
-                    sh_reg(c, sr) |= CC_X|CC_C;
-                if ((v ^ (v << 1)) & m)
-                    sh_reg(c, sr) |= CC_V;
-                v = (v << 1);
-                break;
-            case 2: /* lsr */
-                sh_reg(c, sr) &= ~(CC_X|CC_C);
-                if (v & 1)
-                    sh_reg(c, sr) |= CC_X|CC_C;
-                v = (v >> 1);
-                break;
-            case 3: /* lsl */
-                sh_reg(c, sr) &= ~(CC_X|CC_C);
-                if (v & m)
-                    sh_reg(c, sr) |= CC_X|CC_C;
-                v = (v << 1);
-                break;
-            case 4: /* roxr */
-                x = !!(v & 1);
-                v = (v >> 1) | (sh_reg(c, sr) & CC_X ? m : 0);
-                sh_reg(c, sr) &= ~CC_X;
-                sh_reg(c, sr) |= x ? CC_X : 0;
-                break;
-            case 5: /* roxl */
-                x = !!(v & m);
-                v = (v << 1) | (sh_reg(c, sr) & CC_X ? 1 : 0);
-                sh_reg(c, sr) &= ~CC_X;
-                sh_reg(c, sr) |= x ? CC_X : 0;
-                break;
-            case 6: /* ror */
-                sh_reg(c, sr) &= ~CC_C;
-                if (v & 1)
-                    sh_reg(c, sr) |= CC_C;
-                v = (v >> 1) | (sh_reg(c, sr) & CC_C ? m : 0);
-                break;
-            case 7: /* rol */
-                sh_reg(c, sr) &= ~CC_C;
-                if (v & m)
-                    sh_reg(c, sr) |= CC_C;
-                v = (v << 1) | (sh_reg(c, sr) & CC_C ? 1 : 0);
-                break;
-            }
-        }
-        if (typ == 2) /* roxl/roxr */
-            sh_reg(c, sr) |= sh_reg(c, sr) & CC_X ? CC_C : 0;
-        v &= (m << 1) - 1;
-        sh_reg(c, sr) |= (v == 0 ? CC_Z : 0) | (v & m ? CC_N : 0);
-        c->p->operand.val = v;
-        rc = write_ea(c);
+        rc = shift_ea(c, op, typ, cnt);
         break;
     }
     case 0xf: /* COMPLETE */
@@ -1591,6 +1719,841 @@ int m68k_emulate(struct m68k_emulate_ctxt *c)
         break;
     }
 
+bail:
+    return rc;
+}
+
+/*
+ * Fast path: m68k_emulate() dispatches on the opcode word through a 64K-entry 
+ * table. Common instructions have handlers specialised for their addressing 
+ * modes, so that no effective-address decode happens at run time. Handlers 
+ * make exactly the same accesses, in the same order, as decode_insn(), so 
+ * cycle counts and prefetch behaviour do not change. They record the inputs 
+ * to the condition codes rather than computing them: most results are never 
+ * tested before they are overwritten.
+ */
+
+typedef int (*insn_fn)(struct m68k_emulate_ctxt *, uint16_t op);
+static insn_fn insn_table[0x10000];
+
+/* Deferred condition-code operations. */
+enum { CCOP_none = 0, CCOP_mov, CCOP_add, CCOP_sub, CCOP_cmp };
+
+static uint16_t cc_eval_lazy(const struct m68k_lazy_cc *cc, uint16_t sr)
+{
+    uint32_t msb, s = cc->src, d = cc->dst, r = cc->res;
+
+    msb = 1u << (cc->sz == OPSZ_L ? 31 : cc->sz == OPSZ_W ? 15 : 7);
+    sr &= ~(CC_N|CC_Z|CC_V|CC_C);
+    if (r & msb)
+        sr |= CC_N;
+    if ((r & ((msb<<1)-1)) == 0)
+        sr |= CC_Z;
+
+    switch (cc->op) {
+    case CCOP_add:
+        sr &= ~CC_X;
+        if (!((s ^ d) & msb) && ((d ^ r) & msb))
+            sr |= CC_V;
+        if ((s & d & msb) || (s & ~r & msb) || (d & ~r & msb))
+            sr |= CC_C | CC_X;
+        break;
+    case CCOP_sub: case CCOP_cmp:
+        if (((s ^ d) & msb) && ((d ^ r) & msb))
+            sr |= CC_V;
+        if ((s & ~d & msb) || (r & ~d & msb) || (s & r & msb))
+            sr |= CC_C;
+        if (cc->op == CCOP_sub)
+            sr = (sr & ~CC_X) | ((sr & CC_C) ? CC_X : 0);
+        break;
+    }
+
+    return sr;
+}
+
+void m68k_sync_ccr(struct m68k_emulate_ctxt *c)
+{
+    struct m68k_lazy_cc *cc = &c->lazy_cc;
+    if (cc->op == CCOP_none)
+        return;
+    if (c->regs->sr == cc->sr)
+        c->regs->sr = cc_eval_lazy(cc, c->regs->sr);
+    cc->op = CCOP_none;
+}
+
+/* Record the inputs to the condition codes for instruction of size op_sz. */
+static void cc_defer(
+    struct m68k_emulate_ctxt *c, uint8_t op, uint32_t s, uint32_t d,
+    uint32_t r)
+{
+    struct m68k_lazy_cc *cc = &c->p->cc;
+    /* mov and cmp leave X alone: settle any X owed by a pending add/sub. */
+    if (((op == CCOP_mov) || (op == CCOP_cmp))
+        && ((cc->op == CCOP_add) || (cc->op == CCOP_sub)))
+        sh_reg(c, sr) = ((sh_reg(c, sr) & ~CC_X)
+                         | (cc_eval_lazy(cc, sh_reg(c, sr)) & CC_X));
+    cc->op = op;
+    cc->sz = c->op_sz;
+    cc->src = s;
+    cc->dst = d;
+    cc->res = r;
+}
+
+/* Fold deferred condition codes into the shadow SR. */
+static void cc_flush(struct m68k_emulate_ctxt *c)
+{
+    if (c->p->cc.op == CCOP_none)
+        return;
+    sh_reg(c, sr) = cc_eval_lazy(&c->p->cc, sh_reg(c, sr));
+    c->p->cc.op = CCOP_none;
+}
+
+static int cc_eval_lazy_condition(struct m68k_emulate_ctxt *c, uint8_t cond)
+{
+    uint16_t sr = sh_reg(c, sr);
+    if (c->p->cc.op != CCOP_none)
+        sr = cc_eval_lazy(&c->p->cc, sr);
+    return cc_test(sr, cond);
+}
+
+/* Effective-address classes handled by the fast path. Others (indexed, and 
+ * invalid modes) always take the generic path. */
+enum {
+    EA_DN, EA_AN, EA_AI, EA_PI, EA_PD, EA_DI, EA_IX,
+    EA_AW, EA_AL, EA_PCDI, EA_PCIX, EA_IMM, EA_BAD, EA_NR
+};
+
+static unsigned int ea_class(uint16_t op)
+{
+    unsigned int mode = (op >> 3) & 7, reg = op & 7;
+    if (mode != 7)
+        return mode;
+    return (reg <= 4) ? EA_AW + reg : EA_BAD;
+}
+
+#define always_inline inline __attribute__((always_inline))
+
+/* As decode_ea(), for a class which is usually a compile-time constant. */
+static always_inline int ea_decode(
+    struct m68k_emulate_ctxt *c, unsigned int cls, unsigned int reg,
+    struct operand *op)
+{
+    unsigned int bytes = (c->op_sz == OPSZ_B ? 1 :
+                          c->op_sz == OPSZ_W ? 2 : 4);
+    int32_t disp;
+    int rc = 0;
+
+    op->type = OP_MEM;
+    switch (cls) {
+    case EA_DN:
+        op->type = OP_REG;
+        op->reg = &sh_reg(c, d[reg]);
+        break;
+    case EA_AN:
+        op->type = OP_REG;
+        op->reg = &sh_reg(c, a[reg]);
+        break;
+    case EA_AI:
+        op->reg = &sh_reg(c, a[reg]);
+        op->mem = *op->reg;
+        break;
+    case EA_PI:
+        op->reg = &sh_reg(c, a[reg]);
+        op->mem = *op->reg;
+        *op->reg += bytes;
+        if ((reg == 7) && (bytes == 1))
+            *op->reg += 1;
+        break;
+    case EA_PD:
+        op->reg = &sh_reg(c, a[reg]);
+        op->mem = *op->reg -= bytes;
+        if ((reg == 7) && (bytes == 1))
+            op->mem = *op->reg -= 1;
+        break;
+    case EA_DI:
+        rc = fetch_insn_sbytes(c, &disp, OPSZ_W);
+        op->mem = sh_reg(c, a[reg]) + disp;
+        break;
+    case EA_AW:
+        rc = fetch_insn_ubytes(c, &op->mem, OPSZ_W);
+        break;
+    case EA_AL:
+        rc = fetch_insn_ubytes(c, &op->mem, OPSZ_L);
+        break;
+    case EA_PCDI:
+        op->mem = sh_reg(c, pc);
+        rc = fetch_insn_sbytes(c, &disp, OPSZ_W);
+        op->mem += disp;
+        break;
+    case EA_IMM:
+        op->type = OP_IMM;
+        rc = fetch_insn_ubytes(c, &op->val, c->op_sz);
+        break;
+    default:
+        rc = M68KEMUL_UNHANDLEABLE;
+        break;
+    }
+
+    return rc;
+}
+
+static always_inline int ea_read(
+    struct m68k_emulate_ctxt *c, struct operand *op)
+{
+    unsigned int bytes = (c->op_sz == OPSZ_B ? 1 :
+                          c->op_sz == OPSZ_W ? 2 : 4);
+    if (op->type == OP_MEM)
+        return read(op->mem, &op->val, bytes, c);
+    if (op->type == OP_REG)
+        op->val = (bytes == 1 ? (uint8_t)*op->reg :
+                   bytes == 2 ? (uint16_t)*op->reg : *op->reg);
+    return 0;
+}
+
+static always_inline void reg_write(uint32_t *reg, uint32_t val, uint8_t sz)
+{
+    *reg = (sz == OPSZ_B ? (*reg & ~0xffu) | (uint8_t)val :
+            sz == OPSZ_W ? (*reg & ~0xffffu) | (uint16_t)val :
+            val);
+}
+
+static always_inline int ea_write(
+    struct m68k_emulate_ctxt *c, struct operand *op)
+{
+    unsigned int bytes = (c->op_sz == OPSZ_B ? 1 :
+                          c->op_sz == OPSZ_W ? 2 : 4);
+    if (op->type == OP_MEM)
+        return write(op->mem, op->val, bytes, c);
+    reg_write(op->reg, op->val, c->op_sz);
+    return 0;
+}
+
+/* Effective-address classes accepted by each family of handlers. */
+#define SRC_EA(m, h) m(h, DN) m(h, AN) m(h, AI) m(h, PI) m(h, PD) \
+    m(h, DI) m(h, AW) m(h, AL) m(h, PCDI) m(h, IMM)
+#define DST_EA(m, h) m(h, DN) m(h, AI) m(h, PI) m(h, PD) m(h, DI) \
+    m(h, AW) m(h, AL)
+#define MEM_EA(m, h) m(h, AI) m(h, PI) m(h, PD) m(h, DI) m(h, AW) m(h, AL)
+#define CTL_EA(m, h) m(h, AI) m(h, DI) m(h, AW) m(h, AL) m(h, PCDI)
+
+/* Instantiate handler h(c, op, cls) for a class, and its table entry. */
+#define EA_FN(h, cls)                                                   \
+static int h##_##cls(struct m68k_emulate_ctxt *c, uint16_t op)          \
+{ return h(c, op, EA_##cls); }
+#define EA_ENT(h, cls) [EA_##cls] = h##_##cls,
+#define EA_TABLE(list, h)                                               \
+list(EA_FN, h)                                                          \
+static const insn_fn h##_fn[EA_NR] = { list(EA_ENT, h) };
+
+/* ALU operations. */
+enum { ALU_add, ALU_sub, ALU_and, ALU_or, ALU_eor, ALU_cmp };
+
+/* move */
+static always_inline int insn_move(
+    struct m68k_emulate_ctxt *c, uint16_t op,
+    unsigned int scls, unsigned int dcls)
+{
+    struct operand src, dst;
+    int rc;
+
+    c->op_sz = ((op >> 12) == 1) ? OPSZ_B : ((op >> 12) == 2) ? OPSZ_L
+        : OPSZ_W;
+    bail_if(rc = ea_decode(c, scls, op & 7, &src));
+    bail_if(rc = ea_decode(c, dcls, (op >> 9) & 7, &dst));
+    bail_if(rc = ea_read(c, &src));
+    dst.val = src.val;
+    bail_if(rc = ea_write(c, &dst));
+    cc_defer(c, CCOP_mov, 0, 0, dst.val);
+    if (c->prefetch_valid > 1)
+        c->prefetch_valid = 1;
+bail:
+    return rc;
+}
+
+#define MOVE_FN(s, d)                                                   \
+static int insn_move_##s##_##d(struct m68k_emulate_ctxt *c, uint16_t op) \
+{ return insn_move(c, op, EA_##s, EA_##d); }
+#define MOVE_ENT(s, d) [EA_##d] = insn_move_##s##_##d,
+#define MOVE_FNS(h, s) DST_EA(MOVE_FN, s)
+#define MOVE_ROW(h, s) [EA_##s] = { DST_EA(MOVE_ENT, s) },
+SRC_EA(MOVE_FNS, _)
+static const insn_fn move_fn[EA_NR][EA_NR] = { SRC_EA(MOVE_ROW, _) };
+
+/* movea */
+static always_inline int insn_movea(
+    struct m68k_emulate_ctxt *c, uint16_t op, unsigned int cls)
+{
+    struct operand src;
+    int rc;
+
+    c->op_sz = ((op >> 12) == 2) ? OPSZ_L : OPSZ_W;
+    bail_if(rc = ea_decode(c, cls, op & 7, &src));
+    bail_if(rc = ea_read(c, &src));
+    if (c->op_sz == OPSZ_W) {
+        src.val = (int16_t)src.val;
+        c->op_sz = OPSZ_L;
+    }
+    sh_reg(c, a[(op>>9)&7]) = src.val;
+    if (c->prefetch_valid > 1)
+        c->prefetch_valid = 1;
+bail:
+    return rc;
+}
+EA_TABLE(SRC_EA, insn_movea)
+
+/* add/sub/and/or/cmp <ea>,Dn */
+static always_inline int alu_ea_dn(
+    struct m68k_emulate_ctxt *c, uint16_t op, unsigned int alu,
+    unsigned int cls)
+{
+    uint32_t s, d, *reg = &sh_reg(c, d[(op>>9)&7]);
+    struct operand src;
+    int rc;
+
+    c->op_sz = (op >> 6) & 3;
+    bail_if(rc = ea_decode(c, cls, op & 7, &src));
+    bail_if(rc = ea_read(c, &src));
+    s = src.val;
+    d = *reg;
+    switch (alu) {
+    case ALU_add:
+        cc_defer(c, CCOP_add, s, d, d + s);
+        reg_write(reg, d + s, c->op_sz);
+        break;
+    case ALU_sub:
+        cc_defer(c, CCOP_sub, s, d, d - s);
+        reg_write(reg, d - s, c->op_sz);
+        break;
+    case ALU_and:
+        cc_defer(c, CCOP_mov, 0, 0, s & d);
+        reg_write(reg, s & d, c->op_sz);
+        break;
+    case ALU_or:
+        cc_defer(c, CCOP_mov, 0, 0, s | d);
+        reg_write(reg, s | d, c->op_sz);
+        break;
+    case ALU_cmp:
+        cc_defer(c, CCOP_cmp, s, d, d - s);
+        break;
+    }
+bail:
+    return rc;
+}
+
+/* add/sub/and/or/eor Dn,<ea> */
+static always_inline int alu_dn_ea(
+    struct m68k_emulate_ctxt *c, uint16_t op, unsigned int alu,
+    unsigned int cls)
+{
+    uint32_t s = sh_reg(c, d[(op>>9)&7]), d;
+    struct operand dst;
+    int rc;
+
+    c->op_sz = (op >> 6) & 3;
+    bail_if(rc = ea_decode(c, cls, op & 7, &dst));
+    bail_if(rc = ea_read(c, &dst));
+    d = dst.val;
+    switch (alu) {
+    case ALU_add:
+        dst.val = d + s;
+        cc_defer(c, CCOP_add, s, d, dst.val);
+        break;
+    case ALU_sub:
+        dst.val = d - s;
+        cc_defer(c, CCOP_sub, s, d, dst.val);
+        break;
+    case ALU_and:
+        dst.val = d & s;
+        cc_defer(c, CCOP_mov, 0, 0, dst.val);
+        break;
+    case ALU_or:
+        dst.val = d | s;
+        cc_defer(c, CCOP_mov, 0, 0, dst.val);
+        break;
+    case ALU_eor:
+        dst.val = d ^ s;
+        cc_defer(c, CCOP_mov, 0, 0, dst.val);
+        break;
+    }
+    rc = ea_write(c, &dst);
+bail:
+    return rc;
+}
+
+/* adda/suba/cmpa */
+static always_inline int alu_ea_an(
+    struct m68k_emulate_ctxt *c, uint16_t op, unsigned int alu,
+    unsigned int cls)
+{
+    uint32_t *reg = &sh_reg(c, a[(op>>9)&7]);
+    struct operand src;
+    int rc;
+
+    c->op_sz = op & (1u<<8) ? OPSZ_L : OPSZ_W;
+    bail_if(rc = ea_decode(c, cls, op & 7, &src));
+    bail_if(rc = ea_read(c, &src));
+    if (c->op_sz == OPSZ_W) {
+        src.val = (int16_t)src.val;
+        c->op_sz = OPSZ_L;
+    }
+    switch (alu) {
+    case ALU_add:
+        *reg += src.val;
+        break;
+    case ALU_sub:
+        *reg -= src.val;
+        break;
+    case ALU_cmp:
+        cc_defer(c, CCOP_cmp, src.val, *reg, *reg - src.val);
+        break;
+    }
+bail:
+    return rc;
+}
+
+/* Instantiate handler h(c, op, alu, cls) for each class in a list. */
+#define ALU_FN(h, alu, cls)                                             \
+static int h##_##alu##_##cls(struct m68k_emulate_ctxt *c, uint16_t op)  \
+{ return h(c, op, ALU_##alu, EA_##cls); }
+#define ALU_ENT(h, alu, cls) [EA_##cls] = h##_##alu##_##cls,
+#define ALU_TABLE(list, h, alu)                                         \
+list(ALU_FN, h, alu)                                                    \
+static const insn_fn h##_##alu##_fn[EA_NR] = { list(ALU_ENT, h, alu) };
+#define SRC_EA3(m, h, a) m(h, a, DN) m(h, a, AN) m(h, a, AI) m(h, a, PI) \
+    m(h, a, PD) m(h, a, DI) m(h, a, AW) m(h, a, AL) m(h, a, PCDI)     \
+    m(h, a, IMM)
+#define MEM_EA3(m, h, a) m(h, a, AI) m(h, a, PI) m(h, a, PD) m(h, a, DI) \
+    m(h, a, AW) m(h, a, AL)
+#define DST_EA3(m, h, a) m(h, a, DN) MEM_EA3(m, h, a)
+
+ALU_TABLE(SRC_EA3, alu_ea_dn, add)
+ALU_TABLE(SRC_EA3, alu_ea_dn, sub)
+ALU_TABLE(SRC_EA3, alu_ea_dn, and)
+ALU_TABLE(SRC_EA3, alu_ea_dn, or)
+ALU_TABLE(SRC_EA3, alu_ea_dn, cmp)
+ALU_TABLE(MEM_EA3, alu_dn_ea, add)
+ALU_TABLE(MEM_EA3, alu_dn_ea, sub)
+ALU_TABLE(MEM_EA3, alu_dn_ea, and)
+ALU_TABLE(MEM_EA3, alu_dn_ea, or)
+ALU_TABLE(DST_EA3, alu_dn_ea, eor)
+ALU_TABLE(SRC_EA3, alu_ea_an, add)
+ALU_TABLE(SRC_EA3, alu_ea_an, sub)
+ALU_TABLE(SRC_EA3, alu_ea_an, cmp)
+
+/* addq/subq */
+static always_inline int insn_addq(
+    struct m68k_emulate_ctxt *c, uint16_t op, unsigned int cls)
+{
+    uint32_t val = (op >> 9) & 7 ? : 8;
+    struct operand dst;
+    int rc;
+
+    c->op_sz = (op >> 6) & 3;
+    bail_if(rc = ea_decode(c, cls, op & 7, &dst));
+    bail_if(rc = ea_read(c, &dst));
+    if (cls == EA_AN) {
+        /* adda/suba semantics */
+        c->op_sz = OPSZ_L;
+        *dst.reg = op & (1u<<8) ? *dst.reg - val : *dst.reg + val;
+    } else {
+        uint32_t d = dst.val;
+        if (op & (1u<<8)) {
+            dst.val = d - val;
+            cc_defer(c, CCOP_sub, val, d, dst.val);
+        } else {
+            dst.val = d + val;
+            cc_defer(c, CCOP_add, val, d, dst.val);
+        }
+        rc = ea_write(c, &dst);
+    }
+bail:
+    return rc;
+}
+#define ADDQ_EA(m, h) m(h, AN) DST_EA(m, h)
+EA_TABLE(ADDQ_EA, insn_addq)
+
+/* tst */
+static always_inline int insn_tst(
+    struct m68k_emulate_ctxt *c, uint16_t op, unsigned int cls)
+{
+    struct operand src;
+    int rc;
+
+    c->op_sz = (op >> 6) & 3;
+    bail_if(rc = ea_decode(c, cls, op & 7, &src));
+    bail_if(rc = ea_read(c, &src));
+    cc_defer(c, CCOP_mov, 0, 0, src.val);
+bail:
+    return rc;
+}
+EA_TABLE(SRC_EA, insn_tst)
+
+/* clr */
+static always_inline int insn_clr(
+    struct m68k_emulate_ctxt *c, uint16_t op, unsigned int cls)
+{
+    struct operand dst;
+    int rc;
+
+    c->op_sz = (op >> 6) & 3;
+    bail_if(rc = ea_decode(c, cls, op & 7, &dst));
+    dst.val = 0;
+    bail_if(rc = ea_write(c, &dst));
+    cc_defer(c, CCOP_mov, 0, 0, 0);
+bail:
+    return rc;
+}
+EA_TABLE(DST_EA, insn_clr)
+
+/* lea */
+static always_inline int insn_lea(
+    struct m68k_emulate_ctxt *c, uint16_t op, unsigned int cls)
+{
+    struct operand src;
+    int rc;
+
+    c->op_sz = OPSZ_L;
+    if (!(rc = ea_decode(c, cls, op & 7, &src)))
+        sh_reg(c, a[(op>>9)&7]) = src.mem;
+    return rc;
+}
+EA_TABLE(CTL_EA, insn_lea)
+
+/* pea */
+static always_inline int insn_pea(
+    struct m68k_emulate_ctxt *c, uint16_t op, unsigned int cls)
+{
+    struct operand src;
+    int rc;
+
+    c->op_sz = OPSZ_L;
+    bail_if(rc = ea_decode(c, cls, op & 7, &src));
+    sh_reg(c, a[7]) -= 4;
+    rc = write(sh_reg(c, a[7]), src.mem, 4, c);
+bail:
+    return rc;
+}
+EA_TABLE(CTL_EA, insn_pea)
+
+/* jmp/jsr */
+static always_inline int insn_jmp(
+    struct m68k_emulate_ctxt *c, uint16_t op, unsigned int cls)
+{
+    struct operand dst;
+    int rc;
+
+    bail_if(rc = ea_decode(c, cls, op & 7, &dst));
+    if (!(op & (1u<<6))) {
+        sh_reg(c, a[7]) -= 4;
+        bail_if(rc = write(sh_reg(c, a[7]), sh_reg(c, pc), 4, c));
+    }
+    sh_reg(c, pc) = dst.mem;
+bail:
+    return rc;
+}
+EA_TABLE(CTL_EA, insn_jmp)
+
+static int insn_moveq(struct m68k_emulate_ctxt *c, uint16_t op)
+{
+    uint32_t *reg = &sh_reg(c, d[(op>>9)&7]);
+    *reg = (int8_t)op;
+    c->op_sz = OPSZ_L;
+    cc_defer(c, CCOP_mov, 0, 0, *reg);
+    return 0;
+}
+
+static int insn_bcc(struct m68k_emulate_ctxt *c, uint16_t op)
+{
+    uint32_t target = sh_reg(c, pc);
+    int32_t disp = (int8_t)op;
+    uint8_t cond = (op >> 8) & 0xf;
+    int rc = 0;
+
+    c->op_sz = (disp == 0  ? OPSZ_W : disp == -1 ? OPSZ_L : OPSZ_B);
+    if (disp == 0)
+        bail_if(rc = fetch_insn_sbytes(c, &disp, OPSZ_W));
+    else if (disp == -1)
+        bail_if(rc = fetch_insn_sbytes(c, &disp, OPSZ_L));
+    if (cond == 1) {
+        sh_reg(c, a[7]) -= 4;
+        bail_if(rc = write(sh_reg(c, a[7]), sh_reg(c, pc), 4, c));
+    } else if (!cc_eval_lazy_condition(c, cond))
+        goto bail;
+    sh_reg(c, pc) = target + disp;
+bail:
+    return rc;
+}
+
+static int insn_dbcc(struct m68k_emulate_ctxt *c, uint16_t op)
+{
+    uint32_t pc = sh_reg(c, pc);
+    int32_t disp;
+    int rc;
+
+    bail_if(rc = fetch_insn_sbytes(c, &disp, OPSZ_W));
+    if (!cc_eval_lazy_condition(c, (op >> 8) & 0xf)) {
+        uint32_t *reg = &sh_reg(c, d[op&7]);
+        *reg = (*reg & ~0xffffu) | (uint16_t)(*reg - 1);
+        if ((int16_t)*reg != -1)
+            sh_reg(c, pc) = pc + disp;
+    }
+bail:
+    return rc;
+}
+
+static int insn_nop(struct m68k_emulate_ctxt *c, uint16_t op)
+{
+    return 0;
+}
+
+static int insn_rts(struct m68k_emulate_ctxt *c, uint16_t op)
+{
+    int rc;
+    if (!(rc = read(sh_reg(c, a[7]), &sh_reg(c, pc), 4, c)))
+        sh_reg(c, a[7]) += 4;
+    return rc;
+}
+
+static int insn_swap(struct m68k_emulate_ctxt *c, uint16_t op)
+{
+    uint32_t *reg = &sh_reg(c, d[op&7]);
+    c->op_sz = OPSZ_L;
+    *reg = (*reg << 16) | (uint16_t)(*reg >> 16);
+    cc_defer(c, CCOP_mov, 0, 0, *reg);
+    return 0;
+}
+
+static int insn_ext(struct m68k_emulate_ctxt *c, uint16_t op)
+{
+    uint32_t *reg = &sh_reg(c, d[op&7]);
+    c->op_sz = (op & (1u<<6)) ? OPSZ_L : OPSZ_W;
+    *reg = (c->op_sz == OPSZ_W
+            ? (*reg & ~0xffffu) | (uint16_t)(int8_t)*reg
+            : (int16_t)*reg);
+    cc_defer(c, CCOP_mov, 0, 0, *reg);
+    return 0;
+}
+
+/* Shift/rotate <dn>: the flag updates are too varied to defer. */
+static int insn_shift_reg(struct m68k_emulate_ctxt *c, uint16_t op)
+{
+    uint8_t cnt;
+
+    cc_flush(c);
+    c->op_sz = (op >> 6) & 3;
+    cnt = (op & (1u<<5)) ? sh_reg(c, d[(op>>9)&7]) & 63
+        : (op >> 9) & 7 ?: 8;
+    c->p->operand.type = OP_REG;
+    c->p->operand.reg = &sh_reg(c, d[op&7]);
+    return shift_ea(c, op, (op >> 3) & 3, cnt);
+}
+
+/* ori/andi/subi/addi/eori/cmpi #imm,<ea> */
+static int insn_alu_imm(struct m68k_emulate_ctxt *c, uint16_t op)
+{
+    struct operand dst;
+    uint32_t imm, d;
+    int rc;
+
+    c->op_sz = (op >> 6) & 3;
+    bail_if(rc = fetch_insn_ubytes(c, &imm, c->op_sz));
+    bail_if(rc = ea_decode(c, ea_class(op), op & 7, &dst));
+    bail_if(rc = ea_read(c, &dst));
+    d = dst.val;
+    switch ((op >> 9) & 7) {
+    case 0: /* or */
+        dst.val = d | imm;
+        cc_defer(c, CCOP_mov, 0, 0, dst.val);
+        break;
+    case 1: /* and */
+        dst.val = d & imm;
+        cc_defer(c, CCOP_mov, 0, 0, dst.val);
+        break;
+    case 2: /* sub */
+        dst.val = d - imm;
+        cc_defer(c, CCOP_sub, imm, d, dst.val);
+        break;
+    case 3: /* add */
+        dst.val = d + imm;
+        cc_defer(c, CCOP_add, imm, d, dst.val);
+        break;
+    case 5: /* eor */
+        dst.val = d ^ imm;
+        cc_defer(c, CCOP_mov, 0, 0, dst.val);
+        break;
+    case 6: /* cmp */
+        cc_defer(c, CCOP_cmp, imm, d, d - imm);
+        goto bail;
+    }
+    rc = ea_write(c, &dst);
+bail:
+    return rc;
+}
+
+/* btst/bchg/bclr/bset */
+static int insn_bitop(struct m68k_emulate_ctxt *c, uint16_t op)
+{
+    struct operand dst;
+    uint16_t idx;
+    int rc;
+
+    cc_flush(c);
+    c->op_sz = !(op & 0x38u) ? OPSZ_L: OPSZ_B;
+    if (op & (1u<<8))
+        idx = sh_reg(c, d[(op>>9)&7]);
+    else
+        bail_if(rc = fetch_insn_word(c, &idx));
+    bail_if(rc = ea_decode(c, ea_class(op), op & 7, &dst));
+    bail_if(rc = ea_read(c, &dst));
+    idx &= c->op_sz == OPSZ_B ? 7 : 31;
+    sh_reg(c, sr) &= ~CC_Z;
+    if (!(dst.val & (1u<<idx)))
+        sh_reg(c, sr) |= CC_Z;
+    switch ((op >> 6) & 3) {
+    case 0: goto bail;
+    case 1: dst.val ^= 1u << idx; break;
+    case 2: dst.val &= ~(1u << idx); break;
+    case 3: dst.val |= 1u << idx; break;
+    }
+    rc = ea_write(c, &dst);
+bail:
+    return rc;
+}
+
+/* Is the class a data-alterable destination supported by the fast path? */
+static int ea_dst_ok(unsigned int cls)
+{
+    return (cls <= EA_AL) && (cls != EA_AN) && (cls != EA_IX);
+}
+
+static insn_fn classify_insn(uint16_t op)
+{
+    unsigned int cls = ea_class(op), sz = (op >> 6) & 3;
+    insn_fn fn = NULL;
+
+    switch (op >> 12) {
+    case 0x0:
+        if (!(op & 0x0100u) && (((op >> 9) & 7) != 4)
+            && (((op >> 9) & 7) != 7) && (sz != OPSZ_X) && ea_dst_ok(cls))
+            fn = insn_alu_imm;
+        else if (((op & 0x0100u) || ((op & 0x0f00u) == 0x0800u))
+                 && ((op & 0xf138u) != 0x0108u) && ea_dst_ok(cls))
+            fn = insn_bitop;
+        break;
+    case 0x1: case 0x2: case 0x3:
+        if (((op >> 6) & 7) == 1)
+            fn = ((op >> 12) != 1) ? insn_movea_fn[cls] : NULL;
+        else
+            fn = move_fn[cls][ea_class(((op >> 9) & 0x07)
+                                       | ((op >> 3) & 0x38))];
+        break;
+    case 0x4:
+        switch (misc_insn_class[op & 0xfff]) {
+        case MISC_nop: fn = insn_nop; break;
+        case MISC_rts: fn = insn_rts; break;
+        case MISC_swap: fn = insn_swap; break;
+        case MISC_ext: fn = insn_ext; break;
+        case MISC_tst: fn = insn_tst_fn[cls]; break;
+        case MISC_clr: fn = insn_clr_fn[cls]; break;
+        case MISC_lea: fn = insn_lea_fn[cls]; break;
+        case MISC_pea: fn = insn_pea_fn[cls]; break;
+        case MISC_jmp_jsr: fn = insn_jmp_fn[cls]; break;
+        }
+        break;
+    case 0x5:
+        if (sz != OPSZ_X)
+            fn = insn_addq_fn[cls];
+        else if ((op & 0x0038u) == 0x0008u)
+            fn = insn_dbcc;
+        break;
+    case 0x6:
+        fn = insn_bcc;
+        break;
+    case 0x7:
+        fn = insn_moveq;
+        break;
+    case 0x8: case 0xc:
+        if (((op & 0xb1f0u) == 0x8100u) || (sz == OPSZ_X)
+            || ((op & 0xf130u) == 0xc100u))
+            break; /* abcd/sbcd, div/mul, exg */
+        if (!(op & (1u<<8)))
+            fn = ((op >> 12) == 0x8 ? alu_ea_dn_or_fn
+                  : alu_ea_dn_and_fn)[cls];
+        else
+            fn = ((op >> 12) == 0x8 ? alu_dn_ea_or_fn
+                  : alu_dn_ea_and_fn)[cls];
+        break;
+    case 0x9: case 0xd:
+        if (sz == OPSZ_X)
+            fn = ((op >> 12) == 0x9 ? alu_ea_an_sub_fn
+                  : alu_ea_an_add_fn)[cls];
+        else if ((op & 0x130u) == 0x100u)
+            break; /* addx/subx */
+        else if (!(op & (1u<<8)))
+            fn = ((op >> 12) == 0x9 ? alu_ea_dn_sub_fn
+                  : alu_ea_dn_add_fn)[cls];
+        else
+            fn = ((op >> 12) == 0x9 ? alu_dn_ea_sub_fn
+                  : alu_dn_ea_add_fn)[cls];
+        break;
+    case 0xb:
+        if (sz == OPSZ_X)
+            fn = alu_ea_an_cmp_fn[cls];
+        else if (!(op & (1u<<8)))
+            fn = alu_ea_dn_cmp_fn[cls];
+        else if ((op & 0x38u) != 0x08u)
+            fn = alu_dn_ea_eor_fn[cls]; /* not cmpm */
+        break;
+    case 0xe:
+        if ((op & 0xc0u) != 0xc0u)
+            fn = insn_shift_reg;
+        break;
+    }
+
+    return fn ? : decode_insn;
+}
+
+static void __attribute__((constructor)) insn_table_init(void)
+{
+    unsigned int i;
+    misc_insn_init();
+    for (i = 0; i < 0x10000; i++)
+        insn_table[i] = classify_insn(i);
+}
+
+int m68k_emulate(struct m68k_emulate_ctxt *c)
+{
+    struct m68k_emulate_priv_ctxt priv;
+    insn_fn insn;
+    uint16_t op;
+    int rc, trace = !!(c->regs->sr & SR_T);
+
+    /* Initialise emulator state. Fields are set individually: zeroing the 
+     * whole of priv costs more than many simple instructions take to run. */
+    priv.dis_p = c->dis;
+    priv.sh_regs = *c->regs;
+    memset(&priv.operand, 0, sizeof(priv.operand));
+    memset(&priv.exception, 0, sizeof(priv.exception));
+    c->p = &priv;
+    c->dis[0] = '\0';
+    c->op_sz = OPSZ_X;
+    c->op_words = 0;
+    c->cycles = 0;
+    if ((c->lazy_cc.op != CCOP_none) && (c->regs->sr != c->lazy_cc.sr))
+        c->lazy_cc.op = CCOP_none; /* caller has overwritten SR */
+    priv.cc = c->lazy_cc;
+    bail_if(rc = fetch_insn_word(c, &op));
+
+    /* Disassembly, and opcodes without a fast handler, take the generic 
+     * path, which works on fully-evaluated condition codes. */
+    insn = (c->emulate && !c->disassemble) ? insn_table[op] : decode_insn;
+    if ((insn == decode_insn) && c->emulate) {
+        m68k_sync_ccr(c);
+        sh_reg(c, sr) = c->regs->sr;
+        priv.cc.op = CCOP_none;
+    }
+    rc = insn(c, op);
+
 bail:
     if (!c->emulate || (rc == M68KEMUL_UNHANDLEABLE))
         goto out;
@@ -1606,6 +2569,8 @@ bail:
         (c->p->exception.vector >= M68KVEC_trap_0)) {
         /* No instruction-aborting exception? Write back register state. */
         *c->regs = c->p->sh_regs;
+        c->lazy_cc = c->p->cc;
+        c->lazy_cc.sr = c->regs->sr;
     } else {
         /* Instruction was aborted. Discard register state; no trace. */
         trace = 0;
@@ -1633,6 +2598,31 @@ out:
     return rc;
 }
 
+int m68k_disassemble(struct m68k_emulate_ctxt *c, uint32_t pc)
+{
+    struct m68k_emulate_ctxt saved = *c;
+    struct m68k_regs regs = *c->regs;
+    int rc;
+
+    regs.pc = pc;
+    c->regs = &regs;
+    c->disassemble = 1;
+    c->emulate = 0;
+    c->prefetch_valid = 0;
+
+    rc = m68k_emulate(c);
+
+    c->regs = saved.regs;
+    c->disassemble = saved.disassemble;
+    c->emulate = saved.emulate;
+    c->cycles = saved.cycles;
+    c->prefetch_addr = saved.prefetch_addr;
+    c->prefetch_valid = saved.prefetch_valid;
+    memcpy(c->prefetch_dat, saved.prefetch_dat, sizeof(c->prefetch_dat));
+
+    return rc;
+}
+
 void m68k_dump_regs(struct m68k_regs *r, void (*print)(const char *, ...))
 {
     print("D0: %08x D1: %08x D2: %08x D3: %08x\n",
@@ -1681,10 +2671,12 @@ void m68k_dump_stack(
 int m68k_deliver_exception(
     struct m68k_emulate_ctxt *c, struct m68k_exception *e)
 {
-    uint16_t old_sr = c->regs->sr;
+    uint16_t old_sr;
     uint32_t old_pc = c->regs->pc;
     int rc;
 
+    m68k_sync_ccr(c);
+    old_sr = c->regs->sr;
     c->p->sh_regs = *c->regs;
 
     update_sr(c, (old_sr | SR_S) & ~SR_T);
@@ -106,6 +106,13 @@ struct m68k_emulate_ctxt
     uint32_t prefetch_addr, prefetch_valid;
     uint16_t prefetch_dat[2];
 
+    /* PRIVATE: Condition codes not yet folded into regs->sr. */
+    struct m68k_lazy_cc {
+        uint8_t op, sz;
+        uint16_t sr; /* regs->sr when deferred: detects external updates */
+        uint32_t src, dst, res;
+    } lazy_cc;
+
     /* PRIVATE */
     struct m68k_emulate_priv_ctxt *p;
 };
@@ -114,6 +121,17 @@ struct m68k_emulate_ctxt
  * Returns M68KEMUL_OKAY or M68KEMUL_UNHANDLEABLE. */
 int m68k_emulate(struct m68k_emulate_ctxt *);
 
+/* m68k_sync_ccr: Bring the condition codes in regs->sr up to date.
+ * m68k_emulate() defers computing CCR until an instruction reads it, so this 
+ * must be called before the caller examines regs->sr. A caller which instead 
+ * modifies regs->sr discards the deferred flags. */
+void m68k_sync_ccr(struct m68k_emulate_ctxt *);
+
+/* m68k_disassemble: Disassemble the instruction at @pc into dis/op/op_words.
+ * Register state and the prefetch queue are not modified.
+ * Returns M68KEMUL_OKAY or M68KEMUL_UNHANDLEABLE. */
+int m68k_disassemble(struct m68k_emulate_ctxt *, uint32_t pc);
+
 /* m68k_dump_regs: Print register dump to stdout. */
 void m68k_dump_regs(struct m68k_regs *, void (*print)(const char *, ...));
 
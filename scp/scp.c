@@ -19,8 +19,6 @@
 
 #include "scp.h"
 
-#include "../libdisk/util.c"
-
 struct scp_handle {
     int fd;
     char *sername;
@@ -159,8 +157,10 @@ void scp_send(
 
     write_exact(scp->fd, buf, len + 3);
 
+    /* Bulk data precedes the response: its length is the second 
+     * big-endian parameter (the first is the offset into SRAM). */
     if (cmd == SCPCMD_SENDRAM_USB)
-        read_exact(scp->fd, dat, 512*1024);
+        read_exact(scp->fd, dat, be32toh(((uint32_t *)dat)[1]));
 
     read_exact(scp->fd, buf, 2);
     if (buf[0] != cmd)
@@ -210,22 +210,50 @@ void scp_seek_track(struct scp_handle *scp, unsigned int track)
     scp_send(scp, SCPCMD_SIDE, &side, 1);
 }
 
-void scp_read_flux(struct scp_handle *scp, struct scp_flux *flux)
+struct scp_flux *scp_alloc_flux(unsigned int max_revs)
 {
-    uint8_t info[2] = { ARRAY_SIZE(flux->info), 1 /* wait for index */};
-    unsigned int i;
-
-    scp_send(scp, SCPCMD_READFLUX, &info, 2);
-
-    scp_send(scp, SCPCMD_GETFLUXINFO, NULL, 0);
-    read_exact(scp->fd, flux->info, sizeof(flux->info));
+    unsigned int nr_reads = (max_revs + SCP_HW_REVS - 1) / SCP_HW_REVS;
+    struct scp_flux *flux = memalloc(sizeof(*flux) + nr_reads*SCP_RAM_SIZE);
+    flux->max_revs = max_revs;
+    return flux;
+}
 
-    for (i = 0; i < ARRAY_SIZE(flux->info); i++) {
-        flux->info[i].index_time = be32toh(flux->info[i].index_time);
-        flux->info[i].nr_bitcells = be32toh(flux->info[i].nr_bitcells);
+void scp_read_flux(
+    struct scp_handle *scp, struct scp_flux *flux, unsigned int nr_revs)
+{
+    struct {
+        uint32_t index_time, nr_bitcells;
+    } info[SCP_HW_REVS];
+    uint8_t params[2];
+    unsigned int i, rev, bytes;
+    uint16_t *dat = flux->flux;
+
+    if ((nr_revs == 0) || (nr_revs > flux->max_revs))
+        errx(1, "Bad revolution count %u", nr_revs);
+
+    for (rev = 0; rev < nr_revs; rev += params[0]) {
+        params[0] = min_t(unsigned int, nr_revs - rev, SCP_HW_REVS);
+        params[1] = 1; /* wait for index */
+        scp_send(scp, SCPCMD_READFLUX, params, 2);
+
+        scp_send(scp, SCPCMD_GETFLUXINFO, NULL, 0);
+        read_exact(scp->fd, info, sizeof(info));
+
+        bytes = 0;
+        for (i = 0; i < params[0]; i++) {
+            flux->info[rev+i].index_time = be32toh(info[i].index_time);
+            flux->info[rev+i].nr_bitcells = be32toh(info[i].nr_bitcells);
+            bytes += flux->info[rev+i].nr_bitcells * sizeof(uint16_t);
+        }
+
+        /* Transfer only the part of SRAM that holds this capture. */
+        if (bytes > SCP_RAM_SIZE)
+            errx(1, "Flux capture overflows SCP SRAM (%u bytes)", bytes);
+        *(uint32_t *)&dat[0] = htobe32(0);
+        *(uint32_t *)&dat[2] = htobe32(bytes);
+        scp_send(scp, SCPCMD_SENDRAM_USB, dat, 8);
+        dat += bytes / sizeof(uint16_t);
     }
 
-    *(uint32_t *)&flux->flux[0] = htobe32(0);
-    *(uint32_t *)&flux->flux[2] = htobe32(512*1024);
-    scp_send(scp, SCPCMD_SENDRAM_USB, flux->flux, 8);
+    flux->nr_revs = nr_revs;
 }
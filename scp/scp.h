@@ -14,11 +14,18 @@
 
 struct scp_handle;
 
+#define SCP_RAM_SIZE (512*1024)
+#define SCP_HW_REVS  5   /* max revolutions per flux read */
+#define SCP_MAX_REVS 255 /* max revolutions per track in a .scp file */
+
+/* Captures of more than SCP_HW_REVS revolutions are built from consecutive 
+ * index-aligned flux reads, each transferred out of SCP SRAM in turn. */
 struct scp_flux {
+    unsigned int max_revs, nr_revs;
     struct {
         uint32_t index_time, nr_bitcells;
-    } info[5];
-    uint16_t flux[512*1024/2];
+    } info[SCP_MAX_REVS];
+    uint16_t flux[];
 };
 
 #define SCPCMD_SELA        0x80 /* select drive A */
@@ -72,7 +79,9 @@ void scp_ramtest(struct scp_handle *scp);
 void scp_selectdrive(struct scp_handle *scp, unsigned int drv);
 void scp_deselectdrive(struct scp_handle *scp, unsigned int drv);
 void scp_seek_track(struct scp_handle *scp, unsigned int track);
-void scp_read_flux(struct scp_handle *scp, struct scp_flux *flux);
+struct scp_flux *scp_alloc_flux(unsigned int max_revs);
+void scp_read_flux(
+    struct scp_handle *scp, struct scp_flux *flux, unsigned int nr_revs);
 
 struct disk_header {
     uint8_t sig[3];
@@ -17,12 +17,21 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <time.h>
 
+#include <libdisk/disk.h>
+#include <libdisk/stream.h>
 #include <libdisk/util.h>
+#include <common/config.h>
 #include "scp.h"
 
 #define DEFAULT_SERDEVICE  "/dev/ttyUSB0"
 #define DEFAULT_NRTRACKS   164
+#define DEFAULT_RETRIES    3
+#define DEFAULT_REVS       5
+
+int quiet, verbose;
 
 #define log(_f, _a...) do { if (!quiet) printf(_f, ##_a); } while (0)
 
@@ -33,9 +42,223 @@ struct track_header {
         uint32_t duration;
         uint32_t nr_samples;
         uint32_t offset;
-    } rev[5];
+    } rev[]; /* one entry per stored revolution */
 };
 
+/* Capture and file output are pipelined: while the writer thread emits one 
+ * track, the main thread seeks and captures the next into the other buffer. 
+ * The SCP command stream itself is strictly sequential, so the device is 
+ * kept busy as long as file output never takes longer than a capture. 
+ * 
+ * With live decode, the writer thread first analyses each capture against 
+ * the configured formats. A track that fails is not written but queued for 
+ * recapture, which the main thread performs before moving on. Each 
+ * recapture reads a further SCP_HW_REVS revolutions, giving the analysers 
+ * more to work with on marginal tracks. */
+#define NR_BUFS 2
+
+static struct dump_buf {
+    struct scp_flux *flux;
+    unsigned int trk, attempt;
+} *bufs;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned int prod, cons; /* buffers captured / processed so far */
+    unsigned int nr_tracks, nr_done; /* tracks written to file so far */
+    int fd;
+    uint32_t file_off, *th_offs;
+    unsigned int nr_revs, max_revs; /* revolutions: first/most per track */
+
+    /* Live decode: format_lists is NULL if disabled. */
+    struct format_list **format_lists;
+    struct disk *disk;
+    unsigned int max_retries, nr_retries, nr_bad;
+    struct retry {
+        unsigned int trk, attempt;
+    } *retry;
+    unsigned int nr_retry; /* entries in retry[] awaiting recapture */
+} pipeline = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+static bool_t decode_track(struct dump_buf *b)
+{
+    struct format_list *list = pipeline.format_lists[b->trk];
+    struct disk *d = pipeline.disk;
+    struct track_info *ti;
+    struct stream *s;
+    uint32_t nr_samples[SCP_MAX_REVS];
+    unsigned int i;
+    bool_t ok;
+
+    if (list == NULL)
+        return 1;
+
+    for (i = 0; i < b->flux->nr_revs; i++)
+        nr_samples[i] = b->flux->info[i].nr_bitcells;
+    s = stream_scp_open_memory(b->flux->flux, nr_samples, b->flux->nr_revs);
+    if (s == NULL)
+        return (b->trk >= 160);
+
+    /* As disk-analyse: each format in turn, starting from the last match. */
+    for (i = 0; i < list->nr; i++) {
+        if (track_write_raw_from_stream(
+                d, b->trk, list->ent[list->pos], s) == 0)
+            break;
+        if (++list->pos >= list->nr)
+            list->pos = 0;
+    }
+
+    if (i == list->nr) {
+        ok = (track_write_raw_from_stream(d, b->trk, TRKTYP_unformatted, s)
+              == 0);
+        /* Tracks 160+ are expected to be unused. */
+        if (!ok && (b->trk >= 160)) {
+            track_mark_unformatted(d, b->trk);
+            ok = 1;
+        }
+    } else {
+        ti = &disk_get_info(d)->track[b->trk];
+        for (i = 0; i < ti->nr_sectors; i++)
+            if (!is_valid_sector(ti, i))
+                break;
+        ok = (i == ti->nr_sectors);
+    }
+
+    stream_close(s);
+    return ok;
+}
+
+static void write_track(struct dump_buf *b)
+{
+    struct scp_flux *flux = b->flux;
+    struct track_header *thdr;
+    uint32_t hdr_len, dat_off;
+    unsigned int rev;
+
+    pipeline.th_offs[b->trk] = htole32(pipeline.file_off);
+
+    dat_off = hdr_len = sizeof(*thdr) + flux->nr_revs*sizeof(thdr->rev[0]);
+    thdr = memalloc(hdr_len);
+    memcpy(thdr->sig, "TRK", sizeof(thdr->sig));
+    thdr->tracknr = b->trk;
+
+    for (rev = 0; rev < flux->nr_revs; rev++) {
+        thdr->rev[rev].duration = htole32(flux->info[rev].index_time);
+        thdr->rev[rev].nr_samples = htole32(flux->info[rev].nr_bitcells);
+        thdr->rev[rev].offset = htole32(dat_off);
+        dat_off += flux->info[rev].nr_bitcells * sizeof(uint16_t);
+    }
+
+    write_exact(pipeline.fd, thdr, hdr_len);
+    write_exact(pipeline.fd, flux->flux, dat_off - hdr_len);
+    pipeline.file_off += dat_off;
+    pipeline.max_revs = max_t(unsigned int, pipeline.max_revs, flux->nr_revs);
+    memfree(thdr);
+}
+
+static void *writer_thread(void *arg)
+{
+    struct dump_buf *b;
+    bool_t ok;
+
+    for (;;) {
+        pthread_mutex_lock(&pipeline.mutex);
+        while ((pipeline.cons == pipeline.prod) &&
+               (pipeline.nr_done != pipeline.nr_tracks))
+            pthread_cond_wait(&pipeline.cond, &pipeline.mutex);
+        pthread_mutex_unlock(&pipeline.mutex);
+
+        if (pipeline.nr_done == pipeline.nr_tracks)
+            break;
+
+        b = &bufs[pipeline.cons % NR_BUFS];
+
+        ok = !pipeline.format_lists || decode_track(b);
+        if (!ok && (b->attempt >= pipeline.max_retries)) {
+            warnx("T%u: Damaged or unidentified after %u attempt%s",
+                  b->trk, b->attempt + 1, b->attempt ? "s" : "");
+            pipeline.nr_bad++;
+            ok = 1;
+        }
+        if (ok)
+            write_track(b);
+
+        pthread_mutex_lock(&pipeline.mutex);
+        if (ok) {
+            pipeline.nr_done++;
+        } else {
+            pipeline.retry[pipeline.nr_retry].trk = b->trk;
+            pipeline.retry[pipeline.nr_retry].attempt = b->attempt + 1;
+            pipeline.nr_retry++;
+            pipeline.nr_retries++;
+        }
+        pipeline.cons++;
+        pthread_cond_broadcast(&pipeline.cond);
+        pthread_mutex_unlock(&pipeline.mutex);
+    }
+
+    return NULL;
+}
+
+/* Get a free buffer and the next track to capture into it. Retries take 
+ * precedence over new tracks. Returns NULL when every track is written. */
+static struct dump_buf *get_free_buf(unsigned int *next_trk)
+{
+    struct dump_buf *b = NULL;
+
+    pthread_mutex_lock(&pipeline.mutex);
+    for (;;) {
+        if (pipeline.nr_done == pipeline.nr_tracks)
+            goto out;
+        if (((pipeline.prod - pipeline.cons) != NR_BUFS) &&
+            (pipeline.nr_retry || (*next_trk != pipeline.nr_tracks)))
+            break;
+        pthread_cond_wait(&pipeline.cond, &pipeline.mutex);
+    }
+
+    b = &bufs[pipeline.prod % NR_BUFS];
+    if (pipeline.nr_retry) {
+        pipeline.nr_retry--;
+        b->trk = pipeline.retry[pipeline.nr_retry].trk;
+        b->attempt = pipeline.retry[pipeline.nr_retry].attempt;
+    } else {
+        b->trk = (*next_trk)++;
+        b->attempt = 0;
+    }
+
+out:
+    pthread_mutex_unlock(&pipeline.mutex);
+    return b;
+}
+
+/* Revolutions to capture on the given attempt at a track. */
+static unsigned int capture_revs(unsigned int attempt)
+{
+    if (!pipeline.format_lists)
+        attempt = 0;
+    return min_t(unsigned int, SCP_MAX_REVS,
+                 pipeline.nr_revs + attempt * SCP_HW_REVS);
+}
+
+static void put_full_buf(void)
+{
+    pthread_mutex_lock(&pipeline.mutex);
+    pipeline.prod++;
+    pthread_cond_broadcast(&pipeline.cond);
+    pthread_mutex_unlock(&pipeline.mutex);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 static void usage(int rc)
 {
     printf("Usage: scp_dump [options] out_file\n");
@@ -45,31 +268,68 @@ static void usage(int rc)
     printf("  -d, --device  Name of serial device (%s)\n", DEFAULT_SERDEVICE);
     printf("  -r, --ramtest Test SCP on-board SRAM before dumping\n");
     printf("  -t, --tracks  Nr tracks to dump (%d)\n", DEFAULT_NRTRACKS);
+    printf("  -n, --revs    Nr revolutions to capture per track (%d)\n",
+           DEFAULT_REVS);
+    printf("  -f, --format=FORMAT Decode tracks as they are captured, and\n");
+    printf("                      recapture any that fail\n");
+    printf("  -c, --config=FILE   Config file to parse for format info\n");
+    printf("  -a, --analyse=FILE  Save the decoded image to FILE\n");
+    printf("  -R, --retries=N     Max recaptures of a failing track (%d)\n",
+           DEFAULT_RETRIES);
 
     exit(rc);
 }
 
+/* Decode into a throwaway image unless the caller wants to keep it. */
+static struct disk *create_scratch_disk(void)
+{
+    const char *tmpdir = getenv("TMPDIR") ? : "/tmp";
+    char *name = memalloc(strlen(tmpdir) + 32);
+    struct disk *d;
+    int fd;
+
+    sprintf(name, "%s/scp_dump_XXXXXX.dsk", tmpdir);
+    if ((fd = mkstemps(name, 4)) == -1)
+        err(1, "%s", name);
+    close(fd);
+    d = disk_create(name);
+    unlink(name);
+    if (d == NULL)
+        errx(1, "Unable to create scratch disk %s", name);
+    memfree(name);
+    return d;
+}
+
 int main(int argc, char **argv)
 {
     struct scp_handle *scp;
-    struct scp_flux flux;
+    struct dump_buf *b;
     struct disk_header dhdr;
-    struct track_header thdr;
-    unsigned int rev, trk, nr_tracks = DEFAULT_NRTRACKS;
-    uint32_t *th_offs, file_off, dat_off;
-    int ch, fd, quiet = 0, ramtest = 0;
+    unsigned int i, trk, nr_tracks = DEFAULT_NRTRACKS;
+    pthread_t writer;
+    int ch, fd, ramtest = 0;
     char *sername = DEFAULT_SERDEVICE;
+    char *config = NULL, *format = NULL, *analyse = NULL;
+    double t;
 
-    const static char sopts[] = "hqd:rt:";
+    const static char sopts[] = "hqd:rt:n:f:c:a:R:";
     const static struct option lopts[] = {
         { "help", 0, NULL, 'h' },
         { "quiet", 0, NULL, 'q' },
         { "device", 1, NULL, 'd' },
         { "ramtest", 0, NULL, 'r' },
         { "tracks", 1, NULL, 't' },
+        { "revs", 1, NULL, 'n' },
+        { "format", 1, NULL, 'f' },
+        { "config", 1, NULL, 'c' },
+        { "analyse", 1, NULL, 'a' },
+        { "retries", 1, NULL, 'R' },
         { 0, 0, 0, 0 }
     };
 
+    pipeline.max_retries = DEFAULT_RETRIES;
+    pipeline.nr_revs = DEFAULT_REVS;
+
     while ((ch = getopt_long(argc, argv, sopts, lopts, NULL)) != -1) {
         switch (ch) {
         case 'h':
@@ -87,6 +347,21 @@ int main(int argc, char **argv)
         case 't':
             nr_tracks = atoi(optarg);
             break;
+        case 'n':
+            pipeline.nr_revs = atoi(optarg);
+            break;
+        case 'f':
+            format = optarg;
+            break;
+        case 'c':
+            config = optarg;
+            break;
+        case 'a':
+            analyse = optarg;
+            break;
+        case 'R':
+            pipeline.max_retries = atoi(optarg);
+            break;
         default:
             usage(1);
             break;
@@ -101,21 +376,37 @@ int main(int argc, char **argv)
         usage(1);
     }
 
-    if ((fd = file_open(argv[1], O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1)
-        err(1, "Error creating %s", argv[1]);
+    if ((pipeline.nr_revs == 0) || (pipeline.nr_revs > SCP_MAX_REVS)) {
+        warnx("Bad revolution count specified (%u)", pipeline.nr_revs);
+        usage(1);
+    }
+
+    if ((config || analyse) && !format)
+        format = "default";
+    if (format) {
+        pipeline.format_lists = parse_config(config, format);
+        pipeline.disk = analyse ? disk_create(analyse) : create_scratch_disk();
+        if (pipeline.disk == NULL)
+            errx(1, "Unable to create new disk file: %s", analyse);
+        pipeline.retry = memalloc(nr_tracks * sizeof(*pipeline.retry));
+    }
+
+    if ((fd = file_open(argv[optind], O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1)
+        err(1, "Error creating %s", argv[optind]);
 
     memset(&dhdr, 0, sizeof(dhdr));
     memcpy(dhdr.sig, "SCP", sizeof(dhdr.sig));
     dhdr.version = 0x10; /* taken from existing images */
     dhdr.disk_type = DISKTYPE_amiga;
-    dhdr.nr_revolutions = 5;
+    dhdr.nr_revolutions = pipeline.nr_revs; /* updated when done */
     dhdr.end_track = nr_tracks - 1;
     dhdr.flags = (1u<<_FLAG_writable); /* avoids need for checksum */
     write_exact(fd, &dhdr, sizeof(dhdr));
 
-    th_offs = memalloc(nr_tracks * sizeof(uint32_t));
-    write_exact(fd, th_offs, nr_tracks * sizeof(uint32_t));
-    file_off = sizeof(dhdr) + nr_tracks * sizeof(uint32_t);
+    pipeline.fd = fd;
+    pipeline.th_offs = memalloc(nr_tracks * sizeof(uint32_t));
+    write_exact(fd, pipeline.th_offs, nr_tracks * sizeof(uint32_t));
+    pipeline.file_off = sizeof(dhdr) + nr_tracks * sizeof(uint32_t);
 
     scp = scp_open(sername);
     if (!quiet)
@@ -124,31 +415,24 @@ int main(int argc, char **argv)
         scp_ramtest(scp);
     scp_selectdrive(scp, 0);
 
+    bufs = memalloc(NR_BUFS * sizeof(*bufs));
+    for (i = 0; i < NR_BUFS; i++)
+        bufs[i].flux = scp_alloc_flux(capture_revs(pipeline.max_retries));
+    pipeline.nr_tracks = nr_tracks;
+    if (pthread_create(&writer, NULL, writer_thread, NULL))
+        errx(1, "Failed to create writer thread");
+
     log("Reading track ");
+    t = now();
 
-    for (trk = 0; trk < nr_tracks; trk++) {
-        log("%-4u...", trk);
+    trk = 0;
+    while ((b = get_free_buf(&trk)) != NULL) {
+        log("%-4u...", b->trk);
         fflush(stdout);
 
-        scp_seek_track(scp, trk);
-        scp_read_flux(scp, &flux);
-
-        th_offs[trk] = htole32(file_off);
-
-        memset(&thdr, 0, sizeof(thdr));
-        memcpy(thdr.sig, "TRK", sizeof(thdr.sig));
-        thdr.tracknr = trk;
-
-        dat_off = sizeof(thdr);
-        for (rev = 0; rev < ARRAY_SIZE(thdr.rev); rev++) {
-            thdr.rev[rev].duration = htole32(flux.info[rev].index_time);
-            thdr.rev[rev].nr_samples = htole32(flux.info[rev].nr_bitcells);
-            thdr.rev[rev].offset = htole32(dat_off);
-            dat_off += flux.info[rev].nr_bitcells * sizeof(uint16_t);
-        }
-        write_exact(fd, &thdr, sizeof(thdr));
-        write_exact(fd, flux.flux, dat_off - sizeof(thdr));
-        file_off += dat_off;
+        scp_seek_track(scp, b->trk);
+        scp_read_flux(scp, b->flux, capture_revs(b->attempt));
+        put_full_buf();
 
         log("\b\b\b\b\b\b\b");
     }
@@ -158,8 +442,28 @@ int main(int argc, char **argv)
     scp_deselectdrive(scp, 0);
     scp_close(scp);
 
-    lseek(fd, sizeof(dhdr), SEEK_SET);
-    write_exact(fd, th_offs, nr_tracks * sizeof(uint32_t));
+    pthread_join(writer, NULL);
+    for (i = 0; i < NR_BUFS; i++)
+        memfree(bufs[i].flux);
+    memfree(bufs);
+
+    /* Per-track revolution tables may be shorter than the header count. */
+    dhdr.nr_revolutions = pipeline.max_revs;
+    lseek(fd, 0, SEEK_SET);
+    write_exact(fd, &dhdr, sizeof(dhdr));
+    write_exact(fd, pipeline.th_offs, nr_tracks * sizeof(uint32_t));
+    memfree(pipeline.th_offs);
+
+    log("Dumped %u tracks in %.1f seconds\n", nr_tracks, now() - t);
+
+    if (pipeline.disk) {
+        log("%u recapture%s\n", pipeline.nr_retries,
+            (pipeline.nr_retries == 1) ? "" : "s");
+        disk_close(pipeline.disk);
+    }
+    if (pipeline.nr_bad)
+        fprintf(stderr,"** WARNING: %u tracks are damaged or unidentified!\n",
+                pipeline.nr_bad);
 
     return 0;
 }
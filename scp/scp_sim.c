@@ -0,0 +1,423 @@
+/*
+ * scp_sim.c
+ * 
+ * Simulate Supercard Pro hardware on a pseudo-terminal.
+ * 
+ * Serves the SCP host protocol with flux synthesised from any disk image
+ * that libdisk can read, so that scp_dump can be run and timed end to end
+ * without real hardware. Drive rotation, head stepping and USB transfer
+ * times are modelled with configurable parameters.
+ * 
+ * Written in 2026 by agent
+ */
+
+#define _GNU_SOURCE /* posix_openpt() and friends */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <libdisk/disk.h>
+#include <libdisk/util.h>
+#include "scp.h"
+
+#define SCP_TICK_NS   25
+
+/* Head settle time after a seek. */
+#define SETTLE_MS     15
+
+static struct sim {
+    /* Configuration. */
+    unsigned int jitter_ns, rpm, max_revs, step_ms, latency_us;
+    unsigned int bandwidth; /* KB/s, 0 = unlimited */
+    unsigned int error_pct; /* % of captures to corrupt */
+    int realtime, verbose;
+
+    /* Drive and controller state. */
+    struct disk *disk;
+    struct track_raw *raw;
+    unsigned int nr_tracks;
+    int selected, motor;
+    unsigned int cyl, side;
+    struct {
+        uint32_t index_time, nr_bitcells;
+    } info[SCP_HW_REVS];
+    uint16_t ram[SCP_RAM_SIZE/2];
+    uint32_t seed;
+} sim;
+
+static void usage(int rc)
+{
+    printf("Usage: scp_sim [options] in_file\n");
+    printf("Options:\n");
+    printf("  -h, --help          Display this information\n");
+    printf("  -v, --verbose       Log each command received\n");
+    printf("  -L, --link=PATH     Create symlink PATH to the serial device\n");
+    printf("  -j, --jitter=NS     Random jitter on each flux interval (0)\n");
+    printf("  -r, --rpm=N         Drive rotation speed (300)\n");
+    printf("  -m, --max-revs=N    Max revolutions per capture (%u)\n",
+           SCP_HW_REVS);
+    printf("  -s, --step=MS       Head step time per cylinder (3)\n");
+    printf("  -l, --latency=US    Latency of each command (0)\n");
+    printf("  -b, --bandwidth=KB  SRAM upload rate in KB/s (unlimited)\n");
+    printf("  -f, --fast          Do not wait for drive rotation\n");
+    printf("  -e, --errors=PCT    Corrupt this percentage of captures (0)\n");
+
+    exit(rc);
+}
+
+static void delay_ns(uint64_t ns)
+{
+    struct timespec ts = { .tv_sec = ns / 1000000000u,
+                           .tv_nsec = ns % 1000000000u };
+    while (nanosleep(&ts, &ts) != 0)
+        continue;
+}
+
+static uint64_t rev_ns(void)
+{
+    return 60000000000ull / sim.rpm;
+}
+
+/* Append one flux interval to SCP RAM. Returns FALSE on overflow. */
+static bool_t emit_flux(uint32_t *pos, uint32_t ticks)
+{
+    while (ticks >= 0x10000u) {
+        if (*pos >= ARRAY_SIZE(sim.ram))
+            return 0;
+        sim.ram[(*pos)++] = 0; /* overflow: add 0x10000 to next sample */
+        ticks -= 0x10000u;
+    }
+    if (*pos >= ARRAY_SIZE(sim.ram))
+        return 0;
+    sim.ram[(*pos)++] = htobe16(ticks ?: 1);
+    return 1;
+}
+
+static uint8_t read_flux(unsigned int nr_revs, int wait_index)
+{
+    unsigned int rev, i, tracknr = sim.cyl*2 + sim.side;
+    uint32_t pos = 0, start_pos, ticks, bit;
+    uint64_t speed_sum;
+    double ns, bit_ns, rem = 0;
+
+    if (!sim.selected)
+        return 6; /* NoDriveSel */
+    if (!sim.motor)
+        return 7; /* NoMotorSel */
+    if (nr_revs == 0)
+        return 10; /* ZeroRevs */
+    if (nr_revs > sim.max_revs)
+        return 11; /* ReadTooLong */
+
+    /* Rotation: on average half a revolution to reach the index pulse. */
+    if (sim.realtime)
+        delay_ns(((wait_index ? rnd16(&sim.seed) * rev_ns() >> 16 : 0))
+                 + nr_revs * rev_ns());
+
+    memset(sim.info, 0, sizeof(sim.info));
+    ns = 0;
+
+    for (rev = 0; rev < nr_revs; rev++) {
+        /* Re-read each revolution so that weak bits vary. */
+        if (tracknr < sim.nr_tracks)
+            track_read_raw(sim.raw, tracknr);
+        else
+            track_purge_raw_buffer(sim.raw);
+
+        start_pos = pos;
+        sim.info[rev].index_time = rev_ns() / SCP_TICK_NS;
+
+        if (sim.raw->bitlen == 0) {
+            /* Unformatted: random flux reversals, 2-10us apart. */
+            uint64_t t = 0;
+            while (t < rev_ns()) {
+                uint32_t gap = 2000 + (rnd16(&sim.seed) % 8000);
+                if (!emit_flux(&pos, gap / SCP_TICK_NS))
+                    return 11; /* ReadTooLong */
+                t += gap;
+            }
+            sim.info[rev].nr_bitcells = pos - start_pos;
+            continue;
+        }
+
+        for (i = speed_sum = 0; i < sim.raw->bitlen; i++)
+            speed_sum += sim.raw->speed[i];
+
+        for (i = 0; i < sim.raw->bitlen; i++) {
+            bit_ns = (double)rev_ns() * sim.raw->speed[i] / speed_sum;
+            ns += bit_ns;
+            bit = (sim.raw->bits[i>>3] >> (~i&7)) & 1;
+            if (!bit)
+                continue;
+            if (sim.jitter_ns)
+                ns += (int)(rnd16(&sim.seed) % (2*sim.jitter_ns + 1))
+                    - (int)sim.jitter_ns;
+            /* Quantise to sample ticks, carrying the rounding error. */
+            ns += rem;
+            ticks = (ns > 0) ? (uint32_t)(ns / SCP_TICK_NS) : 0;
+            rem = ns - (double)ticks * SCP_TICK_NS;
+            ns = 0;
+            if (!emit_flux(&pos, ticks))
+                return 11; /* ReadTooLong */
+        }
+
+        sim.info[rev].nr_bitcells = pos - start_pos;
+    }
+
+    /* Simulate a bad read: scramble the same stretch of every revolution. 
+     * An (almost) empty track has nothing to scramble. */
+    if ((sim.info[0].nr_bitcells >= 2)
+        && ((rnd16(&sim.seed) % 100) < sim.error_pct)) {
+        uint32_t off = rnd16(&sim.seed) % (sim.info[0].nr_bitcells / 2);
+        for (rev = 0, pos = 0; rev < nr_revs; rev++) {
+            for (i = off; (i < off + 256) && (i < sim.info[rev].nr_bitcells);
+                 i++)
+                sim.ram[pos + i] = htobe16(20 + rnd16(&sim.seed) % 300);
+            pos += sim.info[rev].nr_bitcells;
+        }
+    }
+
+    return 0x4f;
+}
+
+static uint8_t sendram_usb(int fd, uint8_t *dat, uint8_t len)
+{
+    uint32_t off, bytes;
+
+    if (len != 8)
+        return 12; /* BadLength */
+    off = be32toh(*(uint32_t *)&dat[0]);
+    bytes = be32toh(*(uint32_t *)&dat[4]);
+    if ((off > SCP_RAM_SIZE) || (bytes > (SCP_RAM_SIZE - off)))
+        return 12; /* BadLength */
+    if (sim.bandwidth)
+        delay_ns((uint64_t)bytes * 1000000u / sim.bandwidth);
+    write_exact(fd, (uint8_t *)sim.ram + off, bytes);
+    return 0x4f;
+}
+
+static void serve(int fd)
+{
+    uint8_t cmd[2+255+1], resp[2], csum;
+    uint32_t info[2*SCP_HW_REVS];
+    unsigned int i;
+
+    for (;;) {
+        read_exact(fd, cmd, 2);
+        read_exact(fd, &cmd[2], cmd[1] + 1);
+
+        if (sim.verbose)
+            printf("Command %02x, %u byte(s) of data\n", cmd[0], cmd[1]);
+        if (sim.latency_us)
+            delay_ns(sim.latency_us * 1000ull);
+
+        resp[0] = cmd[0];
+        resp[1] = 0x4f;
+
+        for (i = 0, csum = 0x4a; i < cmd[1] + 2; i++)
+            csum += cmd[i];
+        if (csum != cmd[cmd[1] + 2]) {
+            resp[1] = 3; /* Checksum */
+            write_exact(fd, resp, 2);
+            continue;
+        }
+
+        switch (cmd[0]) {
+        case SCPCMD_SELA:
+            sim.selected = 1;
+            break;
+        case SCPCMD_DSELA:
+            sim.selected = 0;
+            break;
+        case SCPCMD_MTRAON:
+            sim.motor = 1;
+            break;
+        case SCPCMD_MTRAOFF:
+            sim.motor = 0;
+            break;
+        case SCPCMD_SELB: case SCPCMD_DSELB:
+        case SCPCMD_MTRBON: case SCPCMD_MTRBOFF:
+        case SCPCMD_SELDENS: case SCPCMD_RAMTEST:
+            break;
+        case SCPCMD_SEEK0:
+            if (!sim.selected) {
+                resp[1] = 6; /* NoDriveSel */
+                break;
+            }
+            if (sim.realtime)
+                delay_ns((sim.cyl * sim.step_ms + SETTLE_MS) * 1000000ull);
+            sim.cyl = 0;
+            break;
+        case SCPCMD_STEPTO: {
+            unsigned int cyl = cmd[2];
+            if (!sim.selected) {
+                resp[1] = 6; /* NoDriveSel */
+                break;
+            }
+            if (sim.realtime && (cyl != sim.cyl))
+                delay_ns(((cyl > sim.cyl ? cyl - sim.cyl : sim.cyl - cyl)
+                          * sim.step_ms + SETTLE_MS) * 1000000ull);
+            sim.cyl = cyl;
+            break;
+        }
+        case SCPCMD_SIDE:
+            sim.side = cmd[2] & 1;
+            break;
+        case SCPCMD_READFLUX:
+            resp[1] = read_flux(cmd[2], cmd[3] & 1);
+            break;
+        case SCPCMD_GETFLUXINFO:
+            for (i = 0; i < SCP_HW_REVS; i++) {
+                info[2*i+0] = htobe32(sim.info[i].index_time);
+                info[2*i+1] = htobe32(sim.info[i].nr_bitcells);
+            }
+            write_exact(fd, resp, 2);
+            write_exact(fd, info, sizeof(info));
+            continue;
+        case SCPCMD_SENDRAM_USB:
+            resp[1] = sendram_usb(fd, &cmd[2], cmd[1]);
+            break;
+        case SCPCMD_SCPINFO:
+            write_exact(fd, resp, 2);
+            write_exact(fd, "\x10\x10", 2);
+            continue;
+        default:
+            resp[1] = 1; /* BadCommand */
+            break;
+        }
+
+        write_exact(fd, resp, 2);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct termios tio;
+    char *link = NULL, *slave_name;
+    int ch, master, slave;
+
+    const static char sopts[] = "hvL:j:r:m:s:l:b:fe:";
+    const static struct option lopts[] = {
+        { "help", 0, NULL, 'h' },
+        { "verbose", 0, NULL, 'v' },
+        { "link", 1, NULL, 'L' },
+        { "jitter", 1, NULL, 'j' },
+        { "rpm", 1, NULL, 'r' },
+        { "max-revs", 1, NULL, 'm' },
+        { "step", 1, NULL, 's' },
+        { "latency", 1, NULL, 'l' },
+        { "bandwidth", 1, NULL, 'b' },
+        { "fast", 0, NULL, 'f' },
+        { "errors", 1, NULL, 'e' },
+        { 0, 0, 0, 0 }
+    };
+
+    sim.rpm = 300;
+    sim.max_revs = SCP_HW_REVS;
+    sim.step_ms = 3;
+    sim.realtime = 1;
+    sim.seed = 1;
+
+    while ((ch = getopt_long(argc, argv, sopts, lopts, NULL)) != -1) {
+        switch (ch) {
+        case 'h':
+            usage(0);
+            break;
+        case 'v':
+            sim.verbose = 1;
+            break;
+        case 'L':
+            link = optarg;
+            break;
+        case 'j':
+            sim.jitter_ns = atoi(optarg);
+            break;
+        case 'r':
+            sim.rpm = atoi(optarg);
+            break;
+        case 'm':
+            sim.max_revs = atoi(optarg);
+            break;
+        case 's':
+            sim.step_ms = atoi(optarg);
+            break;
+        case 'l':
+            sim.latency_us = atoi(optarg);
+            break;
+        case 'b':
+            sim.bandwidth = atoi(optarg);
+            break;
+        case 'f':
+            sim.realtime = 0;
+            break;
+        case 'e':
+            sim.error_pct = atoi(optarg);
+            break;
+        default:
+            usage(1);
+            break;
+        }
+    }
+
+    if (argc != (optind + 1))
+        usage(1);
+
+    if ((sim.rpm == 0) || (sim.max_revs == 0) ||
+        (sim.max_revs > SCP_HW_REVS)) {
+        warnx("Bad drive parameters");
+        usage(1);
+    }
+
+    if ((sim.disk = disk_open(argv[optind], 1)) == NULL)
+        errx(1, "Unable to open disk '%s'", argv[optind]);
+    sim.nr_tracks = disk_get_info(sim.disk)->nr_tracks;
+    sim.raw = track_alloc_raw_buffer(sim.disk);
+
+    if (((master = posix_openpt(O_RDWR | O_NOCTTY)) == -1) ||
+        grantpt(master) || unlockpt(master) ||
+        ((slave_name = ptsname(master)) == NULL))
+        err(1, "Unable to create pseudo-terminal");
+
+    /* Hold the slave open so that the master never sees hangup between
+     * clients, and make it raw from the outset. */
+    if ((slave = open(slave_name, O_RDWR | O_NOCTTY)) == -1)
+        err(1, "%s", slave_name);
+    if (tcgetattr(slave, &tio))
+        err(1, "%s", slave_name);
+    cfmakeraw(&tio);
+    if (tcsetattr(slave, TCSANOW, &tio))
+        err(1, "%s", slave_name);
+
+    if (link != NULL) {
+        unlink(link);
+        if (symlink(slave_name, link))
+            err(1, "%s", link);
+    }
+
+    printf("Supercard Pro simulator on %s\n", slave_name);
+    fflush(stdout);
+
+    serve(master);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */